@@ -6,59 +6,36 @@ in vec2 texCoordToFrag;
 
 out vec4 outColor;
 
-layout (std140) uniform PassConstants
-{
-  vec4 lightColor[8]; // maxLights = 8
-  vec4 lightDir[8];
-
-  uint numLights;
-  uint drawMode;
-
-  mat4 P;
-  mat4 invP;
-  mat4 V;
-  mat4 invV;
-  mat4 PV;
-  mat4 invPV;
+#pragma block PassConstants
 
-  vec4 E;
+#pragma block MaterialConstants
 
-  float nearZ;
-  float farZ;
-  float deltaT;
-  float totalT;
+#pragma block ObjectConstants
 
-  float viewportWidth;
-  float viewportHeight;
-};
-
-layout (std140) uniform MaterialConstants
-{
-  vec4 ambient;
-  vec4 diffuse;
-  vec4 specular;
-  float shininess;
-};
+uniform sampler2D tex;
 
-layout (std140) uniform ObjectConstants
-{
-  mat4 M;
-  mat4 normalM;
-};
+// Clustered point lights, see LightClusters
+uniform samplerBuffer pointLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLights;
 
-uniform sampler2D tex;
+// Variant defines, injected by ShaderVariants:
+//   NUM_LIGHTS    how many of the lights in PassConstants to shade with
+//   DRAW_NORMALS  output the normal instead of shading
+//   TEXTURED      modulate the shading by tex
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS 0
+#endif
 
 void main()
 {
-  if (drawMode == 1)
-    {
-      outColor = normalize(vec4(normalToFrag, 1.0f));
-      return;
-    }
-
+#ifdef DRAW_NORMALS
+  outColor = normalize(vec4(normalToFrag, 1.0f));
+#else
   outColor = vec4(0.0, 0.0, 0.0, 0.0);
 
-  for (uint i = 0; i < numLights; ++i)
+  // constant trip count, so the compiler can unroll this
+  for (int i = 0; i < NUM_LIGHTS; ++i)
     {
       vec4 am = lightColor[i] * ambient;
 
@@ -79,5 +56,48 @@ void main()
       outColor += (am + diff + spec);
     }
 
-    outColor = texture(tex, texCoordToFrag) * (outColor);
+  // only the point lights binned into this fragment's cluster
+  float depth = -(V * vec4(posToFrag, 1.0f)).z;
+  uvec2 tile = min(uvec2(gl_FragCoord.xy
+                         / vec2(viewportWidth, viewportHeight)
+                         * vec2(clusterDims.xy)),
+                   clusterDims.xy - 1u);
+  uint slice = uint(clamp(floor(log(depth) * clusterSlices.x
+                                - clusterSlices.y),
+                          0.0f,
+                          float(clusterDims.z - 1u)));
+  uvec2 range = texelFetch(clusterGrid,
+                           int(tile.x + clusterDims.x
+                               * (tile.y + clusterDims.y * slice))).xy;
+
+  vec3 normal = normalize(normalToFrag);
+  vec3 toEye = normalize(invV[3].xyz - posToFrag);
+  for (uint i = 0u; i < range.y; ++i)
+    {
+      int light = int(texelFetch(clusterLights, int(range.x + i)).x);
+      vec4 posRadius = texelFetch(pointLights, 2 * light);
+      vec4 color = texelFetch(pointLights, 2 * light + 1);
+
+      vec3 toLight = posRadius.xyz - posToFrag;
+      float dist = length(toLight);
+      float falloff = clamp(1.0f - dist / posRadius.w, 0.0f, 1.0f);
+      falloff *= falloff;
+      if (falloff == 0.0f) continue;
+
+      vec3 dir = toLight / dist;
+      float intensity = max(dot(normal, dir), 0.0f);
+      vec4 lit = intensity * diffuse;
+      if (intensity > 0.0f)
+        {
+          vec3 hlf = normalize(dir + toEye);
+          lit += specular
+            * pow(max(dot(normal, hlf), 0.0f), shininess);
+        }
+      outColor += falloff * color * lit;
+    }
+
+#ifdef TEXTURED
+  outColor = texture(tex, texCoordToFrag) * (outColor);
+#endif
+#endif
 }
@@ -4,45 +4,55 @@ layout (location = 0) in vec3 posToVert;
 layout (location = 1) in vec3 normalToVert;
 layout (location = 2) in vec2 texCoordToVert;
 
-layout (std140) uniform PassConstants
-{
-  vec4 lightColor[8]; // maxLights = 8
-  vec4 lightDir[8];
-  uint numLights;
-  uint drawMode;
-
-  mat4 P;
-  mat4 invP;
-  mat4 V;
-  mat4 invV;
-  mat4 PV;
-  mat4 invPV;
-
-  vec4 E;
-
-  float nearZ;
-  float farZ;
-  float deltaT;
-  float totalT;
-
-  float viewportWidth;
-  float viewportHeight;
-};
-
-layout (std140) uniform ObjectConstants
-{
-  mat4 M;
-  mat4 normalM;
-};
+#pragma block PassConstants
+
+#pragma block ObjectConstants
+
+// Variant defines, injected by ShaderVariants:
+//   SKINNED  place vertices by their joints' skinning matrices, which are
+//            three texels each in palette, numJoints of them per instance
+//            from paletteOffset on, rather than by M
+#ifdef SKINNED
+layout (location = 3) in uvec4 jointsToVert;
+layout (location = 4) in vec4 weightsToVert;
+
+uniform samplerBuffer palette;
+uniform int paletteOffset;
+uniform int numJoints;
+#endif
 
 out vec3 normalToFrag;
 out vec3 posToFrag;
 out vec2 texCoordToFrag;
 
+// must match depth.vert exactly, so that shading lands on the pre-pass depths
+invariant gl_Position;
+
 void main()
 {
+#ifdef SKINNED
+  // the weighted sum of the joints' matrices, a row at a time. They hold
+  // no scale, so they take normals as they take positions
+  int first = paletteOffset + 3 * numJoints * gl_InstanceID;
+  vec4 rows[3] = vec4[3](vec4(0.0f), vec4(0.0f), vec4(0.0f));
+  for (int i = 0; i < 4; ++i)
+    {
+      int joint = first + 3 * int(jointsToVert[i]);
+      rows[0] += weightsToVert[i] * texelFetch(palette, joint);
+      rows[1] += weightsToVert[i] * texelFetch(palette, joint + 1);
+      rows[2] += weightsToVert[i] * texelFetch(palette, joint + 2);
+    }
+
+  vec4 pos = vec4(posToVert, 1.0f);
+  posToFrag = vec3(dot(rows[0], pos), dot(rows[1], pos), dot(rows[2], pos));
+  normalToFrag = normalize(vec3(dot(rows[0].xyz, normalToVert),
+                                dot(rows[1].xyz, normalToVert),
+                                dot(rows[2].xyz, normalToVert)));
+  gl_Position = PV * vec4(posToFrag, 1.0f);
+#else
   gl_Position = PV * M * vec4(posToVert, 1.0f);
   normalToFrag = vec3(normalize(normalM * vec4(normalToVert, 0.0f)));
   posToFrag = vec3(M * vec4(posToVert, 1.0f));
+#endif
   texCoordToFrag = texCoordToVert;
 }
@@ -0,0 +1,15 @@
+#version 410
+
+layout (location = 0) in vec3 posToVert;
+
+#pragma block PassConstants
+
+#pragma block ObjectConstants
+
+// must match basic.vert exactly, so that shading lands on the same depths
+invariant gl_Position;
+
+void main()
+{
+  gl_Position = PV * M * vec4(posToVert, 1.0f);
+}
@@ -0,0 +1,13 @@
+#version 410
+
+in vec2 cornerToFrag;
+in vec4 colorToFrag;
+
+out vec4 outColor;
+
+void main()
+{
+  // a round dot, soft at the edge
+  float fade = max(1.0f - dot(cornerToFrag, cornerToFrag), 0.0f);
+  outColor = vec4(colorToFrag.rgb, colorToFrag.a * fade);
+}
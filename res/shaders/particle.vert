@@ -0,0 +1,28 @@
+#version 410
+
+// per instance: world space position, and age over lifetime
+layout (location = 0) in vec4 posAgeToVert;
+
+#pragma block PassConstants
+
+// at birth and at death
+uniform vec2 sizes;
+uniform vec4 startColor;
+uniform vec4 endColor;
+
+out vec2 cornerToFrag;
+out vec4 colorToFrag;
+
+void main()
+{
+  // a quad facing the camera, drawn as a strip of four corners
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0f - 1.0f;
+  float size = mix(sizes.x, sizes.y, posAgeToVert.w);
+  vec3 right = vec3(invV[0]);
+  vec3 up = vec3(invV[1]);
+  vec3 pos = posAgeToVert.xyz + size * (corner.x * right + corner.y * up);
+
+  gl_Position = PV * vec4(pos, 1.0f);
+  cornerToFrag = corner;
+  colorToFrag = mix(startColor, endColor, posAgeToVert.w);
+}
@@ -2,36 +2,16 @@
 
 layout (location = 0) in vec3 positionToVert;
 
-layout (std140) uniform PassConstants
-{
-  vec4 lightColor[8]; // maxLights = 8
-  vec4 lightDir[8];
-
-  uint numLights;
-
-  mat4 P;
-  mat4 invP;
-  mat4 V;
-  mat4 invV;
-  mat4 PV;
-  mat4 invPV;
-
-  vec4 E;
-
-  float nearZ;
-  float farZ;
-  float deltaT;
-  float totalT;
-
-  float viewportWidth;
-  float viewportHeight;
-};
+#pragma block PassConstants
 
 out vec3 texCoordsToFrag;
 
 void main()
 {
-  gl_Position = P * mat4(mat3(V)) * vec4(positionToVert,
-                                         1.0);
+  vec4 pos = P * mat4(mat3(V)) * vec4(positionToVert, 1.0);
+
+  // w for z puts the sky at the far plane, so drawn after everything else
+  // the depth test discards it wherever something is in front
+  gl_Position = pos.xyww;
   texCoordsToFrag = positionToVert;
 }
@@ -0,0 +1,99 @@
+#include "AssetCache.hpp"
+
+#include <iostream>
+#include "MappedFile.hpp"
+#include "util.hpp"
+#include "config.hpp"
+
+dmp::AssetCache::AssetCache(AssetLoader & loader)
+  : mLoader(loader),
+    mResidency(loader, textureBudgetBytes)
+{
+}
+
+uint64_t dmp::AssetCache::contentHash(const std::string & path)
+{
+  // hash each file once per run; after that a path is as good as its hash
+  auto found = mContentHashes.find(path);
+  if (found != mContentHashes.end()) return found->second;
+
+  MappedFile file(path);
+  if (!file.valid())
+    {
+      throw InvariantViolation("Failed to open texture " + path);
+    }
+
+  auto hash = hashBytes(file.data(), file.size());
+  mContentHashes[path] = hash;
+  return hash;
+}
+
+dmp::TextureHandle dmp::AssetCache::share(uint64_t key,
+                                          std::function<Texture()> make,
+                                          std::function<void(GLuint)> track)
+{
+  auto found = mTextures.find(key);
+  if (found != mTextures.end())
+    {
+      if (auto tex = found->second.lock()) return tex;
+    }
+
+  auto deleter = [this, key](Texture * tex)
+    {
+      // the loader may still be decoding into it
+      mLoader.cancel(*tex);
+      mResidency.untrack(*tex);
+      tex->freeTexture();
+      delete tex;
+
+      auto curr = mTextures.find(key);
+      if (curr != mTextures.end() && curr->second.expired())
+        {
+          mTextures.erase(curr);
+        }
+    };
+
+  TextureHandle tex(new Texture(make()), deleter);
+  mTextures[key] = tex;
+  track(*tex);
+
+  ifDebug(std::cerr << "Texture cache: " << mTextures.size()
+          << " unique texture(s)" << std::endl);
+
+  return tex;
+}
+
+dmp::TextureHandle dmp::AssetCache::texture(const std::string & path)
+{
+  // the default texture has no file, so give it the hash of no content
+  auto key = path == "" ? hashBytes(nullptr, 0) : contentHash(path);
+
+  return share(key,
+               [&]()
+               {
+                 std::string p = path;
+                 return p == "" ? Texture(p) : Texture(p, mLoader);
+               },
+               [&](GLuint tex)
+               {
+                 if (path != "") mResidency.track(tex, path, false);
+               });
+}
+
+dmp::TextureHandle dmp::AssetCache::cubemap(
+  const std::vector<std::string> & faces)
+{
+  // salted, so a cube map never collides with one of its own faces
+  const char salt[] = "cubemap";
+  auto key = hashBytes(salt, sizeof(salt));
+  for (const auto & curr : faces)
+    {
+      auto faceHash = contentHash(curr);
+      key = hashBytes(&faceHash, sizeof(faceHash), key);
+    }
+
+  // always drawn, so never worth evicting
+  return share(key,
+               [&]() {return Texture(faces, mLoader);},
+               [&](GLuint tex) {mResidency.track(tex, "", true);});
+}
@@ -0,0 +1,54 @@
+#ifndef DMP_ASSETCACHE_HPP
+#define DMP_ASSETCACHE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "AssetLoader.hpp"
+#include "Renderer/Texture.hpp"
+#include "Renderer/TextureResidency.hpp"
+
+namespace dmp
+{
+  // Hands out shared TextureHandles keyed by the contents of their source
+  // files, so a texture used from many places, or from several paths that
+  // hold the same file, is loaded and kept on the GPU once. Must be used on
+  // the GL thread, and must outlive every handle it gives out
+  class AssetCache
+  {
+  public:
+    AssetCache() = delete;
+    AssetCache(const AssetCache &) = delete;
+    AssetCache & operator=(const AssetCache &) = delete;
+
+    AssetCache(AssetLoader & loader);
+
+    // "" is the default 1x1 white texture
+    TextureHandle texture(const std::string & path);
+
+    // faces in the order +X, -X, +Y, -Y, +Z, -Z
+    TextureHandle cubemap(const std::vector<std::string> & faces);
+
+    // number of distinct textures currently alive
+    size_t size() const {return mTextures.size();}
+
+    // every texture from this cache is tracked here
+    TextureResidency & residency() {return mResidency;}
+
+  private:
+    uint64_t contentHash(const std::string & path);
+    TextureHandle share(uint64_t key,
+                        std::function<Texture()> make,
+                        std::function<void(GLuint)> track);
+
+    AssetLoader & mLoader;
+    TextureResidency mResidency;
+    std::map<std::string, uint64_t> mContentHashes;
+    std::map<uint64_t, std::weak_ptr<const Texture>> mTextures;
+  };
+}
+
+#endif
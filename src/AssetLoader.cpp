@@ -0,0 +1,253 @@
+#include "AssetLoader.hpp"
+
+#include <cstring>
+#include <iostream>
+#include "Timer.hpp"
+#include "util.hpp"
+#include "config.hpp"
+#include "Renderer/Texture.hpp"
+
+dmp::AssetLoader::AssetLoader(size_t numThreads)
+  : mPool(numThreads)
+{
+  initAssetLoader();
+}
+
+dmp::AssetLoader::~AssetLoader()
+{
+  glDeleteBuffers(1, &mPBO);
+}
+
+void dmp::AssetLoader::initAssetLoader()
+{
+  glGenBuffers(1, &mPBO);
+  expectNoErrors("Gen asset loader PBO");
+}
+
+void dmp::AssetLoader::loadTexture(GLuint tex, const std::string & path)
+{
+  auto req = std::make_shared<Request>();
+  req->tex = tex;
+  req->target = GL_TEXTURE_2D;
+  req->channels = Image::REQUESTED_CHANNELS;
+  req->paths = {path};
+  submit(req);
+}
+
+void dmp::AssetLoader::loadCubemap(GLuint tex,
+                                   const std::vector<std::string> & paths)
+{
+  expect("Cube map has six faces", paths.size() == 6);
+
+  auto req = std::make_shared<Request>();
+  req->tex = tex;
+  req->target = GL_TEXTURE_CUBE_MAP;
+  req->channels = 3; // don't want a transparent skybox
+  req->paths = paths;
+  submit(req);
+}
+
+void dmp::AssetLoader::submit(std::shared_ptr<Request> req)
+{
+  req->images.resize(req->paths.size());
+  req->cooked.resize(req->paths.size());
+  req->errors.resize(req->paths.size());
+  req->remaining = req->paths.size();
+  ++mInFlight;
+  mPending.emplace(req->tex, req);
+
+  for (size_t i = 0; i < req->paths.size(); ++i)
+    {
+      mPool.submit([this, req, i]()
+                   {
+                     // Image and TextureCache report failure by throwing,
+                     // which must not escape the worker. Hand it to the GL
+                     // thread instead
+                     try
+                       {
+                         if (useTextureCache)
+                           {
+                             req->cooked[i] =
+                               TextureCache::fetch(req->paths[i],
+                                                   req->channels);
+                           }
+                         else
+                           {
+                             req->images[i] = Image(req->paths[i].c_str(),
+                                                    req->channels);
+                           }
+                       }
+                     catch (const std::exception & e)
+                       {
+                         req->errors[i] = e.what();
+                       }
+
+                     std::lock_guard<std::mutex> lock(mMutex);
+                     if (--req->remaining == 0) mReady.push_back(req);
+                   });
+    }
+}
+
+void dmp::AssetLoader::cancel(GLuint tex)
+{
+  auto range = mPending.equal_range(tex);
+  for (auto it = range.first; it != range.second; ++it)
+    {
+      if (auto req = it->second.lock()) req->cancelled = true;
+    }
+}
+
+bool dmp::AssetLoader::idle() const
+{
+  return mInFlight == 0;
+}
+
+size_t dmp::AssetLoader::update(float budgetMs)
+{
+  using asMs = std::chrono::duration<float, std::milli>;
+  auto start = Clock::now();
+  size_t uploaded = 0;
+
+  while (true)
+    {
+      std::shared_ptr<Request> req;
+
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mReady.empty()) break;
+        req = mReady.front();
+        mReady.pop_front();
+      }
+
+      auto range = mPending.equal_range(req->tex);
+      for (auto it = range.first; it != range.second; ++it)
+        {
+          if (it->second.lock() != req) continue;
+          mPending.erase(it);
+          break;
+        }
+
+      // the texture is gone, and its name may already belong to another
+      if (req->cancelled)
+        {
+          --mInFlight;
+          continue;
+        }
+
+      for (size_t i = 0; i < req->errors.size(); ++i)
+        {
+          if (req->errors[i].empty()) continue;
+          throw InvariantViolation("Failed to load " + req->paths[i]
+                                   + ": " + req->errors[i]);
+        }
+
+      upload(*req);
+      --mInFlight;
+      ++uploaded;
+
+      if (asMs(Clock::now() - start).count() >= budgetMs) break;
+    }
+
+  ifDebug(if (uploaded > 0)
+            {
+              std::cerr << "Uploaded " << uploaded << " texture(s) in "
+                        << asMs(Clock::now() - start).count() << "ms, "
+                        << mInFlight << " still loading"
+                        << std::endl;
+            });
+
+  return uploaded;
+}
+
+void dmp::AssetLoader::upload(Request & req)
+{
+  glBindTexture(req.target, req.tex);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mPBO);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  size_t totalBytes = 0;
+  size_t levels = 1;
+
+  for (size_t i = 0; i < req.paths.size(); ++i)
+    {
+      const auto & img = req.images[i];
+      const auto & cooked = req.cooked[i];
+      const unsigned char * src = cooked.valid()
+        ? cooked.pixels()
+        : img.data.get();
+      size_t bytes = cooked.valid() ? cooked.pixelBytes() : img.bytes();
+
+      // orphan the previous upload's storage instead of waiting on it
+      glBufferData(GL_PIXEL_UNPACK_BUFFER,
+                   (GLsizeiptr) bytes,
+                   nullptr,
+                   GL_STREAM_DRAW);
+      auto dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                                  0,
+                                  (GLsizeiptr) bytes,
+                                  GL_MAP_WRITE_BIT
+                                  | GL_MAP_INVALIDATE_BUFFER_BIT);
+      expect("Map pixel unpack buffer", dst);
+      std::memcpy(dst, src, bytes);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+      GLenum imageTarget = req.target == GL_TEXTURE_CUBE_MAP
+        ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum) i
+        : req.target;
+
+      // the source is the bound PBO, so the data pointer is an offset
+      if (cooked.valid())
+        {
+          cooked.upload(imageTarget, (GLvoid *) 0);
+          levels = cooked.header().numLevels;
+          totalBytes += bytes;
+        }
+      else
+        {
+          GLenum format = img.channels == 3 ? GL_RGB : GL_RGBA;
+          glTexImage2D(imageTarget,
+                       0,
+                       (GLint) format,
+                       (GLsizei) img.width,
+                       (GLsizei) img.height,
+                       0,
+                       format,
+                       GL_UNSIGNED_BYTE,
+                       (GLvoid *) 0);
+
+          if (req.target == GL_TEXTURE_2D)
+            {
+              levels = mipLevelCount(img.width, img.height);
+              totalBytes += mipChainBytes(img.width, img.height, img.channels);
+            }
+          else
+            {
+              totalBytes += bytes;
+            }
+        }
+
+      expectNoErrors("Upload " + req.paths[i]);
+
+      // GL has its copy; let the decoded pixels or the mapping go now rather
+      // than when the whole request is done
+      req.images[i] = Image();
+      req.cooked[i] = CookedTexture();
+    }
+
+  // may have been lowered when the texture was evicted
+  glTexParameteri(req.target, GL_TEXTURE_MAX_LEVEL, (GLint) levels - 1);
+
+  // cooked textures brought their own mip chain
+  if (req.target == GL_TEXTURE_2D && !useTextureCache)
+    {
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glBindTexture(req.target, 0);
+
+  expectNoErrors("Complete texture upload");
+
+  if (uploadedFn) uploadedFn(req.tex, totalBytes, levels);
+}
@@ -0,0 +1,88 @@
+#ifndef DMP_ASSETLOADER_HPP
+#define DMP_ASSETLOADER_HPP
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <GL/glew.h>
+#include "Image.hpp"
+#include "ThreadPool.hpp"
+#include "Renderer/TextureCache.hpp"
+
+namespace dmp
+{
+  // Decodes images (or maps them from the TextureCache) on a pool of worker
+  // threads and uploads them into existing GL textures on the GL thread. The
+  // textures are expected to hold a placeholder until their upload lands
+  class AssetLoader
+  {
+  public:
+    AssetLoader(const AssetLoader &) = delete;
+    AssetLoader & operator=(const AssetLoader &) = delete;
+
+    AssetLoader() : AssetLoader(ThreadPool::defaultThreadCount()) {}
+    AssetLoader(size_t numThreads);
+    ~AssetLoader();
+
+    // Replace the 2D texture tex with the image at path and its mipmaps
+    void loadTexture(GLuint tex, const std::string & path);
+
+    // Replace the six faces of the cube map tex. The faces are decoded in
+    // parallel but uploaded together, so the cube map is never incomplete
+    void loadCubemap(GLuint tex, const std::vector<std::string> & paths);
+
+    // Forget every pending load into tex, e.g. because tex is about to be
+    // deleted. Must be called on the GL thread
+    void cancel(GLuint tex);
+
+    // Upload finished decodes until budgetMs has passed. At least one
+    // upload happens per call if any are ready, so loading always makes
+    // progress. Must be called on the GL thread. Returns the number of
+    // textures that changed
+    size_t update(float budgetMs);
+
+    bool idle() const;
+
+    // the decoding workers, for other bulk work done at load time. Tasks
+    // submitted here delay texture decodes behind them
+    ThreadPool & pool() {return mPool;}
+
+    // Called on the GL thread after each texture lands, with the bytes and
+    // number of mip levels it now has on the GPU (per face, for cube maps)
+    std::function<void(GLuint tex, size_t bytes, size_t levels)> uploadedFn;
+
+  private:
+    struct Request
+    {
+      GLuint tex;
+      GLenum target;
+      int channels;
+      std::vector<std::string> paths;
+      std::vector<Image> images;
+      std::vector<CookedTexture> cooked;
+      std::vector<std::string> errors;
+      size_t remaining;
+      bool cancelled = false; // only touched on the GL thread
+    };
+
+    void initAssetLoader();
+    void submit(std::shared_ptr<Request> req);
+    void upload(Request & req);
+
+    GLuint mPBO = 0;
+    size_t mInFlight = 0;
+    std::multimap<GLuint, std::weak_ptr<Request>> mPending;
+
+    mutable std::mutex mMutex;
+    std::deque<std::shared_ptr<Request>> mReady;
+
+    // last, so the workers are joined before anything they touch goes away
+    ThreadPool mPool;
+  };
+}
+
+#endif
@@ -3,16 +3,49 @@
 #include "ext/stb_image.h"
 #include "ext/stb_image_write.h"
 #include <iostream>
+#include <algorithm>
+#include <limits>
 #include <GL/glew.h>
 
 dmp::Image::Image(std::string path)
 {
-  initImage(path.c_str());
+  initImage(path.c_str(), REQUESTED_CHANNELS);
 }
 
 dmp::Image::Image(const char * path)
 {
-  initImage(path);
+  initImage(path, REQUESTED_CHANNELS);
+}
+
+dmp::Image::Image(const char * path, int requestedChannels)
+{
+  initImage(path, requestedChannels);
+}
+
+dmp::Image::Image(const unsigned char * file,
+                  size_t fileSize,
+                  int requestedChannels)
+{
+  expect("File not null", file);
+  expect("Requested channels within [1, 4]",
+         requestedChannels >= 1 && requestedChannels <= 4);
+  expect("File size fits in an int",
+         fileSize <= (size_t) std::numeric_limits<int>::max());
+
+  int width, height, channels;
+  unsigned char * pixels = stbi_load_from_memory(file,
+                                                 (int) fileSize,
+                                                 &width,
+                                                 &height,
+                                                 &channels,
+                                                 requestedChannels);
+  initDecoded(pixels, width, height, requestedChannels);
+}
+
+std::shared_ptr<unsigned char> dmp::Image::allocate(size_t bytes)
+{
+  return std::shared_ptr<unsigned char>(new unsigned char[bytes],
+                                        std::default_delete<unsigned char[]>());
 }
 
 dmp::Image::Image()
@@ -21,26 +54,30 @@ dmp::Image::Image()
   height = 1;
   channels = REQUESTED_CHANNELS;
 
-  data =
-    {
-      (unsigned char) DEFAULT_COLOR,
-      (unsigned char) DEFAULT_COLOR,
-      (unsigned char) DEFAULT_COLOR,
-      (unsigned char) DEFAULT_COLOR
-    };
+  data = allocate(bytes());
+  std::fill(data.get(), data.get() + bytes(), (unsigned char) DEFAULT_COLOR);
 }
 
-void dmp::Image::initImage(const char * path)
+void dmp::Image::initImage(const char * path, int requestedChannels)
 {
   expect("Path not null", path);
+  expect("Requested channels within [1, 4]",
+         requestedChannels >= 1 && requestedChannels <= 4);
 
   int width, height, channels;
   unsigned char * pixels = stbi_load(path,
                                      &width,
                                      &height,
                                      &channels,
-                                     REQUESTED_CHANNELS);
+                                     requestedChannels);
+  initDecoded(pixels, width, height, requestedChannels);
+}
 
+void dmp::Image::initDecoded(unsigned char * pixels,
+                             int width,
+                             int height,
+                             int requestedChannels)
+{
   ifDebug(if (pixels == nullptr)
             {
               std::cerr << "Failed to load image: "
@@ -49,17 +86,13 @@ void dmp::Image::initImage(const char * path)
             });
   expect("Load image file", pixels);
 
-  data.resize(width * height * REQUESTED_CHANNELS);
-
-  for (size_t i = 0; i < data.size(); ++i)
-    {
-      data[i] = pixels[i];
-    }
-  stbi_image_free(pixels);
+  // take ownership of stb's buffer rather than copying out of it
+  data = std::shared_ptr<unsigned char>(pixels, stbi_image_free);
 
   this->width = (size_t) width;
   this->height = (size_t) height;
-  this->channels = (size_t) channels;
+  // the decoded data has the requested channels, whatever the file had
+  this->channels = (size_t) requestedChannels;
 }
 
 dmp::Image::Image(int x, int y, int w, int h)
@@ -67,7 +100,7 @@ dmp::Image::Image(int x, int y, int w, int h)
   width = (size_t) w;
   height = (size_t) h;
   channels = REQUESTED_CHANNELS;
-  data.resize(width * height * channels);
+  data = allocate(bytes());
 
   GLint viewport[4];
   glGetIntegerv(GL_VIEWPORT, viewport);
@@ -76,8 +109,8 @@ dmp::Image::Image(int x, int y, int w, int h)
                 (GLsizei) height,
                 GL_RGBA, // TODO: might not always be this
                 GL_UNSIGNED_BYTE,
-                (GLsizei) data.size(),
-                data.data());
+                (GLsizei) bytes(),
+                data.get());
 
   expectNoErrors("Read from framebuffer");
 }
@@ -95,7 +128,7 @@ void dmp::Image::writeBMPToFile(const char * path) const
                             (int) width,
                             (int) height,
                             (int) channels,
-                            data.data());
+                            data.get());
 
   expect("Successfully wrote file", res != 0);
 }
@@ -2,6 +2,7 @@
 #define DMP_IMAGE_HPP
 
 #include <vector>
+#include <memory>
 #include <cstddef>
 #include <string>
 
@@ -19,19 +20,33 @@ namespace dmp
     Image();
     Image(std::string path);
     Image(const char * path);
+    Image(const char * path, int requestedChannels);
+    // decode an image file that is already in memory
+    Image(const unsigned char * file, size_t fileSize, int requestedChannels);
     Image(int x, int y, int width, int height);
 
     void writeBMPToFile(const char * path) const;
     void writeBMPToFile(std::string path) const;
 
+    size_t bytes() const {return width * height * channels;}
+
     // Fields
 
     size_t width;
     size_t height;
     size_t channels;
-    std::vector<unsigned char> data;
+
+    // Rows of pixels, top to bottom. Copies of an Image share this. Decoded
+    // images own the decoder's buffer directly instead of a copy of it
+    std::shared_ptr<unsigned char> data;
   private:
-    void initImage(const char * path);
+    static std::shared_ptr<unsigned char> allocate(size_t bytes);
+
+    void initImage(const char * path, int requestedChannels);
+    void initDecoded(unsigned char * pixels,
+                     int width,
+                     int height,
+                     int requestedChannels);
   };
 }
 
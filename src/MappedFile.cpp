@@ -0,0 +1,144 @@
+#include "MappedFile.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include "util.hpp"
+
+dmp::MappedFile::MappedFile(const std::string & path)
+{
+  initMappedFile(path);
+}
+
+dmp::MappedFile::MappedFile(MappedFile && other)
+  : mData(other.mData), mSize(other.mSize)
+{
+  other.mData = nullptr;
+  other.mSize = 0;
+}
+
+dmp::MappedFile & dmp::MappedFile::operator=(MappedFile && other)
+{
+  if (this == &other) return *this;
+
+  freeMappedFile();
+  mData = other.mData;
+  mSize = other.mSize;
+  other.mData = nullptr;
+  other.mSize = 0;
+
+  return *this;
+}
+
+dmp::MappedFile::~MappedFile()
+{
+  freeMappedFile();
+}
+
+void dmp::MappedFile::initMappedFile(const std::string & path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+      close(fd);
+      return;
+    }
+
+  auto size = (size_t) st.st_size;
+  void * addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // the mapping holds its own reference to the file
+  close(fd);
+
+  if (addr == MAP_FAILED) return;
+
+  mData = static_cast<const unsigned char *>(addr);
+  mSize = size;
+}
+
+void dmp::MappedFile::freeMappedFile()
+{
+  if (!valid()) return;
+
+  munmap((void *) mData, mSize);
+  mData = nullptr;
+  mSize = 0;
+}
+
+void dmp::makeDirectories(const std::string & dir)
+{
+  for (size_t pos = dir.find('/', 1);
+       ;
+       pos = dir.find('/', pos + 1))
+    {
+      auto prefix = dir.substr(0, pos);
+      if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+          throw InvariantViolation("Failed to create " + prefix);
+        }
+      if (pos == std::string::npos) break;
+    }
+}
+
+std::vector<std::string> dmp::listFiles(const std::string & dir,
+                                        const std::string & extension)
+{
+  std::vector<std::string> res;
+
+  DIR * handle = opendir(dir.c_str());
+  if (!handle) return res;
+
+  while (auto entry = readdir(handle))
+    {
+      std::string name = entry->d_name;
+      if (name.size() <= extension.size()
+          || name.compare(name.size() - extension.size(),
+                          extension.size(),
+                          extension) != 0)
+        {
+          continue;
+        }
+
+      auto path = dir + "/" + name;
+      struct stat st;
+      if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        {
+          res.push_back(path);
+        }
+    }
+  closedir(handle);
+
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+void dmp::writeFileAtomic(const std::string & path,
+                          const void * data,
+                          size_t size)
+{
+  // unique per thread, so concurrent writers of one path don't collide
+  auto tmp = path + "." + std::to_string(getpid()) + "."
+    + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(static_cast<const char *>(data), (std::streamsize) size);
+    expect("Write temporary file", out.good());
+  }
+
+  if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+      std::remove(tmp.c_str());
+      throw InvariantViolation("Failed to move file into place: " + path);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef DMP_MAPPEDFILE_HPP
+#define DMP_MAPPEDFILE_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace dmp
+{
+  // Read only memory mapping of a whole file. A file that can't be opened
+  // gives an invalid mapping rather than an error, since callers mostly use
+  // this to probe caches
+  class MappedFile
+  {
+  public:
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    MappedFile() = default;
+    MappedFile(const std::string & path);
+    MappedFile(MappedFile && other);
+    MappedFile & operator=(MappedFile && other);
+    ~MappedFile();
+
+    bool valid() const {return mData != nullptr;}
+    const unsigned char * data() const {return mData;}
+    size_t size() const {return mSize;}
+
+  private:
+    void initMappedFile(const std::string & path);
+    void freeMappedFile();
+
+    const unsigned char * mData = nullptr;
+    size_t mSize = 0;
+  };
+
+  // mkdir -p
+  void makeDirectories(const std::string & dir);
+
+  // paths of the regular files directly in dir whose names end in
+  // extension, sorted. A missing dir has no files
+  std::vector<std::string> listFiles(const std::string & dir,
+                                     const std::string & extension);
+
+  // Write a whole file by writing a temporary next to it and renaming that
+  // into place. Readers, including ones that have the old file mapped, see
+  // either the old contents or the new ones, never a partial write
+  void writeFileAtomic(const std::string & path,
+                       const void * data,
+                       size_t size);
+}
+
+#endif
@@ -1,9 +1,13 @@
 #include "Program.hpp"
 
 #include <iostream>
+#include <map>
 #include <unistd.h>
 #include "config.hpp"
 #include "util.hpp"
+#include "MappedFile.hpp"
+#include "Scene/Model/Model.hpp"
+#include "Scene/Model/MeshCache.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/constants.hpp>
@@ -28,7 +32,9 @@ dmp::Program::Program(int width, int height,
   : mWindow(width, height, title),
     mRenderer((GLsizei) mWindow.getFramebufferWidth(),
               (GLsizei) mWindow.getFramebufferHeight()),
-    mTimer()
+    mTimer(),
+    mAssetCache(mAssetLoader),
+    mShapeCache(mAssetLoader.pool())
 {
   mWindow.windowSizeFn = [&](GLFWwindow * w,
                              int width,
@@ -36,6 +42,10 @@ dmp::Program::Program(int width, int height,
     {
       int fbWidth, fbHeight;
       glfwGetFramebufferSize(w, &fbWidth, &fbHeight);
+
+      // minimized, with nothing to draw to
+      if (fbWidth == 0 || fbHeight == 0) return;
+
       mRenderer.resize((GLsizei) fbWidth, (GLsizei) fbHeight);
     };
 
@@ -43,6 +53,7 @@ dmp::Program::Program(int width, int height,
                                           int width,
                                           int height)
     {
+      if (width == 0 || height == 0) return;
       mRenderer.resize((GLsizei) width, (GLsizei) height);
     };
 
@@ -391,9 +402,116 @@ dmp::Program::Program(int width, int height,
                },
                GLFW_KEY_S);
 
+  Keybind t(mWindow,
+               [&](Keybind &)
+               {
+                 mRenderOptions.drawTextures = !(mRenderOptions.drawTextures);
+               },
+               GLFW_KEY_T);
+
+  Keybind m(mWindow,
+               [&](Keybind &)
+               {
+                 mAssetCache.residency().printStats(std::cerr);
+               },
+               GLFW_KEY_M);
+
+  Keybind p(mWindow,
+               [&](Keybind &)
+               {
+                 mRenderOptions.depthPrepass = !(mRenderOptions.depthPrepass);
+               },
+               GLFW_KEY_P);
+
+  Keybind f(mWindow,
+               [&](Keybind &)
+               {
+                 mRenderOptions.sortFrontToBack
+                   = !(mRenderOptions.sortFrontToBack);
+               },
+               GLFW_KEY_F);
+
+  Keybind b(mWindow,
+               [&](Keybind &)
+               {
+                 mRenderOptions.skyboxLast = !(mRenderOptions.skyboxLast);
+               },
+               GLFW_KEY_B);
+
+  Keybind g(mWindow,
+               [&](Keybind &)
+               {
+                 mRenderer.gpuTimer().printStats(std::cerr);
+                 std::cerr << "Render scale: " << mRenderer.renderScale()
+                           << (mRenderOptions.dynamicResolution
+                               ? " (dynamic)" : " (fixed)")
+                           << std::endl;
+                 std::cerr << "Triangles drawn: "
+                           << mRenderer.trianglesDrawn()
+                           << (mRenderOptions.lod ? " (lod)" : " (no lod)")
+                           << std::endl;
+                 if (mWave)
+                   {
+                     std::cerr << "Wave updates that waited on the GPU: "
+                               << mWave->streamStalls() << std::endl;
+                   }
+                 if (mTerrain)
+                   {
+                     std::cerr << "Terrain chunks drawn: "
+                               << mTerrain->chunksDrawn() << " ("
+                               << mTerrain->chunksBuilding()
+                               << " building)" << std::endl;
+                   }
+                 for (const auto & curr : mScene.crowds)
+                   {
+                     std::cerr << "Crowd members drawn: " << curr->visible()
+                               << " of " << curr->size() << std::endl;
+                   }
+                 for (const auto & curr : mScene.emitters)
+                   {
+                     std::cerr << "Particles alive: " << curr->size()
+                               << " (" << curr->streamStalls()
+                               << " updates waited on the GPU)"
+                               << std::endl;
+                   }
+               },
+               GLFW_KEY_G);
+
+  Keybind o(mWindow,
+               [&](Keybind &)
+               {
+                 mRenderOptions.lod = !(mRenderOptions.lod);
+               },
+               GLFW_KEY_O);
+
+  // dynamic, then fixed at full, three quarter and half resolution
+  Keybind r(mWindow,
+               [&](Keybind &)
+               {
+                 auto & ro = mRenderOptions;
+                 if (ro.dynamicResolution)
+                   {
+                     ro.dynamicResolution = false;
+                     ro.fixedRenderScale = 1.0f;
+                   }
+                 else if (ro.fixedRenderScale > 0.75f)
+                   {
+                     ro.fixedRenderScale = 0.75f;
+                   }
+                 else if (ro.fixedRenderScale > 0.5f)
+                   {
+                     ro.fixedRenderScale = 0.5f;
+                   }
+                 else
+                   {
+                     ro.dynamicResolution = true;
+                   }
+               },
+               GLFW_KEY_R);
+
   mKeybinds = {esc, up, down, right, left, pageUp, pageDown,
                w, n, l, comma, period, one, two, three, four, five,
-               i, j, k, tab, s};
+               i, j, k, tab, s, t, m, p, f, b, g, o, r};
 
   mWindow.keyFn = [&mKeybinds=mKeybinds](GLFWwindow * w,
                                          int key,
@@ -427,6 +545,7 @@ dmp::Program::Program(int width, int height,
 
   mWindow.mouseButtonFn = [&mRenderer=mRenderer,
                            &mScene=mScene,
+                           &mWindow=mWindow,
                            &mRenderOptions=mRenderOptions,
                            &mOverlayCallbacks=mOverlayCallbacks,
                            &mMousePosX=mMousePosX,
@@ -439,11 +558,30 @@ dmp::Program::Program(int width, int height,
         {
           if (action == GLFW_RELEASE)
             {
-              int id = mRenderer.pick(mScene,
-                                      mRenderOptions,
-                                      mMousePosX,
-                                      mMousePosY);
-              if (id < 255) mOverlayCallbacks[id](id);
+              float ndcX = (2.0f * (float) mMousePosX)
+                / (float) mWindow.getWidth() - 1.0f;
+              float ndcY = 1.0f - (2.0f * (float) mMousePosY)
+                / (float) mWindow.getHeight();
+
+              if (mRenderOptions.drawOverlays)
+                {
+                  auto id = mScene.pickOverlay(ndcX, ndcY);
+                  if (id != noOverlayID)
+                    {
+                      mOverlayCallbacks[id](id);
+                      return;
+                    }
+                }
+
+              // No overlay under the cursor, select whatever object is,
+              // or nothing
+
+              mScene.selected = mScene.pick(mRenderer.unproject(ndcX, ndcY));
+              ifDebug(if (mScene.selected >= 0)
+                        {
+                          std::cerr << "Picked object: " << mScene.selected
+                                    << std::endl;
+                        });
             }
         }
     };
@@ -466,6 +604,275 @@ static void updateFPS(dmp::Window & window, const dmp::Timer & timer, float scal
     }
 }
 
+// vertex x, z of a waveGridSize square sheet of ripples 8 units across,
+// spreading from its center at time t
+static dmp::ObjectVertex waveVertex(size_t x, size_t z, float t)
+{
+  auto px = 8.0f * (float) x / (float) (dmp::waveGridSize - 1) - 4.0f;
+  auto pz = 8.0f * (float) z / (float) (dmp::waveGridSize - 1) - 4.0f;
+  auto r = std::max(std::sqrt(px * px + pz * pz), 1e-4f);
+
+  auto phase = 3.0f * r - 2.0f * t;
+  auto height = 0.1f * glm::sin(phase);
+  auto slope = 0.3f * glm::cos(phase); // d height / d r
+
+  return {
+    glm::vec3(px, height, pz),
+    glm::normalize(glm::vec3(-slope * px / r, 1.0f, -slope * pz / r)),
+    glm::vec2((float) x, (float) z) / (float) (dmp::waveGridSize - 1)
+  };
+}
+
+// Rolling hills over a terrainSamples square, as 16 bit heights: octaves
+// of waves, each twice the frequency and half the height of the one
+// before and turned against it so their crests don't line up
+static void writeTerrainHeights(const std::string & path,
+                                dmp::ThreadPool & pool)
+{
+  const size_t width = dmp::terrainSamples;
+  const size_t octaves = 8;
+  std::vector<uint16_t> heights(width * width);
+
+  pool.parallelFor(width, [&](size_t z)
+    {
+      for (size_t x = 0; x < width; ++x)
+        {
+          auto u = 6.0f * (float) x / (float) (width - 1);
+          auto v = 6.0f * (float) z / (float) (width - 1);
+          float sum = 0.0f;
+          float amp = 1.0f;
+          float total = 0.0f;
+          for (size_t o = 0; o < octaves; ++o)
+            {
+              sum += amp * glm::sin(u + 1.7f * (float) o)
+                * glm::cos(v + 0.9f * (float) o);
+              total += amp;
+              amp *= 0.5f;
+
+              auto nextU = 2.0f * (0.8f * u - 0.6f * v);
+              v = 2.0f * (0.6f * u + 0.8f * v);
+              u = nextU;
+            }
+
+          auto h = 0.5f + 0.5f * sum / total;
+          heights[z * width + x] = (uint16_t) (65535.0f * h);
+        }
+    });
+
+  dmp::makeDirectories(dmp::terrainCacheDir);
+  dmp::writeFileAtomic(path,
+                       heights.data(),
+                       heights.size() * sizeof(uint16_t));
+}
+
+// The crowd's figure: a skeleton of hips, spine, chest, head, two arms and
+// two legs, standing on the origin facing +z
+static dmp::Skeleton figureSkeleton()
+{
+  auto at = [](const char * name, int32_t parent, float x, float y)
+    {
+      dmp::Joint joint;
+      joint.name = name;
+      joint.parent = parent;
+      joint.bind.translation = glm::vec3(x, y, 0.0f);
+      return joint;
+    };
+
+  return dmp::Skeleton({
+      at("hips", -1, 0.0f, 0.95f),
+      at("spine", 0, 0.0f, 0.25f),
+      at("chest", 1, 0.0f, 0.25f),
+      at("head", 2, 0.0f, 0.3f),
+      at("upperArmL", 2, 0.22f, 0.25f),
+      at("forearmL", 4, 0.0f, -0.3f),
+      at("upperArmR", 2, -0.22f, 0.25f),
+      at("forearmR", 6, 0.0f, -0.3f),
+      at("thighL", 0, 0.1f, -0.05f),
+      at("shinL", 8, 0.0f, -0.45f),
+      at("thighR", 0, -0.1f, -0.05f),
+      at("shinR", 10, 0.0f, -0.45f)
+    });
+}
+
+// A capsule per bone, each bound to its joint and, near that joint, half
+// to its parent, so that the figure bends there rather than breaks
+static void figureMesh(const dmp::Skeleton & skeleton,
+                       std::vector<dmp::SkinnedVertex> & verts,
+                       std::vector<GLuint> & idxs)
+{
+  struct Part
+  {
+    const char * joint;
+    dmp::Shape shape;
+    glm::vec3 min;
+    glm::vec3 max;
+  };
+
+  std::vector<Part> parts = {
+    {"hips", dmp::Capsule, {-0.16f, 0.82f, -0.1f}, {0.16f, 1.2f, 0.1f}},
+    {"spine", dmp::Capsule, {-0.15f, 1.12f, -0.1f}, {0.15f, 1.45f, 0.1f}},
+    {"chest", dmp::Capsule, {-0.2f, 1.38f, -0.12f}, {0.2f, 1.72f, 0.12f}},
+    {"head", dmp::Sphere, {-0.11f, 1.72f, -0.12f}, {0.11f, 2.0f, 0.12f}}
+  };
+  for (float side : {1.0f, -1.0f})
+    {
+      auto arm = side > 0.0f ? "upperArmL" : "upperArmR";
+      auto forearm = side > 0.0f ? "forearmL" : "forearmR";
+      auto thigh = side > 0.0f ? "thighL" : "thighR";
+      auto shin = side > 0.0f ? "shinL" : "shinR";
+      parts.push_back({arm, dmp::Capsule,
+                       {side * 0.22f - 0.05f, 1.38f, -0.05f},
+                       {side * 0.22f + 0.05f, 1.74f, 0.05f}});
+      parts.push_back({forearm, dmp::Capsule,
+                       {side * 0.22f - 0.045f, 1.08f, -0.045f},
+                       {side * 0.22f + 0.045f, 1.42f, 0.045f}});
+      parts.push_back({thigh, dmp::Capsule,
+                       {side * 0.1f - 0.07f, 0.43f, -0.07f},
+                       {side * 0.1f + 0.07f, 0.95f, 0.07f}});
+      parts.push_back({shin, dmp::Capsule,
+                       {side * 0.1f - 0.055f, 0.0f, -0.06f},
+                       {side * 0.1f + 0.055f, 0.47f, 0.06f}});
+    }
+
+  // where each joint is in the bind pose, which has no rotations
+  std::vector<glm::vec3> bindAt(skeleton.size());
+  for (size_t j = 0; j < skeleton.size(); ++j)
+    {
+      auto parent = skeleton.parent(j);
+      bindAt[j] = skeleton.joint(j).bind.translation
+        + (parent >= 0 ? bindAt[parent] : glm::vec3(0.0f));
+    }
+
+  const float blendDist = 0.08f;
+  dmp::ShapeParams params;
+  params.segments = 10;
+  params.rings = 4;
+  for (const auto & part : parts)
+    {
+      auto joint = skeleton.find(part.joint);
+      auto parent = skeleton.parent(joint);
+      auto mesh = dmp::buildShape(part.shape, part.min, part.max, params);
+
+      auto first = (GLuint) verts.size();
+      for (const auto & v : mesh.verts)
+        {
+          auto d = std::abs(v.position.y - bindAt[joint].y);
+          auto toParent = parent >= 0
+            ? 0.5f * std::max(0.0f, 1.0f - d / blendDist)
+            : 0.0f;
+          verts.push_back(dmp::skinVertex(
+                            v,
+                            glm::uvec4(joint, std::max(parent, 0), 0, 0),
+                            glm::vec4(1.0f - toParent, toParent, 0.0f, 0.0f)));
+        }
+      for (auto i : mesh.indices) idxs.push_back(first + i);
+    }
+}
+
+// Idling, walking and running, each a loop of keys at 30 a second
+static std::vector<dmp::AnimationClip> figureClips(
+  const dmp::Skeleton & skeleton)
+{
+  struct Gait
+  {
+    const char * name;
+    size_t frames;
+    float stride; // how far the legs swing, and the rest with them
+    float knee;
+    float arm;
+    float elbow;
+    float lean;
+    float bob;
+  };
+
+  const Gait gaits[] = {
+    {"idle", 90, 0.03f, 0.05f, 0.06f, 0.15f, 0.0f, 0.01f},
+    {"walk", 30, 0.45f, 0.6f, 0.35f, 0.3f, 0.05f, 0.03f},
+    {"run", 20, 0.8f, 1.3f, 0.7f, 1.2f, 0.2f, 0.06f}
+  };
+
+  auto twoPi = 2.0f * glm::pi<float>();
+  const glm::vec3 xAxis(1.0f, 0.0f, 0.0f);
+  const glm::vec3 yAxis(0.0f, 1.0f, 0.0f);
+  std::vector<dmp::AnimationClip> res;
+  for (const auto & gait : gaits)
+    {
+      std::vector<std::vector<dmp::JointPose>> frames(gait.frames);
+      for (size_t f = 0; f < gait.frames; ++f)
+        {
+          auto phase = twoPi * (float) f / (float) gait.frames;
+          auto swing = glm::sin(phase);
+
+          // rotations about x turn a limb hanging down backward
+          auto angles = std::map<std::string, std::pair<glm::vec3, float>>{
+            {"hips", {yAxis, 0.2f * gait.stride * swing}},
+            {"spine", {xAxis, gait.lean}},
+            {"chest", {yAxis, -0.3f * gait.stride * swing}},
+            {"thighL", {xAxis, -gait.stride * swing}},
+            {"thighR", {xAxis, gait.stride * swing}},
+            {"shinL", {xAxis, gait.knee * std::max(0.0f, glm::cos(phase))}},
+            {"shinR", {xAxis, gait.knee * std::max(0.0f, -glm::cos(phase))}},
+            {"upperArmL", {xAxis, gait.arm * swing}},
+            {"upperArmR", {xAxis, -gait.arm * swing}},
+            {"forearmL", {xAxis, -gait.elbow * (1.0f + swing) * 0.5f}},
+            {"forearmR", {xAxis, -gait.elbow * (1.0f - swing) * 0.5f}}
+          };
+
+          auto & frame = frames[f];
+          for (size_t j = 0; j < skeleton.size(); ++j)
+            {
+              auto pose = skeleton.joint(j).bind;
+              auto found = angles.find(skeleton.joint(j).name);
+              if (found != angles.end())
+                {
+                  pose.rotation = glm::rotate(glm::quat(),
+                                              found->second.second,
+                                              found->second.first);
+                }
+              frame.push_back(pose);
+            }
+
+          // two steps a cycle, so the hips bob twice
+          frame[0].translation.y += gait.bob * glm::cos(2.0f * phase);
+        }
+      res.emplace_back(gait.name, frames, 30.0f);
+    }
+
+  return res;
+}
+
+void dmp::Program::updateWave()
+{
+  if (!mWave) return;
+
+  auto t = mTimeScale * mTimer.time();
+  mWave->updateVertices([t](ObjectVertex * data, size_t)
+                        {
+                          for (size_t z = 0; z < waveGridSize; ++z)
+                            {
+                              for (size_t x = 0; x < waveGridSize; ++x)
+                                {
+                                  *data++ = waveVertex(x, z, t);
+                                }
+                            }
+                        });
+}
+
+void dmp::Program::updateCrowd()
+{
+  if (!mCrowd) return;
+
+  // each member idles, walks and runs a few seconds of each in turn,
+  // starting at its own point in that cycle
+  auto t = mTimeScale * mTimer.time() / 4.0f;
+  auto numClips = mCrowd->clips().size();
+  for (size_t i = 0; i < mCrowd->size(); ++i)
+    {
+      auto at = t + (float) numClips * mod(0.7548777f * (float) i, 1.0f);
+      mCrowd->play(i, (size_t) at % numClips, 0.5f);
+    }
+}
+
 int dmp::Program::run()
 {
   mTimer.reset();
@@ -486,9 +893,32 @@ int dmp::Program::run()
         }
       else
         {
+          if (mAssetLoader.update(assetUploadBudgetMs) > 0)
+            {
+              mRenderer.texturesChanged();
+            }
+          mAssetCache.residency().update();
+
+          // the terrain picks its chunks for the view of the frame before
+          auto pc = mRenderer.lastPassConstants();
+          if (mTerrain && pc)
+            {
+              mTerrain->setView(pc->V, pc->P, pc->viewportHeight);
+            }
+          if (mCrowd && pc) mCrowd->setView(pc->PV);
+
+          updateCrowd();
           mScene.update(mTimer.deltaTime() * mTimeScale);
-          mRenderer.render(mScene, mTimer, mRenderOptions);
-          mWindow.swapBuffer();
+          updateWave();
+
+          // a minimized window has an empty framebuffer, which the
+          // renderer keeps its last size over
+          if (mWindow.getFramebufferWidth() > 0
+              && mWindow.getFramebufferHeight() > 0)
+            {
+              mRenderer.render(mScene, mTimer, mRenderOptions);
+              mWindow.swapBuffer();
+            }
         }
 
       // poll window system events
@@ -510,10 +940,9 @@ void dmp::Program::buildScene(TransformFn cameraFn,
 {
   mScene.graph = std::make_unique<Branch>();
 
-  std::string notex = "";
-  mScene.textures.emplace_back(notex);
-  std::string someRandomTexture = skyBox[0];
-  mScene.textures.emplace_back(someRandomTexture);
+  mScene.residency = &mAssetCache.residency();
+  mScene.textures.push_back(mAssetCache.texture(""));
+  mScene.textures.push_back(mAssetCache.texture(skyBox[0]));
 
   mScene.materials.push_back( // Ruby = 0
     {
@@ -544,6 +973,7 @@ void dmp::Program::buildScene(TransformFn cameraFn,
 
   mScene.materialConstants =
     std::make_unique<UniformBuffer>(mScene.materials.size(),
+                                    sizeof(Material),
                                     Material::std140Size());
 
   for (size_t i = 0; i < mScene.materials.size(); ++i)
@@ -593,6 +1023,41 @@ void dmp::Program::buildScene(TransformFn cameraFn,
    blueLight->insert(mScene.lights[2]);
    mScene.graph->insert(mScene.lights[3]);
 
+   // a field of small point lights drifting around the boxes. Containers
+   // hold references, so every light is added before any is inserted
+   auto pointLightSpin = mScene.graph->transform(
+     [](glm::mat4 & M, glm::quat &, float deltaT)
+     {
+       M = glm::rotate(M, deltaT / 8.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+       return M;
+     });
+   auto pointLightGroup = pointLightSpin->branch();
+
+   const int pointLightsPerSide = 16;
+   for (int i = 0; i < pointLightsPerSide; ++i)
+     {
+       for (int j = 0; j < pointLightsPerSide; ++j)
+         {
+           auto u = (float) i / (float) (pointLightsPerSide - 1);
+           auto v = (float) j / (float) (pointLightsPerSide - 1);
+           auto hue = 2.0f * glm::pi<float>() * mod(u + v, 1.0f);
+           glm::vec4 color(0.5f + 0.5f * glm::cos(hue),
+                           0.5f + 0.5f * glm::cos(hue - 2.0944f),
+                           0.5f + 0.5f * glm::cos(hue + 2.0944f),
+                           1.0f);
+           glm::vec4 pos(glm::mix(-6.0f, 6.0f, u),
+                         0.6f * glm::sin(7.0f * (u + v)),
+                         glm::mix(-6.0f, 6.0f, v),
+                         1.0f);
+           mScene.pointLights.push_back({color, pos, 1.25f, glm::mat4()});
+         }
+     }
+
+   for (auto & curr : mScene.pointLights)
+     {
+       pointLightGroup->insert(curr);
+     }
+
    mScene.cameras.emplace_back();
    mScene.graph->insert(mScene.cameras[0].focus());
    cam->insert(mScene.cameras[0].pos());
@@ -600,7 +1065,7 @@ void dmp::Program::buildScene(TransformFn cameraFn,
    glm::vec4 max(0.2f, 0.5f, 0.1f, 1.0f);
    glm::vec4 min = -max;
 
-   Object build1(Cube, min, max, 1, 0);
+   auto build1 = mShapeCache.get(Cube, min, max, 1, 0);
    auto staticBoxOne = [=](glm::mat4 & M, glm::quat & q, float)
      {
        return staticQuatFn(M, q, 0.0f);
@@ -609,7 +1074,7 @@ void dmp::Program::buildScene(TransformFn cameraFn,
    auto boxOne = mScene.graph->transform(staticBoxOne);
    mScene.objects.push_back(boxOne->insert(build1));
 
-   Object build2(Cube, min, max, 1, 0);
+   auto build2 = mShapeCache.get(Cube, min, max, 1, 0);
    auto staticBoxTwo = [=](glm::mat4 & M, glm::quat & q, float)
      {
        return staticQuatFn(M, q, 0.25f);
@@ -618,7 +1083,7 @@ void dmp::Program::buildScene(TransformFn cameraFn,
    auto boxTwo = mScene.graph->transform(staticBoxTwo);
    mScene.objects.push_back(boxTwo->insert(build2));
 
-   Object build3(Cube, min, max, 1, 0);
+   auto build3 = mShapeCache.get(Cube, min, max, 1, 0);
    auto staticBoxThree = [=](glm::mat4 & M, glm::quat & q, float)
      {
        return staticQuatFn(M, q, 0.5f);
@@ -627,7 +1092,7 @@ void dmp::Program::buildScene(TransformFn cameraFn,
    auto boxThree = mScene.graph->transform(staticBoxThree);
    mScene.objects.push_back(boxThree->insert(build3));
 
-   Object build4(Cube, min, max, 1, 0);
+   auto build4 = mShapeCache.get(Cube, min, max, 1, 0);
    auto staticBoxFour = [=](glm::mat4 & M, glm::quat & q, float)
      {
        return staticQuatFn(M, q, 0.75f);
@@ -636,7 +1101,7 @@ void dmp::Program::buildScene(TransformFn cameraFn,
    auto boxFour = mScene.graph->transform(staticBoxFour);
    mScene.objects.push_back(boxFour->insert(build4));
 
-   Object build5(Cube, min, max, 1, 0);
+   auto build5 = mShapeCache.get(Cube, min, max, 1, 0);
    auto staticBoxFive = [=](glm::mat4 & M, glm::quat & q, float)
      {
        return staticQuatFn(M, q, 1.0f);
@@ -645,46 +1110,235 @@ void dmp::Program::buildScene(TransformFn cameraFn,
    auto boxFive = mScene.graph->transform(staticBoxFive);
    mScene.objects.push_back(boxFive->insert(build5));
 
-   Object buildLerp(Cube, min, max, 0, 0);
+   auto buildLerp = mShapeCache.get(Cube, min, max, 0, 0);
    auto lerpBox = mScene.graph->transform(quatFn);
    mDynamicBox = lerpBox->insert(buildLerp);
    mScene.objects.push_back(mDynamicBox);
 
+   // a row of the other procedural shapes in front of the boxes, finely
+   // tessellated, each fitted to a 1.5 unit box
+   ShapeParams fine;
+   fine.segments = 256;
+   fine.rings = 128;
+
+   ShapeParams terrain;
+   terrain.heightsWidth = 257;
+   for (size_t z = 0; z < terrain.heightsWidth; ++z)
+     {
+       for (size_t x = 0; x < terrain.heightsWidth; ++x)
+         {
+           auto u = (float) x / (float) (terrain.heightsWidth - 1);
+           auto v = (float) z / (float) (terrain.heightsWidth - 1);
+           terrain.heights.push_back(glm::sin(9.0f * u) * glm::cos(7.0f * v)
+                                     + 0.3f * glm::sin(31.0f * u * v));
+         }
+     }
+
+   const std::pair<Shape, const ShapeParams *> shapes[] =
+     {
+       {Sphere, &fine},
+       {Capsule, &fine},
+       {Cylinder, &fine},
+       {Torus, &fine},
+       {Heightfield, &terrain}
+     };
+
+   glm::vec4 shapeMax(0.75f, 0.75f, 0.75f, 1.0f);
+   for (size_t i = 0; i < 5; ++i)
+     {
+       // the capsule stands twice as tall as it is wide
+       auto top = shapeMax;
+       if (shapes[i].first == Capsule) top.y += 1.5f;
+       auto shapeMin = glm::vec4(-glm::vec3(shapeMax), 1.0f);
+       auto built = mShapeCache.get(shapes[i].first,
+                                    shapeMin,
+                                    top,
+                                    1,
+                                    0,
+                                    *shapes[i].second);
+
+       auto place = glm::translate(glm::mat4(),
+                                   {3.0f * (float) i - 6.0f, 0.0f, 4.0f});
+       auto shapeGroup = mScene.graph->transform(place);
+       mScene.objects.push_back(shapeGroup->insert(built));
+     }
+
+   // streamed, so rewriting it every frame never waits on the GPU
+   std::vector<ObjectVertex> waveVerts;
+   std::vector<GLuint> waveIdxs;
+   for (size_t z = 0; z < waveGridSize; ++z)
+     {
+       for (size_t x = 0; x < waveGridSize; ++x)
+         {
+           waveVerts.push_back(waveVertex(x, z, 0.0f));
+           if (x + 1 == waveGridSize || z + 1 == waveGridSize) continue;
+
+           auto i = (GLuint) (z * waveGridSize + x);
+           auto below = i + (GLuint) waveGridSize;
+           waveIdxs.insert(waveIdxs.end(),
+                           {i, below, i + 1, i + 1, below, below + 1});
+         }
+     }
+   // room for the ripples, which the bounds would otherwise miss
+   waveVerts.front().position.y = -0.1f;
+   waveVerts.back().position.y = 0.1f;
+
+   Object buildWave(waveVerts, waveIdxs, GL_TRIANGLES, 0, 0, GL_STREAM_DRAW);
+   auto waveGroup = mScene.graph->transform(
+     glm::translate(glm::mat4(), glm::vec3(0.0f, -1.5f, 0.0f)));
+   mWave = waveGroup->insert(buildWave);
+   mScene.objects.push_back(mWave);
+
+   // a kilometre of hills, well under everything else
+   auto heightsPath = std::string(terrainCacheDir) + "/heights.r16";
+   if (!MappedFile(heightsPath).valid())
+     {
+       writeTerrainHeights(heightsPath, mAssetLoader.pool());
+     }
+   auto hills = std::make_unique<Terrain>(heightsPath,
+                                          terrainSpacing,
+                                          terrainHeightScale,
+                                          1,
+                                          0,
+                                          mAssetLoader.pool());
+   mTerrain = hills.get();
+   auto terrainExtent = mTerrain->bounds().max.x;
+   auto terrainGroup = mScene.graph->transform(
+     glm::translate(glm::mat4(), glm::vec3(-0.5f * terrainExtent,
+                                           -terrainHeightScale - 5.0f,
+                                           -0.5f * terrainExtent)));
+   std::unique_ptr<Node> terrainNode = std::move(hills);
+   terrainGroup->insert(terrainNode);
+   mScene.objects.insert(mScene.objects.end(),
+                         mTerrain->objects().begin(),
+                         mTerrain->objects().end());
+
+   // a fountain of sparks circling the boxes, its trail left in the air
+   // behind it. Rate is set to keep it at capacity
+   EmitterParams fountain;
+   fountain.capacity = fountainParticles;
+   fountain.life = 3.0f;
+   fountain.lifeJitter = 0.5f;
+   fountain.rate = (float) fountain.capacity
+     / (fountain.life * (1.0f - 0.5f * fountain.lifeJitter));
+   fountain.speed = 6.0f;
+   fountain.spread = 0.25f;
+   // shared with asset loads, which per frame work goes ahead of
+   mScene.pool = &mAssetLoader.pool();
+   mScene.emitters.push_back(std::make_unique<ParticleEmitter>(fountain));
+   auto fountainSpin = mScene.graph->transform(
+     [](glm::mat4 & M, glm::quat &, float deltaT)
+     {
+       M = glm::rotate(M, deltaT / 2.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+       return M;
+     });
+   auto fountainArm = fountainSpin->transform(
+     glm::translate(glm::mat4(), glm::vec3(7.0f, -1.5f, 0.0f)));
+   fountainArm->insert(*mScene.emitters.back());
+
+   // a crowd of figures on a grid behind everything, each facing its own
+   // way
+   auto skeleton = figureSkeleton();
+   std::vector<SkinnedVertex> figureVerts;
+   std::vector<GLuint> figureIdxs;
+   figureMesh(skeleton, figureVerts, figureIdxs);
+   auto clips = figureClips(skeleton);
+   mScene.crowds.push_back(std::make_unique<Crowd>(std::move(skeleton),
+                                                   std::move(clips),
+                                                   figureVerts,
+                                                   figureIdxs,
+                                                   crowdSize,
+                                                   1,
+                                                   0));
+   mCrowd = mScene.crowds.back().get();
+   const size_t crowdRows = 32;
+   for (size_t i = 0; i < crowdSize; ++i)
+     {
+       auto x = 1.6f * ((float) (i % (crowdSize / crowdRows))
+                        - 0.5f * (float) (crowdSize / crowdRows));
+       auto z = -1.6f * (float) (i / (crowdSize / crowdRows));
+       auto yaw = 2.0f * glm::pi<float>() * mod(0.618034f * (float) i, 1.0f);
+       auto M = glm::rotate(glm::translate(glm::mat4(), {x, 0.0f, z}),
+                            yaw,
+                            glm::vec3(0.0f, 1.0f, 0.0f));
+       mCrowd->add(M, 0, (float) i);
+     }
+   auto crowdGroup = mScene.graph->transform(
+     glm::translate(glm::mat4(), glm::vec3(0.0f, -2.0f, -12.0f)));
+   crowdGroup->insert(*mCrowd);
+
+   // every OBJ in modelDir, fitted into a 2 unit cube in a row behind the
+   // boxes, each copied modelCopies times down a line going away from the
+   // camera. Copies share their GPU buffers
+   auto models = listFiles(modelDir, ".obj");
+   for (size_t i = 0; i < models.size(); ++i)
+     {
+       AABB bounds;
+       std::vector<Object> parts;
+       if (useMeshCache)
+         {
+           auto cooked = MeshCache::fetch(models[i], mAssetLoader.pool());
+           bounds = cooked.bounds();
+           parts = cooked.objects(1, 0);
+         }
+       else
+         {
+           Model model(models[i], mAssetLoader.pool());
+           bounds = model.bounds();
+           parts = model.objects(1, 0);
+         }
+       if (bounds.empty()) continue;
+
+       auto extent = bounds.max - bounds.min;
+       auto fit = 2.0f / std::max(extent.x, std::max(extent.y, extent.z));
+       for (size_t c = 0; c < modelCopies; ++c)
+         {
+           auto place = glm::translate(glm::mat4(),
+                                       {3.0f * (float) i,
+                                        0.0f,
+                                        -4.0f - 4.0f * (float) c});
+           place = glm::scale(place, glm::vec3(fit));
+           place = glm::translate(place, -bounds.centroid());
+
+           auto modelGroup = mScene.graph->transform(place)->branch();
+           for (auto & curr : parts)
+             {
+               mScene.objects.push_back(modelGroup->insert(curr));
+             }
+         }
+     }
+
    mScene.objectConstants
      = std::make_unique<UniformBuffer>(mScene.objects.size(),
+                                       sizeof(ObjectConstants),
                                        ObjectConstants::std140Size());
 
-  std::vector<const char *> sb;
-  for (size_t i = 0; i < 6; ++i) sb.push_back(skyBox[i]);
-
-  mScene.skybox = std::make_unique<Skybox>(sb);
+  std::vector<std::string> sb(skyBox, skyBox + 6);
+  mScene.skybox = std::make_unique<Skybox>(mAssetCache.cubemap(sb));
 
   mScene.overlays.emplace_back(-0.75f, -0.8f,
                                1.5f, 0.2f,
-                               registerOverlayCallback([](int selectedID){std::cerr << "Callback 0: selected: " << selectedID << std::endl;}),
+                               registerOverlayCallback([](uint32_t selectedID){std::cerr << "Callback 0: selected: " << selectedID << std::endl;}),
                                mScene.textures[1]);
 
   mScene.overlays.emplace_back(-0.5f, -0.75f,
                                1.0f, 0.2f,
-                               //registerOverlayCallback([](int selectedID){std::cerr << "Callback 1: selected: " << selectedID << std::endl;}),
+                               //registerOverlayCallback([](uint32_t selectedID){std::cerr << "Callback 1: selected: " << selectedID << std::endl;}),
                                mScene.textures[1]);
 
   mScene.overlays.emplace_back(-0.25f, -0.7f,
                                0.5f, 0.2f,
-                               registerOverlayCallback([](int selectedID){std::cerr << "Callback 2: selected: " << selectedID << std::endl;}),
+                               registerOverlayCallback([](uint32_t selectedID){std::cerr << "Callback 2: selected: " << selectedID << std::endl;}),
                                mScene.textures[1]);
 
-  mScene.overlayConstants
-    = std::make_unique<UniformBuffer>(mScene.overlays.size(),
-                                      OverlayConstants::std140Size());
-
   Object::sortByMaterial(mScene.objects);
   mScene.graph->update(0.0f, glm::mat4(), true);
 }
 
-int dmp::Program::registerOverlayCallback(OverlayCallback cb)
+uint32_t dmp::Program::registerOverlayCallback(OverlayCallback cb)
 {
-  expect("Less than 255 overlay callbacks", mNextFreeOverlayID < 255);
+  expect("Less than noOverlayID overlay callbacks",
+         mNextFreeOverlayID < noOverlayID);
   auto retval = mNextFreeOverlayID;
   ++mNextFreeOverlayID;
   mOverlayCallbacks.push_back(cb);
@@ -10,6 +10,10 @@
 #include "util.hpp"
 #include "Timer.hpp"
 #include "Scene.hpp"
+#include "AssetLoader.hpp"
+#include "AssetCache.hpp"
+#include "Scene/ShapeCache.hpp"
+#include "Scene/Terrain.hpp"
 
 namespace dmp
 {
@@ -117,6 +121,8 @@ namespace dmp
                     TransformFn lightFn,
                     TransformFn quatFn,
                     TransformFn staticQuatFn);
+    void updateWave();
+    void updateCrowd();
     bool mDrawWireframe = false;
     bool mDrawNormals = false;
 
@@ -127,6 +133,9 @@ namespace dmp
     Renderer mRenderer;
     Timer mTimer;
     Scene mScene;
+    AssetLoader mAssetLoader;
+    AssetCache mAssetCache;
+    ShapeCache mShapeCache;
     std::map<std::string, float> mCameraState;
     int mLightCoeff = 0.0f;
     std::unordered_set<Keybind> mKeybinds;
@@ -148,12 +157,21 @@ namespace dmp
     Object * mDynamicBox = nullptr;
     bool mShowDynBox = true;
 
+    // a sheet of ripples under the boxes, rewritten every frame
+    Object * mWave = nullptr;
+
+    // owned by the scene graph
+    Terrain * mTerrain = nullptr;
+
+    // owned by the scene
+    Crowd * mCrowd = nullptr;
+
     int mMousePosX = 0;
     int mMousePosY = 0;
 
-    typedef std::function<void(int selectedID)> OverlayCallback;
-    int registerOverlayCallback(OverlayCallback cb);
-    int mNextFreeOverlayID = 0;
+    typedef std::function<void(uint32_t selectedID)> OverlayCallback;
+    uint32_t registerOverlayCallback(OverlayCallback cb);
+    uint32_t mNextFreeOverlayID = 0;
     std::vector<OverlayCallback> mOverlayCallbacks;
   };
 }
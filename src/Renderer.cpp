@@ -6,8 +6,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include "util.hpp"
 #include "config.hpp"
-#include "Image.hpp"
 #include "Renderer/Pass.hpp"
+#include "Renderer/Std140.hpp"
 
 #include <iostream>
 #include <glm/gtx/string_cast.hpp>
@@ -24,25 +24,58 @@ dmp::Renderer::Renderer(GLsizei width,
           << "Supported GLSL version: "
           << (char *)glGetString(GL_VERSION)
           << std::endl);
-  loadShaders(basicShader, mShaderProg);
-  loadShaders(overlayShader, mOverlayShaderProg);
-  loadShaders(overlayPickingShader, mOverlayPickingShaderProg);
+
+  // shaders pull these in with #pragma block, so they always match the
+  // C++ structs
+  Shader::defineBlock("PassConstants",
+                      std140::glslBlock("PassConstants",
+                                        PassConstants::layout()));
+  Shader::defineBlock("MaterialConstants",
+                      std140::glslBlock("MaterialConstants",
+                                        Material::layout()));
+  Shader::defineBlock("ObjectConstants",
+                      std140::glslBlock("ObjectConstants",
+                                        ObjectConstants::layout()));
+
+  // submitted together so the driver can compile them side by side
+  ShaderBatch shaders;
+  mBasicShaders = std::make_unique<ShaderVariants>(basicShader);
+  mBasicShaders->prepare(shaders, basicVariant(RenderOptions(), 4));
+  auto skinned = basicVariant(RenderOptions(), 4);
+  skinned.skinned = true;
+  mBasicShaders->prepare(shaders, skinned);
+  shaders.add(mDepthShaderProg, depthShader);
+  shaders.add(mSkyboxShaderProg, skyboxShader);
+  shaders.add(mOverlayShaderProg, overlayShader);
+  shaders.add(mParticleShaderProg, particleShader);
+  shaders.finish();
 
   initPassConstants();
+  mOverlayBatch = std::make_unique<OverlayBatch>();
+  mLightClusters = std::make_unique<LightClusters>();
+  mGpuTimer = std::make_unique<GpuTimer>();
+  mSceneTarget = std::make_unique<RenderTarget>(width, height);
   resize(width, height);
-  mWidth = width;
-  mHeight = height;
 }
 
-void dmp::Renderer::loadShaders(const std::string shaderName,
-                                Shader & shaderProg)
+dmp::ShaderVariant dmp::Renderer::basicVariant(const RenderOptions & ro,
+                                               GLuint numLights)
 {
-  auto vertName = shaderName + std::string(".vert");
-  auto fragName = shaderName + std::string(".frag");
+  ShaderVariant variant;
+  variant.drawMode = ro.drawNormals ? drawNormals : drawShaded;
+
+  // the normals view ignores lights and textures, so one program covers it
+  if (!ro.drawNormals)
+    {
+      variant.numLights = numLights;
+      variant.textured = ro.drawTextures;
+    }
+  else
+    {
+      variant.textured = false;
+    }
 
-  shaderProg.initShader(vertName.c_str(),
-                        nullptr, nullptr, nullptr,
-                        fragName.c_str());
+  return variant;
 }
 
 void dmp::Renderer::initRenderer()
@@ -71,6 +104,12 @@ void dmp::Renderer::initRenderer()
   glEnable (GL_BLEND);
   glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+  // UniformBuffer spaces its elements for the largest alignment GL allows
+  // rather than asking each time
+  expect("Uniform buffer offset alignment divides maxOffsetAlignment",
+         std140::maxOffsetAlignment
+         % (size_t) uniformBufferOffsetAlignment() == 0);
+
   expectNoErrors("init renderer");
 }
 
@@ -79,6 +118,9 @@ void dmp::Renderer::resize(GLsizei width, GLsizei height)
   float fWidth = (float) width;
   float fHeight = (float) height;
   glViewport(0, 0, width, height);
+  mWidth = width;
+  mHeight = height;
+  mSceneTarget->resize(width, height);
 
   mP = glm::perspective(fieldOfView,
                         fWidth / fHeight,
@@ -89,6 +131,7 @@ void dmp::Renderer::resize(GLsizei width, GLsizei height)
 void dmp::Renderer::initPassConstants()
 {
   mPassConstants = std::make_unique<UniformBuffer>(1,
+                                                   sizeof(PassConstants),
                                                    PassConstants::std140Size());
 }
 
@@ -99,6 +142,13 @@ void dmp::Renderer::render(const Scene & scene,
   expect("Scene Object Constants not null",
          scene.objectConstants);
 
+  mGpuTimer->frame();
+
+  mRenderScale = ro.dynamicResolution
+    ? mResolution.update(mGpuTimer->scaledMs())
+    : glm::clamp(ro.fixedRenderScale, minRenderScale, 1.0f);
+  mSceneTarget->bind(mRenderScale);
+
   glClear(GL_DEPTH_BUFFER_BIT);
   glClear(GL_COLOR_BUFFER_BIT);
 
@@ -113,21 +163,22 @@ void dmp::Renderer::render(const Scene & scene,
 
   PassConstants pc = {};
 
-  pc.lightColor[0] = scene.lights[0].color;
-  pc.lightColor[1] = scene.lights[1].color;
-  pc.lightColor[2] = scene.lights[2].color;
-  pc.lightColor[3] = scene.lights[3].color;
-  pc.lightDir[0] = scene.lights[0].M * scene.lights[0].dir;
-  pc.lightDir[1] = scene.lights[1].M * scene.lights[1].dir;
-  pc.lightDir[2] = scene.lights[2].M * scene.lights[2].dir;
-  pc.lightDir[3] = scene.lights[3].M * scene.lights[3].dir;
-  pc.numLights = 4;
+  // lights past maxLights are left out
+  auto numLights = std::min(scene.lights.size(), maxLights);
+  for (size_t i = 0; i < numLights; ++i)
+    {
+      pc.lightColor[i] = scene.lights[i].color;
+      pc.lightDir[i] = scene.lights[i].M * scene.lights[i].dir;
+    }
+  pc.numLights = (unsigned int) numLights;
   pc.drawMode = ro.drawNormals ? drawNormals : drawShaded;
 
+  GLuint shaderProg = mBasicShaders->get(basicVariant(ro, pc.numLights));
+
   pc.P = mP;
   pc.invP = glm::inverse(pc.P);
   pc.V = scene.cameras[0].getV();
-  pc.invP = glm::inverse(pc.V);
+  pc.invV = glm::inverse(pc.V);
   pc.PV = pc.P * pc.V;
   pc.invPV = glm::inverse(pc.PV);
   pc.E = scene.cameras[0].getE(pc.PV);
@@ -136,51 +187,79 @@ void dmp::Renderer::render(const Scene & scene,
   pc.deltaT = timer.deltaTime();
   pc.totalT = timer.time();
 
-  pc.viewportWidth = (float) mWidth;
-  pc.viewportHeight = (float) mHeight;
+  pc.viewportWidth = (float) mSceneTarget->width();
+  pc.viewportHeight = (float) mSceneTarget->height();
+
+  mLightClusters->build(scene.pointLights, pc.V, pc.P, nearZ, farZ);
+  pc.clusterDims = glm::uvec4(clusterGridX,
+                              clusterGridY,
+                              clusterGridZ,
+                              mLightClusters->numLights());
+  pc.clusterSlices = mLightClusters->sliceParams();
 
   mPassConstants->update(0, pc);
+  mLastPassConstants = pc;
+  mHasPassConstants = true;
 
-  GLuint pcIdx = glGetUniformBlockIndex(mShaderProg, "PassConstants");
-  glUniformBlockBinding(mShaderProg, pcIdx, 1);
+  GLuint pcIdx = glGetUniformBlockIndex(shaderProg, "PassConstants");
+  glUniformBlockBinding(shaderProg, pcIdx, 1);
   mPassConstants->bind(1, 0);
 
   // Material Constants
 
-  GLuint mcIdx = glGetUniformBlockIndex(mShaderProg, "MaterialConstants");
-  glUniformBlockBinding(mShaderProg, mcIdx, 2);
+  GLuint mcIdx = glGetUniformBlockIndex(shaderProg, "MaterialConstants");
+  glUniformBlockBinding(shaderProg, mcIdx, 2);
   scene.materialConstants->bind(2, materialIndex);
 
   // Object Constants
 
-  GLuint ocIdx = glGetUniformBlockIndex(mShaderProg, "ObjectConstants");
-  glUniformBlockBinding(mShaderProg, ocIdx, 3);
+  GLuint ocIdx = glGetUniformBlockIndex(shaderProg, "ObjectConstants");
+  glUniformBlockBinding(shaderProg, ocIdx, 3);
 
-  // TODO: this should be last
-  glDepthMask(GL_FALSE);
-  expect("skybox not null", scene.skybox);
-  scene.skybox->bind(GL_TEXTURE0);
-  scene.skybox->draw();
-  expectNoErrors("Draw skybox");
-  glDepthMask(GL_TRUE);
+  buildDrawList(scene, pc, ro);
+
+  if (ro.depthPrepass) drawDepthPrepass(scene);
 
+  if (!ro.skyboxLast) drawSkybox(scene);
 
-  glUseProgram(mShaderProg);
+  mGpuTimer->begin("opaque");
+
+  // after a pre-pass, depth is already final and the depth test rejects
+  // every hidden fragment whatever the order, so go back to the material
+  // order of Scene::objects to save rebinding materials
+  glDepthMask(ro.depthPrepass ? GL_FALSE : GL_TRUE);
+  if (ro.depthPrepass)
+    {
+      std::sort(mDrawList.begin(),
+                mDrawList.end(),
+                [](const std::pair<float, size_t> & lhs,
+                   const std::pair<float, size_t> & rhs)
+                {
+                  return lhs.second < rhs.second;
+                });
+    }
+
+  glUseProgram(shaderProg);
+  mLightClusters->bind(GL_TEXTURE1, shaderProg);
 
   expectNoErrors("Bind shader program");
 
-  for (size_t i = 0; i < scene.objects.size(); ++i)
+  for (const auto & curr : mDrawList)
     {
+      auto i = curr.second;
+
       if (scene.objects[i]->materialIndex() != materialIndex)
         {
           materialIndex = scene.objects[i]->materialIndex();
           scene.materialConstants->bind(2, materialIndex);
         }
 
+      GLuint tex = *scene.textures[scene.objects[i]->textureIndex()];
+      if (scene.residency) scene.residency->touch(tex);
+
       glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D,
-                    scene.textures[scene.objects[i]->textureIndex()]);
-      glUniform1i(glGetUniformLocation(mShaderProg, "tex"),
+      glBindTexture(GL_TEXTURE_2D, tex);
+      glUniform1i(glGetUniformLocation(shaderProg, "tex"),
                   texUnitAsInt(GL_TEXTURE0));
 
 
@@ -192,10 +271,28 @@ void dmp::Renderer::render(const Scene & scene,
       scene.objects[i]->draw();
     }
 
+  mGpuTimer->end();
+
+  drawSelection(scene, ro);
+  drawCrowds(scene, pc, ro);
+
+  if (ro.skyboxLast) drawSkybox(scene);
+
+  drawParticles(scene);
+
+  glDepthMask(GL_TRUE);
+
   if (ro.drawWireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
+  mGpuTimer->begin("upscale", false);
+  mSceneTarget->blitToScreen();
+  mGpuTimer->end();
+
   if (!ro.drawOverlays) return;
 
+  // overlays draw straight to the window, at its full resolution
+  glClear(GL_DEPTH_BUFFER_BIT);
+
   // Now draw overlays
 
   expectNoErrors("Overlays pre");
@@ -208,71 +305,233 @@ void dmp::Renderer::render(const Scene & scene,
       mPassConstants->bind(1, 0);
     }
 
-  ocIdx = glGetUniformBlockIndex(mOverlayShaderProg, "OverlayConstants");
-
-  if (ocIdx != GL_INVALID_INDEX)
+  // the atlas keeps its own copies, but a rebuild reads from the originals
+  for (const auto & curr : scene.overlays)
     {
-      glUniformBlockBinding(mOverlayShaderProg, ocIdx, 2);
+      if (scene.residency && curr.isVisible())
+        {
+          scene.residency->touch(curr.getTexture());
+        }
     }
 
+  mOverlayBatch->update(scene.overlays);
+  if (mOverlayBatch->empty()) return;
+
+  mGpuTimer->begin("overlays", false);
+
   glUseProgram(mOverlayShaderProg);
 
-  for (size_t i = 0; i < scene.overlays.size(); ++i)
-    {
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, scene.overlays[i].getTexture());
-      glUniform1i(glGetUniformLocation(mOverlayShaderProg, "tex"),
-                  texUnitAsInt(GL_TEXTURE0));
+  mOverlayBatch->bind(GL_TEXTURE0);
+  glUniform1i(glGetUniformLocation(mOverlayShaderProg, "tex"),
+              texUnitAsInt(GL_TEXTURE0));
 
-      scene.overlayConstants->bind(2, i);
+  expectNoErrors("Set Overlay uniforms");
 
-      expectNoErrors("Set Overlay uniforms");
+  mOverlayBatch->draw();
 
-      scene.overlays[i].draw();
-    }
+  mGpuTimer->end();
 }
 
+void dmp::Renderer::buildDrawList(const Scene & scene,
+                                  const PassConstants & pc,
+                                  const RenderOptions & ro)
+{
+  mDrawList.clear();
+  mTrianglesDrawn = 0;
+  for (size_t i = 0; i < scene.objects.size(); ++i)
+    {
+      auto & obj = *scene.objects[i];
+      if (!obj.isVisible()) continue;
+
+      if (ro.lod) obj.selectLod(pc.V, pc.P, pc.viewportHeight);
+      else obj.resetLod();
+      mTrianglesDrawn += obj.numTriangles();
+
+      auto center = obj.worldBounds().centroid();
+      auto depth = -(pc.V * glm::vec4(center, 1.0f)).z;
+      mDrawList.push_back({depth, i});
+    }
+
+  if (!ro.sortFrontToBack) return;
 
-int dmp::Renderer::pick(const Scene & scene,
-                        const RenderOptions &,
-                        int x, int y)
+  std::sort(mDrawList.begin(), mDrawList.end());
+}
+
+void dmp::Renderer::drawDepthPrepass(const Scene & scene)
 {
-  glClear(GL_DEPTH_BUFFER_BIT);
-  glClear(GL_COLOR_BUFFER_BIT);
+  mGpuTimer->begin("depth");
 
-  expectNoErrors("Clear framebuffer");
+  glUseProgram(mDepthShaderProg);
 
-  GLuint pcIdx = glGetUniformBlockIndex(mOverlayPickingShaderProg,
-                                        "PassConstants");
+  GLuint pcIdx = glGetUniformBlockIndex(mDepthShaderProg, "PassConstants");
+  glUniformBlockBinding(mDepthShaderProg, pcIdx, 1);
+  GLuint ocIdx = glGetUniformBlockIndex(mDepthShaderProg, "ObjectConstants");
+  glUniformBlockBinding(mDepthShaderProg, ocIdx, 3);
 
-  if (pcIdx != GL_INVALID_INDEX)
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+  for (const auto & curr : mDrawList)
     {
-      glUniformBlockBinding(mOverlayPickingShaderProg, pcIdx, 1);
-      mPassConstants->bind(1, 0);
+      scene.objectConstants->bind(3, curr.second);
+      scene.objects[curr.second]->bind();
+      scene.objects[curr.second]->draw();
     }
 
-  GLuint ocIdx = glGetUniformBlockIndex(mOverlayPickingShaderProg,
-                                        "OverlayConstants");
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+  expectNoErrors("Depth pre-pass");
+  mGpuTimer->end();
+}
+
+void dmp::Renderer::drawSkybox(const Scene & scene)
+{
+  expect("skybox not null", scene.skybox);
+
+  mGpuTimer->begin("skybox");
+
+  glDepthMask(GL_FALSE);
+  glUseProgram(mSkyboxShaderProg);
+  scene.skybox->bind(GL_TEXTURE0, mSkyboxShaderProg);
+  scene.skybox->draw();
+  expectNoErrors("Draw skybox");
+
+  mGpuTimer->end();
+}
+
+void dmp::Renderer::drawSelection(const Scene & scene,
+                                  const RenderOptions & ro)
+{
+  if (scene.selected < 0) return;
+  auto i = (size_t) scene.selected;
+
+  ShaderVariant variant;
+  variant.drawMode = drawNormals;
+  variant.textured = false;
+  GLuint shaderProg = mBasicShaders->get(variant);
+
+  mGpuTimer->begin("selection");
+
+  glUseProgram(shaderProg);
+
+  GLuint pcIdx = glGetUniformBlockIndex(shaderProg, "PassConstants");
+  glUniformBlockBinding(shaderProg, pcIdx, 1);
+  GLuint mcIdx = glGetUniformBlockIndex(shaderProg, "MaterialConstants");
+  glUniformBlockBinding(shaderProg, mcIdx, 2);
+  GLuint ocIdx = glGetUniformBlockIndex(shaderProg, "ObjectConstants");
+  glUniformBlockBinding(shaderProg, ocIdx, 3);
+
+  // its edges, coloured by normal, pulled towards the camera so they win
+  // the depth test against the faces already drawn
+  glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+  glEnable(GL_POLYGON_OFFSET_LINE);
+  glPolygonOffset(-1.0f, -1.0f);
+
+  scene.objectConstants->bind(3, i);
+  scene.objects[i]->bind();
+  scene.objects[i]->draw();
 
-  if (ocIdx != GL_INVALID_INDEX)
+  glDisable(GL_POLYGON_OFFSET_LINE);
+  glPolygonMode(GL_FRONT_AND_BACK, ro.drawWireframe ? GL_LINE : GL_FILL);
+
+  expectNoErrors("Draw selection");
+  mGpuTimer->end();
+}
+
+void dmp::Renderer::drawCrowds(const Scene & scene,
+                               const PassConstants & pc,
+                               const RenderOptions & ro)
+{
+  if (scene.crowds.empty()) return;
+
+  mGpuTimer->begin("crowds");
+
+  auto variant = basicVariant(ro, pc.numLights);
+  variant.skinned = true;
+  GLuint shaderProg = mBasicShaders->get(variant);
+  glUseProgram(shaderProg);
+
+  GLuint pcIdx = glGetUniformBlockIndex(shaderProg, "PassConstants");
+  glUniformBlockBinding(shaderProg, pcIdx, 1);
+  GLuint mcIdx = glGetUniformBlockIndex(shaderProg, "MaterialConstants");
+  glUniformBlockBinding(shaderProg, mcIdx, 2);
+  mLightClusters->bind(GL_TEXTURE1, shaderProg);
+
+  // crowds aren't in the depth pre-pass, so they lay down their own
+  glDepthMask(GL_TRUE);
+
+  for (const auto & curr : scene.crowds)
     {
-      glUniformBlockBinding(mOverlayPickingShaderProg, ocIdx, 2);
+      if (curr->visible() == 0) continue;
+
+      scene.materialConstants->bind(2, curr->materialIndex());
+
+      GLuint tex = *scene.textures[curr->textureIndex()];
+      if (scene.residency) scene.residency->touch(tex);
+
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, tex);
+      glUniform1i(glGetUniformLocation(shaderProg, "tex"),
+                  texUnitAsInt(GL_TEXTURE0));
+
+      // after the light clusters' three
+      curr->draw(GL_TEXTURE4, shaderProg);
+      mTrianglesDrawn += curr->numTriangles() * curr->visible();
     }
 
-  glUseProgram(mOverlayPickingShaderProg);
+  expectNoErrors("Crowd pass");
+  mGpuTimer->end();
+}
 
-  for (size_t i = 0; i < scene.overlays.size(); ++i)
-    {
-      scene.overlayConstants->bind(2, i);
+void dmp::Renderer::drawParticles(const Scene & scene)
+{
+  if (scene.emitters.empty()) return;
+
+  mGpuTimer->begin("particles");
 
-      expectNoErrors("Set Overlay uniforms");
+  glUseProgram(mParticleShaderProg);
+  GLuint pcIdx = glGetUniformBlockIndex(mParticleShaderProg, "PassConstants");
+  glUniformBlockBinding(mParticleShaderProg, pcIdx, 1);
 
-      scene.overlays[i].draw();
+  // Blended additively, which doesn't depend on order, so particles are
+  // never sorted. They're tested against the depth of what's behind them
+  // but don't write it, so as not to hide each other
+  glDepthMask(GL_FALSE);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+  auto sizes = glGetUniformLocation(mParticleShaderProg, "sizes");
+  auto startColor = glGetUniformLocation(mParticleShaderProg, "startColor");
+  auto endColor = glGetUniformLocation(mParticleShaderProg, "endColor");
+  for (const auto & curr : scene.emitters)
+    {
+      const auto & params = curr->params();
+      glUniform2f(sizes, params.startSize, params.endSize);
+      glUniform4f(startColor,
+                  params.startColor[0],
+                  params.startColor[1],
+                  params.startColor[2],
+                  params.startColor[3]);
+      glUniform4f(endColor,
+                  params.endColor[0],
+                  params.endColor[1],
+                  params.endColor[2],
+                  params.endColor[3]);
+      curr->draw();
     }
 
-  expectNoErrors("Finished drawing picking colors");
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  expectNoErrors("Particle pass");
+
+  mGpuTimer->end();
+}
+
+dmp::Ray dmp::Renderer::unproject(float ndcX, float ndcY) const
+{
+  expect("Frame rendered prior to unproject", mHasPassConstants);
 
-  Image pix(x, y, 1, 1);
+  auto nearH = mLastPassConstants.invPV * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+  auto farH = mLastPassConstants.invPV * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+  auto nearP = glm::vec3(nearH) / nearH.w;
+  auto farP = glm::vec3(farH) / farH.w;
 
-  return static_cast<int>(pix.data[0]);
+  return {nearP, glm::normalize(farP - nearP)};
 }
@@ -5,6 +5,13 @@
 #include <glm/glm.hpp>
 #include "Scene.hpp"
 #include "Renderer/Shader.hpp"
+#include "Renderer/ShaderVariants.hpp"
+#include "Renderer/Pass.hpp"
+#include "Renderer/OverlayBatch.hpp"
+#include "Renderer/LightClusters.hpp"
+#include "Renderer/GpuTimer.hpp"
+#include "Renderer/RenderTarget.hpp"
+#include "Renderer/ResolutionController.hpp"
 #include "Timer.hpp"
 
 namespace dmp
@@ -14,6 +21,27 @@ namespace dmp
     bool drawWireframe = false;
     bool drawNormals = false;
     bool drawOverlays = false;
+    bool drawTextures = true;
+
+    // Pass ordering. The pre-pass lays down depth with color writes off so
+    // that shading runs once per pixel. Sorting draws opaque objects front
+    // to back, and with the pre-pass off lets the depth test reject hidden
+    // fragments early. Drawn last, the skybox is only shaded where nothing
+    // covers it
+    bool depthPrepass = true;
+    bool sortFrontToBack = true;
+    bool skyboxLast = true;
+
+    // The scene is drawn offscreen at a scale of the window's resolution
+    // and stretched to fit; overlays are always drawn at full resolution.
+    // With dynamicResolution the scale follows GPU frame time, otherwise
+    // it is fixedRenderScale, for benchmarking
+    bool dynamicResolution = true;
+    float fixedRenderScale = 1.0f;
+
+    // Objects with levels of detail draw the coarsest one that looks the
+    // same from where they are. Off, they always draw the finest
+    bool lod = true;
   };
 
   class Renderer
@@ -33,19 +61,67 @@ namespace dmp
                 const Timer & timer,
                 const RenderOptions & ro);
 
-    int pick(const Scene & scene, const RenderOptions & ro, int x, int y);
+    // world space ray through a point in normalized device coordinates,
+    // using the view and projection of the last rendered frame
+    Ray unproject(float ndcX, float ndcY) const;
+
+    // call when texture contents have been replaced, for example when
+    // asynchronous loads land
+    void texturesChanged() {mOverlayBatch->invalidate();}
+
+    // GPU time spent in each pass of recent frames
+    const GpuTimer & gpuTimer() const {return *mGpuTimer;}
+
+    // fraction of the window's resolution the last frame was drawn at
+    float renderScale() const {return mRenderScale;}
+
+    // triangles in the last frame's draw list, at the levels of detail
+    // drawn, and of the crowd members drawn
+    size_t trianglesDrawn() const {return mTrianglesDrawn;}
+
+    // what the last frame was drawn with, or null before the first
+    const PassConstants * lastPassConstants() const
+    {
+      return mHasPassConstants ? &mLastPassConstants : nullptr;
+    }
   private:
     void initRenderer();
-    void loadShaders(const std::string shaderFile,
-                     Shader & shaderProg);
     void initPassConstants();
+    void buildDrawList(const Scene & scene,
+                       const PassConstants & pc,
+                       const RenderOptions & ro);
+    void drawDepthPrepass(const Scene & scene);
+    void drawSkybox(const Scene & scene);
+    void drawSelection(const Scene & scene, const RenderOptions & ro);
+    void drawCrowds(const Scene & scene,
+                    const PassConstants & pc,
+                    const RenderOptions & ro);
+    void drawParticles(const Scene & scene);
+    static ShaderVariant basicVariant(const RenderOptions & ro,
+                                      GLuint numLights);
 
     glm::mat4 mP;
-    Shader mShaderProg;
+    std::unique_ptr<ShaderVariants> mBasicShaders;
+    Shader mDepthShaderProg;
+    Shader mSkyboxShaderProg;
     Shader mOverlayShaderProg;
-    Shader mOverlayPickingShaderProg;
+    Shader mParticleShaderProg;
 
     std::unique_ptr<UniformBuffer> mPassConstants;
+    std::unique_ptr<OverlayBatch> mOverlayBatch;
+    std::unique_ptr<LightClusters> mLightClusters;
+    std::unique_ptr<GpuTimer> mGpuTimer;
+    std::unique_ptr<RenderTarget> mSceneTarget;
+    ResolutionController mResolution = {targetGpuFrameMs,
+                                        minRenderScale,
+                                        maxRenderScale};
+    float mRenderScale = 1.0f;
+    size_t mTrianglesDrawn = 0;
+
+    // visible objects as (view depth, index into Scene::objects)
+    std::vector<std::pair<float, size_t>> mDrawList;
+    PassConstants mLastPassConstants = {};
+    bool mHasPassConstants = false;
 
     GLsizei mWidth;
     GLsizei mHeight;
@@ -0,0 +1,141 @@
+#include "GpuTimer.hpp"
+
+#include <cstring>
+#include <iomanip>
+#include <glm/glm.hpp>
+#include "../util.hpp"
+
+namespace
+{
+  // weight of the newest sample in each pass's running average
+  const float smoothing = 0.1f;
+}
+
+dmp::GpuTimer::~GpuTimer()
+{
+  for (auto & frame : mFrames)
+    {
+      for (auto & curr : frame) mFreeQueries.push_back(curr.id);
+    }
+
+  if (!mFreeQueries.empty())
+    {
+      glDeleteQueries((GLsizei) mFreeQueries.size(), mFreeQueries.data());
+    }
+}
+
+void dmp::GpuTimer::frame()
+{
+  expect("GPU timer pass ended before frame", !mActive);
+
+  ++mFrameCount;
+  mCurrFrame = (mCurrFrame + 1) % latency;
+  collect(mFrames[mCurrFrame]);
+}
+
+void dmp::GpuTimer::collect(std::vector<Query> & frame)
+{
+  for (auto & curr : frame)
+    {
+      // still not done after latency frames means the GPU is far behind;
+      // drop the sample rather than wait for it
+      GLint available = GL_FALSE;
+      glGetQueryObjectiv(curr.id, GL_QUERY_RESULT_AVAILABLE, &available);
+
+      if (available)
+        {
+          GLuint64 ns = 0;
+          glGetQueryObjectui64v(curr.id, GL_QUERY_RESULT, &ns);
+          // a pass back from being stale starts its average over
+          auto & pass = mPasses[curr.pass];
+          pass.ms = stale(pass)
+            ? (float) ns / 1.0e6f
+            : glm::mix(pass.ms, (float) ns / 1.0e6f, smoothing);
+          pass.sampled = mFrameCount;
+        }
+
+      mFreeQueries.push_back(curr.id);
+    }
+
+  frame.clear();
+  expectNoErrors("Collect GPU timer queries");
+}
+
+size_t dmp::GpuTimer::passIndex(const char * pass)
+{
+  for (size_t i = 0; i < mPasses.size(); ++i)
+    {
+      if (std::strcmp(mPasses[i].name.c_str(), pass) == 0) return i;
+    }
+
+  mPasses.push_back({pass, 0.0f, true, 0});
+  return mPasses.size() - 1;
+}
+
+GLuint dmp::GpuTimer::newQuery()
+{
+  if (mFreeQueries.empty())
+    {
+      GLuint id;
+      glGenQueries(1, &id);
+      return id;
+    }
+
+  auto id = mFreeQueries.back();
+  mFreeQueries.pop_back();
+  return id;
+}
+
+void dmp::GpuTimer::begin(const char * pass, bool scaled)
+{
+  expect("GPU timer passes do not nest", !mActive);
+
+  auto query = Query{newQuery(), passIndex(pass)};
+  mPasses[query.pass].scaled = scaled;
+  mFrames[mCurrFrame].push_back(query);
+  glBeginQuery(GL_TIME_ELAPSED, query.id);
+  mActive = true;
+}
+
+void dmp::GpuTimer::end()
+{
+  expect("GPU timer pass begun", mActive);
+
+  glEndQuery(GL_TIME_ELAPSED);
+  mActive = false;
+}
+
+bool dmp::GpuTimer::stale(const Pass & pass) const
+{
+  return pass.sampled == 0 || mFrameCount - pass.sampled > latency;
+}
+
+float dmp::GpuTimer::totalMs() const
+{
+  float total = 0.0f;
+  for (const auto & curr : mPasses)
+    {
+      if (!stale(curr)) total += curr.ms;
+    }
+  return total;
+}
+
+float dmp::GpuTimer::scaledMs() const
+{
+  float total = 0.0f;
+  for (const auto & curr : mPasses)
+    {
+      if (curr.scaled && !stale(curr)) total += curr.ms;
+    }
+  return total;
+}
+
+void dmp::GpuTimer::printStats(std::ostream & out) const
+{
+  out << std::fixed << std::setprecision(3) << "GPU: ";
+  for (const auto & curr : mPasses)
+    {
+      if (!stale(curr)) out << curr.name << " " << curr.ms << " ms, ";
+    }
+  out << "total " << totalMs() << " ms" << std::endl;
+}
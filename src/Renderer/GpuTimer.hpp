@@ -0,0 +1,79 @@
+#ifndef DMP_GPUTIMER_HPP
+#define DMP_GPUTIMER_HPP
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <GL/glew.h>
+
+namespace dmp
+{
+  // Measures how long the GPU spends on each named pass with
+  // GL_TIME_ELAPSED queries. Results are read back a few frames late so
+  // that reading them never waits on the GPU, and are smoothed over recent
+  // frames
+  class GpuTimer
+  {
+  public:
+    struct Pass
+    {
+      std::string name;
+      float ms;
+
+      // drawn at the render scale, and the frame its last sample was
+      // read back on
+      bool scaled;
+      size_t sampled;
+    };
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer & operator=(const GpuTimer &) = delete;
+
+    GpuTimer() = default;
+    ~GpuTimer();
+
+    // call once at the start of each frame, before the first pass
+    void frame();
+
+    // time the GL commands issued between begin and end. Passes cannot
+    // nest, since only one GL_TIME_ELAPSED query can be active at a time.
+    // A pass is scaled if it draws at the render scale rather than at the
+    // window's size
+    void begin(const char * pass, bool scaled = true);
+    void end();
+
+    // passes in the order they were first timed
+    const std::vector<Pass> & passes() const {return mPasses;}
+
+    // A pass is stale if it has not been sampled in the last latency
+    // frames, as when it is no longer drawn. Totals leave those out, and
+    // scaledMs the passes that are not scaled too
+    bool stale(const Pass & pass) const;
+    float totalMs() const;
+    float scaledMs() const;
+    void printStats(std::ostream & out) const;
+
+  private:
+    struct Query
+    {
+      GLuint id;
+      size_t pass;
+    };
+
+    // frames of queries in flight before the oldest is read back
+    static const size_t latency = 4;
+
+    void collect(std::vector<Query> & frame);
+    size_t passIndex(const char * pass);
+    GLuint newQuery();
+
+    std::vector<Query> mFrames[latency];
+    std::vector<GLuint> mFreeQueries;
+    std::vector<Pass> mPasses;
+    size_t mCurrFrame = 0;
+    size_t mFrameCount = 0;
+    bool mActive = false;
+  };
+}
+
+#endif
@@ -0,0 +1,301 @@
+#include "LightClusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include "../util.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static_assert(dmp::maxPointLights <= 0x10000,
+              "point light indices are stored in 16 bits");
+static_assert(dmp::clusterGridX % 4 == 0,
+              "clusters are tested four at a time along x");
+
+namespace
+{
+  const size_t numClusters = dmp::clusterGridX
+    * dmp::clusterGridY
+    * dmp::clusterGridZ;
+
+  // each buffer is sized for the worst case up front, so its texture never
+  // needs to be pointed at new storage
+  const GLsizeiptr capacity[3] = {
+    (GLsizeiptr) (dmp::maxPointLights * 2 * sizeof(glm::vec4)),
+    (GLsizeiptr) (numClusters * sizeof(glm::uvec2)),
+    (GLsizeiptr) (numClusters * dmp::maxLightsPerCluster * sizeof(uint16_t))
+  };
+
+  // Bit i of the result is set if the sphere at c with radius r touches
+  // box i of the four starting at each of min and max
+  int touchesFour(const float * minX, const float * minY, const float * minZ,
+                  const float * maxX, const float * maxY, const float * maxZ,
+                  const glm::vec3 & c,
+                  float r)
+  {
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    auto axis = [&](const float * lo, const float * hi, float p)
+      {
+        __m128 pp = _mm_set1_ps(p);
+        __m128 below = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(lo), pp), zero);
+        __m128 above = _mm_max_ps(_mm_sub_ps(pp, _mm_loadu_ps(hi)), zero);
+        __m128 d = _mm_add_ps(below, above);
+        return _mm_mul_ps(d, d);
+      };
+
+    __m128 distSq = _mm_add_ps(axis(minX, maxX, c.x),
+                               _mm_add_ps(axis(minY, maxY, c.y),
+                                          axis(minZ, maxZ, c.z)));
+    return _mm_movemask_ps(_mm_cmple_ps(distSq, _mm_set1_ps(r * r)));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; ++i)
+      {
+        auto axis = [](float lo, float hi, float p)
+          {
+            float d = std::max(lo - p, 0.0f) + std::max(p - hi, 0.0f);
+            return d * d;
+          };
+
+        float distSq = axis(minX[i], maxX[i], c.x)
+          + axis(minY[i], maxY[i], c.y)
+          + axis(minZ[i], maxZ[i], c.z);
+        if (distSq <= r * r) mask |= 1 << i;
+      }
+    return mask;
+#endif
+  }
+}
+
+dmp::LightClusters::LightClusters()
+{
+  initLightClusters();
+}
+
+dmp::LightClusters::~LightClusters()
+{
+  glDeleteTextures(3, mTextures);
+  glDeleteBuffers(3, mBuffers);
+}
+
+void dmp::LightClusters::initLightClusters()
+{
+  mMinX.resize(numClusters);
+  mMinY.resize(numClusters);
+  mMinZ.resize(numClusters);
+  mMaxX.resize(numClusters);
+  mMaxY.resize(numClusters);
+  mMaxZ.resize(numClusters);
+  mBins.resize(numClusters * maxLightsPerCluster);
+  mCounts.resize(numClusters);
+  mGrid.resize(numClusters);
+
+  glGenBuffers(3, mBuffers);
+  glGenTextures(3, mTextures);
+
+  const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+
+  for (int i = 0; i < 3; ++i)
+    {
+      glBindBuffer(GL_TEXTURE_BUFFER, mBuffers[i]);
+      glBufferData(GL_TEXTURE_BUFFER, capacity[i], nullptr, GL_STREAM_DRAW);
+      glBindTexture(GL_TEXTURE_BUFFER, mTextures[i]);
+      glTexBuffer(GL_TEXTURE_BUFFER, formats[i], mBuffers[i]);
+    }
+
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  expectNoErrors("Init light clusters");
+}
+
+void dmp::LightClusters::initBounds(const glm::mat4 & P,
+                                    float near,
+                                    float far)
+{
+  mBoundsP = P;
+  mBoundsNear = near;
+  mBoundsFar = far;
+
+  float logRatio = std::log(far / near);
+  mSliceParams = glm::vec2((float) clusterGridZ / logRatio,
+                           (float) clusterGridZ * std::log(near) / logRatio);
+
+  // view space x at depth d and NDC x is ndc * d / P[0][0], likewise y
+  float invSX = 1.0f / P[0][0];
+  float invSY = 1.0f / P[1][1];
+
+  for (size_t z = 0; z < clusterGridZ; ++z)
+    {
+      float dNear = near * std::pow(far / near,
+                                    (float) z / (float) clusterGridZ);
+      float dFar = near * std::pow(far / near,
+                                   (float) (z + 1) / (float) clusterGridZ);
+
+      for (size_t y = 0; y < clusterGridY; ++y)
+        {
+          float ndcY0 = -1.0f + 2.0f * (float) y / (float) clusterGridY;
+          float ndcY1 = -1.0f + 2.0f * (float) (y + 1) / (float) clusterGridY;
+
+          for (size_t x = 0; x < clusterGridX; ++x)
+            {
+              float ndcX0 = -1.0f + 2.0f * (float) x / (float) clusterGridX;
+              float ndcX1 = -1.0f
+                + 2.0f * (float) (x + 1) / (float) clusterGridX;
+
+              // the tile's edges fan out with depth, so the box spans the
+              // extremes of its near and far faces
+              size_t idx = x + clusterGridX * (y + clusterGridY * z);
+              mMinX[idx] = std::min(ndcX0 * dNear, ndcX0 * dFar) * invSX;
+              mMaxX[idx] = std::max(ndcX1 * dNear, ndcX1 * dFar) * invSX;
+              mMinY[idx] = std::min(ndcY0 * dNear, ndcY0 * dFar) * invSY;
+              mMaxY[idx] = std::max(ndcY1 * dNear, ndcY1 * dFar) * invSY;
+              mMinZ[idx] = -dFar;
+              mMaxZ[idx] = -dNear;
+            }
+        }
+    }
+}
+
+size_t dmp::LightClusters::slice(float depth) const
+{
+  float s = std::floor(std::log(depth) * mSliceParams.x - mSliceParams.y);
+  return (size_t) glm::clamp(s, 0.0f, (float) (clusterGridZ - 1));
+}
+
+void dmp::LightClusters::build(const std::vector<PointLight> & lights,
+                               const glm::mat4 & V,
+                               const glm::mat4 & P,
+                               float near,
+                               float far)
+{
+  expect("point light count within maxPointLights",
+         lights.size() <= maxPointLights);
+
+  if (P != mBoundsP || near != mBoundsNear || far != mBoundsFar)
+    {
+      initBounds(P, near, far);
+    }
+
+  std::fill(mCounts.begin(), mCounts.end(), 0);
+  mLightData.clear();
+  mStats = Stats();
+
+  for (const auto & curr : lights)
+    {
+      glm::vec4 world = curr.M * curr.pos;
+      glm::vec3 view = glm::vec3(V * world);
+      float depth = -view.z;
+      float r = curr.radius;
+
+      if (depth + r < near || depth - r > far) continue;
+
+      auto light = (uint16_t) (mLightData.size() / 2);
+      bool touched = false;
+
+      size_t z0 = slice(std::max(depth - r, near));
+      size_t z1 = slice(std::min(depth + r, far));
+
+      for (size_t z = z0; z <= z1; ++z)
+        {
+          for (size_t y = 0; y < clusterGridY; ++y)
+            {
+              size_t row = clusterGridX * (y + clusterGridY * z);
+              for (size_t x = 0; x < clusterGridX; x += 4)
+                {
+                  size_t first = row + x;
+                  int mask = touchesFour(&mMinX[first], &mMinY[first],
+                                         &mMinZ[first], &mMaxX[first],
+                                         &mMaxY[first], &mMaxZ[first],
+                                         view, r);
+
+                  for (size_t i = 0; mask != 0; ++i, mask >>= 1)
+                    {
+                      if ((mask & 1) == 0) continue;
+
+                      // the light's index is only claimed once it lands in
+                      // a cluster, so that culled lights take no space
+                      if (!touched)
+                        {
+                          mLightData.push_back(glm::vec4(glm::vec3(world),
+                                                         r));
+                          mLightData.push_back(curr.color);
+                          touched = true;
+                        }
+
+                      auto & count = mCounts[first + i];
+                      if (count == maxLightsPerCluster)
+                        {
+                          ++mStats.dropped;
+                          continue;
+                        }
+                      mBins[(first + i) * maxLightsPerCluster + count] = light;
+                      ++count;
+                    }
+                }
+            }
+        }
+    }
+
+  mStats.lights = mLightData.size() / 2;
+
+  mIndices.clear();
+  for (size_t i = 0; i < numClusters; ++i)
+    {
+      auto count = mCounts[i];
+      mGrid[i] = glm::uvec2((GLuint) mIndices.size(), count);
+      mStats.busiest = std::max(mStats.busiest, (size_t) count);
+
+      auto bin = mBins.begin() + (ptrdiff_t) (i * maxLightsPerCluster);
+      mIndices.insert(mIndices.end(), bin, bin + count);
+    }
+  mStats.references = mIndices.size();
+
+  upload();
+}
+
+void dmp::LightClusters::upload()
+{
+  const std::pair<const GLvoid *, GLsizeiptr> data[3] = {
+    {mLightData.data(),
+     (GLsizeiptr) (mLightData.size() * sizeof(glm::vec4))},
+    {mGrid.data(), (GLsizeiptr) (mGrid.size() * sizeof(glm::uvec2))},
+    {mIndices.data(), (GLsizeiptr) (mIndices.size() * sizeof(uint16_t))}
+  };
+
+  for (int i = 0; i < 3; ++i)
+    {
+      glBindBuffer(GL_TEXTURE_BUFFER, mBuffers[i]);
+      // orphan last frame's contents rather than wait for draws reading them
+      glBufferData(GL_TEXTURE_BUFFER, capacity[i], nullptr, GL_STREAM_DRAW);
+      if (data[i].second > 0)
+        {
+          glBufferSubData(GL_TEXTURE_BUFFER, 0, data[i].second, data[i].first);
+        }
+    }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  expectNoErrors("Upload light clusters");
+}
+
+void dmp::LightClusters::bind(GLenum firstUnit, GLuint shaderProg) const
+{
+  const char * const samplers[3] = {
+    "pointLights",
+    "clusterGrid",
+    "clusterLights"
+  };
+
+  for (GLenum i = 0; i < 3; ++i)
+    {
+      glActiveTexture(firstUnit + i);
+      glBindTexture(GL_TEXTURE_BUFFER, mTextures[i]);
+      glUniform1i(glGetUniformLocation(shaderProg, samplers[i]),
+                  (GLint) (firstUnit + i - GL_TEXTURE0));
+    }
+
+  expectNoErrors("Bind light clusters");
+}
@@ -0,0 +1,92 @@
+#ifndef DMP_LIGHTCLUSTERS_HPP
+#define DMP_LIGHTCLUSTERS_HPP
+
+#include <vector>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "../config.hpp"
+#include "../Scene/Types.hpp"
+
+namespace dmp
+{
+  // Clustered forward lighting. Each frame, build bins the point lights into
+  // a clusterGridX by clusterGridY by clusterGridZ grid over the view
+  // frustum and streams the result to three buffer textures:
+  //
+  //   pointLights    RGBA32F, two texels per light: world space position
+  //                  and radius, then color
+  //   clusterGrid    RG32UI, one texel per cluster: first index into
+  //                  clusterLights and light count
+  //   clusterLights  R16UI, light indices grouped by cluster
+  //
+  // Clusters are numbered x + clusterGridX * (y + clusterGridY * z), with x
+  // and y tiling the screen and z the depth slice
+  class LightClusters
+  {
+  public:
+    struct Stats
+    {
+      size_t lights = 0;     // lights touching the view frustum
+      size_t references = 0; // light indices across every cluster
+      size_t busiest = 0;    // most lights in any one cluster
+      size_t dropped = 0;    // lights past maxLightsPerCluster in a cluster
+    };
+
+    LightClusters(const LightClusters &) = delete;
+    LightClusters & operator=(const LightClusters &) = delete;
+
+    LightClusters();
+    ~LightClusters();
+
+    // P must be a symmetric perspective projection, such as
+    // glm::perspective, with these near and far planes
+    void build(const std::vector<PointLight> & lights,
+               const glm::mat4 & V,
+               const glm::mat4 & P,
+               float near,
+               float far);
+
+    // depth slice of a fragment at view depth d (positive, in front of the
+    // camera) is floor(log(d) * x - y)
+    glm::vec2 sliceParams() const {return mSliceParams;}
+    GLuint numLights() const {return (GLuint) mStats.lights;}
+
+    // binds the buffer textures to firstUnit and the two units after it,
+    // and points shaderProg's samplers at them. shaderProg must be in use
+    void bind(GLenum firstUnit, GLuint shaderProg) const;
+
+    const Stats & stats() const {return mStats;}
+
+  private:
+    void initLightClusters();
+    void initBounds(const glm::mat4 & P, float near, float far);
+    size_t slice(float depth) const;
+    void upload();
+
+    // view space bounds of every cluster, one array per component so that
+    // four neighbouring clusters along x can be tested at once
+    std::vector<float> mMinX, mMinY, mMinZ;
+    std::vector<float> mMaxX, mMaxY, mMaxZ;
+    glm::mat4 mBoundsP;
+    float mBoundsNear = 0.0f;
+    float mBoundsFar = 0.0f;
+    glm::vec2 mSliceParams;
+
+    // maxLightsPerCluster slots per cluster, filled light by light, then
+    // packed into mIndices
+    std::vector<uint16_t> mBins;
+    std::vector<uint32_t> mCounts;
+
+    std::vector<glm::vec4> mLightData;
+    std::vector<glm::uvec2> mGrid;
+    std::vector<uint16_t> mIndices;
+
+    GLuint mBuffers[3] = {0, 0, 0};
+    GLuint mTextures[3] = {0, 0, 0};
+
+    Stats mStats;
+  };
+}
+
+#endif
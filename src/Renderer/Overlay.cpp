@@ -1,119 +1,100 @@
 #include "Overlay.hpp"
 
+#include <utility>
+
+size_t dmp::Overlay::currGeneration = 0;
+
 dmp::Overlay::Overlay(float x,
                       float y,
                       float width,
                       float height,
-                      int id,
-                      Texture & tex)
+                      uint32_t id,
+                      TextureHandle tex)
 {
-  initOverlay(x, y, width, height, static_cast<int32_t>(id), tex);
+  initOverlay(x, y, width, height, id, tex);
 }
 
 dmp::Overlay::Overlay(float x,
                       float y,
                       float width,
                       float height,
-                      Texture & tex)
+                      TextureHandle tex)
+{
+  initOverlay(x, y, width, height, noOverlayID, tex);
+}
+
+dmp::Overlay::Overlay(Overlay && other)
 {
-  initOverlay(x, y, width, height, 255, tex);
+  *this = std::move(other);
+}
+
+dmp::Overlay & dmp::Overlay::operator=(Overlay && other)
+{
+  mTexture = std::move(other.mTexture);
+  mID = other.mID;
+  mX = other.mX;
+  mY = other.mY;
+  mWidth = other.mWidth;
+  mHeight = other.mHeight;
+  mVisible = other.mVisible;
+  ++currGeneration;
+  return *this;
 }
 
 void dmp::Overlay::initOverlay(float x,
                                float y,
                                float width,
                                float height,
-                               int id,
-                               Texture & tex)
+                               uint32_t id,
+                               TextureHandle tex)
+{
+  expect("Overlay has a texture", tex);
+
+  mTexture = tex;
+  mID = id;
+  setPosition(x, y);
+  setSize(width, height);
+}
+
+void dmp::Overlay::setPosition(float x, float y)
 {
   // enforce invariants
   expect("X within [-1.0, 1.0]",
          x <= 1.0f  && x >= -1.0f);
   expect("Y within [-1.0, 1.0]",
          y <= 1.0f  && y >= -1.0f);
-  expect("Width within [0, 2.0]",
-         width <= 2.0f && width >= 0.0f);
-  expect("Height within [0, 2.0]",
-         height <= 2.0f && height >= 0.0f);
-  expect("ID within [0, 255]",
-         id <= 255 && id >= 0);
-
-  // init the overlay
-  std::vector<OverlayVertex> verts;
-  verts.push_back({{x, y},                  {0.0f, 0.0f}});
-  verts.push_back({{x, y - height},         {0.0f, 1.0f}});
-  verts.push_back({{x + width, y - height}, {1.0f, 1.0f}});
-
-  verts.push_back({{x + width, y - height}, {1.0f, 1.0f}});
-  verts.push_back({{x + width, y},          {1.0f, 0.0f}});
-  verts.push_back({{x, y},                  {0.0f, 0.0f}});
 
-  glGenVertexArrays(1, &mVAO);
-  glGenBuffers(1, &mVBO);
-
-  expectNoErrors("Gen Overlay buffers and Arrays");
-  glBindVertexArray(mVAO);
-
-  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
-  glBufferData(GL_ARRAY_BUFFER,
-               verts.size() * sizeof(OverlayVertex),
-               verts.data(),
-               GL_STATIC_DRAW);
-
-  expectNoErrors("Upload Overlay vertex data");
-
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0,
-                        2,
-                        GL_FLOAT,
-                        GL_FALSE,
-                        sizeof(OverlayVertex),
-                        (GLvoid *) 0);
-
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1,
-                        2,
-                        GL_FLOAT,
-                        GL_FALSE,
-                        sizeof(OverlayVertex),
-                        (GLvoid *) offsetof(OverlayVertex, texCoords));
-
-  expectNoErrors("Set Overlay vertex attributes");
-
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
-
-  mTexture = std::move(tex);
-  mID = id;
-
-  expectNoErrors("Complete Overlay init");
-  mValid = true;
+  mX = x;
+  mY = y;
+  ++currGeneration;
 }
 
-dmp::OverlayConstants dmp::Overlay::getOverlayConstants() const
+void dmp::Overlay::setSize(float width, float height)
 {
-  OverlayConstants oc;
-  oc.overlayID = mID;
-  return oc;
-}
+  expect("Width within [0, 2.0]",
+         width <= 2.0f && width >= 0.0f);
+  expect("Height within [0, 2.0]",
+         height <= 2.0f && height >= 0.0f);
 
-void dmp::Overlay::draw() const
-{
-  expect("Overlay valid", mValid);
-  if (!mVisible) return;
-  expectNoErrors("Pre-bind overlay");
-  glBindVertexArray(mVAO);
-  expectNoErrors("Bind overlay");
-  glDrawArrays(GL_TRIANGLES,
-               0, Overlay::drawCount);
+  mWidth = width;
+  mHeight = height;
+  ++currGeneration;
 }
 
-void dmp::Overlay::freeOverlay()
+void dmp::Overlay::appendVertices(std::vector<OverlayVertex> & verts,
+                                  glm::vec2 uvMin,
+                                  glm::vec2 uvMax) const
 {
-  if (!mValid) return;
-
-  glDeleteVertexArrays(1, &mVAO);
-  glDeleteBuffers(1, &mVBO);
-
-  mValid = false;
+  auto left = mX;
+  auto right = mX + mWidth;
+  auto top = mY;
+  auto bottom = mY - mHeight;
+
+  verts.push_back({{left, top},      {uvMin.x, uvMin.y}});
+  verts.push_back({{left, bottom},   {uvMin.x, uvMax.y}});
+  verts.push_back({{right, bottom},  {uvMax.x, uvMax.y}});
+
+  verts.push_back({{right, bottom},  {uvMax.x, uvMax.y}});
+  verts.push_back({{right, top},     {uvMax.x, uvMin.y}});
+  verts.push_back({{left, top},      {uvMin.x, uvMin.y}});
 }
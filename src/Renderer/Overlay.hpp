@@ -11,69 +11,88 @@ namespace dmp
   struct OverlayVertex
   {
     glm::vec2 pos;
-    glm::vec2 texCoords;
+    glm::vec2 texCoords; // in the overlay atlas
   };
 
-  struct OverlayConstants
-  {
-    int overlayID;
-
-    static size_t std140Size()
-    {
-      return dmp::std140PadStruct((std140ScalarSize<int>()));
-    }
-
-    operator GLvoid *() {return (GLvoid *) this;}
-  };
+  // ID of overlays that don't respond to clicks
+  static const uint32_t noOverlayID = ~0u;
 
+  // An axis aligned, textured screen rectangle. Overlays own no GL state;
+  // the texture is shared, and OverlayBatch draws all of them at once
   class Overlay
   {
-
-    static const size_t drawCount = 6;
   public:
+    static const size_t vertexCount = 6;
+
     Overlay() = delete;
     Overlay(const Overlay &) = delete;
     Overlay & operator=(const Overlay &) = delete;
-    Overlay(Overlay &&) = default;
-    Overlay & operator=(Overlay &&) = default;
+    Overlay(Overlay && other);
+    Overlay & operator=(Overlay && other);
     ~Overlay() {}
 
     Overlay(float x,
             float y,
             float width,
             float height,
-            int id,
-            Texture & tex);
+            uint32_t id,
+            TextureHandle tex);
 
     Overlay(float x,
             float y,
             float width,
             float height,
-            Texture & tex);
-
-    void freeOverlay();
-    void bind(GLenum texUnit);
-    void draw();
-    OverlayConstants getOverlayConstants() const;
-    void draw() const;
-    bool isDirty() const {return mDirty;}
-    void setClean() {mDirty = false;}
-    GLuint getTexture() const {return mTexture;}
+            TextureHandle tex);
+
+    // appends this overlay's two triangles, mapping its texture onto the
+    // atlas rectangle uvMin to uvMax
+    void appendVertices(std::vector<OverlayVertex> & verts,
+                        glm::vec2 uvMin,
+                        glm::vec2 uvMax) const;
+
+    GLuint getTexture() const {return *mTexture;}
+
+    uint32_t getID() const {return mID;}
+
+    void show() {mVisible = true; ++currGeneration;}
+    void hide() {mVisible = false; ++currGeneration;}
+    bool isVisible() const {return mVisible;}
+
+    // Screen rectangle in normalized device coordinates. x, y is the top
+    // left corner
+    void setPosition(float x, float y);
+    void setSize(float width, float height);
+    float getX() const {return mX;}
+    float getY() const {return mY;}
+    float getWidth() const {return mWidth;}
+    float getHeight() const {return mHeight;}
+
+    bool contains(float x, float y) const
+    {
+      return x >= mX && x <= mX + mWidth
+        && y <= mY && y >= mY - mHeight;
+    }
+
+    // changes whenever any overlay is created, replaced, moved, resized,
+    // shown or hidden, so that OverlayGrid knows to rebuild
+    static size_t generation() {return currGeneration;}
   private:
+    static size_t currGeneration;
+
     void initOverlay(float x,
                      float y,
                      float width,
                      float height,
-                     int aspectRatio,
-                     Texture & tex);
-    bool mValid = false;
-    bool mDirty = true;
+                     uint32_t id,
+                     TextureHandle tex);
 
-    Texture mTexture;
-    int mID = 255;
+    TextureHandle mTexture;
+    uint32_t mID = noOverlayID;
+    float mX;
+    float mY;
+    float mWidth;
+    float mHeight;
     bool mVisible = true;
-    GLuint mVAO;
-    GLuint mVBO;
   };
 }
 #endif
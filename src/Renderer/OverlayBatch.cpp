@@ -0,0 +1,235 @@
+#include "OverlayBatch.hpp"
+
+#include <algorithm>
+#include "../util.hpp"
+
+dmp::OverlayBatch::OverlayBatch()
+{
+  initOverlayBatch();
+}
+
+dmp::OverlayBatch::~OverlayBatch()
+{
+  glDeleteVertexArrays(1, &mVAO);
+  glDeleteBuffers(1, &mVBO);
+  glDeleteFramebuffers(1, &mCopyFBO);
+  if (mAtlas != 0) glDeleteTextures(1, &mAtlas);
+}
+
+void dmp::OverlayBatch::initOverlayBatch()
+{
+  glGenVertexArrays(1, &mVAO);
+  glGenBuffers(1, &mVBO);
+  glGenFramebuffers(1, &mCopyFBO);
+
+  expectNoErrors("Gen overlay batch buffers and arrays");
+
+  glBindVertexArray(mVAO);
+  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0,
+                        2,
+                        GL_FLOAT,
+                        GL_FALSE,
+                        sizeof(OverlayVertex),
+                        (GLvoid *) offsetof(OverlayVertex, pos));
+
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1,
+                        2,
+                        GL_FLOAT,
+                        GL_FALSE,
+                        sizeof(OverlayVertex),
+                        (GLvoid *) offsetof(OverlayVertex, texCoords));
+
+  expectNoErrors("Set overlay batch vertex attributes");
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+void dmp::OverlayBatch::buildAtlas(const std::vector<GLuint> & textures)
+{
+  struct Entry
+  {
+    GLuint tex;
+    GLsizei width;
+    GLsizei height;
+    GLsizei x;
+    GLsizei y;
+  };
+
+  std::vector<Entry> entries;
+  size_t area = 0;
+  GLsizei widest = 0;
+
+  for (auto curr : textures)
+    {
+      Entry e = {curr, 0, 0, 0, 0};
+      glBindTexture(GL_TEXTURE_2D, curr);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &e.width);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &e.height);
+      entries.push_back(e);
+
+      area += (size_t) ((e.width + atlasPadding * 2)
+                        * (e.height + atlasPadding * 2));
+      widest = std::max(widest, e.width + atlasPadding * 2);
+    }
+
+  expectNoErrors("Query overlay texture sizes");
+
+  GLint maxSize;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+  // Shelf packing: tallest first, left to right, starting a new shelf when
+  // a row fills up
+  std::sort(entries.begin(), entries.end(), [](const Entry & l, const Entry & r)
+            {
+              return l.height > r.height;
+            });
+
+  auto atlasWidth = std::max(widest,
+                             (GLsizei) std::ceil(std::sqrt((double) area)));
+  expect("Overlay atlas fits in a texture", atlasWidth <= maxSize);
+
+  GLsizei x = 0;
+  GLsizei y = 0;
+  GLsizei shelfHeight = 0;
+  for (auto & curr : entries)
+    {
+      auto w = curr.width + atlasPadding * 2;
+      auto h = curr.height + atlasPadding * 2;
+      if (x + w > atlasWidth)
+        {
+          x = 0;
+          y += shelfHeight;
+          shelfHeight = 0;
+        }
+      curr.x = x + atlasPadding;
+      curr.y = y + atlasPadding;
+      x += w;
+      shelfHeight = std::max(shelfHeight, h);
+    }
+
+  auto atlasHeight = std::max(y + shelfHeight, 1);
+  atlasWidth = std::max(atlasWidth, 1);
+  expect("Overlay atlas fits in a texture", atlasHeight <= maxSize);
+
+  if (mAtlas == 0) glGenTextures(1, &mAtlas);
+  glBindTexture(GL_TEXTURE_2D, mAtlas);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexImage2D(GL_TEXTURE_2D,
+               0,
+               GL_RGBA,
+               atlasWidth,
+               atlasHeight,
+               0,
+               GL_RGBA,
+               GL_UNSIGNED_BYTE,
+               nullptr);
+
+  expectNoErrors("Allocate overlay atlas");
+
+  // Copy on the GPU: attach each source to a framebuffer and read it into
+  // its place in the atlas
+  GLint prevReadFBO;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prevReadFBO);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, mCopyFBO);
+
+  mRegions.clear();
+  for (const auto & curr : entries)
+    {
+      glFramebufferTexture2D(GL_READ_FRAMEBUFFER,
+                             GL_COLOR_ATTACHMENT0,
+                             GL_TEXTURE_2D,
+                             curr.tex,
+                             0);
+      expect("Overlay atlas copy framebuffer complete",
+             glCheckFramebufferStatus(GL_READ_FRAMEBUFFER)
+             == GL_FRAMEBUFFER_COMPLETE);
+
+      glCopyTexSubImage2D(GL_TEXTURE_2D,
+                          0,
+                          curr.x, curr.y,
+                          0, 0,
+                          curr.width, curr.height);
+
+      // sample texel centers only, so that filtering stays inside the region
+      glm::vec2 size((float) atlasWidth, (float) atlasHeight);
+      AtlasRegion region =
+        {
+          (glm::vec2((float) curr.x, (float) curr.y) + 0.5f) / size,
+          (glm::vec2((float) (curr.x + curr.width),
+                     (float) (curr.y + curr.height)) - 0.5f) / size
+        };
+      mRegions[curr.tex] = region;
+    }
+
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER,
+                         GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D,
+                         0,
+                         0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint) prevReadFBO);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  expectNoErrors("Build overlay atlas");
+
+  mAtlasSources = textures;
+}
+
+void dmp::OverlayBatch::update(const std::vector<Overlay> & overlays)
+{
+  std::vector<GLuint> textures;
+  textures.reserve(overlays.size());
+  for (const auto & curr : overlays)
+    {
+      textures.push_back(curr.getTexture());
+    }
+  std::sort(textures.begin(), textures.end());
+  textures.erase(std::unique(textures.begin(), textures.end()),
+                 textures.end());
+
+  if (textures != mAtlasSources) buildAtlas(textures);
+
+  mVerts.clear();
+  for (const auto & curr : overlays)
+    {
+      if (!curr.isVisible()) continue;
+      const auto & region = mRegions.at(curr.getTexture());
+      curr.appendVertices(mVerts, region.uvMin, region.uvMax);
+    }
+
+  mDrawCount = (GLsizei) mVerts.size();
+  if (mDrawCount == 0) return;
+
+  // orphan last frame's storage rather than waiting for the GPU to finish
+  // reading it
+  auto bytes = (GLsizeiptr) (mVerts.size() * sizeof(OverlayVertex));
+  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+  glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, mVerts.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  expectNoErrors("Stream overlay vertices");
+}
+
+void dmp::OverlayBatch::bind(GLenum texUnit) const
+{
+  expect("Overlay atlas built prior to bind", mAtlas != 0);
+  glActiveTexture(texUnit);
+  glBindTexture(GL_TEXTURE_2D, mAtlas);
+  glBindVertexArray(mVAO);
+  expectNoErrors("Bind overlay batch");
+}
+
+void dmp::OverlayBatch::draw() const
+{
+  if (mDrawCount == 0) return;
+  glDrawArrays(GL_TRIANGLES, 0, mDrawCount);
+  expectNoErrors("Draw overlay batch");
+}
@@ -0,0 +1,63 @@
+#ifndef DMP_OVERLAYBATCH_HPP
+#define DMP_OVERLAYBATCH_HPP
+
+#include <vector>
+#include <map>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Overlay.hpp"
+
+namespace dmp
+{
+  // Draws every visible overlay with a single draw call. Overlay textures
+  // are copied into one atlas, and each frame the overlay quads are written
+  // into one streaming vertex buffer with atlas texture coordinates and
+  // overlay IDs per vertex
+  class OverlayBatch
+  {
+  public:
+    OverlayBatch(const OverlayBatch &) = delete;
+    OverlayBatch & operator=(const OverlayBatch &) = delete;
+
+    OverlayBatch();
+    ~OverlayBatch();
+
+    // rebuilds the atlas if the set of overlay textures changed, then
+    // streams this frame's vertices
+    void update(const std::vector<Overlay> & overlays);
+
+    // texture contents changed under the same names; rebuild the atlas on
+    // the next update
+    void invalidate() {mAtlasSources.clear();}
+
+    bool empty() const {return mDrawCount == 0;}
+    void bind(GLenum texUnit) const;
+    void draw() const;
+
+  private:
+    struct AtlasRegion
+    {
+      glm::vec2 uvMin;
+      glm::vec2 uvMax;
+    };
+
+    void initOverlayBatch();
+    void buildAtlas(const std::vector<GLuint> & textures);
+
+    // texels left empty around each atlas region so that linear filtering
+    // never reads a neighbour
+    static const GLsizei atlasPadding = 1;
+
+    std::vector<GLuint> mAtlasSources;
+    std::map<GLuint, AtlasRegion> mRegions;
+    GLuint mAtlas = 0;
+    GLuint mCopyFBO = 0;
+
+    std::vector<OverlayVertex> mVerts;
+    GLuint mVAO = 0;
+    GLuint mVBO = 0;
+    GLsizei mDrawCount = 0;
+  };
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include "OverlayGrid.hpp"
+
+#include <algorithm>
+
+size_t dmp::OverlayGrid::cellCoord(float ndc)
+{
+  float cell = (ndc + 1.0f) * 0.5f * (float) cellsPerSide;
+  if (cell <= 0.0f) return 0;
+  return std::min(cellsPerSide - 1, (size_t) cell);
+}
+
+void dmp::OverlayGrid::build(const std::vector<Overlay> & overlays)
+{
+  const size_t numCells = cellsPerSide * cellsPerSide;
+
+  // Two passes: count the overlays touching each cell, then fill them in.
+  // Walking overlays in order keeps every cell's list in draw order
+  auto forEachCell = [&](const Overlay & o, auto fn)
+    {
+      auto x0 = cellCoord(o.getX());
+      auto x1 = cellCoord(o.getX() + o.getWidth());
+      auto y0 = cellCoord(o.getY() - o.getHeight());
+      auto y1 = cellCoord(o.getY());
+
+      for (size_t y = y0; y <= y1; ++y)
+        {
+          for (size_t x = x0; x <= x1; ++x)
+            {
+              fn(y * cellsPerSide + x);
+            }
+        }
+    };
+
+  std::vector<uint32_t> counts(numCells, 0);
+  for (const auto & curr : overlays)
+    {
+      forEachCell(curr, [&](size_t cell) {++counts[cell];});
+    }
+
+  mCellStart.assign(numCells + 1, 0);
+  for (size_t i = 0; i < numCells; ++i)
+    {
+      mCellStart[i + 1] = mCellStart[i] + counts[i];
+    }
+
+  mIdxs.resize(mCellStart[numCells]);
+  std::fill(counts.begin(), counts.end(), 0);
+  for (size_t i = 0; i < overlays.size(); ++i)
+    {
+      forEachCell(overlays[i], [&](size_t cell)
+                  {
+                    mIdxs[mCellStart[cell] + counts[cell]] = (uint32_t) i;
+                    ++counts[cell];
+                  });
+    }
+
+  mNumOverlays = overlays.size();
+  mGeneration = Overlay::generation();
+  mBuilt = true;
+}
+
+uint32_t dmp::OverlayGrid::pick(const std::vector<Overlay> & overlays,
+                                float x, float y) const
+{
+  expect("Overlay grid built for overlays", builtFor(overlays));
+
+  if (x < -1.0f || x > 1.0f || y < -1.0f || y > 1.0f) return noOverlayID;
+
+  auto cell = cellCoord(y) * cellsPerSide + cellCoord(x);
+
+  // later overlays are drawn on top of earlier ones
+  for (auto i = mCellStart[cell + 1]; i > mCellStart[cell]; --i)
+    {
+      const auto & curr = overlays[mIdxs[i - 1]];
+      if (curr.isVisible() && curr.contains(x, y)) return curr.getID();
+    }
+
+  return noOverlayID;
+}
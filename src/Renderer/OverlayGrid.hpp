@@ -0,0 +1,52 @@
+#ifndef DMP_OVERLAYGRID_HPP
+#define DMP_OVERLAYGRID_HPP
+
+#include <vector>
+#include <cstdint>
+#include "Overlay.hpp"
+
+namespace dmp
+{
+  // Uniform grid over normalized device coordinates. Each cell lists the
+  // overlays that overlap it in draw order, so a click only has to test the
+  // handful of overlays in one cell, back to front
+  class OverlayGrid
+  {
+  public:
+    static const size_t cellsPerSide = 32;
+
+    OverlayGrid() = default;
+    OverlayGrid(const OverlayGrid &) = delete;
+    OverlayGrid & operator=(const OverlayGrid &) = delete;
+    OverlayGrid(OverlayGrid &&) = default;
+    OverlayGrid & operator=(OverlayGrid &&) = default;
+
+    // false once any overlay has changed since the last build
+    bool builtFor(const std::vector<Overlay> & overlays) const
+    {
+      return mBuilt
+        && mNumOverlays == overlays.size()
+        && mGeneration == Overlay::generation();
+    }
+
+    void build(const std::vector<Overlay> & overlays);
+
+    // ID of the topmost visible overlay containing x, y (in normalized
+    // device coordinates), or noOverlayID if there isn't one
+    uint32_t pick(const std::vector<Overlay> & overlays,
+                  float x,
+                  float y) const;
+
+  private:
+    static size_t cellCoord(float ndc);
+
+    // cell i lists mIdxs[mCellStart[i]] to mIdxs[mCellStart[i + 1]]
+    std::vector<uint32_t> mCellStart;
+    std::vector<uint32_t> mIdxs;
+    size_t mNumOverlays = 0;
+    size_t mGeneration = 0; // Overlay::generation() when built
+    bool mBuilt = false;
+  };
+}
+
+#endif
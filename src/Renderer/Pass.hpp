@@ -17,7 +17,12 @@ namespace dmp
 
     unsigned int numLights;
     unsigned int drawMode;
-    glm::uvec2 numLightsPadding; // barf
+    glm::uvec2 numLightsPadding; // clusterDims is vec4 aligned
+
+    // Clustered point lights, see LightClusters
+    glm::uvec4 clusterDims; // grid x, y and z, then the point light count
+    glm::vec2 clusterSlices; // LightClusters::sliceParams
+    glm::vec2 clusterSlicesPadding; // P is vec4 aligned
 
     glm::mat4 P;
     glm::mat4 invP;
@@ -36,17 +41,41 @@ namespace dmp
     float viewportWidth;
     float viewportHeight;
 
-    static size_t std140Size()
+    static constexpr std::array<std140::Field, 19> layout()
     {
-      return dmp::std140PadStruct((std140VecArraySize<float, 4, maxLights>() * 2) +
-                                  (std140VecSize<unsigned int, 4>()) +
-                                  (std140MatSize<float, 4, 4>() * 6) +
-                                  (std140VecSize<float, 4>()) +
-                                  (std140ScalarSize<float>() * 6));
+      return {{
+          DMP_STD140_ARRAY(PassConstants, Vec4, lightColor, maxLights),
+          DMP_STD140_ARRAY(PassConstants, Vec4, lightDir, maxLights),
+          DMP_STD140_FIELD(PassConstants, Uint, numLights),
+          DMP_STD140_FIELD(PassConstants, Uint, drawMode),
+          DMP_STD140_FIELD(PassConstants, UVec4, clusterDims),
+          DMP_STD140_FIELD(PassConstants, Vec2, clusterSlices),
+          DMP_STD140_FIELD(PassConstants, Mat4, P),
+          DMP_STD140_FIELD(PassConstants, Mat4, invP),
+          DMP_STD140_FIELD(PassConstants, Mat4, V),
+          DMP_STD140_FIELD(PassConstants, Mat4, invV),
+          DMP_STD140_FIELD(PassConstants, Mat4, PV),
+          DMP_STD140_FIELD(PassConstants, Mat4, invPV),
+          DMP_STD140_FIELD(PassConstants, Vec4, E),
+          DMP_STD140_FIELD(PassConstants, Float, nearZ),
+          DMP_STD140_FIELD(PassConstants, Float, farZ),
+          DMP_STD140_FIELD(PassConstants, Float, deltaT),
+          DMP_STD140_FIELD(PassConstants, Float, totalT),
+          DMP_STD140_FIELD(PassConstants, Float, viewportWidth),
+          DMP_STD140_FIELD(PassConstants, Float, viewportHeight)
+        }};
+    }
+
+    static constexpr size_t std140Size()
+    {
+      return std140::blockSize(layout());
     }
 
     operator GLvoid *() {return (GLvoid *) this;}
   };
+
+  static_assert(std140::matches(PassConstants::layout()),
+                "PassConstants members are not at their std140 offsets");
 }
 
 #endif
@@ -0,0 +1,121 @@
+#include "RenderTarget.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include "../util.hpp"
+
+dmp::RenderTarget::RenderTarget(GLsizei width, GLsizei height)
+  : mWidth(width),
+    mHeight(height),
+    mScaledWidth(width),
+    mScaledHeight(height)
+{
+  initRenderTarget();
+}
+
+dmp::RenderTarget::~RenderTarget()
+{
+  freeStorage();
+  glDeleteFramebuffers(1, &mFBO);
+}
+
+void dmp::RenderTarget::initRenderTarget()
+{
+  glGenFramebuffers(1, &mFBO);
+  glGenTextures(1, &mColor);
+  glGenRenderbuffers(1, &mDepth);
+
+  expectNoErrors("Gen render target");
+
+  glBindTexture(GL_TEXTURE_2D, mColor);
+  glTexImage2D(GL_TEXTURE_2D,
+               0,
+               GL_RGBA8,
+               mWidth,
+               mHeight,
+               0,
+               GL_RGBA,
+               GL_UNSIGNED_BYTE,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, mDepth);
+  glRenderbufferStorage(GL_RENDERBUFFER,
+                        GL_DEPTH_COMPONENT24,
+                        mWidth,
+                        mHeight);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+  glFramebufferTexture2D(GL_FRAMEBUFFER,
+                         GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D,
+                         mColor,
+                         0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                            GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER,
+                            mDepth);
+
+  expect("Render target complete",
+         glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  expectNoErrors("Init render target");
+}
+
+void dmp::RenderTarget::freeStorage()
+{
+  glDeleteTextures(1, &mColor);
+  glDeleteRenderbuffers(1, &mDepth);
+  mColor = 0;
+  mDepth = 0;
+}
+
+void dmp::RenderTarget::resize(GLsizei width, GLsizei height)
+{
+  expect("Render target not empty", width > 0 && height > 0);
+
+  if (width == mWidth && height == mHeight) return;
+
+  freeStorage();
+  glDeleteFramebuffers(1, &mFBO);
+
+  mWidth = width;
+  mHeight = height;
+  mScaledWidth = std::min(mScaledWidth, width);
+  mScaledHeight = std::min(mScaledHeight, height);
+  initRenderTarget();
+}
+
+void dmp::RenderTarget::bind(float scale)
+{
+  expect("Render scale in (0, 1]", scale > 0.0f && scale <= 1.0f);
+
+  mScaledWidth = std::max((GLsizei) 1,
+                          (GLsizei) std::lround((float) mWidth * scale));
+  mScaledHeight = std::max((GLsizei) 1,
+                           (GLsizei) std::lround((float) mHeight * scale));
+
+  glBindFramebuffer(GL_FRAMEBUFFER, mFBO);
+  glViewport(0, 0, mScaledWidth, mScaledHeight);
+}
+
+void dmp::RenderTarget::blitToScreen() const
+{
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, mFBO);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, mScaledWidth, mScaledHeight,
+                    0, 0, mWidth, mHeight,
+                    GL_COLOR_BUFFER_BIT,
+                    GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, mWidth, mHeight);
+
+  expectNoErrors("Blit render target");
+}
@@ -0,0 +1,52 @@
+#ifndef DMP_RENDERTARGET_HPP
+#define DMP_RENDERTARGET_HPP
+
+#include <GL/glew.h>
+
+namespace dmp
+{
+  // Offscreen color and depth buffers for drawing the scene at a fraction
+  // of the window's resolution, then stretching it to fill the window.
+  // Storage is allocated at full size, and scaling only changes the region
+  // drawn into, so the scale can change every frame for free
+  class RenderTarget
+  {
+  public:
+    RenderTarget() = delete;
+    RenderTarget(const RenderTarget &) = delete;
+    RenderTarget & operator=(const RenderTarget &) = delete;
+
+    RenderTarget(GLsizei width, GLsizei height);
+    ~RenderTarget();
+
+    // neither may be 0, as for a minimized window; keep the old size then
+    void resize(GLsizei width, GLsizei height);
+
+    // binds for drawing into the lower left scale * size region, and sets
+    // the viewport to it
+    void bind(float scale);
+
+    // size of the region last bound
+    GLsizei width() const {return mScaledWidth;}
+    GLsizei height() const {return mScaledHeight;}
+
+    // stretches the region last bound over the whole default framebuffer,
+    // and leaves the default framebuffer bound
+    void blitToScreen() const;
+
+  private:
+    void initRenderTarget();
+    void freeStorage();
+
+    GLuint mFBO = 0;
+    GLuint mColor = 0;
+    GLuint mDepth = 0;
+
+    GLsizei mWidth;
+    GLsizei mHeight;
+    GLsizei mScaledWidth;
+    GLsizei mScaledHeight;
+  };
+}
+
+#endif
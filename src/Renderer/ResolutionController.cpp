@@ -0,0 +1,28 @@
+#include "ResolutionController.hpp"
+
+#include <cmath>
+#include <glm/glm.hpp>
+
+namespace
+{
+  // fraction of the target either side of it that counts as on target
+  const float deadBand = 0.1f;
+
+  // fraction of the way to the ideal scale moved each frame. The measured
+  // time lags the scale by a few frames, so stepping all the way overshoots
+  const float damping = 0.1f;
+}
+
+float dmp::ResolutionController::update(float gpuMs)
+{
+  if (gpuMs <= 0.0f) return mScale;
+
+  float ratio = mTargetMs / gpuMs;
+  if (std::abs(ratio - 1.0f) < deadBand) return mScale;
+
+  float ideal = mScale * std::sqrt(ratio);
+  mScale = glm::clamp(glm::mix(mScale, ideal, damping),
+                      mMinScale,
+                      mMaxScale);
+  return mScale;
+}
@@ -0,0 +1,36 @@
+#ifndef DMP_RESOLUTIONCONTROLLER_HPP
+#define DMP_RESOLUTIONCONTROLLER_HPP
+
+namespace dmp
+{
+  // Picks the scene's render scale each frame to hold the GPU frame time at
+  // a target. Cost grows with pixel count, the square of the scale, so the
+  // scale heads for the square root of the ratio of target to measured
+  // time. Steps are damped, and times within a dead band of the target are
+  // left alone, so that the scale settles instead of hunting
+  class ResolutionController
+  {
+  public:
+    ResolutionController() = delete;
+
+    ResolutionController(float targetMs, float minScale, float maxScale)
+      : mTargetMs(targetMs),
+        mMinScale(minScale),
+        mMaxScale(maxScale),
+        mScale(maxScale) {}
+
+    // gpuMs is the measured frame time, or 0 before any is known. Returns
+    // the scale to draw the next frame at
+    float update(float gpuMs);
+
+    float scale() const {return mScale;}
+
+  private:
+    float mTargetMs;
+    float mMinScale;
+    float mMaxScale;
+    float mScale;
+  };
+}
+
+#endif
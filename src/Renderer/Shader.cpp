@@ -3,8 +3,23 @@
 #include <utility>
 #include <GL/glew.h>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include "../MappedFile.hpp"
+#include "../Timer.hpp"
+#include "../config.hpp"
 
 std::map<const std::string, std::vector<char>> dmp::Shader::memo;
+std::map<std::string, std::string> dmp::Shader::blocks;
+
+void dmp::Shader::defineBlock(const std::string & name,
+                              const std::string & glsl)
+{
+  blocks[name] = glsl;
+}
 
 std::vector<char> dmp::Shader::loadGLSL(const std::string & path)
 {
@@ -29,7 +44,52 @@ std::vector<char> dmp::Shader::loadGLSL(const std::string & path)
   return bytecodeIter->second;
 }
 
-static GLuint compileShader(std::vector<char> source, GLenum type)
+std::vector<char> dmp::Shader::loadGLSL(const std::string & path,
+                                        const std::string & defines)
+{
+  auto raw = loadGLSL(path);
+  static const std::string version = "#version";
+  static const std::string pragma = "#pragma block ";
+
+  std::string source;
+  source.reserve(raw.size() + defines.size());
+
+  size_t lineStart = 0;
+  while (lineStart < raw.size())
+    {
+      auto eol = std::find(raw.begin() + (std::ptrdiff_t) lineStart,
+                           raw.end(),
+                           '\n');
+      auto lineEnd = (size_t) (eol - raw.begin());
+      std::string line(raw.begin() + (std::ptrdiff_t) lineStart,
+                       raw.begin() + (std::ptrdiff_t) lineEnd);
+      lineStart = lineEnd + 1;
+
+      if (line.compare(0, pragma.size(), pragma) == 0)
+        {
+          auto name = line.substr(pragma.size());
+          auto found = blocks.find(name);
+          if (found == blocks.end())
+            {
+              throw InvariantViolation("Undefined uniform block " + name
+                                       + " in " + path);
+            }
+          source += found->second;
+          continue;
+        }
+
+      source += line + "\n";
+
+      // GLSL wants #version before anything else, so the defines go after it
+      if (line.compare(0, version.size(), version) == 0) source += defines;
+    }
+
+  return std::vector<char>(source.begin(), source.end());
+}
+
+// Starts compiling. The result is only checked by checkShader, so that
+// drivers can compile in the background in the meantime
+static GLuint submitShader(const std::vector<char> & source, GLenum type)
 {
   GLuint id = glCreateShader(type);
 
@@ -38,6 +98,11 @@ static GLuint compileShader(std::vector<char> source, GLenum type)
   glShaderSource(id, 1, &sourcePtr, &sourceLen);
   glCompileShader(id);
 
+  return id;
+}
+
+static void checkShader(GLuint id)
+{
   GLint result = GL_FALSE;
   GLint infoLogLen = 0;
 
@@ -55,8 +120,6 @@ static GLuint compileShader(std::vector<char> source, GLenum type)
 
   expect("GLSL compilation failures",
          result == GL_TRUE);
-
-  return id;
 }
 
 dmp::Shader::Shader(const char * vertPath,
@@ -73,61 +136,93 @@ void dmp::Shader::initShader(const char * vertPath,
                              const char * geomPath,
                              const char * tescPath,
                              const char * tesePath,
-                             const char * fragPath)
+                             const char * fragPath,
+                             const std::string & defines)
 {
-  GLuint vertId = 0;
-  GLuint geomId = 0;
-  GLuint tescId = 0;
-  GLuint teseId = 0;
-  GLuint fragId = 0;
+  auto pending = begin(vertPath, geomPath,
+                       tescPath, tesePath,
+                       fragPath, defines);
+  finish(pending);
+}
 
+dmp::Shader::Pending dmp::Shader::begin(const char * vertPath,
+                                        const char * geomPath,
+                                        const char * tescPath,
+                                        const char * tesePath,
+                                        const char * fragPath,
+                                        const std::string & defines)
+{
+  Pending pending;
+  pending.start = Clock::now();
 
-  if (vertPath)
+  const std::pair<GLenum, const char *> paths[] =
     {
-      auto vertSrc = loadGLSL(vertPath);
-      vertId = compileShader(vertSrc, GL_VERTEX_SHADER);
-      expect("Load vertex shader", vertId != 0);
-    }
-
-  if (geomPath)
+      {GL_VERTEX_SHADER, vertPath},
+      {GL_GEOMETRY_SHADER, geomPath},
+      {GL_TESS_CONTROL_SHADER, tescPath},
+      {GL_TESS_EVALUATION_SHADER, tesePath},
+      {GL_FRAGMENT_SHADER, fragPath}
+    };
+
+  std::vector<Stage> stages;
+  for (const auto & curr : paths)
     {
-      auto geomSrc = loadGLSL(geomPath);
-      geomId = compileShader(geomSrc, GL_GEOMETRY_SHADER);
-      expect("Load geometry shader", geomId != 0);
+      if (!curr.second) continue;
+      stages.push_back({curr.first, loadGLSL(curr.second, defines)});
     }
 
-  if (tescPath)
-    {
-      auto tescSrc = loadGLSL(tescPath);
-      tescId = compileShader(tescSrc, GL_TESS_CONTROL_SHADER);
-      expect("Load tess control shader", tescId != 0);
-    }
+  expect("Shader has at least one stage", !stages.empty());
+  pending.name = vertPath ? vertPath : fragPath ? fragPath : "shader";
+
+  pending.cached = useShaderCache && binariesSupported();
+  pending.key = pending.cached ? programKey(stages) : 0;
 
-  if (tesePath)
+  if (pending.cached && loadBinary(pending.key))
     {
-      auto teseSrc = loadGLSL(tesePath);
-      teseId = compileShader(teseSrc, GL_TESS_EVALUATION_SHADER);
-      expect("Load tess evaluation shader", teseId != 0);
+      pending.fromBinary = true;
+      return pending;
     }
 
-  if (fragPath)
+  for (const auto & curr : stages)
     {
-      auto fragSrc = loadGLSL(fragPath);
-      fragId = compileShader(fragSrc, GL_FRAGMENT_SHADER);
-      expect("Load fragment shader", fragId != 0);
+      pending.stageIds.push_back(submitShader(curr.source, curr.type));
+      expect("Create shader stage", pending.stageIds.back() != 0);
     }
 
   expectNoErrors("Compile shader sources");
 
   mShaderProg = glCreateProgram();
-  if (vertPath) glAttachShader(mShaderProg, vertId);
-  if (geomPath) glAttachShader(mShaderProg, geomId);
-  if (tesePath) glAttachShader(mShaderProg, teseId);
-  if (tescPath) glAttachShader(mShaderProg, tescId);
-  if (fragPath) glAttachShader(mShaderProg, fragId);
+  expect("Create shader program",
+         mShaderProg != 0);
 
+  for (auto id : pending.stageIds) glAttachShader(mShaderProg, id);
+
+  if (pending.cached)
+    {
+      glProgramParameteri(mShaderProg,
+                          GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                          GL_TRUE);
+    }
+
+  // linking doesn't wait for the compiles, the status queries do
   glLinkProgram(mShaderProg);
 
+  return pending;
+}
+
+void dmp::Shader::finish(Pending & pending)
+{
+  if (pending.fromBinary)
+    {
+      ifDebug(std::cerr << "Loaded " << pending.name
+              << " from the program cache in "
+              << Milliseconds(Clock::now() - pending.start).count()
+              << "ms" << std::endl);
+      return;
+    }
+
+  for (auto id : pending.stageIds) checkShader(id);
+
   GLint result = GL_FALSE;
   GLint infoLogLen = 0;
 
@@ -146,18 +241,214 @@ void dmp::Shader::initShader(const char * vertPath,
   expect("GLSL linking failures",
          result == GL_TRUE);
 
-  if (vertPath) glDetachShader(mShaderProg, vertId);
-  if (geomPath) glDetachShader(mShaderProg, geomId);
-  if (tesePath) glDetachShader(mShaderProg, teseId);
-  if (tescPath) glDetachShader(mShaderProg, tescId);
-  if (fragPath) glDetachShader(mShaderProg, fragId);
+  for (auto id : pending.stageIds)
+    {
+      glDetachShader(mShaderProg, id);
+      glDeleteShader(id);
+    }
+  pending.stageIds.clear();
 
-  if (vertPath) glDeleteShader(vertId);
-  if (geomPath) glDeleteShader(geomId);
-  if (tesePath) glDeleteShader(teseId);
-  if (tescPath) glDeleteShader(tescId);
-  if (fragPath) glDeleteShader(fragId);
+  if (pending.cached) saveBinary(pending.key);
 
-  expect("Create shader program",
-         mShaderProg != 0);
+  ifDebug(std::cerr << "Compiled " << pending.name << " in "
+          << Milliseconds(Clock::now() - pending.start).count() << "ms"
+          << std::endl);
+}
+
+bool dmp::Shader::done() const
+{
+  if (!GLEW_KHR_parallel_shader_compile && !GLEW_ARB_parallel_shader_compile)
+    {
+      return true;
+    }
+
+  GLint result = GL_TRUE;
+  glGetProgramiv(mShaderProg, GL_COMPLETION_STATUS_KHR, &result);
+  return result == GL_TRUE;
+}
+
+void dmp::ShaderBatch::add(Shader & shader,
+                           const char * vertPath,
+                           const char * geomPath,
+                           const char * tescPath,
+                           const char * tesePath,
+                           const char * fragPath,
+                           const std::string & defines)
+{
+  // let the driver use as many threads as it likes. Without either
+  // extension, drivers may still compile asynchronously on their own
+  static bool threadsSet = false;
+  if (!threadsSet)
+    {
+      if (GLEW_KHR_parallel_shader_compile)
+        {
+          glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+        }
+      else if (GLEW_ARB_parallel_shader_compile)
+        {
+          glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+        }
+      threadsSet = true;
+    }
+
+  if (mPending.empty())
+    {
+      mStart = Clock::now();
+      mAdded = 0;
+    }
+  ++mAdded;
+
+  mPending.push_back({&shader,
+                      shader.begin(vertPath, geomPath,
+                                   tescPath, tesePath,
+                                   fragPath, defines)});
+}
+
+void dmp::ShaderBatch::add(Shader & shader,
+                           const std::string & name,
+                           const std::string & defines)
+{
+  auto vertName = name + ".vert";
+  auto fragName = name + ".frag";
+  add(shader,
+      vertName.c_str(),
+      nullptr, nullptr, nullptr,
+      fragName.c_str(),
+      defines);
+}
+
+void dmp::ShaderBatch::finish()
+{
+  // finish whichever programs are ready first, so their binaries get saved
+  // while the rest are still compiling. Without the extension, done()
+  // is always true and this is just submission order
+  while (!mPending.empty())
+    {
+      auto ready = std::find_if(mPending.begin(),
+                                mPending.end(),
+                                [](const Entry & curr)
+                                {
+                                  return curr.first->done();
+                                });
+
+      if (ready == mPending.end())
+        {
+          std::this_thread::yield();
+          continue;
+        }
+
+      ready->first->finish(ready->second);
+      mPending.erase(ready);
+    }
+
+  ifDebug(if (mAdded > 0)
+            {
+              std::cerr << "Built " << mAdded << " shader program(s) in "
+                        << Milliseconds(Clock::now() - mStart).count()
+                        << "ms" << std::endl;
+            });
+  mAdded = 0;
+}
+
+bool dmp::Shader::binariesSupported()
+{
+  // some drivers (macOS among them) expose the API but no formats
+  static GLint numFormats = -1;
+  if (numFormats < 0) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+  return numFormats > 0;
+}
+
+uint64_t dmp::Shader::programKey(const std::vector<Stage> & stages)
+{
+  // a binary is only good for the exact driver that produced it
+  uint64_t key = hashBytes(nullptr, 0);
+  for (GLenum str : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+      auto value = reinterpret_cast<const char *>(glGetString(str));
+      if (value) key = hashBytes(value, std::strlen(value), key);
+    }
+
+  for (const auto & curr : stages)
+    {
+      key = hashBytes(&curr.type, sizeof(curr.type), key);
+      key = hashBytes(curr.source.data(), curr.source.size(), key);
+    }
+
+  return key;
+}
+
+std::string dmp::Shader::binaryPath(uint64_t key)
+{
+  std::ostringstream name;
+  name << shaderCacheDir << "/"
+       << std::hex << std::setw(16) << std::setfill('0') << key
+       << ".dmpprog";
+  return name.str();
+}
+
+bool dmp::Shader::loadBinary(uint64_t key)
+{
+  MappedFile file(binaryPath(key));
+  if (!file.valid() || file.size() < sizeof(BinaryHeader)) return false;
+
+  auto header = reinterpret_cast<const BinaryHeader *>(file.data());
+  if (header->magic != binaryMagic
+      || header->key != key
+      || header->length != file.size() - sizeof(BinaryHeader))
+    {
+      return false;
+    }
+
+  mShaderProg = glCreateProgram();
+  glProgramBinary(mShaderProg,
+                  header->format,
+                  file.data() + sizeof(BinaryHeader),
+                  (GLsizei) header->length);
+
+  // a driver update can leave the strings alone but still refuse the
+  // binary. Clear whatever error that raised and compile instead
+  GLint result = GL_FALSE;
+  glGetProgramiv(mShaderProg, GL_LINK_STATUS, &result);
+  while (glGetError() != GL_NO_ERROR) {}
+
+  if (result == GL_TRUE) return true;
+
+  ifDebug(std::cerr << "Driver rejected cached program binary "
+          << binaryPath(key) << ", recompiling" << std::endl);
+  glDeleteProgram(mShaderProg);
+  mShaderProg = 0;
+  return false;
+}
+
+void dmp::Shader::saveBinary(uint64_t key)
+{
+  GLint length = 0;
+  glGetProgramiv(mShaderProg, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+
+  std::vector<unsigned char> file(sizeof(BinaryHeader) + (size_t) length);
+  BinaryHeader header = {binaryMagic, 0, key, (uint32_t) length, 0};
+
+  GLenum format = 0;
+  glGetProgramBinary(mShaderProg,
+                     length,
+                     nullptr,
+                     &format,
+                     file.data() + sizeof(BinaryHeader));
+  expectNoErrors("Get program binary");
+
+  header.format = format;
+  std::memcpy(file.data(), &header, sizeof(header));
+
+  // the cache only saves time, so failing to write it isn't fatal
+  try
+    {
+      makeDirectories(shaderCacheDir);
+      writeFileAtomic(binaryPath(key), file.data(), file.size());
+    }
+  catch (const std::exception & e)
+    {
+      ifDebug(std::cerr << "Failed to save program binary: " << e.what()
+              << std::endl);
+    }
 }
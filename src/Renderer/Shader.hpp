@@ -4,11 +4,15 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <cstdint>
 #include <GL/glew.h>
 #include "../util.hpp"
+#include "../Timer.hpp"
 
 namespace dmp
 {
+  class ShaderBatch;
+
   class Shader
   {
   public:
@@ -34,16 +38,119 @@ namespace dmp
         }
     }
 
+    // Source lines reading "#pragma block name" are replaced by glsl,
+    // usually a uniform block declaration from std140::glslBlock. Must be
+    // called before any shader using the block is built
+    static void defineBlock(const std::string & name,
+                            const std::string & glsl);
+
+    // defines is inserted into every stage right after its #version line
     void initShader(const char * vertPath,
                     const char * geomPath,
                     const char * tescPath,
                     const char * tesePath,
-                    const char * fragPath);
+                    const char * fragPath,
+                    const std::string & defines = "");
   private:
+    friend class ShaderBatch;
+
+    // a program that has been submitted but not yet checked
+    struct Pending
+    {
+      std::string name;
+      uint64_t key = 0;
+      bool cached = false;     // save to or load from the binary cache
+      bool fromBinary = false; // nothing to check, it was already linked
+      std::vector<GLuint> stageIds;
+      TimePoint start;
+    };
+
+    // begin issues the compiles and link, finish waits for and checks them
+    Pending begin(const char * vertPath,
+                  const char * geomPath,
+                  const char * tescPath,
+                  const char * tesePath,
+                  const char * fragPath,
+                  const std::string & defines);
+    void finish(Pending & pending);
+
+    // false while the driver is still compiling in the background
+    bool done() const;
+
+    struct Stage
+    {
+      GLenum type;
+      std::vector<char> source;
+    };
+
+    // Layout of a cached program binary file: this header, then length
+    // bytes of binary in the driver's format
+    struct BinaryHeader
+    {
+      uint32_t magic;
+      uint32_t format;
+      uint64_t key;
+      uint32_t length;
+      uint32_t padding;
+    };
+
+    static const uint32_t binaryMagic = 0x50504D44; // "DMPP"
+
     static std::map<const std::string, std::vector<char>> memo;
+    static std::map<std::string, std::string> blocks;
     static std::vector<char> loadGLSL(const std::string & path);
+    static std::vector<char> loadGLSL(const std::string & path,
+                                      const std::string & defines);
+
+    // Programs linked from source are saved to shaderCacheDir as binaries,
+    // keyed by their sources and the driver. Later runs load the binary
+    // instead, falling back to source if the driver won't take it
+    static bool binariesSupported();
+    static uint64_t programKey(const std::vector<Stage> & stages);
+    static std::string binaryPath(uint64_t key);
+    bool loadBinary(uint64_t key);
+    void saveBinary(uint64_t key);
+
     GLuint mShaderProg = 0;
   };
+
+  // Builds several Shaders together. Every compile and link is issued before
+  // any result is asked for, so drivers that compile in the background, or
+  // on several threads with KHR/ARB_parallel_shader_compile, can overlap
+  // them. The Shaders are not usable until finish returns
+  class ShaderBatch
+  {
+  public:
+    ShaderBatch() = default;
+    ShaderBatch(const ShaderBatch &) = delete;
+    ShaderBatch & operator=(const ShaderBatch &) = delete;
+
+    void add(Shader & shader,
+             const char * vertPath,
+             const char * geomPath,
+             const char * tescPath,
+             const char * tesePath,
+             const char * fragPath,
+             const std::string & defines = "");
+
+    // name.vert and name.frag
+    void add(Shader & shader,
+             const std::string & name,
+             const std::string & defines = "");
+
+    // Wait for everything added so far. Throws on the first program that
+    // failed to compile or link
+    void finish();
+
+  private:
+    using Entry = std::pair<Shader *, Shader::Pending>;
+
+    std::vector<Entry> mPending;
+
+    // when the first of the mAdded programs still pending was added
+    TimePoint mStart;
+    size_t mAdded = 0;
+  };
 }
 
 
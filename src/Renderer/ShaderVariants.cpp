@@ -0,0 +1,46 @@
+#include "ShaderVariants.hpp"
+
+#include <iostream>
+#include "Pass.hpp"
+#include "../util.hpp"
+#include "../config.hpp"
+
+std::string dmp::ShaderVariant::defines() const
+{
+  expect("Variant light count within maxLights", numLights <= maxLights);
+
+  std::string res = "#define NUM_LIGHTS " + std::to_string(numLights) + "\n";
+  if (drawMode == drawNormals) res += "#define DRAW_NORMALS\n";
+  if (textured) res += "#define TEXTURED\n";
+  if (skinned) res += "#define SKINNED\n";
+  return res;
+}
+
+void dmp::ShaderVariants::prepare(ShaderBatch & batch,
+                                  const ShaderVariant & variant)
+{
+  auto & prog = mPrograms[variant];
+  if (prog) return;
+
+  prog = std::make_unique<Shader>();
+  batch.add(*prog, mName, variant.defines());
+}
+
+const dmp::Shader & dmp::ShaderVariants::get(const ShaderVariant & variant)
+{
+  auto found = mPrograms.find(variant);
+  if (found != mPrograms.end()) return *found->second;
+
+  ifDebug(std::cerr << "Compiling " << mName << " variant:\n"
+          << variant.defines() << std::flush);
+
+  auto prog = std::make_unique<Shader>();
+  auto vertName = mName + ".vert";
+  auto fragName = mName + ".frag";
+  prog->initShader(vertName.c_str(),
+                   nullptr, nullptr, nullptr,
+                   fragName.c_str(),
+                   variant.defines());
+
+  return *(mPrograms[variant] = std::move(prog));
+}
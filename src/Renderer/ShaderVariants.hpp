@@ -0,0 +1,61 @@
+#ifndef DMP_SHADERVARIANTS_HPP
+#define DMP_SHADERVARIANTS_HPP
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <GL/glew.h>
+#include "Shader.hpp"
+
+namespace dmp
+{
+  // Everything that picks a compile time permutation of a shader. Each
+  // field becomes a #define, so the shader branches at compile time rather
+  // than on uniforms
+  struct ShaderVariant
+  {
+    GLuint drawMode = 0;  // drawShaded or drawNormals, see Pass.hpp
+    GLuint numLights = 0; // up to maxLights
+    bool textured = true;
+    bool skinned = false; // posed by joint palettes, see Crowd
+
+    std::string defines() const;
+
+    bool operator<(const ShaderVariant & other) const
+    {
+      return std::tie(drawMode, numLights, textured, skinned)
+        < std::tie(other.drawMode,
+                   other.numLights,
+                   other.textured,
+                   other.skinned);
+    }
+  };
+
+  // All the variants of one pair of shader files, name.vert and name.frag.
+  // A variant is compiled the first time it is asked for, unless it was
+  // added to a ShaderBatch up front. Compiled variants go through the
+  // program binary cache like any other Shader
+  class ShaderVariants
+  {
+  public:
+    ShaderVariants() = delete;
+    ShaderVariants(const ShaderVariants &) = delete;
+    ShaderVariants & operator=(const ShaderVariants &) = delete;
+
+    ShaderVariants(const std::string & name) : mName(name) {}
+
+    // compile variant along with the rest of batch
+    void prepare(ShaderBatch & batch, const ShaderVariant & variant);
+
+    const Shader & get(const ShaderVariant & variant);
+
+    size_t size() const {return mPrograms.size();}
+
+  private:
+    std::string mName;
+    std::map<ShaderVariant, std::unique_ptr<Shader>> mPrograms;
+  };
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef DMP_STD140_HPP
+#define DMP_STD140_HPP
+
+#include <array>
+#include <string>
+#include <cstddef>
+
+// Describe a member of a uniform block struct. _type is a std140::Type
+// enumerator, _member the name of both the C++ member and the GLSL field
+#ifndef DMP_STD140_FIELD
+#define DMP_STD140_FIELD(_struct, _type, _member)                       \
+  dmp::std140::Field {dmp::std140::Type::_type, #_member, 0,            \
+      offsetof(_struct, _member)}
+#else
+#error DMP_STD140_FIELD already defined!
+#endif
+
+#ifndef DMP_STD140_ARRAY
+#define DMP_STD140_ARRAY(_struct, _type, _member, _count)               \
+  dmp::std140::Field {dmp::std140::Type::_type, #_member, (_count),     \
+      offsetof(_struct, _member)}
+#else
+#error DMP_STD140_ARRAY already defined!
+#endif
+
+namespace dmp
+{
+  // Compile time std140 layout. A uniform block struct lists its fields in
+  // a constexpr layout(); from that come the std140 offsets and block size,
+  // checked against the C++ struct with static_assert, and the GLSL
+  // declaration that shaders pull in with "#pragma block Name"
+  namespace std140
+  {
+    enum class Type {Float, Int, Uint, Vec2, Vec3, Vec4, UVec2, UVec4, Mat3, Mat4};
+
+    struct Field
+    {
+      Type type;
+      const char * name;
+      size_t count;     // array length, 0 if not an array
+      size_t cppOffset; // offsetof the C++ member
+    };
+
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT is at most 256 on every
+    // implementation, so elements this far apart can be bound anywhere
+    static const size_t maxOffsetAlignment = 256;
+
+    constexpr size_t alignUp(size_t n, size_t align)
+    {
+      return (n + align - 1) / align * align;
+    }
+
+    constexpr size_t baseSize(Type t)
+    {
+      switch (t)
+        {
+        case Type::Float:
+        case Type::Int:
+        case Type::Uint:
+          return 4;
+        case Type::Vec2:
+        case Type::UVec2:
+          return 8;
+        case Type::Vec3:
+          return 12;
+        case Type::Vec4:
+        case Type::UVec4:
+          return 16;
+        case Type::Mat3:
+          return 3 * 16; // columns are padded to vec4
+        case Type::Mat4:
+          return 4 * 16;
+        }
+      return 0;
+    }
+
+    constexpr size_t baseAlignment(Type t)
+    {
+      switch (t)
+        {
+        case Type::Float:
+        case Type::Int:
+        case Type::Uint:
+          return 4;
+        case Type::Vec2:
+        case Type::UVec2:
+          return 8;
+        default:
+          return 16;
+        }
+    }
+
+    // array elements are rounded up to vec4 alignment
+    constexpr size_t alignment(const Field & f)
+    {
+      return f.count > 0
+        ? alignUp(baseAlignment(f.type), 16)
+        : baseAlignment(f.type);
+    }
+
+    constexpr size_t size(const Field & f)
+    {
+      return f.count > 0
+        ? alignUp(baseSize(f.type), 16) * f.count
+        : baseSize(f.type);
+    }
+
+    template <size_t N>
+    constexpr size_t offset(const std::array<Field, N> & fields, size_t i)
+    {
+      size_t off = 0;
+      for (size_t j = 0; j < i; ++j)
+        {
+          off = alignUp(off, alignment(fields[j])) + size(fields[j]);
+        }
+      return alignUp(off, alignment(fields[i]));
+    }
+
+    // the block's size is rounded up to the alignment of a vec4
+    template <size_t N>
+    constexpr size_t blockSize(const std::array<Field, N> & fields)
+    {
+      return alignUp(offset(fields, N - 1) + size(fields[N - 1]), 16);
+    }
+
+    // distance between consecutive elements of an array of blocks in one
+    // uniform buffer
+    template <size_t N>
+    constexpr size_t stride(const std::array<Field, N> & fields)
+    {
+      return alignUp(blockSize(fields), maxOffsetAlignment);
+    }
+
+    // true if every C++ member sits at its std140 offset
+    template <size_t N>
+    constexpr bool matches(const std::array<Field, N> & fields)
+    {
+      for (size_t i = 0; i < N; ++i)
+        {
+          if (fields[i].cppOffset != offset(fields, i)) return false;
+        }
+      return true;
+    }
+
+    inline const char * glslType(Type t)
+    {
+      switch (t)
+        {
+        case Type::Float: return "float";
+        case Type::Int: return "int";
+        case Type::Uint: return "uint";
+        case Type::Vec2: return "vec2";
+        case Type::Vec3: return "vec3";
+        case Type::Vec4: return "vec4";
+        case Type::UVec2: return "uvec2";
+        case Type::UVec4: return "uvec4";
+        case Type::Mat3: return "mat3";
+        case Type::Mat4: return "mat4";
+        }
+      return "";
+    }
+
+    template <size_t N>
+    std::string glslBlock(const std::string & name,
+                          const std::array<Field, N> & fields)
+    {
+      std::string res = "layout (std140) uniform " + name + "\n{\n";
+      for (const auto & curr : fields)
+        {
+          res += std::string("  ") + glslType(curr.type) + " " + curr.name;
+          if (curr.count > 0) res += "[" + std::to_string(curr.count) + "]";
+          res += ";\n";
+        }
+      res += "};\n";
+      return res;
+    }
+  }
+}
+
+#endif
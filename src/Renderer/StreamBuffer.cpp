@@ -0,0 +1,149 @@
+#include "StreamBuffer.hpp"
+
+#include <algorithm>
+#include "../util.hpp"
+
+namespace
+{
+  // how long each wait on a region's fence may block before checking
+  // again, in nanoseconds
+  const GLuint64 fenceTimeout = 1000000;
+
+  const std::pair<size_t, size_t> noBytes = {0, 0};
+}
+
+dmp::StreamBuffer::StreamBuffer(GLuint buffer,
+                                GLenum target,
+                                size_t regionBytes,
+                                size_t numRegions,
+                                const void * initial)
+  : mBuffer(buffer),
+    mTarget(target),
+    mRegionBytes(regionBytes),
+    mFences(numRegions, nullptr),
+    mStale(numRegions, noBytes)
+{
+  expect("Stream buffer has regions", numRegions > 0);
+  initStreamBuffer(initial);
+}
+
+dmp::StreamBuffer::~StreamBuffer()
+{
+  for (auto curr : mFences)
+    {
+      if (curr) glDeleteSync(curr);
+    }
+}
+
+void dmp::StreamBuffer::initStreamBuffer(const void * initial)
+{
+  glBindBuffer(mTarget, mBuffer);
+  glBufferData(mTarget,
+               (GLsizeiptr) (mRegionBytes * mFences.size()),
+               nullptr,
+               GL_STREAM_DRAW);
+
+  if (initial)
+    {
+      for (size_t i = 0; i < mFences.size(); ++i)
+        {
+          glBufferSubData(mTarget,
+                          (GLintptr) (i * mRegionBytes),
+                          (GLsizeiptr) mRegionBytes,
+                          initial);
+        }
+    }
+
+  expectNoErrors("Init stream buffer");
+}
+
+void * dmp::StreamBuffer::map(size_t offset, size_t bytes)
+{
+  expect("Stream buffer write within a region",
+         offset <= mRegionBytes && bytes <= mRegionBytes - offset);
+  expect("Stream buffer write not empty", bytes > 0);
+
+  auto numRegions = mFences.size();
+  auto prev = mCurr;
+  auto next = (mCurr + 1) % numRegions;
+
+  glBindBuffer(mTarget, mBuffer);
+
+  // next missed what was written since it was last written; take that
+  // from prev, except where this write covers it
+  auto stale = mStale[next];
+  std::pair<size_t, size_t> keep[2] =
+    {
+      {stale.first, std::min(stale.second, offset)},
+      {std::max(stale.first, offset + bytes), stale.second}
+    };
+  if (numRegions > 1 && (keep[0].first < keep[0].second
+                         || keep[1].first < keep[1].second))
+    {
+      glBindBuffer(GL_COPY_READ_BUFFER, mBuffer);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+      for (const auto & curr : keep)
+        {
+          if (curr.first >= curr.second) continue;
+          glCopyBufferSubData(GL_COPY_READ_BUFFER,
+                              GL_COPY_WRITE_BUFFER,
+                              (GLintptr) (prev * mRegionBytes + curr.first),
+                              (GLintptr) (next * mRegionBytes + curr.first),
+                              (GLsizeiptr) (curr.second - curr.first));
+        }
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+  // every draw that could read the region being left has been issued, and
+  // so have the copies out of it above, which its fence must cover too
+  if (mFences[prev]) glDeleteSync(mFences[prev]);
+  mFences[prev] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  // The copies into next are queued behind the draws still reading it, so
+  // only the CPU has to wait for those. With one region, next is prev and
+  // this waits on the fence just made
+  if (mFences[next])
+    {
+      auto res = glClientWaitSync(mFences[next], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+      if (res == GL_TIMEOUT_EXPIRED) ++mStalls;
+      while (res == GL_TIMEOUT_EXPIRED)
+        {
+          res = glClientWaitSync(mFences[next], 0, fenceTimeout);
+        }
+      expect("Wait on stream buffer fence", res != GL_WAIT_FAILED);
+
+      glDeleteSync(mFences[next]);
+      mFences[next] = nullptr;
+    }
+
+  mStale[next] = noBytes;
+  for (size_t i = 0; i < numRegions; ++i)
+    {
+      if (i == next) continue;
+      auto & curr = mStale[i];
+      if (curr.first >= curr.second) curr = {offset, offset + bytes};
+      curr.first = std::min(curr.first, offset);
+      curr.second = std::max(curr.second, offset + bytes);
+    }
+
+  mCurr = next;
+
+  // the copies above only touch bytes outside the mapping, and the GPU is
+  // done with the rest of next, so there is nothing to synchronize with
+  auto res = glMapBufferRange(mTarget,
+                              (GLintptr) (next * mRegionBytes + offset),
+                              (GLsizeiptr) bytes,
+                              GL_MAP_WRITE_BIT
+                              | GL_MAP_INVALIDATE_RANGE_BIT
+                              | GL_MAP_UNSYNCHRONIZED_BIT);
+  expectNoErrors("Map stream buffer");
+  return res;
+}
+
+void dmp::StreamBuffer::unmap()
+{
+  glBindBuffer(mTarget, mBuffer);
+  glUnmapBuffer(mTarget);
+  expectNoErrors("Unmap stream buffer");
+}
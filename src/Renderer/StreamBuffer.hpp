@@ -0,0 +1,68 @@
+#ifndef DMP_STREAMBUFFER_HPP
+#define DMP_STREAMBUFFER_HPP
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <GL/glew.h>
+
+namespace dmp
+{
+  // A ring of numRegions copies of some data the CPU rewrites often, such
+  // as the vertices of a mesh deformed every frame, all in one buffer.
+  // Each write goes to the region after the one being drawn, which the GPU
+  // finished reading numRegions - 1 writes ago, so writes map it write
+  // only and unsynchronized instead of waiting on the draws in flight. A
+  // fence per region catches the GPU falling that far behind.
+  //
+  // Writes may cover part of a region. The rest of it is brought up to
+  // date by a copy on the GPU from the region before, so neither the CPU
+  // nor the driver ever reads the buffer back
+  class StreamBuffer
+  {
+  public:
+    StreamBuffer() = delete;
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer & operator=(const StreamBuffer &) = delete;
+
+    // gives buffer, which the caller keeps owning, storage for numRegions
+    // regions of regionBytes each, all starting as initial
+    StreamBuffer(GLuint buffer,
+                 GLenum target,
+                 size_t regionBytes,
+                 size_t numRegions,
+                 const void * initial);
+    ~StreamBuffer();
+
+    // Moves to the next region and maps bytes [offset, offset + bytes) of
+    // it, at least one, for writing. The mapping's contents are undefined,
+    // so every byte of it must be written before unmap. Leaves buffer
+    // bound to target
+    void * map(size_t offset, size_t bytes);
+    void unmap();
+
+    // what draws should read, the region last written
+    size_t region() const {return mCurr;}
+    size_t regionBytes() const {return mRegionBytes;}
+
+    // maps that found the GPU still reading the region they were after
+    size_t stalls() const {return mStalls;}
+
+  private:
+    void initStreamBuffer(const void * initial);
+
+    GLuint mBuffer;
+    GLenum mTarget;
+    size_t mRegionBytes;
+
+    // per region, the fence after the last draw that could read it, and
+    // the bytes written since it was last written, as [first, last)
+    std::vector<GLsync> mFences;
+    std::vector<std::pair<size_t, size_t>> mStale;
+
+    size_t mCurr = 0;
+    size_t mStalls = 0;
+  };
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include "Texture.hpp"
 
 #include "../util.hpp"
+#include "../config.hpp"
+#include "TextureCache.hpp"
 
 #include <iostream>
 
@@ -20,26 +22,47 @@ void dmp::Texture::initTexture(const std::string & path)
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   expectNoErrors("texture filtering");
 
-  if (path != "")
+  if (path != "" && useTextureCache)
     {
-      mImage = Image(path);
+      // every level is already in the file; nothing to decode or generate
+      auto cooked = TextureCache::fetch(path, Image::REQUESTED_CHANNELS);
+
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      cooked.upload(GL_TEXTURE_2D, cooked.pixels());
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+      glTexParameteri(GL_TEXTURE_2D,
+                      GL_TEXTURE_MAX_LEVEL,
+                      (GLint) cooked.header().numLevels - 1);
+      expectNoErrors("upload cooked texture");
     }
+  else
+    {
+      Image img;
+      if (path != "")
+        {
+          img = Image(path);
+        }
 
-  // TODO: gracefully handle the possibility that Image might not be RGBA
-  glTexImage2D(GL_TEXTURE_2D,
-               0, // generating mipmaps
-               GL_RGBA, // forced an alpha channel (TODO)
-               (GLsizei) mImage.width,
-               (GLsizei) mImage.height,
-               0, // should always be zero because "legacy"
-               GL_RGBA, // (TODO?)
-               GL_UNSIGNED_BYTE,
-               mImage.data.data());
+      // TODO: gracefully handle the possibility that Image might not be RGBA
+      glTexImage2D(GL_TEXTURE_2D,
+                   0, // generating mipmaps
+                   GL_RGBA, // forced an alpha channel (TODO)
+                   (GLsizei) img.width,
+                   (GLsizei) img.height,
+                   0, // should always be zero because "legacy"
+                   GL_RGBA, // (TODO?)
+                   GL_UNSIGNED_BYTE,
+                   img.data.get());
 
-  expectNoErrors("generate texture");
+      expectNoErrors("generate texture");
 
-  glGenerateMipmap(GL_TEXTURE_2D);
-  expectNoErrors("generate mipmaps");
+      // GL owns a copy now. Only hang on to ours if asked to
+      if (retainTextureImages) mImage = img;
+
+      glGenerateMipmap(GL_TEXTURE_2D);
+      expectNoErrors("generate mipmaps");
+    }
 
   glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -47,6 +70,46 @@ void dmp::Texture::initTexture(const std::string & path)
   mValid = true;
 }
 
+void dmp::Texture::initCubemap(const std::vector<std::string> & faces,
+                               AssetLoader & loader)
+{
+  expect("Cube map has six faces", faces.size() == 6);
+
+  mTarget = GL_TEXTURE_CUBE_MAP;
+  glGenTextures(1, &mTexId);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, mTexId);
+  expectNoErrors("gen and bind cubemap");
+
+  const unsigned char white[3] = {0xFF, 0xFF, 0xFF};
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (size_t i = 0; i < faces.size(); ++i)
+    {
+      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + ((GLenum)i),
+                   0,
+                   GL_RGB,
+                   1,
+                   1,
+                   0,
+                   GL_RGB,
+                   GL_UNSIGNED_BYTE,
+                   white);
+    }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  expectNoErrors("Load placeholder cubemap images");
+
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  expectNoErrors("cubemap parameters");
+
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+  loader.loadCubemap(mTexId, faces);
+  mValid = true;
+}
+
 void dmp::Texture::freeTexture()
 {
   expect("texture valid prior to delete", mValid);
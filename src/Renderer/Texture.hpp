@@ -2,9 +2,12 @@
 #define DMP_TEXTURE_HPP
 
 #include <string>
+#include <vector>
+#include <memory>
 #include <GL/glew.h>
 #include "../util.hpp"
 #include "../Image.hpp"
+#include "../AssetLoader.hpp"
 
 namespace dmp
 {
@@ -22,6 +25,21 @@ namespace dmp
       initTexture(path);
     }
 
+    // Starts out as the default 1x1 white image and is filled in by loader
+    // once path has been decoded
+    Texture(std::string & path, AssetLoader & loader)
+    {
+      initTexture("");
+      if (path != "") loader.loadTexture(mTexId, path);
+    }
+
+    // A cube map from six face images, +X, -X, +Y, -Y, +Z, -Z. Every face
+    // starts out white and is filled in by loader
+    Texture(const std::vector<std::string> & faces, AssetLoader & loader)
+    {
+      initCubemap(faces, loader);
+    }
+
     ~Texture() {}
 
     void freeTexture();
@@ -32,18 +50,54 @@ namespace dmp
       return mTexId;
     }
 
+    // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+    GLenum target() const {return mTarget;}
+
+    // CPU side pixels, only kept if retainTextureImages is set and the
+    // texture was decoded rather than loaded from the texture cache.
+    // Otherwise this is the 1x1 default image
+    const Image & getImage() const {return mImage;}
+
   private:
     void initTexture(const std::string &);
+    void initCubemap(const std::vector<std::string> & faces,
+                     AssetLoader & loader);
 
     Image mImage;
     GLuint mTexId = 0;
+    GLenum mTarget = GL_TEXTURE_2D;
     bool mValid = false;
     size_t mWidth;
     size_t mHeight;
     size_t mComponents;
   };
 
+  // Shared reference to a texture owned by an AssetCache. The texture is
+  // freed when the last handle to it goes away
+  using TextureHandle = std::shared_ptr<const Texture>;
+
   inline GLuint texUnitAsInt(GLenum t) {return t - GL_TEXTURE0;}
+
+  // levels in a full mip chain down to 1x1
+  inline size_t mipLevelCount(size_t width, size_t height)
+  {
+    size_t levels = 1;
+    for (auto size = std::max(width, height); size > 1; size /= 2) ++levels;
+    return levels;
+  }
+
+  // bytes in a full mip chain of tightly packed texels
+  inline size_t mipChainBytes(size_t width, size_t height, size_t channels)
+  {
+    size_t bytes = 0;
+    for (size_t i = 0; i < mipLevelCount(width, height); ++i)
+      {
+        bytes += std::max<size_t>(1, width >> i)
+          * std::max<size_t>(1, height >> i)
+          * channels;
+      }
+    return bytes;
+  }
 }
 
 #endif
@@ -0,0 +1,292 @@
+#include "TextureCache.hpp"
+
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <sys/stat.h>
+#include "../Image.hpp"
+#include "../util.hpp"
+#include "../config.hpp"
+
+static_assert(sizeof(dmp::CookedTexture::Header) == 48,
+              "CookedTexture::Header has no padding");
+static_assert(sizeof(dmp::CookedTexture::Level) == 24,
+              "CookedTexture::Level has no padding");
+
+namespace
+{
+  // level pixels start on this boundary within the file
+  const size_t levelAlignment = 16;
+
+  size_t alignUp(size_t n, size_t align)
+  {
+    return (n + align - 1) / align * align;
+  }
+
+  // 2x2 box filter. Odd edges reuse their last row or column
+  void downsample(const unsigned char * src,
+                  size_t srcWidth,
+                  size_t srcHeight,
+                  unsigned char * dst,
+                  size_t dstWidth,
+                  size_t dstHeight,
+                  size_t channels)
+  {
+    for (size_t y = 0; y < dstHeight; ++y)
+      {
+        auto row0 = src + std::min(2 * y, srcHeight - 1) * srcWidth * channels;
+        auto row1 = src
+          + std::min(2 * y + 1, srcHeight - 1) * srcWidth * channels;
+
+        for (size_t x = 0; x < dstWidth; ++x)
+          {
+            auto col0 = std::min(2 * x, srcWidth - 1) * channels;
+            auto col1 = std::min(2 * x + 1, srcWidth - 1) * channels;
+
+            for (size_t c = 0; c < channels; ++c)
+              {
+                unsigned sum = (unsigned) row0[col0 + c] + row0[col1 + c]
+                  + row1[col0 + c] + row1[col1 + c];
+                *dst++ = (unsigned char) ((sum + 2) / 4);
+              }
+          }
+      }
+  }
+}
+
+dmp::CookedTexture::CookedTexture(MappedFile && file)
+  : mFile(std::move(file))
+{
+  if (validate()) return;
+
+  mFile = MappedFile();
+  mHeader = nullptr;
+  mLevels = nullptr;
+}
+
+bool dmp::CookedTexture::validate()
+{
+  if (!mFile.valid() || mFile.size() < sizeof(Header)) return false;
+
+  mHeader = reinterpret_cast<const Header *>(mFile.data());
+  if (mHeader->magic != magic
+      || mHeader->version != version
+      || mHeader->channels < 1
+      || mHeader->channels > 4
+      || mHeader->numLevels < 1
+      || mHeader->numLevels > 32
+      || mFile.size() < sizeof(Header) + mHeader->numLevels * sizeof(Level))
+    {
+      return false;
+    }
+
+  mLevels = reinterpret_cast<const Level *>(mFile.data() + sizeof(Header));
+  for (uint32_t i = 0; i < mHeader->numLevels; ++i)
+    {
+      const auto & l = mLevels[i];
+      if (l.bytes != (uint64_t) l.width * l.height * mHeader->channels
+          || l.offset < mLevels[0].offset
+          || l.offset + l.bytes > mFile.size())
+        {
+          return false;
+        }
+    }
+
+  return true;
+}
+
+GLenum dmp::CookedTexture::format() const
+{
+  switch (mHeader->channels)
+    {
+    case 1:
+      return GL_RED;
+    case 2:
+      return GL_RG;
+    case 3:
+      return GL_RGB;
+    default:
+      return GL_RGBA;
+    }
+}
+
+const unsigned char * dmp::CookedTexture::pixels() const
+{
+  return mFile.data() + mLevels[0].offset;
+}
+
+size_t dmp::CookedTexture::pixelBytes() const
+{
+  const auto & last = mLevels[mHeader->numLevels - 1];
+  return (size_t) (last.offset + last.bytes - mLevels[0].offset);
+}
+
+void dmp::CookedTexture::upload(GLenum imageTarget,
+                                const GLvoid * base,
+                                size_t firstLevel) const
+{
+  expect("Upload a valid cooked texture", valid());
+  expect("First level in range", firstLevel < mHeader->numLevels);
+
+  auto fmt = format();
+  for (size_t i = firstLevel; i < mHeader->numLevels; ++i)
+    {
+      const auto & l = mLevels[i];
+      glTexImage2D(imageTarget,
+                   (GLint) (i - firstLevel),
+                   (GLint) fmt,
+                   (GLsizei) l.width,
+                   (GLsizei) l.height,
+                   0,
+                   fmt,
+                   GL_UNSIGNED_BYTE,
+                   static_cast<const unsigned char *>(base)
+                   + (l.offset - mLevels[0].offset));
+    }
+
+  expectNoErrors("Upload cooked texture levels");
+}
+
+std::string dmp::TextureCache::cachePath(const std::string & path,
+                                         int channels)
+{
+  auto key = hashBytes(path.data(), path.size());
+  key = hashBytes(&channels, sizeof(channels), key);
+
+  std::ostringstream name;
+  name << textureCacheDir << "/"
+       << std::hex << std::setw(16) << std::setfill('0') << key
+       << ".dmptex";
+  return name.str();
+}
+
+dmp::CookedTexture dmp::TextureCache::fetch(const std::string & path,
+                                            int channels)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    {
+      throw InvariantViolation("Failed to stat " + path);
+    }
+
+  CookedTexture::Header stamp = {};
+  stamp.sourceSize = (uint64_t) st.st_size;
+  stamp.sourceMTime = (int64_t) st.st_mtime;
+
+  auto dst = cachePath(path, channels);
+  CookedTexture cooked(MappedFile{dst});
+
+  bool sameChannels = cooked.valid()
+    && cooked.header().channels == (uint32_t) channels;
+
+  // the usual warm start: the source hasn't been touched since cooking
+  if (sameChannels
+      && cooked.header().sourceSize == stamp.sourceSize
+      && cooked.header().sourceMTime == stamp.sourceMTime)
+    {
+      return cooked;
+    }
+
+  MappedFile src(path);
+  expect("Map texture source", src.valid());
+  stamp.sourceHash = hashBytes(src.data(), src.size());
+
+  // touched (a checkout, a copy) but not actually changed. Note the new
+  // mtime so the next run takes the fast path again
+  if (sameChannels && cooked.header().sourceHash == stamp.sourceHash)
+    {
+      restamp(stamp, dst);
+      return cooked;
+    }
+
+  cooked = CookedTexture();
+  stamp.channels = (uint32_t) channels;
+  cook(src, stamp, dst);
+
+  cooked = CookedTexture(MappedFile{dst});
+  expect("Cooked texture readable", cooked.valid());
+  return cooked;
+}
+
+void dmp::TextureCache::cook(const MappedFile & src,
+                             const CookedTexture::Header & stamp,
+                             const std::string & dst)
+{
+  Image img(src.data(), src.size(), (int) stamp.channels);
+  size_t channels = img.channels;
+
+  std::vector<CookedTexture::Level> levels;
+  size_t w = img.width;
+  size_t h = img.height;
+  while (true)
+    {
+      levels.push_back({0,
+                        (uint64_t) (w * h * channels),
+                        (uint32_t) w,
+                        (uint32_t) h});
+      if (w == 1 && h == 1) break;
+      w = std::max<size_t>(1, w / 2);
+      h = std::max<size_t>(1, h / 2);
+    }
+
+  auto offset = alignUp(sizeof(CookedTexture::Header)
+                        + levels.size() * sizeof(CookedTexture::Level),
+                        levelAlignment);
+  for (auto & l : levels)
+    {
+      l.offset = offset;
+      offset = alignUp(offset + (size_t) l.bytes, levelAlignment);
+    }
+
+  std::vector<unsigned char> file(offset, 0);
+
+  auto header = stamp;
+  header.magic = CookedTexture::magic;
+  header.version = CookedTexture::version;
+  header.width = (uint32_t) img.width;
+  header.height = (uint32_t) img.height;
+  header.numLevels = (uint32_t) levels.size();
+  std::memcpy(file.data(), &header, sizeof(header));
+  std::memcpy(file.data() + sizeof(header),
+              levels.data(),
+              levels.size() * sizeof(CookedTexture::Level));
+
+  std::memcpy(file.data() + levels[0].offset, img.data.get(), img.bytes());
+  for (size_t i = 1; i < levels.size(); ++i)
+    {
+      const auto & prev = levels[i - 1];
+      const auto & curr = levels[i];
+      downsample(file.data() + prev.offset, prev.width, prev.height,
+                 file.data() + curr.offset, curr.width, curr.height,
+                 channels);
+    }
+
+  makeDirectories(textureCacheDir);
+
+  // another thread may be cooking the same file, or a crash could cut this
+  // write short; either way nobody should see a torn file
+  writeFileAtomic(dst, file.data(), file.size());
+
+  ifDebug(std::cerr << "Cooked texture " << dst << ": "
+          << img.width << "x" << img.height << "x" << channels << ", "
+          << levels.size() << " levels" << std::endl);
+}
+
+void dmp::TextureCache::restamp(const CookedTexture::Header & stamp,
+                                const std::string & dst)
+{
+  std::fstream file(dst, std::ios::binary | std::ios::in | std::ios::out);
+  if (!file) return;
+
+  CookedTexture::Header header;
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file) return;
+
+  header.sourceSize = stamp.sourceSize;
+  header.sourceMTime = stamp.sourceMTime;
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
@@ -0,0 +1,100 @@
+#ifndef DMP_TEXTURECACHE_HPP
+#define DMP_TEXTURECACHE_HPP
+
+#include <string>
+#include <cstdint>
+#include <GL/glew.h>
+#include "../MappedFile.hpp"
+
+namespace dmp
+{
+  // A cooked texture file, mapped into memory. The file is a Header, a
+  // table of numLevels Levels, then the pixels of every mip level, largest
+  // first, tightly packed rows. Fields are in native byte order; the cache
+  // is not meant to move between machines
+  class CookedTexture
+  {
+  public:
+    static const uint32_t magic = 0x54504D44; // "DMPT"
+    static const uint32_t version = 1;
+
+    struct Header
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t width;
+      uint32_t height;
+      uint32_t channels;
+      uint32_t numLevels;
+      // what the source file looked like when this was cooked
+      uint64_t sourceSize;
+      int64_t sourceMTime;
+      uint64_t sourceHash;
+    };
+
+    struct Level
+    {
+      uint64_t offset; // from the start of the file
+      uint64_t bytes;
+      uint32_t width;
+      uint32_t height;
+    };
+
+    CookedTexture(const CookedTexture &) = delete;
+    CookedTexture & operator=(const CookedTexture &) = delete;
+    CookedTexture(CookedTexture &&) = default;
+    CookedTexture & operator=(CookedTexture &&) = default;
+
+    CookedTexture() = default;
+    // An invalid or truncated file gives an invalid CookedTexture
+    CookedTexture(MappedFile && file);
+
+    bool valid() const {return mFile.valid();}
+
+    const Header & header() const {return *mHeader;}
+    const Level & level(size_t i) const {return mLevels[i];}
+    GLenum format() const;
+
+    // every level, back to back, starting with level 0
+    const unsigned char * pixels() const;
+    size_t pixelBytes() const;
+
+    // glTexImage2D every level from firstLevel down into imageTarget of the
+    // bound texture, so that firstLevel becomes GL level 0. Level i is read
+    // from base plus its offset within pixels(), so base is either pixels()
+    // or an offset into the bound unpack buffer holding a copy of them.
+    // Expects an unpack alignment of 1
+    void upload(GLenum imageTarget,
+                const GLvoid * base,
+                size_t firstLevel = 0) const;
+
+  private:
+    bool validate();
+
+    MappedFile mFile;
+    const Header * mHeader = nullptr;
+    const Level * mLevels = nullptr;
+  };
+
+  // Cooks source images into CookedTextures with a full mip chain under
+  // textureCacheDir the first time they are asked for, and just maps the
+  // cooked file after that. A cooked file is keyed by source path and
+  // requested channels, and stays valid while the source's size and mtime
+  // match, or failing that, while the source's content hash does.
+  // Safe to call from any thread
+  class TextureCache
+  {
+  public:
+    static CookedTexture fetch(const std::string & path, int channels);
+
+  private:
+    static std::string cachePath(const std::string & path, int channels);
+    static void cook(const MappedFile & src,
+                     const CookedTexture::Header & stamp,
+                     const std::string & dst);
+    static void restamp(const CookedTexture::Header & stamp,
+                        const std::string & dst);
+  };
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include "TextureResidency.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "../util.hpp"
+#include "../config.hpp"
+
+dmp::TextureResidency::TextureResidency(AssetLoader & loader,
+                                        size_t budgetBytes)
+  : mLoader(loader)
+{
+  mStats.budgetBytes = budgetBytes;
+  mLoader.uploadedFn = [this](GLuint tex, size_t bytes, size_t levels)
+    {
+      uploaded(tex, bytes, levels);
+    };
+}
+
+dmp::TextureResidency::~TextureResidency()
+{
+  mLoader.uploadedFn = nullptr;
+}
+
+void dmp::TextureResidency::track(GLuint tex,
+                                  const std::string & path,
+                                  bool pinned)
+{
+  expect("Texture not already tracked", mEntries.count(tex) == 0);
+
+  // everything starts out as the loader's 1x1 placeholder
+  mLRU.push_front({tex, path, pinned, State::loading, 0, 1, mFrame});
+  mEntries[tex] = mLRU.begin();
+  setBytes(mLRU.front(), 4);
+  ++mStats.tracked;
+}
+
+void dmp::TextureResidency::untrack(GLuint tex)
+{
+  auto found = mEntries.find(tex);
+  if (found == mEntries.end()) return;
+
+  auto & entry = *found->second;
+  setBytes(entry, 0);
+  if (entry.state == State::evicted || entry.state == State::reloading)
+    {
+      --mStats.evicted;
+    }
+  --mStats.tracked;
+
+  mLRU.erase(found->second);
+  mEntries.erase(found);
+}
+
+void dmp::TextureResidency::setBytes(Entry & entry, size_t bytes)
+{
+  mStats.residentBytes -= entry.bytes;
+  mStats.residentBytes += bytes;
+  entry.bytes = bytes;
+}
+
+void dmp::TextureResidency::uploaded(GLuint tex, size_t bytes, size_t levels)
+{
+  auto found = mEntries.find(tex);
+  if (found == mEntries.end()) return;
+
+  auto & entry = *found->second;
+  setBytes(entry, bytes);
+  entry.levels = levels;
+  if (entry.state == State::reloading) --mStats.evicted;
+  entry.state = State::resident;
+}
+
+void dmp::TextureResidency::touch(GLuint tex)
+{
+  auto found = mEntries.find(tex);
+  if (found == mEntries.end()) return;
+
+  auto & entry = *found->second;
+  entry.lastUsed = mFrame;
+  mLRU.splice(mLRU.begin(), mLRU, found->second);
+
+  if (entry.state == State::evicted)
+    {
+      mLoader.loadTexture(entry.tex, entry.path);
+      entry.state = State::reloading;
+      ++mStats.reloads;
+    }
+
+  if (entry.state == State::reloading) ++mStats.reloadStalls;
+}
+
+void dmp::TextureResidency::update()
+{
+  ++mFrame;
+
+  // least recently used first. Everything in front of the first texture
+  // that was used too recently to evict was used more recently still
+  for (auto it = mLRU.rbegin();
+       it != mLRU.rend() && mStats.residentBytes > mStats.budgetBytes;
+       ++it)
+    {
+      if (it->lastUsed + textureEvictAfterFrames > mFrame) break;
+      if (it->pinned || it->state != State::resident) continue;
+      evict(*it);
+    }
+}
+
+void dmp::TextureResidency::evict(Entry & entry)
+{
+  glBindTexture(GL_TEXTURE_2D, entry.tex);
+
+  auto levelSize = [](size_t level)
+    {
+      GLint width = 0;
+      GLint height = 0;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D,
+                               (GLint) level,
+                               GL_TEXTURE_WIDTH,
+                               &width);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D,
+                               (GLint) level,
+                               GL_TEXTURE_HEIGHT,
+                               &height);
+      return glm::ivec2(width, height);
+    };
+
+  size_t first = 0;
+  while (first + 1 < entry.levels)
+    {
+      auto size = levelSize(first);
+      if ((size_t) std::max(size.x, size.y) <= evictedTextureSize) break;
+      ++first;
+    }
+
+  // already no larger than it would be cut down to, so there is nothing to
+  // gain from evicting it, now or later
+  if (first == 0)
+    {
+      glBindTexture(GL_TEXTURE_2D, 0);
+      entry.pinned = true;
+      return;
+    }
+
+  // The small end of the texture's own mip chain becomes the whole
+  // texture. Every texture the loader uploads has a full chain, cooked or
+  // not, so this needs no source file, and the texture has gone unused
+  // for textureEvictAfterFrames, so reading it back waits on no draws
+  std::vector<glm::ivec2> sizes;
+  std::vector<std::vector<unsigned char>> tail;
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  for (size_t i = first; i < entry.levels; ++i)
+    {
+      sizes.push_back(levelSize(i));
+      tail.emplace_back((size_t) (sizes.back().x * sizes.back().y * 4));
+      glGetTexImage(GL_TEXTURE_2D,
+                    (GLint) i,
+                    GL_RGBA,
+                    GL_UNSIGNED_BYTE,
+                    tail.back().data());
+    }
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  size_t bytes = 0;
+  size_t levels = tail.size();
+  for (size_t i = 0; i < levels; ++i)
+    {
+      glTexImage2D(GL_TEXTURE_2D,
+                   (GLint) i,
+                   GL_RGBA,
+                   sizes[i].x,
+                   sizes[i].y,
+                   0,
+                   GL_RGBA,
+                   GL_UNSIGNED_BYTE,
+                   tail[i].data());
+      bytes += tail[i].size();
+    }
+
+  // redefining the levels past the new end as empty releases their storage
+  for (size_t i = levels; i < entry.levels; ++i)
+    {
+      glTexImage2D(GL_TEXTURE_2D,
+                   (GLint) i,
+                   GL_RGBA,
+                   0,
+                   0,
+                   0,
+                   GL_RGBA,
+                   GL_UNSIGNED_BYTE,
+                   nullptr);
+    }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) levels - 1);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  expectNoErrors("Evict texture " + entry.path);
+
+  ifDebug(std::cerr << "Evicted " << entry.path << ", freeing "
+          << (entry.bytes - bytes) << " bytes" << std::endl);
+
+  setBytes(entry, bytes);
+  entry.levels = levels;
+  entry.state = State::evicted;
+  ++mStats.evicted;
+  ++mStats.evictions;
+}
+
+void dmp::TextureResidency::printStats(std::ostream & out) const
+{
+  auto asMiB = [](size_t bytes) {return (double) bytes / (1024.0 * 1024.0);};
+
+  out << std::fixed << std::setprecision(2)
+      << "Textures: " << asMiB(mStats.residentBytes) << " of "
+      << asMiB(mStats.budgetBytes) << " MiB resident, "
+      << mStats.tracked << " tracked, "
+      << mStats.evicted << " evicted" << std::endl
+      << "Since startup: " << mStats.evictions << " evictions, "
+      << mStats.reloads << " reloads, "
+      << mStats.reloadStalls << " draws waiting on a reload" << std::endl;
+}
@@ -0,0 +1,85 @@
+#ifndef DMP_TEXTURERESIDENCY_HPP
+#define DMP_TEXTURERESIDENCY_HPP
+
+#include <list>
+#include <string>
+#include <ostream>
+#include <unordered_map>
+#include <GL/glew.h>
+#include "../AssetLoader.hpp"
+
+namespace dmp
+{
+  // Keeps the 2D textures it tracks within a GPU memory budget. Once over
+  // budget, textures that no draw has touched for textureEvictAfterFrames
+  // are cut down to the small end of their own mip chains, least recently
+  // used first, whether or not the texture cache is on. The next draw to
+  // touch an evicted texture starts streaming the full texture back in
+  // through the AssetLoader, and draws with the small mips until it lands.
+  // Must be used on the GL thread
+  class TextureResidency
+  {
+  public:
+    struct Stats
+    {
+      size_t residentBytes = 0;
+      size_t budgetBytes = 0;
+      size_t tracked = 0;
+      size_t evicted = 0;      // currently cut down or reloading
+      size_t evictions = 0;    // since startup
+      size_t reloads = 0;      // since startup
+      size_t reloadStalls = 0; // draws made with small mips since startup
+    };
+
+    TextureResidency() = delete;
+    TextureResidency(const TextureResidency &) = delete;
+    TextureResidency & operator=(const TextureResidency &) = delete;
+
+    TextureResidency(AssetLoader & loader, size_t budgetBytes);
+    ~TextureResidency();
+
+    // Start tracking tex, which the loader is loading from path. Pinned
+    // textures count toward the budget but are never evicted
+    void track(GLuint tex, const std::string & path, bool pinned);
+    void untrack(GLuint tex);
+
+    // tex is about to be drawn with
+    void touch(GLuint tex);
+
+    // Once per frame. Evicts until back under budget, if possible
+    void update();
+
+    const Stats & stats() const {return mStats;}
+    void printStats(std::ostream & out) const;
+
+  private:
+    enum class State {loading, resident, evicted, reloading};
+
+    struct Entry
+    {
+      GLuint tex;
+      std::string path;
+      bool pinned;
+      State state;
+      size_t bytes;
+      size_t levels;
+      size_t lastUsed;
+    };
+
+    using LRU = std::list<Entry>;
+
+    void uploaded(GLuint tex, size_t bytes, size_t levels);
+    void evict(Entry & entry);
+    void setBytes(Entry & entry, size_t bytes);
+
+    AssetLoader & mLoader;
+    Stats mStats;
+    size_t mFrame = 0;
+
+    // most recently used first
+    LRU mLRU;
+    std::unordered_map<GLuint, LRU::iterator> mEntries;
+  };
+}
+
+#endif
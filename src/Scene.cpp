@@ -13,22 +13,37 @@ void dmp::Scene::update(float deltaT)
 
   graph->update(deltaT);
 
+  // after the graph, so particles are born where their emitters are now
+  for (auto & curr : emitters)
+    {
+      curr->update(deltaT, pool);
+    }
+
+  for (auto & curr : crowds)
+    {
+      curr->update(deltaT, pool);
+    }
+
+  std::vector<size_t> moved;
   for (size_t i = 0; i < objects.size(); ++i)
     {
       if (objects[i]->isDirty())
         {
           objectConstants->update(i, objects[i]->getObjectConstants());
           objects[i]->setClean();
+          moved.push_back(i);
         }
     }
-  for (size_t i = 0; i < overlays.size(); ++i)
+
+  if (!bvh.builtFor(objects))
     {
-      if (overlays[i].isDirty())
-        {
-          overlayConstants->update(i, overlays[i].getOverlayConstants());
-          overlays[i].setClean();
-        }
+      bvh.build(objects);
+      if (selected >= (int) objects.size()) selected = -1;
     }
+  else bvh.refit(moved);
+
+  if (!overlayGrid.builtFor(overlays)) overlayGrid.build(overlays);
+
 
   for (auto & curr : cameras)
     {
@@ -36,6 +51,17 @@ void dmp::Scene::update(float deltaT)
     }
 }
 
+int dmp::Scene::pick(const Ray & ray) const
+{
+  expect("BVH built for current objects", bvh.builtFor(objects));
+  return bvh.intersect(ray);
+}
+
+uint32_t dmp::Scene::pickOverlay(float x, float y) const
+{
+  return overlayGrid.pick(overlays, x, y);
+}
+
 void dmp::Scene::free()
 {
   for (auto & curr : objects)
@@ -43,15 +69,18 @@ void dmp::Scene::free()
       curr->freeObject();
     }
 
-  for (auto & curr : overlays)
+  for (auto & curr : emitters)
     {
-      curr.freeOverlay();
+      curr->freeParticleEmitter();
     }
 
-  for (auto & curr : textures)
+  for (auto & curr : crowds)
     {
-      curr.freeTexture();
+      curr->freeCrowd();
     }
 
+  // the last handle to each texture frees it
+  textures.clear();
+  overlays.clear();
   skybox->freeSkybox();
 }
@@ -8,9 +8,15 @@
 #include "Scene/Graph.hpp"
 #include "Scene/Camera.hpp"
 #include "Scene/Skybox.hpp"
+#include "Scene/Particles.hpp"
+#include "Scene/Crowd.hpp"
+#include "Scene/BVH.hpp"
 #include "Renderer/UniformBuffer.hpp"
 #include "Renderer/Texture.hpp"
+#include "Renderer/TextureResidency.hpp"
 #include "Renderer/Overlay.hpp"
+#include "Renderer/OverlayGrid.hpp"
+#include "ThreadPool.hpp"
 
 namespace dmp
 {
@@ -18,17 +24,37 @@ namespace dmp
   {
     std::vector<Material> materials;
     std::unique_ptr<UniformBuffer> materialConstants;
-    std::vector<Texture> textures;
+    std::vector<TextureHandle> textures;
+    // told about every texture drawn with, if set
+    TextureResidency * residency = nullptr;
     std::vector<Light> lights;
+    std::vector<PointLight> pointLights;
     std::vector<Camera> cameras;
     std::vector<Object *> objects;
     std::unique_ptr<UniformBuffer> objectConstants;
     std::unique_ptr<Branch> graph;
     std::unique_ptr<Skybox> skybox;
+    std::vector<std::unique_ptr<ParticleEmitter>> emitters;
+    std::vector<std::unique_ptr<Crowd>> crowds;
+    // runs particle and crowd updates, if set
+    ThreadPool * pool = nullptr;
     std::vector<Overlay> overlays;
-    std::unique_ptr<UniformBuffer> overlayConstants;
+    BVH bvh;
+    OverlayGrid overlayGrid;
+
+    // index into objects of the object last clicked on, or -1. Outlined
+    // when drawn
+    int selected = -1;
 
     void update(float deltaT);
+
+    // returns the index into objects of the closest visible object hit by
+    // ray, or -1 if nothing was hit
+    int pick(const Ray & ray) const;
+
+    // returns the ID of the topmost visible overlay at x, y in normalized
+    // device coordinates, or noOverlayID
+    uint32_t pickOverlay(float x, float y) const;
     void free();
   };
 }
@@ -0,0 +1,621 @@
+#include "Animation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include "../util.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // uint16s per group of four joints per key
+  const size_t keyGroup = 24;
+
+  // The top three rows of the matrix of a rotation then a translation
+  void poseRows(float x, float y, float z, float w,
+                float tx, float ty, float tz,
+                float * rows)
+  {
+    rows[0] = 1.0f - 2.0f * (y * y + z * z);
+    rows[1] = 2.0f * (x * y - w * z);
+    rows[2] = 2.0f * (x * z + w * y);
+    rows[3] = tx;
+    rows[4] = 2.0f * (x * y + w * z);
+    rows[5] = 1.0f - 2.0f * (x * x + z * z);
+    rows[6] = 2.0f * (y * z - w * x);
+    rows[7] = ty;
+    rows[8] = 2.0f * (x * z - w * y);
+    rows[9] = 2.0f * (y * z + w * x);
+    rows[10] = 1.0f - 2.0f * (x * x + y * y);
+    rows[11] = tz;
+  }
+
+  // out = a * b, as affine matrices kept as their top three rows. out may
+  // not be either of them
+  void mulRows(const float * a, const float * b, float * out)
+  {
+    for (int i = 0; i < 3; ++i)
+      {
+        for (int k = 0; k < 4; ++k)
+          {
+            out[4 * i + k] = a[4 * i] * b[k]
+              + a[4 * i + 1] * b[4 + k]
+              + a[4 * i + 2] * b[8 + k]
+              + (k == 3 ? a[4 * i + 3] : 0.0f);
+          }
+      }
+  }
+
+#ifdef __SSE2__
+  template <int lane>
+  __m128 splat(__m128 v)
+  {
+    return _mm_shuffle_ps(v, v, _MM_SHUFFLE(lane, lane, lane, lane));
+  }
+
+  // as mulRows, a row at a time
+  void mulRows(const __m128 * a, const __m128 * b, __m128 * out)
+  {
+    const __m128 wOnly = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+    for (int i = 0; i < 3; ++i)
+      {
+        auto row = _mm_and_ps(a[i], wOnly);
+        row = _mm_add_ps(row, _mm_mul_ps(splat<0>(a[i]), b[0]));
+        row = _mm_add_ps(row, _mm_mul_ps(splat<1>(a[i]), b[1]));
+        row = _mm_add_ps(row, _mm_mul_ps(splat<2>(a[i]), b[2]));
+        out[i] = row;
+      }
+  }
+
+  // Four quaternions a weighted toward b, one component per register,
+  // the shorter way round and normalized. Written over a
+  void nlerp(__m128 * a, __m128 * b, __m128 weight)
+  {
+    auto dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]),
+                                     _mm_mul_ps(a[1], b[1])),
+                          _mm_add_ps(_mm_mul_ps(a[2], b[2]),
+                                     _mm_mul_ps(a[3], b[3])));
+    auto flip = _mm_and_ps(dot, _mm_set1_ps(-0.0f));
+
+    __m128 len = _mm_setzero_ps();
+    for (int c = 0; c < 4; ++c)
+      {
+        auto to = _mm_xor_ps(b[c], flip);
+        a[c] = _mm_add_ps(a[c], _mm_mul_ps(weight, _mm_sub_ps(to, a[c])));
+        len = _mm_add_ps(len, _mm_mul_ps(a[c], a[c]));
+      }
+
+    auto scale = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(len));
+    for (int c = 0; c < 4; ++c) a[c] = _mm_mul_ps(a[c], scale);
+  }
+
+  // eight 16 bit integers as two registers of four floats
+  void widenSigned(__m128i v, __m128 & lo, __m128 & hi)
+  {
+    lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+  }
+
+  void widenUnsigned(__m128i v, __m128 & lo, __m128 & hi)
+  {
+    auto zero = _mm_setzero_si128();
+    lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+  }
+
+  // one group of keys as a rotation, w rebuilt, and still quantized
+  // translation, one component per register
+  void decode(const uint16_t * key, __m128 * rot, __m128 * pos)
+  {
+    auto k = reinterpret_cast<const __m128i *>(key);
+    auto mixed = _mm_loadu_si128(k + 1); // rotation z, translation x
+    __m128 unused;
+    widenSigned(_mm_loadu_si128(k), rot[0], rot[1]);
+    widenSigned(mixed, rot[2], unused);
+    widenUnsigned(mixed, unused, pos[0]);
+    widenUnsigned(_mm_loadu_si128(k + 2), pos[1], pos[2]);
+
+    auto scale = _mm_set1_ps(1.0f / 32767.0f);
+    auto len = _mm_setzero_ps();
+    for (int c = 0; c < 3; ++c)
+      {
+        rot[c] = _mm_mul_ps(rot[c], scale);
+        len = _mm_add_ps(len, _mm_mul_ps(rot[c], rot[c]));
+      }
+    rot[3] = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(),
+                                    _mm_sub_ps(_mm_set1_ps(1.0f), len)));
+  }
+#else
+  void nlerp(float * a, const float * b, float weight)
+  {
+    auto dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    auto flip = dot < 0.0f ? -1.0f : 1.0f;
+
+    float len = 0.0f;
+    for (int c = 0; c < 4; ++c)
+      {
+        a[c] += weight * (flip * b[c] - a[c]);
+        len += a[c] * a[c];
+      }
+
+    auto scale = 1.0f / std::sqrt(len);
+    for (int c = 0; c < 4; ++c) a[c] *= scale;
+  }
+#endif
+}
+
+dmp::SkinnedVertex dmp::skinVertex(const ObjectVertex & v,
+                                   const glm::uvec4 & joints,
+                                   const glm::vec4 & weights)
+{
+  SkinnedVertex res;
+  res.position = v.position;
+  res.normal = v.normal;
+  res.texCoords = v.texCoords;
+
+  auto total = weights[0] + weights[1] + weights[2] + weights[3];
+  expect("Skinned vertex has weight", total > 0.0f);
+
+  int sum = 0;
+  int heaviest = 0;
+  for (int i = 0; i < 4; ++i)
+    {
+      expect("Joint index fits a byte", joints[i] < 256);
+      res.joints[i] = (uint8_t) joints[i];
+      res.weights[i] = (uint8_t) std::lround(255.0f * weights[i] / total);
+      sum += res.weights[i];
+      if (weights[i] > weights[heaviest]) heaviest = i;
+    }
+
+  // rounding can leave the total a little off, which the heaviest can
+  // take up the least noticeably
+  res.weights[heaviest] = (uint8_t) (res.weights[heaviest] + 255 - sum);
+  return res;
+}
+
+// -----------------------------------------------------------------------------
+// Skeleton
+// -----------------------------------------------------------------------------
+
+dmp::Skeleton::Skeleton(std::vector<Joint> joints)
+  : mJoints(std::move(joints))
+{
+  initSkeleton();
+}
+
+void dmp::Skeleton::initSkeleton()
+{
+  expect("Skeleton has joints", !mJoints.empty());
+
+  // rotations and translations only, so each inverse is the transposed
+  // rotation and the translation taken back through it
+  std::vector<float> model(12 * mJoints.size());
+  mInverseBind.resize(12 * mJoints.size());
+  for (size_t j = 0; j < mJoints.size(); ++j)
+    {
+      auto parent = mJoints[j].parent;
+      expect("Skeleton joints come after their parents",
+             parent < (int32_t) j);
+
+      const auto & q = mJoints[j].bind.rotation;
+      const auto & t = mJoints[j].bind.translation;
+      auto len = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+      float local[12];
+      poseRows(q.x / len, q.y / len, q.z / len, q.w / len,
+               t.x, t.y, t.z,
+               local);
+
+      auto m = model.data() + 12 * j;
+      if (parent < 0) std::copy(local, local + 12, m);
+      else mulRows(model.data() + 12 * parent, local, m);
+
+      auto inv = mInverseBind.data() + 12 * j;
+      for (int i = 0; i < 3; ++i)
+        {
+          for (int k = 0; k < 3; ++k) inv[4 * i + k] = m[4 * k + i];
+          inv[4 * i + 3] = -(m[i] * m[3]
+                             + m[4 + i] * m[7]
+                             + m[8 + i] * m[11]);
+        }
+    }
+}
+
+int32_t dmp::Skeleton::find(const std::string & name) const
+{
+  for (size_t j = 0; j < mJoints.size(); ++j)
+    {
+      if (mJoints[j].name == name) return (int32_t) j;
+    }
+  return -1;
+}
+
+// -----------------------------------------------------------------------------
+// Pose
+// -----------------------------------------------------------------------------
+
+dmp::Pose::Pose(size_t numJoints)
+  : mSize(numJoints),
+    mStride((numJoints + 3) & ~(size_t) 3),
+    mData(NumComponents * mStride, 0.0f)
+{
+  std::fill(component(RotW), component(RotW) + mStride, 1.0f);
+}
+
+dmp::JointPose dmp::Pose::get(size_t j) const
+{
+  JointPose res;
+  res.rotation = glm::quat(component(RotW)[j],
+                           component(RotX)[j],
+                           component(RotY)[j],
+                           component(RotZ)[j]);
+  res.translation = glm::vec3(component(PosX)[j],
+                              component(PosY)[j],
+                              component(PosZ)[j]);
+  return res;
+}
+
+void dmp::Pose::set(size_t j, const JointPose & pose)
+{
+  component(RotX)[j] = pose.rotation.x;
+  component(RotY)[j] = pose.rotation.y;
+  component(RotZ)[j] = pose.rotation.z;
+  component(RotW)[j] = pose.rotation.w;
+  component(PosX)[j] = pose.translation.x;
+  component(PosY)[j] = pose.translation.y;
+  component(PosZ)[j] = pose.translation.z;
+}
+
+dmp::Pose dmp::Pose::bind(const Skeleton & skeleton)
+{
+  Pose res(skeleton.size());
+  for (size_t j = 0; j < skeleton.size(); ++j)
+    {
+      res.set(j, skeleton.joint(j).bind);
+    }
+  return res;
+}
+
+void dmp::blendPoses(const Pose & a, const Pose & b, float weight, Pose & out)
+{
+  expect("Blended poses match", a.size() == b.size());
+  if (out.size() != a.size()) out = Pose(a.size());
+
+  const float * ac[Pose::NumComponents];
+  const float * bc[Pose::NumComponents];
+  float * oc[Pose::NumComponents];
+  for (int c = 0; c < Pose::NumComponents; ++c)
+    {
+      ac[c] = a.component((Pose::Component) c);
+      bc[c] = b.component((Pose::Component) c);
+      oc[c] = out.component((Pose::Component) c);
+    }
+
+#ifdef __SSE2__
+  auto w = _mm_set1_ps(weight);
+  for (size_t i = 0; i < a.stride(); i += 4)
+    {
+      __m128 ra[4];
+      __m128 rb[4];
+      for (int c = 0; c < 4; ++c)
+        {
+          ra[c] = _mm_loadu_ps(ac[c] + i);
+          rb[c] = _mm_loadu_ps(bc[c] + i);
+        }
+      nlerp(ra, rb, w);
+      for (int c = 0; c < 4; ++c) _mm_storeu_ps(oc[c] + i, ra[c]);
+
+      for (int c = Pose::PosX; c <= Pose::PosZ; ++c)
+        {
+          auto pa = _mm_loadu_ps(ac[c] + i);
+          auto pb = _mm_loadu_ps(bc[c] + i);
+          _mm_storeu_ps(oc[c] + i,
+                        _mm_add_ps(pa, _mm_mul_ps(w, _mm_sub_ps(pb, pa))));
+        }
+    }
+#else
+  for (size_t i = 0; i < a.stride(); ++i)
+    {
+      float qa[4] = {ac[0][i], ac[1][i], ac[2][i], ac[3][i]};
+      float qb[4] = {bc[0][i], bc[1][i], bc[2][i], bc[3][i]};
+      nlerp(qa, qb, weight);
+      for (int c = 0; c < 4; ++c) oc[c][i] = qa[c];
+
+      for (int c = Pose::PosX; c <= Pose::PosZ; ++c)
+        {
+          oc[c][i] = ac[c][i] + weight * (bc[c][i] - ac[c][i]);
+        }
+    }
+#endif
+}
+
+void dmp::skinningPalette(const Skeleton & skeleton,
+                          const Pose & pose,
+                          const glm::mat4 & M,
+                          std::vector<float> & scratch,
+                          float * out)
+{
+  auto numJoints = skeleton.size();
+  expect("Pose fits skeleton", pose.size() == numJoints);
+  scratch.resize(12 * numJoints);
+
+  float placed[12];
+  for (int i = 0; i < 3; ++i)
+    {
+      for (int k = 0; k < 4; ++k) placed[4 * i + k] = M[k][i];
+    }
+
+  const float * x = pose.component(Pose::RotX);
+  const float * y = pose.component(Pose::RotY);
+  const float * z = pose.component(Pose::RotZ);
+  const float * w = pose.component(Pose::RotW);
+  const float * tx = pose.component(Pose::PosX);
+  const float * ty = pose.component(Pose::PosY);
+  const float * tz = pose.component(Pose::PosZ);
+
+#ifdef __SSE2__
+  __m128 placedRows[3] =
+    {
+      _mm_loadu_ps(placed),
+      _mm_loadu_ps(placed + 4),
+      _mm_loadu_ps(placed + 8)
+    };
+
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  for (size_t g = 0; g < numJoints; g += 4)
+    {
+      // four joints' local matrices at once, one element per register,
+      // then turned into rows of each
+      auto qx = _mm_loadu_ps(x + g);
+      auto qy = _mm_loadu_ps(y + g);
+      auto qz = _mm_loadu_ps(z + g);
+      auto qw = _mm_loadu_ps(w + g);
+      auto xx = _mm_mul_ps(qx, qx);
+      auto yy = _mm_mul_ps(qy, qy);
+      auto zz = _mm_mul_ps(qz, qz);
+      auto xy = _mm_mul_ps(qx, qy);
+      auto xz = _mm_mul_ps(qx, qz);
+      auto yz = _mm_mul_ps(qy, qz);
+      auto wx = _mm_mul_ps(qw, qx);
+      auto wy = _mm_mul_ps(qw, qy);
+      auto wz = _mm_mul_ps(qw, qz);
+
+      __m128 rows[3][4] =
+        {
+          {
+            _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))),
+            _mm_mul_ps(two, _mm_sub_ps(xy, wz)),
+            _mm_mul_ps(two, _mm_add_ps(xz, wy)),
+            _mm_loadu_ps(tx + g)
+          },
+          {
+            _mm_mul_ps(two, _mm_add_ps(xy, wz)),
+            _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))),
+            _mm_mul_ps(two, _mm_sub_ps(yz, wx)),
+            _mm_loadu_ps(ty + g)
+          },
+          {
+            _mm_mul_ps(two, _mm_sub_ps(xz, wy)),
+            _mm_mul_ps(two, _mm_add_ps(yz, wx)),
+            _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))),
+            _mm_loadu_ps(tz + g)
+          }
+        };
+      for (auto & row : rows)
+        {
+          _MM_TRANSPOSE4_PS(row[0], row[1], row[2], row[3]);
+        }
+
+      // then down the hierarchy, which goes in joint order, so a parent
+      // in the same group is already done
+      auto last = std::min(g + 4, numJoints);
+      for (size_t j = g; j < last; ++j)
+        {
+          __m128 local[3] =
+            {
+              rows[0][j - g],
+              rows[1][j - g],
+              rows[2][j - g]
+            };
+
+          __m128 parentRows[3];
+          const __m128 * from = placedRows;
+          auto parent = skeleton.parent(j);
+          if (parent >= 0)
+            {
+              auto p = scratch.data() + 12 * parent;
+              for (int i = 0; i < 3; ++i)
+                {
+                  parentRows[i] = _mm_loadu_ps(p + 4 * i);
+                }
+              from = parentRows;
+            }
+
+          __m128 model[3];
+          mulRows(from, local, model);
+          auto m = scratch.data() + 12 * j;
+          for (int i = 0; i < 3; ++i) _mm_storeu_ps(m + 4 * i, model[i]);
+
+          auto ib = skeleton.inverseBind(j);
+          __m128 inverseBind[3] =
+            {
+              _mm_loadu_ps(ib),
+              _mm_loadu_ps(ib + 4),
+              _mm_loadu_ps(ib + 8)
+            };
+          __m128 skin[3];
+          mulRows(model, inverseBind, skin);
+          for (int i = 0; i < 3; ++i)
+            {
+              _mm_storeu_ps(out + 12 * j + 4 * i, skin[i]);
+            }
+        }
+    }
+#else
+  for (size_t j = 0; j < numJoints; ++j)
+    {
+      float local[12];
+      poseRows(x[j], y[j], z[j], w[j], tx[j], ty[j], tz[j], local);
+
+      auto parent = skeleton.parent(j);
+      auto from = parent >= 0 ? scratch.data() + 12 * parent : placed;
+      auto m = scratch.data() + 12 * j;
+      mulRows(from, local, m);
+      mulRows(m, skeleton.inverseBind(j), out + 12 * j);
+    }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// AnimationClip
+// -----------------------------------------------------------------------------
+
+dmp::AnimationClip::AnimationClip(
+  const std::string & name,
+  const std::vector<std::vector<JointPose>> & frames,
+  float rate)
+  : mName(name),
+    mNumJoints(frames.empty() ? 0 : frames[0].size()),
+    mStride((mNumJoints + 3) & ~(size_t) 3),
+    mNumFrames(frames.size()),
+    mRate(rate)
+{
+  initAnimationClip(frames);
+}
+
+void dmp::AnimationClip::initAnimationClip(
+  const std::vector<std::vector<JointPose>> & frames)
+{
+  expect("Animation clip has frames", mNumFrames > 0 && mNumJoints > 0);
+  expect("Animation clip rate positive", mRate > 0.0f);
+
+  mPosMin.assign(3 * mStride, 0.0f);
+  mPosStep.assign(3 * mStride, 0.0f);
+  for (size_t j = 0; j < mNumJoints; ++j)
+    {
+      glm::vec3 lo = frames[0][j].translation;
+      glm::vec3 hi = lo;
+      for (const auto & frame : frames)
+        {
+          expect("Animation frames match", frame.size() == mNumJoints);
+          lo = glm::min(lo, frame[j].translation);
+          hi = glm::max(hi, frame[j].translation);
+        }
+      for (int c = 0; c < 3; ++c)
+        {
+          mPosMin[c * mStride + j] = lo[c];
+          mPosStep[c * mStride + j] = (hi[c] - lo[c]) / 65535.0f;
+        }
+    }
+
+  auto groups = mStride / 4;
+  mKeys.assign(mNumFrames * groups * keyGroup, 0);
+  for (size_t f = 0; f < mNumFrames; ++f)
+    {
+      for (size_t j = 0; j < mNumJoints; ++j)
+        {
+          auto key = mKeys.data() + (f * groups + j / 4) * keyGroup + j % 4;
+
+          auto q = frames[f][j].rotation;
+          auto len = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+          auto sign = q.w < 0.0f ? -1.0f : 1.0f;
+          float rot[3] = {q.x, q.y, q.z};
+          for (int c = 0; c < 3; ++c)
+            {
+              auto v = std::lround(32767.0f * sign * rot[c] / len);
+              key[4 * c] = (uint16_t) (int16_t) v;
+            }
+
+          const auto & t = frames[f][j].translation;
+          for (int c = 0; c < 3; ++c)
+            {
+              auto step = mPosStep[c * mStride + j];
+              auto v = step > 0.0f
+                ? std::lround((t[c] - mPosMin[c * mStride + j]) / step)
+                : 0;
+              key[4 * (3 + c)] = (uint16_t) std::min(std::max(v, 0L), 65535L);
+            }
+        }
+    }
+}
+
+void dmp::AnimationClip::sample(float time, Pose & out) const
+{
+  expect("Sampled pose matches clip", out.size() == mNumJoints);
+
+  auto frames = (float) mNumFrames;
+  auto at = time * mRate;
+  at -= std::floor(at / frames) * frames;
+  auto f0 = std::min((size_t) at, mNumFrames - 1);
+  auto f1 = f0 + 1 == mNumFrames ? 0 : f0 + 1;
+  auto weight = at - (float) f0;
+
+  auto groups = mStride / 4;
+  const uint16_t * key0 = mKeys.data() + f0 * groups * keyGroup;
+  const uint16_t * key1 = mKeys.data() + f1 * groups * keyGroup;
+
+  float * dst[Pose::NumComponents];
+  for (int c = 0; c < Pose::NumComponents; ++c)
+    {
+      dst[c] = out.component((Pose::Component) c);
+    }
+
+#ifdef __SSE2__
+  auto w = _mm_set1_ps(weight);
+  for (size_t g = 0; g < groups; ++g)
+    {
+      __m128 rot0[4];
+      __m128 rot1[4];
+      __m128 pos0[3];
+      __m128 pos1[3];
+      decode(key0 + g * keyGroup, rot0, pos0);
+      decode(key1 + g * keyGroup, rot1, pos1);
+
+      nlerp(rot0, rot1, w);
+      for (int c = 0; c < 4; ++c) _mm_storeu_ps(dst[c] + 4 * g, rot0[c]);
+
+      // interpolated while still in steps, then taken back once
+      for (int c = 0; c < 3; ++c)
+        {
+          auto steps = _mm_add_ps(pos0[c],
+                                  _mm_mul_ps(w, _mm_sub_ps(pos1[c], pos0[c])));
+          auto min = _mm_loadu_ps(mPosMin.data() + c * mStride + 4 * g);
+          auto step = _mm_loadu_ps(mPosStep.data() + c * mStride + 4 * g);
+          _mm_storeu_ps(dst[Pose::PosX + c] + 4 * g,
+                        _mm_add_ps(min, _mm_mul_ps(step, steps)));
+        }
+    }
+#else
+  for (size_t j = 0; j < mNumJoints; ++j)
+    {
+      auto k0 = key0 + (j / 4) * keyGroup + j % 4;
+      auto k1 = key1 + (j / 4) * keyGroup + j % 4;
+
+      float q0[4];
+      float q1[4];
+      float len0 = 0.0f;
+      float len1 = 0.0f;
+      for (int c = 0; c < 3; ++c)
+        {
+          q0[c] = (float) (int16_t) k0[4 * c] / 32767.0f;
+          q1[c] = (float) (int16_t) k1[4 * c] / 32767.0f;
+          len0 += q0[c] * q0[c];
+          len1 += q1[c] * q1[c];
+        }
+      q0[3] = std::sqrt(std::max(0.0f, 1.0f - len0));
+      q1[3] = std::sqrt(std::max(0.0f, 1.0f - len1));
+      nlerp(q0, q1, weight);
+      for (int c = 0; c < 4; ++c) dst[c][j] = q0[c];
+
+      for (int c = 0; c < 3; ++c)
+        {
+          auto s0 = (float) k0[4 * (3 + c)];
+          auto s1 = (float) k1[4 * (3 + c)];
+          dst[Pose::PosX + c][j] = mPosMin[c * mStride + j]
+            + mPosStep[c * mStride + j] * (s0 + weight * (s1 - s0));
+        }
+    }
+#endif
+}
@@ -0,0 +1,186 @@
+#ifndef DMP_SCENE_ANIMATION_HPP
+#define DMP_SCENE_ANIMATION_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "VertexFormat.hpp"
+
+namespace dmp
+{
+  // A joint's rotation and translation relative to its parent
+  struct JointPose
+  {
+    glm::quat rotation;
+    glm::vec3 translation;
+  };
+
+  struct Joint
+  {
+    std::string name;
+    int32_t parent; // -1 for the root
+    JointPose bind;
+  };
+
+  // What a skinned mesh is drawn from: up to four joints per vertex, and
+  // how much each pulls it, out of 255
+  struct SkinnedVertex
+  {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+    uint8_t joints[4];
+    uint8_t weights[4];
+  };
+
+  // v bound to joints, with weights that are normalized and rounded so
+  // that they add up to exactly 255
+  SkinnedVertex skinVertex(const ObjectVertex & v,
+                           const glm::uvec4 & joints,
+                           const glm::vec4 & weights);
+
+  // A joint hierarchy, in an order where every joint comes after its
+  // parent so that poses can be taken to model space in one pass
+  class Skeleton
+  {
+  public:
+    Skeleton() = delete;
+    Skeleton(const Skeleton &) = default;
+    Skeleton & operator=(const Skeleton &) = default;
+
+    // joints must already be in parent first order
+    Skeleton(std::vector<Joint> joints);
+    ~Skeleton() = default;
+
+    size_t size() const {return mJoints.size();}
+    const Joint & joint(size_t j) const {return mJoints[j];}
+    int32_t parent(size_t j) const {return mJoints[j].parent;}
+
+    // index of the joint called name, or -1
+    int32_t find(const std::string & name) const;
+
+    // From model space to joint j's space in the bind pose, as the top
+    // three rows of the matrix, row after row
+    const float * inverseBind(size_t j) const
+    {
+      return mInverseBind.data() + 12 * j;
+    }
+
+  private:
+    void initSkeleton();
+
+    std::vector<Joint> mJoints;
+    std::vector<float> mInverseBind;
+  };
+
+  // The joints of one skeleton relative to their parents, with one array
+  // per component padded to a multiple of four joints, so that four
+  // joints are sampled and blended at once. Padding joints are left as
+  // identities
+  class Pose
+  {
+  public:
+    enum Component {RotX, RotY, RotZ, RotW, PosX, PosY, PosZ,
+                    NumComponents};
+
+    Pose() = default;
+    Pose(const Pose &) = default;
+    Pose & operator=(const Pose &) = default;
+
+    Pose(size_t numJoints);
+    ~Pose() = default;
+
+    // joints, and joints with the padding
+    size_t size() const {return mSize;}
+    size_t stride() const {return mStride;}
+
+    float * component(Component c) {return mData.data() + c * mStride;}
+    const float * component(Component c) const
+    {
+      return mData.data() + c * mStride;
+    }
+
+    JointPose get(size_t j) const;
+    void set(size_t j, const JointPose & pose);
+
+    // the skeleton's bind pose
+    static Pose bind(const Skeleton & skeleton);
+
+  private:
+    size_t mSize = 0;
+    size_t mStride = 0;
+    std::vector<float> mData;
+  };
+
+  // A looping clip of keyframes, sampled at a fixed rate, compressed to
+  // twelve bytes per joint per key. Rotations are stored as the x, y and z
+  // of a quaternion turned to have a positive w, which is rebuilt from
+  // them, at 16 bits each. Translations are 16 bits each across the range
+  // each joint moves over in the clip, so a joint that doesn't move gets
+  // its translation back exactly. Keys are laid out frame by frame in
+  // groups of four joints, each component together, so sampling reads
+  // them in order and decodes four joints at once
+  class AnimationClip
+  {
+  public:
+    AnimationClip() = delete;
+    AnimationClip(const AnimationClip &) = default;
+    AnimationClip & operator=(const AnimationClip &) = default;
+
+    // frames[f][j] is joint j at f / rate seconds. The last frame runs on
+    // into the first
+    AnimationClip(const std::string & name,
+                  const std::vector<std::vector<JointPose>> & frames,
+                  float rate);
+    ~AnimationClip() = default;
+
+    const std::string & name() const {return mName;}
+    size_t numJoints() const {return mNumJoints;}
+    size_t numFrames() const {return mNumFrames;}
+    float duration() const {return (float) mNumFrames / mRate;}
+
+    // out at time seconds in, wrapped around the clip. out must be a
+    // pose of numJoints joints
+    void sample(float time, Pose & out) const;
+
+    // size of the compressed keys
+    size_t bytes() const {return mKeys.size() * sizeof(uint16_t);}
+
+  private:
+    void initAnimationClip(const std::vector<std::vector<JointPose>> & frames);
+
+    std::string mName;
+    size_t mNumJoints;
+    size_t mStride; // joints with the padding to a multiple of four
+    size_t mNumFrames;
+    float mRate;
+
+    // per axis, then per joint, where each joint's translations start and
+    // how far apart the steps between them are
+    std::vector<float> mPosMin;
+    std::vector<float> mPosStep;
+
+    // per frame, per group of four joints: rotation x, y and z as signed,
+    // then translation x, y and z as unsigned, four of each
+    std::vector<uint16_t> mKeys;
+  };
+
+  // out is a weighted between a and b, which it may be either of.
+  // Rotations take the shorter way round and are normalized after
+  void blendPoses(const Pose & a, const Pose & b, float weight, Pose & out);
+
+  // Takes pose to model space, joint by joint, then placed by M. Writes,
+  // per joint, M times its model space transform times its inverse bind,
+  // as three rows of twelve floats in all: the matrix that skins a
+  // vertex bound to it. scratch holds the model space transforms and is
+  // grown to fit
+  void skinningPalette(const Skeleton & skeleton,
+                       const Pose & pose,
+                       const glm::mat4 & M,
+                       std::vector<float> & scratch,
+                       float * out);
+}
+
+#endif
@@ -0,0 +1,281 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <limits>
+
+bool dmp::BVH::builtFor(const std::vector<Object *> & objs) const
+{
+  return mObjects.size() == objs.size()
+    && std::equal(objs.begin(), objs.end(), mObjects.begin());
+}
+
+void dmp::BVH::build(const std::vector<Object *> & objs)
+{
+  auto numPrims = objs.size();
+  expect("BVH prim count fits in 32 bits",
+         numPrims < std::numeric_limits<uint32_t>::max());
+
+  mObjects.assign(objs.begin(), objs.end());
+  mPrimBounds.resize(numPrims);
+  mPrims.resize(numPrims);
+  mLeafOf.assign(numPrims, 0);
+  mNodes.clear();
+  mDepth = 0;
+
+  if (numPrims == 0) return;
+
+  std::vector<glm::vec3> centroids(numPrims);
+  for (size_t i = 0; i < numPrims; ++i)
+    {
+      expect("BVH object not null", objs[i]);
+      mPrimBounds[i] = objs[i]->worldBounds();
+      centroids[i] = mPrimBounds[i].centroid();
+      mPrims[i] = (uint32_t) i;
+    }
+
+  mNodes.reserve(2 * numPrims);
+  mNodes.push_back({AABB(), 0, (uint32_t) numPrims, noParent});
+  updateLeafBounds(0);
+
+  // depth first, so children always come after their parent in mNodes
+  std::vector<std::pair<uint32_t, size_t>> todo = {{0, 1}};
+  while (!todo.empty())
+    {
+      auto curr = todo.back();
+      todo.pop_back();
+      mDepth = std::max(mDepth, curr.second);
+
+      auto before = mNodes.size();
+      subdivide(curr.first, centroids);
+      if (mNodes.size() == before) continue;
+
+      todo.push_back({(uint32_t) before + 1, curr.second + 1});
+      todo.push_back({(uint32_t) before, curr.second + 1});
+    }
+}
+
+void dmp::BVH::subdivide(uint32_t nodeIdx,
+                         const std::vector<glm::vec3> & centroids)
+{
+  uint32_t first = mNodes[nodeIdx].leftOrFirst;
+  uint32_t count = mNodes[nodeIdx].count;
+
+  if (count <= maxLeafSize)
+    {
+      for (uint32_t i = first; i < first + count; ++i)
+        {
+          mLeafOf[mPrims[i]] = nodeIdx;
+        }
+      return;
+    }
+
+  AABB centroidBounds;
+  for (uint32_t i = first; i < first + count; ++i)
+    {
+      centroidBounds.grow(centroids[mPrims[i]]);
+    }
+
+  // Binned SAH: try a split between every pair of bins on every axis
+  int bestAxis = -1;
+  size_t bestSplit = 0;
+  float bestCost = std::numeric_limits<float>::infinity();
+
+  for (int axis = 0; axis < 3; ++axis)
+    {
+      float lo = centroidBounds.min[axis];
+      float extent = centroidBounds.max[axis] - lo;
+      if (extent <= 0.0f) continue;
+
+      AABB binBounds[numBins];
+      uint32_t binCounts[numBins] = {};
+      float scale = (float) numBins / extent;
+
+      for (uint32_t i = first; i < first + count; ++i)
+        {
+          auto prim = mPrims[i];
+          auto bin = std::min(numBins - 1,
+                              (size_t) ((centroids[prim][axis] - lo) * scale));
+          ++binCounts[bin];
+          binBounds[bin].grow(mPrimBounds[prim]);
+        }
+
+      float leftArea[numBins - 1];
+      uint32_t leftCount[numBins - 1];
+      AABB sweep;
+      uint32_t sum = 0;
+      for (size_t i = 0; i < numBins - 1; ++i)
+        {
+          sweep.grow(binBounds[i]);
+          sum += binCounts[i];
+          leftArea[i] = sweep.surfaceArea();
+          leftCount[i] = sum;
+        }
+
+      sweep = AABB();
+      sum = 0;
+      for (size_t i = numBins - 1; i > 0; --i)
+        {
+          sweep.grow(binBounds[i]);
+          sum += binCounts[i];
+
+          float cost = (float) leftCount[i - 1] * leftArea[i - 1]
+            + (float) sum * sweep.surfaceArea();
+          if (cost < bestCost)
+            {
+              bestCost = cost;
+              bestAxis = axis;
+              bestSplit = i - 1;
+            }
+        }
+    }
+
+  uint32_t mid = first + count / 2;
+
+  if (bestAxis >= 0)
+    {
+      float lo = centroidBounds.min[bestAxis];
+      float scale = (float) numBins
+        / (centroidBounds.max[bestAxis] - lo);
+
+      auto split = std::partition(mPrims.begin() + first,
+                                  mPrims.begin() + first + count,
+                                  [&](uint32_t prim)
+                                  {
+                                    auto bin = std::min(numBins - 1,
+                                                        (size_t) ((centroids[prim][bestAxis] - lo) * scale));
+                                    return bin <= bestSplit;
+                                  });
+      mid = (uint32_t) (split - mPrims.begin());
+    }
+
+  // every centroid landed on the same side; fall back to an even split
+  if (mid == first || mid == first + count) mid = first + count / 2;
+
+  auto left = (uint32_t) mNodes.size();
+  mNodes.push_back({AABB(), first, mid - first, nodeIdx});
+  mNodes.push_back({AABB(), mid, first + count - mid, nodeIdx});
+  updateLeafBounds(left);
+  updateLeafBounds(left + 1);
+
+  mNodes[nodeIdx].leftOrFirst = left;
+  mNodes[nodeIdx].count = 0;
+}
+
+void dmp::BVH::updateLeafBounds(uint32_t nodeIdx)
+{
+  auto & node = mNodes[nodeIdx];
+  node.bounds = AABB();
+  for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+    {
+      node.bounds.grow(mPrimBounds[mPrims[i]]);
+    }
+}
+
+void dmp::BVH::refitAll()
+{
+  for (size_t i = mNodes.size(); i > 0; --i)
+    {
+      auto & node = mNodes[i - 1];
+      if (node.count > 0)
+        {
+          updateLeafBounds((uint32_t) i - 1);
+        }
+      else
+        {
+          node.bounds = mNodes[node.leftOrFirst].bounds;
+          node.bounds.grow(mNodes[node.leftOrFirst + 1].bounds);
+        }
+    }
+}
+
+void dmp::BVH::refit(const std::vector<size_t> & moved)
+{
+  if (mNodes.empty() || moved.empty()) return;
+
+  for (auto idx : moved)
+    {
+      expect("moved index in range", idx < mObjects.size());
+      mPrimBounds[idx] = mObjects[idx]->worldBounds();
+    }
+
+  // walking from each leaf to the root costs about moved * depth. Past the
+  // point where that visits every node, just sweep the whole tree once
+  if (moved.size() * mDepth >= mNodes.size())
+    {
+      refitAll();
+      return;
+    }
+
+  for (auto idx : moved)
+    {
+      auto curr = mLeafOf[idx];
+      updateLeafBounds(curr);
+      curr = mNodes[curr].parent;
+
+      while (curr != noParent)
+        {
+          auto & node = mNodes[curr];
+          node.bounds = mNodes[node.leftOrFirst].bounds;
+          node.bounds.grow(mNodes[node.leftOrFirst + 1].bounds);
+          curr = node.parent;
+        }
+    }
+}
+
+int dmp::BVH::intersect(const Ray & ray) const
+{
+  if (mNodes.empty()) return -1;
+
+  glm::vec3 invDir = 1.0f / ray.dir;
+  float closest = std::numeric_limits<float>::infinity();
+  int hit = -1;
+  float tNear;
+
+  if (!mNodes[0].bounds.intersect(ray, invDir, closest, tNear)) return -1;
+
+  std::vector<uint32_t> stack;
+  stack.reserve(mDepth + 1);
+  stack.push_back(0);
+
+  while (!stack.empty())
+    {
+      const auto & node = mNodes[stack.back()];
+      stack.pop_back();
+
+      if (node.count > 0)
+        {
+          for (uint32_t i = node.leftOrFirst;
+               i < node.leftOrFirst + node.count;
+               ++i)
+            {
+              auto prim = mPrims[i];
+              if (!mObjects[prim]->isVisible()) continue;
+              if (!mPrimBounds[prim].intersect(ray, invDir, closest, tNear))
+                {
+                  continue;
+                }
+              if (mObjects[prim]->intersect(ray, closest)) hit = (int) prim;
+            }
+          continue;
+        }
+
+      // visit the nearer child first so that its hits can cull the other
+      uint32_t near = node.leftOrFirst;
+      uint32_t far = node.leftOrFirst + 1;
+      float tNearChild, tFarChild;
+      bool hitNear = mNodes[near].bounds.intersect(ray, invDir,
+                                                   closest, tNearChild);
+      bool hitFar = mNodes[far].bounds.intersect(ray, invDir,
+                                                 closest, tFarChild);
+
+      if (hitNear && hitFar && tFarChild < tNearChild)
+        {
+          std::swap(near, far);
+        }
+
+      if (hitFar) stack.push_back(far);
+      if (hitNear) stack.push_back(near);
+    }
+
+  return hit;
+}
@@ -0,0 +1,62 @@
+#ifndef DMP_SCENE_BVH_HPP
+#define DMP_SCENE_BVH_HPP
+
+#include <vector>
+#include <cstdint>
+#include "Types.hpp"
+#include "Object.hpp"
+
+namespace dmp
+{
+  // Bounding volume hierarchy over the world space bounds of a list of
+  // Objects. Built once with binned SAH, then refit as objects move. Only a
+  // change to the list itself (objects added, removed or reordered) requires
+  // a rebuild
+  class BVH
+  {
+  public:
+    BVH() = default;
+    BVH(const BVH &) = delete;
+    BVH & operator=(const BVH &) = delete;
+    BVH(BVH &&) = default;
+    BVH & operator=(BVH &&) = default;
+
+    // true if the hierarchy was built over exactly this list of objects
+    bool builtFor(const std::vector<Object *> & objs) const;
+
+    void build(const std::vector<Object *> & objs);
+
+    // objects at these indices have moved since the last build or refit
+    void refit(const std::vector<size_t> & moved);
+
+    // returns the index of the closest visible object hit by the ray, or -1
+    int intersect(const Ray & ray) const;
+
+  private:
+    struct Node
+    {
+      AABB bounds;
+      uint32_t leftOrFirst; // left child if interior, first prim if leaf
+      uint32_t count;       // 0 if interior
+      uint32_t parent;
+    };
+
+    static const uint32_t noParent = 0xFFFFFFFF;
+    static const uint32_t maxLeafSize = 4;
+    static const size_t numBins = 12;
+
+    void subdivide(uint32_t nodeIdx,
+                   const std::vector<glm::vec3> & centroids);
+    void updateLeafBounds(uint32_t nodeIdx);
+    void refitAll();
+
+    std::vector<const Object *> mObjects;
+    std::vector<AABB> mPrimBounds;
+    std::vector<uint32_t> mPrims;
+    std::vector<uint32_t> mLeafOf;
+    std::vector<Node> mNodes;
+    size_t mDepth = 0;
+  };
+}
+
+#endif
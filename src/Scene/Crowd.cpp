@@ -0,0 +1,375 @@
+#include "Crowd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include "../util.hpp"
+#include "../config.hpp"
+
+namespace
+{
+  // texels of RGBA32F per joint in a palette
+  const size_t texelsPerJoint = 3;
+}
+
+dmp::Crowd::Crowd(Skeleton skeleton,
+                  std::vector<AnimationClip> clips,
+                  const std::vector<SkinnedVertex> & verts,
+                  const std::vector<GLuint> & idxs,
+                  size_t capacity,
+                  size_t matIdx,
+                  size_t texIdx)
+  : mSkeleton(std::move(skeleton)),
+    mClips(std::move(clips)),
+    mMaterialIdx(matIdx),
+    mTextureIdx(texIdx)
+{
+  initCrowd(verts, idxs, capacity);
+}
+
+void dmp::Crowd::initCrowd(const std::vector<SkinnedVertex> & verts,
+                           const std::vector<GLuint> & idxs,
+                           size_t capacity)
+{
+  expect("Crowd has room", capacity > 0);
+  expect("Crowd has clips", !mClips.empty());
+  expect("Crowd joints fit a byte", mSkeleton.size() <= 256);
+  for (const auto & curr : mClips)
+    {
+      expect("Crowd clips fit its skeleton",
+             curr.numJoints() == mSkeleton.size());
+    }
+
+  mCapacity = capacity;
+  mMembers.reserve(capacity);
+  mBatches.resize((capacity + crowdBatchSize - 1) / crowdBatchSize);
+  for (auto & curr : mBatches)
+    {
+      curr.visible.reserve(crowdBatchSize);
+      curr.pose = Pose(mSkeleton.size());
+      curr.blend = Pose(mSkeleton.size());
+    }
+
+  initBounds(verts);
+
+  glGenVertexArrays(1, &mVAO);
+  glGenBuffers(1, &mVBO);
+  glGenBuffers(1, &mEBO);
+  glBindVertexArray(mVAO);
+
+  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+  glBufferData(GL_ARRAY_BUFFER,
+               (GLsizeiptr) (verts.size() * sizeof(SkinnedVertex)),
+               verts.data(),
+               GL_STATIC_DRAW);
+
+  auto stride = (GLsizei) sizeof(SkinnedVertex);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                        (const GLvoid *) offsetof(SkinnedVertex, position));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+                        (const GLvoid *) offsetof(SkinnedVertex, normal));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
+                        (const GLvoid *) offsetof(SkinnedVertex, texCoords));
+  glEnableVertexAttribArray(3);
+  glVertexAttribIPointer(3, 4, GL_UNSIGNED_BYTE, stride,
+                         (const GLvoid *) offsetof(SkinnedVertex, joints));
+  glEnableVertexAttribArray(4);
+  glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                        (const GLvoid *) offsetof(SkinnedVertex, weights));
+
+  // 16 bit indices when they'll do, as for static meshes
+  mNumIndices = idxs.size();
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+  if (verts.size() <= 65536)
+    {
+      std::vector<uint16_t> narrow(idxs.begin(), idxs.end());
+      mIndexType = GL_UNSIGNED_SHORT;
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                   (GLsizeiptr) (narrow.size() * sizeof(uint16_t)),
+                   narrow.data(),
+                   GL_STATIC_DRAW);
+    }
+  else
+    {
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                   (GLsizeiptr) (idxs.size() * sizeof(GLuint)),
+                   idxs.data(),
+                   GL_STATIC_DRAW);
+    }
+
+  glBindVertexArray(0);
+
+  // GL 4.1 only promises 65536 texels in a buffer texture, though
+  // desktop drivers take far more
+  auto texels = capacity * mSkeleton.size() * texelsPerJoint;
+  GLint maxTexels = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+  expect("Crowd palettes fit a buffer texture",
+         texels * streamRegions <= (size_t) maxTexels);
+
+  glGenBuffers(1, &mPaletteBuffer);
+  glGenTextures(1, &mPaletteTexture);
+  mStream = std::make_unique<StreamBuffer>(mPaletteBuffer,
+                                           GL_TEXTURE_BUFFER,
+                                           texels * 4 * sizeof(float),
+                                           streamRegions,
+                                           nullptr);
+  glBindTexture(GL_TEXTURE_BUFFER, mPaletteTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mPaletteBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  expectNoErrors("Init crowd");
+  mValid = true;
+}
+
+void dmp::Crowd::initBounds(const std::vector<SkinnedVertex> & verts)
+{
+  auto numJoints = mSkeleton.size();
+
+  // each joint's bind position, and how far from it its vertices reach.
+  // However the joints bend, a vertex stays within that of each joint it's
+  // bound to, and so within the box around those reaches
+  std::vector<glm::vec3> joints(numJoints);
+  for (size_t j = 0; j < numJoints; ++j)
+    {
+      auto inv = mSkeleton.inverseBind(j);
+      for (int i = 0; i < 3; ++i)
+        {
+          joints[j][i] = -(inv[i] * inv[3]
+                           + inv[4 + i] * inv[7]
+                           + inv[8 + i] * inv[11]);
+        }
+    }
+
+  std::vector<float> reach(numJoints, 0.0f);
+  for (const auto & v : verts)
+    {
+      for (int k = 0; k < 4; ++k)
+        {
+          if (v.weights[k] == 0) continue;
+          auto j = v.joints[k];
+          expect("Skinned vertex joint in skeleton", j < numJoints);
+          reach[j] = std::max(reach[j], glm::length(v.position - joints[j]));
+        }
+    }
+
+  // where the joints go at every key of every clip
+  Pose pose(numJoints);
+  std::vector<float> palette(12 * numJoints);
+  std::vector<float> scratch;
+  for (const auto & clip : mClips)
+    {
+      for (size_t f = 0; f < clip.numFrames(); ++f)
+        {
+          clip.sample(clip.duration() * (float) f / (float) clip.numFrames(),
+                      pose);
+          skinningPalette(mSkeleton, pose, glm::mat4(), scratch,
+                          palette.data());
+          for (size_t j = 0; j < numJoints; ++j)
+            {
+              if (reach[j] == 0.0f) continue;
+
+              auto m = palette.data() + 12 * j;
+              glm::vec3 at;
+              for (int i = 0; i < 3; ++i)
+                {
+                  at[i] = m[4 * i] * joints[j].x
+                    + m[4 * i + 1] * joints[j].y
+                    + m[4 * i + 2] * joints[j].z
+                    + m[4 * i + 3];
+                }
+              mBounds.grow(at - glm::vec3(reach[j]));
+              mBounds.grow(at + glm::vec3(reach[j]));
+            }
+        }
+    }
+
+  // poses between keys and blends between clips can stray a little past
+  // the keys themselves
+  auto margin = 0.1f * (mBounds.max - mBounds.min);
+  mBounds.min -= margin;
+  mBounds.max += margin;
+}
+
+void dmp::Crowd::freeCrowd()
+{
+  if (!mValid) return;
+
+  mStream.reset();
+  glDeleteTextures(1, &mPaletteTexture);
+  glDeleteBuffers(1, &mPaletteBuffer);
+  glDeleteVertexArrays(1, &mVAO);
+  glDeleteBuffers(1, &mVBO);
+  glDeleteBuffers(1, &mEBO);
+
+  mValid = false;
+}
+
+size_t dmp::Crowd::add(const glm::mat4 & M, size_t clip, float time)
+{
+  expect("Crowd not full", mMembers.size() < mCapacity);
+  expect("Crowd clip exists", clip < mClips.size());
+
+  Member member;
+  member.M = M;
+  member.clip = clip;
+  member.time = time;
+  mMembers.push_back(member);
+  return mMembers.size() - 1;
+}
+
+void dmp::Crowd::play(size_t member, size_t clip, float fadeTime)
+{
+  expect("Crowd clip exists", clip < mClips.size());
+
+  auto & m = mMembers[member];
+  if (playing(member) == clip) return;
+
+  // a fade already under way is cut short, into the clip it was after
+  if (m.fading)
+    {
+      m.clip = m.next;
+      m.time = m.nextTime;
+    }
+
+  const auto & from = mClips[m.clip];
+  auto through = m.time / from.duration();
+  through -= std::floor(through);
+
+  m.next = clip;
+  m.nextTime = through * mClips[clip].duration();
+  m.fade = 0.0f;
+  m.fadeRate = fadeTime > 0.0f ? 1.0f / fadeTime : 0.0f;
+  m.fading = fadeTime > 0.0f;
+  if (!m.fading)
+    {
+      m.clip = clip;
+      m.time = m.nextTime;
+    }
+}
+
+size_t dmp::Crowd::playing(size_t member) const
+{
+  const auto & m = mMembers[member];
+  return m.fading ? m.next : m.clip;
+}
+
+void dmp::Crowd::setView(const glm::mat4 & PV)
+{
+  mPV = PV;
+  mHasView = true;
+}
+
+void dmp::Crowd::update(float deltaT, ThreadPool * pool)
+{
+  auto numBatches = (mMembers.size() + crowdBatchSize - 1) / crowdBatchSize;
+
+  auto step = [&](size_t b) {advance(b, deltaT);};
+  if (pool) pool->parallelFor(numBatches, step);
+  else for (size_t b = 0; b < numBatches; ++b) step(b);
+
+  mVisible = 0;
+  for (size_t b = 0; b < numBatches; ++b)
+    {
+      mBatches[b].offset = mVisible;
+      mVisible += mBatches[b].visible.size();
+    }
+  if (mVisible == 0) return;
+
+  auto floatsPerMember = 4 * texelsPerJoint * mSkeleton.size();
+  auto out = static_cast<float *>(
+    mStream->map(0, mVisible * floatsPerMember * sizeof(float)));
+  auto write = [&](size_t b)
+    {
+      pose(b, out + mBatches[b].offset * floatsPerMember);
+    };
+  if (pool) pool->parallelFor(numBatches, write);
+  else for (size_t b = 0; b < numBatches; ++b) write(b);
+  mStream->unmap();
+}
+
+void dmp::Crowd::advance(size_t batch, float deltaT)
+{
+  auto first = batch * crowdBatchSize;
+  auto last = std::min(first + crowdBatchSize, mMembers.size());
+  auto & visible = mBatches[batch].visible;
+  visible.clear();
+
+  Frustum frustum(mPV * mM);
+
+  for (auto i = first; i < last; ++i)
+    {
+      auto & m = mMembers[i];
+      m.time += deltaT;
+      if (m.fading)
+        {
+          m.nextTime += deltaT;
+          m.fade += deltaT * m.fadeRate;
+          if (m.fade >= 1.0f)
+            {
+              m.clip = m.next;
+              m.time = m.nextTime;
+              m.fading = false;
+            }
+        }
+
+      // kept within the clip, so precision doesn't wear away
+      auto duration = mClips[m.clip].duration();
+      if (m.time > duration) m.time -= duration * std::floor(m.time / duration);
+
+      if (mHasView && frustum.outside(mBounds.transform(m.M))) continue;
+      visible.push_back((uint32_t) i);
+    }
+}
+
+void dmp::Crowd::pose(size_t batch, float * out)
+{
+  auto & b = mBatches[batch];
+  auto floatsPerMember = 4 * texelsPerJoint * mSkeleton.size();
+
+  for (auto i : b.visible)
+    {
+      const auto & m = mMembers[i];
+      mClips[m.clip].sample(m.time, b.pose);
+      if (m.fading)
+        {
+          mClips[m.next].sample(m.nextTime, b.blend);
+          blendPoses(b.pose, b.blend, m.fade, b.pose);
+        }
+
+      skinningPalette(mSkeleton, b.pose, mM * m.M, b.model, out);
+      out += floatsPerMember;
+    }
+}
+
+void dmp::Crowd::draw(GLenum unit, GLuint shaderProg) const
+{
+  expect("Crowd valid", mValid);
+  if (mVisible == 0) return;
+
+  glActiveTexture(unit);
+  glBindTexture(GL_TEXTURE_BUFFER, mPaletteTexture);
+  glUniform1i(glGetUniformLocation(shaderProg, "palette"),
+              (GLint) (unit - GL_TEXTURE0));
+
+  // there's no texture buffer range in GL 4.1, so the whole buffer is
+  // bound and the shader told where the region drawn starts
+  auto first = mStream->region() * mStream->regionBytes()
+    / (4 * sizeof(float));
+  glUniform1i(glGetUniformLocation(shaderProg, "paletteOffset"),
+              (GLint) first);
+  glUniform1i(glGetUniformLocation(shaderProg, "numJoints"),
+              (GLint) mSkeleton.size());
+
+  glBindVertexArray(mVAO);
+  glDrawElementsInstanced(GL_TRIANGLES,
+                          (GLsizei) mNumIndices,
+                          mIndexType,
+                          nullptr,
+                          (GLsizei) mVisible);
+  expectNoErrors("Draw crowd");
+}
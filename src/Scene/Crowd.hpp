@@ -0,0 +1,148 @@
+#ifndef DMP_SCENE_CROWD_HPP
+#define DMP_SCENE_CROWD_HPP
+
+#include <vector>
+#include <memory>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Types.hpp"
+#include "Animation.hpp"
+#include "../ThreadPool.hpp"
+#include "../Renderer/StreamBuffer.hpp"
+
+namespace dmp
+{
+  // Many copies of one skinned mesh, each placed and animated on its own,
+  // drawn with one instanced draw. Each member plays one of the crowd's
+  // clips, cross fading into another when told to play it.
+  //
+  // Each update, members are culled against the view and the visible
+  // ones have their clips sampled, blended and taken to a palette of
+  // skinning matrices, crowdBatchSize members to a task on the pool. The
+  // palettes are streamed into a buffer texture, three RGBA32F texels per
+  // joint, one member after another, which the skinned shader variant
+  // reads by gl_InstanceID
+  class Crowd
+  {
+  public:
+    Crowd() = delete;
+    Crowd(const Crowd &) = delete;
+    Crowd & operator=(const Crowd &) = delete;
+
+    // Room for capacity members. Every clip must be for skeleton, and
+    // every vertex bound to its joints. Must be called on the GL thread
+    Crowd(Skeleton skeleton,
+          std::vector<AnimationClip> clips,
+          const std::vector<SkinnedVertex> & verts,
+          const std::vector<GLuint> & idxs,
+          size_t capacity,
+          size_t matIdx,
+          size_t texIdx);
+    ~Crowd() {}
+
+    void freeCrowd();
+
+    // where the whole crowd is, set by the scene graph
+    void setM(glm::mat4 M) {mM = M;}
+    glm::mat4 getM() const {return mM;}
+
+    // a member at M within the crowd, time seconds into clip
+    size_t add(const glm::mat4 & M, size_t clip, float time = 0.0f);
+    void setM(size_t member, const glm::mat4 & M) {mMembers[member].M = M;}
+
+    // Fades member from what it's playing into clip over fadeTime
+    // seconds, starting clip as far through as the one it leaves is, so
+    // that cycles such as footsteps line up
+    void play(size_t member, size_t clip, float fadeTime);
+
+    // the clip member is playing, or fading into
+    size_t playing(size_t member) const;
+
+    // The view later updates cull against, usually that of the last frame
+    // drawn. Until this is first called every member is drawn
+    void setView(const glm::mat4 & PV);
+
+    // Moves on by deltaT, with a pool spreading the members over it. Must
+    // be called on the GL thread, not from one of pool's tasks
+    void update(float deltaT, ThreadPool * pool = nullptr);
+
+    // the skinned shader must be in use already, with its palette sampler
+    // on unit
+    void draw(GLenum unit, GLuint shaderProg) const;
+
+    size_t materialIndex() const {return mMaterialIdx;}
+    size_t textureIndex() const {return mTextureIdx;}
+
+    const Skeleton & skeleton() const {return mSkeleton;}
+    const std::vector<AnimationClip> & clips() const {return mClips;}
+
+    // members, and those drawn at the last update
+    size_t size() const {return mMembers.size();}
+    size_t visible() const {return mVisible;}
+    size_t numTriangles() const {return mNumIndices / 3;}
+
+    // updates that had to wait for the GPU to finish drawing
+    size_t streamStalls() const {return mStream ? mStream->stalls() : 0;}
+
+  private:
+    struct Member
+    {
+      glm::mat4 M;
+      size_t clip;
+      float time;
+
+      // fading into next, fade of the way there
+      bool fading = false;
+      size_t next = 0;
+      float nextTime = 0.0f;
+      float fade = 0.0f;
+      float fadeRate = 0.0f;
+    };
+
+    // what one task works with, kept to save reallocating each update
+    struct Batch
+    {
+      std::vector<uint32_t> visible;
+      size_t offset = 0; // of its first palette, in members
+      Pose pose;
+      Pose blend;
+      std::vector<float> model;
+    };
+
+    void initCrowd(const std::vector<SkinnedVertex> & verts,
+                   const std::vector<GLuint> & idxs,
+                   size_t capacity);
+    void initBounds(const std::vector<SkinnedVertex> & verts);
+    void advance(size_t batch, float deltaT);
+    void pose(size_t batch, float * out);
+
+    Skeleton mSkeleton;
+    std::vector<AnimationClip> mClips;
+    std::vector<Member> mMembers;
+    std::vector<Batch> mBatches;
+    size_t mCapacity = 0;
+    size_t mVisible = 0;
+
+    glm::mat4 mM;
+    bool mHasView = false;
+    glm::mat4 mPV;
+
+    // of any member in any pose, in its own space
+    AABB mBounds;
+
+    size_t mMaterialIdx;
+    size_t mTextureIdx;
+
+    bool mValid = false;
+    GLuint mVAO = 0;
+    GLuint mVBO = 0;
+    GLuint mEBO = 0;
+    GLenum mIndexType = GL_UNSIGNED_INT;
+    size_t mNumIndices = 0;
+    GLuint mPaletteBuffer = 0;
+    GLuint mPaletteTexture = 0;
+    std::unique_ptr<StreamBuffer> mStream;
+  };
+}
+
+#endif
@@ -26,6 +26,21 @@ void ContainerVisitor::operator()(Light & lit) const
   lit.M = mM;
 }
 
+void ContainerVisitor::operator()(PointLight & lit) const
+{
+  lit.M = mM;
+}
+
+void ContainerVisitor::operator()(ParticleEmitter & emitter) const
+{
+  emitter.setM(mM);
+}
+
+void ContainerVisitor::operator()(Crowd & crowd) const
+{
+  crowd.setM(mM);
+}
+
 // -----------------------------------------------------------------------------
 // Container
 // -----------------------------------------------------------------------------
@@ -54,6 +69,24 @@ Light * Transform::insert(Light & l)
   return &(boost::get<Light &>(((Container *) mChild.get())->mValue));
 }
 
+PointLight * Transform::insert(PointLight & l)
+{
+  mChild = std::make_unique<Container>(l);
+  return &(boost::get<PointLight &>(((Container *) mChild.get())->mValue));
+}
+
+ParticleEmitter * Transform::insert(ParticleEmitter & e)
+{
+  mChild = std::make_unique<Container>(e);
+  return &(boost::get<ParticleEmitter &>(((Container *) mChild.get())->mValue));
+}
+
+Crowd * Transform::insert(Crowd & c)
+{
+  mChild = std::make_unique<Container>(c);
+  return &(boost::get<Crowd &>(((Container *) mChild.get())->mValue));
+}
+
 CameraPos * Transform::insert(CameraPos & c)
 {
   mChild = std::make_unique<Container>(c);
@@ -246,6 +279,24 @@ Light * Branch::insert(Light & l)
   return &(boost::get<Light &>(((Container *) mChildren.back().get())->mValue));
 }
 
+PointLight * Branch::insert(PointLight & l)
+{
+  mChildren.push_back(std::make_unique<Container>(l));
+  return &(boost::get<PointLight &>(((Container *) mChildren.back().get())->mValue));
+}
+
+ParticleEmitter * Branch::insert(ParticleEmitter & e)
+{
+  mChildren.push_back(std::make_unique<Container>(e));
+  return &(boost::get<ParticleEmitter &>(((Container *) mChildren.back().get())->mValue));
+}
+
+Crowd * Branch::insert(Crowd & c)
+{
+  mChildren.push_back(std::make_unique<Container>(c));
+  return &(boost::get<Crowd &>(((Container *) mChildren.back().get())->mValue));
+}
+
 CameraPos * Branch::insert(CameraPos & c)
 {
   mChildren.push_back(std::make_unique<Container>(c));
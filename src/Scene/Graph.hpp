@@ -9,6 +9,8 @@
 #include <memory>
 #include "Object.hpp"
 #include "Camera.hpp"
+#include "Particles.hpp"
+#include "Crowd.hpp"
 #include <glm/gtc/quaternion.hpp>
 
 
@@ -39,6 +41,9 @@ namespace dmp
     void operator()(CameraPos & cam) const;
     void operator()(CameraFocus & cam) const;
     void operator()(Light & lit) const;
+    void operator()(PointLight & lit) const;
+    void operator()(ParticleEmitter & emitter) const;
+    void operator()(Crowd & crowd) const;
 
     float mDeltaT;
     glm::mat4 mM;
@@ -53,7 +58,16 @@ namespace dmp
     Container(CameraPos & cam) : mValue(cam) {}
     Container(CameraFocus & cam) : mValue(cam) {}
     Container(Light & lit) : mValue(lit) {}
-    boost::variant<Object, CameraPos &, CameraFocus &, Light &> mValue;
+    Container(PointLight & lit) : mValue(lit) {}
+    Container(ParticleEmitter & emitter) : mValue(emitter) {}
+    Container(Crowd & crowd) : mValue(crowd) {}
+    boost::variant<Object,
+                   CameraPos &,
+                   CameraFocus &,
+                   Light &,
+                   PointLight &,
+                   ParticleEmitter &,
+                   Crowd &> mValue;
   private:
     void updateImpl(float deltaT, glm::mat4 M, bool dirty) override;
 
@@ -80,6 +94,9 @@ namespace dmp
 
     Object * insert(Object o);
     Light * insert(Light & l);
+    PointLight * insert(PointLight & l);
+    ParticleEmitter * insert(ParticleEmitter & e);
+    Crowd * insert(Crowd & c);
     CameraPos * insert(CameraPos & c);
     CameraFocus * insert(CameraFocus & c);
     Node * insert(std::unique_ptr<Node> & n);
@@ -109,6 +126,9 @@ namespace dmp
     Container * insert(std::unique_ptr<Container> & c);
     Object * insert(Object o);
     Light * insert(Light & l);
+    PointLight * insert(PointLight & l);
+    ParticleEmitter * insert(ParticleEmitter & e);
+    Crowd * insert(Crowd & c);
     CameraPos * insert(CameraPos & c);
     CameraFocus * insert(CameraFocus & c);
 
@@ -0,0 +1,444 @@
+#include "MeshCache.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstddef>
+#include <sys/stat.h>
+#include "../../util.hpp"
+#include "../../config.hpp"
+#include "../VertexFormat.hpp"
+
+static_assert(sizeof(dmp::CookedMesh::Header) == 136,
+              "CookedMesh::Header has no padding");
+static_assert(sizeof(dmp::CookedMesh::Attribute) == 20,
+              "CookedMesh::Attribute has no padding");
+static_assert(sizeof(dmp::CookedMesh::Submesh) == 80,
+              "CookedMesh::Submesh has no padding");
+static_assert(sizeof(dmp::CookedMesh::Lod) == 24,
+              "CookedMesh::Lod has no padding");
+
+namespace
+{
+  // vertex and index blobs start on this boundary within the file
+  const size_t blobAlignment = 64;
+
+  size_t alignUp(size_t n, size_t align)
+  {
+    return (n + align - 1) / align * align;
+  }
+
+  // the submesh and lod tables follow the attributes, aligned for their
+  // 64 bit fields
+  uint64_t submeshOffset(uint64_t numAttributes)
+  {
+    return alignUp((size_t) (sizeof(dmp::CookedMesh::Header)
+                             + numAttributes
+                             * sizeof(dmp::CookedMesh::Attribute)),
+                   sizeof(uint64_t));
+  }
+
+  bool inFile(uint64_t offset, uint64_t bytes, size_t fileSize)
+  {
+    return offset <= fileSize && bytes <= fileSize - offset;
+  }
+
+  dmp::AABB toAABB(const float (&min)[3], const float (&max)[3])
+  {
+    dmp::AABB res;
+    res.min = {min[0], min[1], min[2]};
+    res.max = {max[0], max[1], max[2]};
+    return res;
+  }
+
+  void fromAABB(const dmp::AABB & box, float (&min)[3], float (&max)[3])
+  {
+    for (int i = 0; i < 3; ++i)
+      {
+        min[i] = box.min[i];
+        max[i] = box.max[i];
+      }
+  }
+
+  template <typename T>
+  uint64_t hashValue(const T & value, uint64_t seed)
+  {
+    return dmp::hashBytes(&value, sizeof(value), seed);
+  }
+
+  // format's layout as it is written to the file
+  std::vector<dmp::CookedMesh::Attribute> fileLayout(dmp::VertexFormat format)
+  {
+    std::vector<dmp::CookedMesh::Attribute> res;
+    for (const auto & curr : dmp::vertexLayout(format).attributes)
+      {
+        res.push_back({curr.location,
+                       (uint32_t) curr.components,
+                       curr.type,
+                       curr.normalized,
+                       curr.offset});
+      }
+    return res;
+  }
+}
+
+dmp::CookedMesh::CookedMesh(MappedFile && file)
+  : mFile(std::make_shared<MappedFile>(std::move(file)))
+{
+  if (validate()) return;
+
+  mFile = nullptr;
+  mHeader = nullptr;
+  mSubmeshes = nullptr;
+  mLods = nullptr;
+}
+
+bool dmp::CookedMesh::validate()
+{
+  if (!mFile->valid() || mFile->size() < sizeof(Header)) return false;
+
+  auto size = mFile->size();
+  mHeader = reinterpret_cast<const Header *>(mFile->data());
+
+  if (mHeader->magic != magic
+      || mHeader->version != version
+      || mHeader->vertexFormat > (uint32_t) VertexFormat::Quantized)
+    {
+      return false;
+    }
+
+  auto format = (VertexFormat) mHeader->vertexFormat;
+  auto layout = fileLayout(format);
+  auto stride = (uint64_t) vertexLayout(format).stride;
+  if (mHeader->vertexStride != stride
+      || mHeader->numAttributes != layout.size())
+    {
+      return false;
+    }
+
+  auto tables = submeshOffset(mHeader->numAttributes)
+    + (uint64_t) mHeader->numSubmeshes * sizeof(Submesh)
+    + (uint64_t) mHeader->numLods * sizeof(Lod);
+  if (tables > size
+      || mHeader->vertexOffset % blobAlignment != 0
+      || mHeader->indexOffset % blobAlignment != 0
+      || mHeader->vertexBytes % stride != 0
+      || !inFile(mHeader->namesOffset, mHeader->namesBytes, size)
+      || !inFile(mHeader->vertexOffset, mHeader->vertexBytes, size)
+      || !inFile(mHeader->indexOffset, mHeader->indexBytes, size))
+    {
+      return false;
+    }
+
+  auto attributes = reinterpret_cast<const Attribute *>(mFile->data()
+                                                        + sizeof(Header));
+  if (std::memcmp(attributes, layout.data(), layout.size() * sizeof(Attribute)))
+    {
+      return false;
+    }
+
+  mSubmeshes = reinterpret_cast<const Submesh *>(
+    mFile->data() + submeshOffset(mHeader->numAttributes));
+  mLods = reinterpret_cast<const Lod *>(mSubmeshes + mHeader->numSubmeshes);
+  auto numVerts = mHeader->vertexBytes / stride;
+  for (uint32_t i = 0; i < mHeader->numSubmeshes; ++i)
+    {
+      const auto & s = mSubmeshes[i];
+      if (s.indexType != GL_UNSIGNED_SHORT && s.indexType != GL_UNSIGNED_INT)
+        {
+          return false;
+        }
+
+      auto indexSize = indexBytes(s.indexType);
+      if (s.firstVertex > numVerts
+          || s.numVerts > numVerts - s.firstVertex
+          || s.indexOffset % indexSize != 0
+          || s.indexOffset > mHeader->indexBytes
+          || s.numIndices > (mHeader->indexBytes - s.indexOffset) / indexSize
+          || (uint64_t) s.nameOffset + s.nameBytes > mHeader->namesBytes
+          || (uint64_t) s.firstLod + s.numLods > mHeader->numLods)
+        {
+          return false;
+        }
+
+      for (uint32_t l = s.firstLod; l < s.firstLod + s.numLods; ++l)
+        {
+          if (mLods[l].firstIndex > s.numIndices
+              || mLods[l].numIndices > s.numIndices - mLods[l].firstIndex)
+            {
+              return false;
+            }
+        }
+    }
+
+  return true;
+}
+
+std::string dmp::CookedMesh::name(size_t i) const
+{
+  auto names = reinterpret_cast<const char *>(mFile->data()
+                                              + mHeader->namesOffset);
+  return std::string(names + mSubmeshes[i].nameOffset,
+                     mSubmeshes[i].nameBytes);
+}
+
+dmp::AABB dmp::CookedMesh::bounds() const
+{
+  return toAABB(mHeader->boundsMin, mHeader->boundsMax);
+}
+
+std::vector<dmp::Object> dmp::CookedMesh::objects(size_t matIdx,
+                                                  size_t texIdx) const
+{
+  expect("Objects from a valid cooked mesh", valid());
+
+  const auto & layout = vertexLayout((VertexFormat) mHeader->vertexFormat);
+  auto verts = mFile->data() + mHeader->vertexOffset;
+  auto indices = mFile->data() + mHeader->indexOffset;
+
+  std::vector<Object> res;
+  res.reserve(mHeader->numSubmeshes);
+
+  for (uint32_t i = 0; i < mHeader->numSubmeshes; ++i)
+    {
+      const auto & s = mSubmeshes[i];
+
+      auto geom = std::make_shared<RetainedGeometry>();
+      geom->storage = mFile;
+      geom->layout = &layout;
+      geom->verts = verts + s.firstVertex * (uint64_t) layout.stride;
+      geom->numVerts = (size_t) s.numVerts;
+      geom->indices = indices + s.indexOffset;
+      geom->numIndices = (size_t) s.numIndices;
+      geom->indexType = s.indexType;
+      geom->bounds = toAABB(s.boundsMin, s.boundsMax);
+      for (uint32_t l = s.firstLod; l < s.firstLod + s.numLods; ++l)
+        {
+          geom->lods.push_back({(size_t) mLods[l].firstIndex,
+                                (size_t) mLods[l].numIndices,
+                                mLods[l].error});
+        }
+
+      res.emplace_back(std::move(geom),
+                       GL_TRIANGLES,
+                       matIdx + s.material,
+                       texIdx);
+    }
+
+  return res;
+}
+
+std::string dmp::MeshCache::cachePath(const std::string & path)
+{
+  auto key = hashBytes(path.data(), path.size());
+
+  std::ostringstream name;
+  name << meshCacheDir << "/"
+       << std::hex << std::setw(16) << std::setfill('0') << key
+       << ".dmpmesh";
+  return name.str();
+}
+
+uint64_t dmp::MeshCache::settingsHash()
+{
+  // everything in config.hpp that changes what a cook writes
+  auto res = hashBytes(&meshVertexFormat, sizeof(meshVertexFormat));
+  res = hashValue(optimizeMeshes, res);
+  res = hashValue(optimizeMeshOverdraw, res);
+  res = hashValue(vertexCacheSize, res);
+  res = hashValue(overdrawAcmrThreshold, res);
+  res = hashValue(generateLods, res);
+  res = hashValue(maxLodLevels, res);
+  res = hashValue(minLodTriangles, res);
+  res = hashValue(lodMaxError, res);
+  return res;
+}
+
+dmp::CookedMesh dmp::MeshCache::fetch(const std::string & path,
+                                      ThreadPool & pool)
+{
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    {
+      throw InvariantViolation("Failed to stat " + path);
+    }
+
+  CookedMesh::Header stamp = {};
+  stamp.settingsHash = settingsHash();
+  stamp.sourceSize = (uint64_t) st.st_size;
+  stamp.sourceMTime = (int64_t) st.st_mtime;
+
+  auto dst = cachePath(path);
+  CookedMesh cooked(MappedFile{dst});
+
+  // cooked with other settings, it has to be cooked again whatever the
+  // source looks like
+  bool sameSettings = cooked.valid()
+    && cooked.header().vertexFormat == (uint32_t) meshVertexFormat
+    && cooked.header().settingsHash == stamp.settingsHash;
+
+  // the usual warm start: the source hasn't been touched since cooking
+  if (sameSettings
+      && cooked.header().sourceSize == stamp.sourceSize
+      && cooked.header().sourceMTime == stamp.sourceMTime)
+    {
+      return cooked;
+    }
+
+  {
+    MappedFile src(path);
+    expect("Map model source", src.valid());
+    stamp.sourceHash = hashBytes(src.data(), src.size());
+  }
+
+  // touched (a checkout, a copy) but not actually changed. Note the new
+  // mtime so the next run takes the fast path again
+  if (sameSettings && cooked.header().sourceHash == stamp.sourceHash)
+    {
+      restamp(stamp, dst);
+      return cooked;
+    }
+
+  cooked = CookedMesh();
+  cook(Model(path, pool), stamp, dst);
+
+  cooked = CookedMesh(MappedFile{dst});
+  expect("Cooked mesh readable", cooked.valid());
+  return cooked;
+}
+
+void dmp::MeshCache::cook(const Model & model,
+                          const CookedMesh::Header & stamp,
+                          const std::string & dst)
+{
+  const auto & meshes = model.meshes();
+  auto format = meshVertexFormat;
+  auto layout = fileLayout(format);
+  auto stride = (size_t) vertexLayout(format).stride;
+
+  std::string names;
+  std::vector<CookedMesh::Submesh> submeshes;
+  std::vector<CookedMesh::Lod> lods;
+  std::vector<std::vector<unsigned char>> packedVerts;
+  std::vector<std::vector<unsigned char>> packedIndices;
+  uint64_t numVerts = 0;
+  uint64_t allIndexBytes = 0;
+  for (const auto & curr : meshes)
+    {
+      AABB box;
+      for (const auto & v : curr.verts) box.grow(v.position);
+
+      CookedMesh::Submesh s = {};
+      s.nameOffset = (uint32_t) names.size();
+      s.nameBytes = (uint32_t) curr.name.size();
+      s.indexType = indexType(curr.verts.size());
+      s.firstLod = (uint32_t) lods.size();
+      s.numLods = (uint32_t) curr.lods.size();
+      s.firstVertex = numVerts;
+      s.numVerts = curr.verts.size();
+      s.indexOffset = allIndexBytes;
+      s.numIndices = curr.indices.size();
+      fromAABB(box, s.boundsMin, s.boundsMax);
+
+      for (const auto & l : curr.lods)
+        {
+          lods.push_back({l.firstIndex, l.numIndices, l.error, 0});
+        }
+
+      packedVerts.push_back(packVertices(curr.verts.data(),
+                                         curr.verts.size(),
+                                         format,
+                                         box));
+      packedIndices.push_back(packIndices(curr.indices.data(),
+                                          curr.indices.size(),
+                                          s.indexType));
+
+      names += curr.name;
+      numVerts += s.numVerts;
+      // the next submesh's indices may be wider
+      allIndexBytes = alignUp((size_t) (allIndexBytes
+                                        + packedIndices.back().size()),
+                              sizeof(GLuint));
+      submeshes.push_back(s);
+    }
+
+  auto header = stamp;
+  header.magic = CookedMesh::magic;
+  header.version = CookedMesh::version;
+  header.numAttributes = (uint32_t) layout.size();
+  header.numSubmeshes = (uint32_t) submeshes.size();
+  header.vertexStride = (uint32_t) stride;
+  header.vertexFormat = (uint32_t) format;
+  header.numLods = (uint32_t) lods.size();
+  header.padding = 0;
+  auto submeshTable = submeshOffset(layout.size());
+  auto lodTable = submeshTable
+    + submeshes.size() * sizeof(CookedMesh::Submesh);
+  header.namesOffset = lodTable + lods.size() * sizeof(CookedMesh::Lod);
+  header.namesBytes = names.size();
+  header.vertexOffset = alignUp((size_t) (header.namesOffset + names.size()),
+                                blobAlignment);
+  header.vertexBytes = numVerts * stride;
+  header.indexOffset = alignUp((size_t) (header.vertexOffset
+                                         + header.vertexBytes),
+                               blobAlignment);
+  header.indexBytes = allIndexBytes;
+  fromAABB(model.bounds(), header.boundsMin, header.boundsMax);
+
+  std::vector<unsigned char> file((size_t) (header.indexOffset
+                                            + header.indexBytes),
+                                  0);
+
+  auto out = file.data();
+  std::memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+  std::memcpy(out, layout.data(), layout.size() * sizeof(layout[0]));
+  std::memcpy(file.data() + submeshTable,
+              submeshes.data(),
+              submeshes.size() * sizeof(submeshes[0]));
+  std::memcpy(file.data() + lodTable,
+              lods.data(),
+              lods.size() * sizeof(lods[0]));
+  std::memcpy(file.data() + header.namesOffset, names.data(), names.size());
+
+  for (size_t i = 0; i < meshes.size(); ++i)
+    {
+      std::memcpy(file.data() + header.vertexOffset
+                  + submeshes[i].firstVertex * stride,
+                  packedVerts[i].data(),
+                  packedVerts[i].size());
+      std::memcpy(file.data() + header.indexOffset
+                  + submeshes[i].indexOffset,
+                  packedIndices[i].data(),
+                  packedIndices[i].size());
+    }
+
+  makeDirectories(meshCacheDir);
+
+  // another thread or process may be cooking the same file, or a crash
+  // could cut this write short; either way nobody should see a torn file
+  writeFileAtomic(dst, file.data(), file.size());
+
+  ifDebug(std::cerr << "Cooked mesh " << dst << ": "
+          << submeshes.size() << " submeshes, " << numVerts
+          << " vertices, " << file.size() << " bytes" << std::endl);
+}
+
+void dmp::MeshCache::restamp(const CookedMesh::Header & stamp,
+                             const std::string & dst)
+{
+  std::fstream file(dst, std::ios::binary | std::ios::in | std::ios::out);
+  if (!file) return;
+
+  CookedMesh::Header header;
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file) return;
+
+  header.sourceSize = stamp.sourceSize;
+  header.sourceMTime = stamp.sourceMTime;
+  header.sourceHash = stamp.sourceHash;
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
@@ -0,0 +1,154 @@
+#ifndef DMP_SCENE_MODEL_MESHCACHE_HPP
+#define DMP_SCENE_MODEL_MESHCACHE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <GL/glew.h>
+#include "Model.hpp"
+#include "../Object.hpp"
+#include "../../MappedFile.hpp"
+#include "../../ThreadPool.hpp"
+
+namespace dmp
+{
+  // A cooked model file, mapped into memory. The file is a Header, a table
+  // of numAttributes Attributes describing one vertex, a table of
+  // numSubmeshes Submeshes, a table of numLods Lods they share, their
+  // names, then the vertices of every submesh back to back and likewise
+  // their indices. The vertex and index blobs are laid out exactly as the
+  // GPU takes them, so an Object can be uploaded straight from the
+  // mapping. Fields are in native byte order; the cache is not meant to
+  // move between machines
+  class CookedMesh
+  {
+  public:
+    static const uint32_t magic = 0x4D504D44; // "DMPM"
+    static const uint32_t version = 5;
+
+    struct Header
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t numAttributes;
+      uint32_t numSubmeshes;
+      uint32_t vertexStride;
+      uint32_t vertexFormat; // a VertexFormat
+      uint32_t numLods;
+      uint32_t padding;
+      // from the start of the file
+      uint64_t namesOffset;
+      uint64_t namesBytes;
+      uint64_t vertexOffset;
+      uint64_t vertexBytes;
+      uint64_t indexOffset;
+      uint64_t indexBytes;
+      float boundsMin[3];
+      float boundsMax[3];
+      // hash of the import settings this was cooked with
+      uint64_t settingsHash;
+      // what the source file looked like when this was cooked
+      uint64_t sourceSize;
+      int64_t sourceMTime;
+      uint64_t sourceHash;
+    };
+
+    // one glVertexAttribPointer
+    struct Attribute
+    {
+      uint32_t location;
+      uint32_t components;
+      uint32_t type;
+      uint32_t normalized;
+      uint32_t offset; // within a vertex
+    };
+
+    // Indices count from the submesh's first vertex, and are as narrow as
+    // its number of vertices allows. Quantized positions are fractions of
+    // the submesh's bounds
+    struct Submesh
+    {
+      uint32_t nameOffset; // within the names
+      uint32_t nameBytes;
+      // added to the material index given to objects(). OBJ materials
+      // aren't imported, so this is 0 for now
+      uint32_t material;
+      uint32_t indexType;
+      // within the Lods. No levels means every index is one level
+      uint32_t firstLod;
+      uint32_t numLods;
+      uint64_t firstVertex;
+      uint64_t numVerts;
+      uint64_t indexOffset; // within the indices, in bytes
+      uint64_t numIndices;
+      float boundsMin[3];
+      float boundsMax[3];
+    };
+
+    // one level of detail of a submesh, as a range of its indices
+    struct Lod
+    {
+      uint64_t firstIndex;
+      uint64_t numIndices;
+      float error; // in object space
+      uint32_t padding;
+    };
+
+    CookedMesh(const CookedMesh &) = delete;
+    CookedMesh & operator=(const CookedMesh &) = delete;
+    CookedMesh(CookedMesh &&) = default;
+    CookedMesh & operator=(CookedMesh &&) = default;
+
+    CookedMesh() = default;
+    // An invalid or truncated file, or one whose vertex layout isn't its
+    // VertexFormat's, gives an invalid CookedMesh
+    CookedMesh(MappedFile && file);
+
+    bool valid() const {return mFile && mFile->valid();}
+
+    const Header & header() const {return *mHeader;}
+    const Submesh & submesh(size_t i) const {return mSubmeshes[i];}
+    std::string name(size_t i) const;
+
+    // of every submesh together
+    AABB bounds() const;
+
+    // one Object per submesh, each uploaded from and retaining for picking
+    // its part of the mapping, which stays mapped while any of them do.
+    // Must be called on the GL thread
+    std::vector<Object> objects(size_t matIdx, size_t texIdx) const;
+
+  private:
+    bool validate();
+
+    std::shared_ptr<const MappedFile> mFile;
+    const Header * mHeader = nullptr;
+    const Submesh * mSubmeshes = nullptr;
+    const Lod * mLods = nullptr;
+  };
+
+  // Cooks OBJ files into CookedMeshes in meshVertexFormat under
+  // meshCacheDir the first time they are asked for, and just maps the
+  // cooked file after that. A cooked file is keyed by source path, and
+  // stays valid while it was cooked with the current import settings
+  // (vertex format, optimization and levels of detail) and the source's
+  // size and mtime match, or failing that, its content hash does. Must
+  // not be called from one of pool's tasks
+  class MeshCache
+  {
+  public:
+    static CookedMesh fetch(const std::string & path, ThreadPool & pool);
+
+  private:
+    static std::string cachePath(const std::string & path);
+    static uint64_t settingsHash();
+    static void cook(const Model & model,
+                     const CookedMesh::Header & stamp,
+                     const std::string & dst);
+    static void restamp(const CookedMesh::Header & stamp,
+                        const std::string & dst);
+  };
+}
+
+#endif
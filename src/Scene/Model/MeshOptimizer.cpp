@@ -0,0 +1,365 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <glm/glm.hpp>
+#include "../../util.hpp"
+#include "../../config.hpp"
+
+namespace
+{
+  const GLuint noVertex = 0xFFFFFFFF;
+
+  // FIFO post-transform cache, kept as the time each vertex went in.
+  // Hits don't refresh a vertex, so it is in the cache while fewer than
+  // size misses have happened since
+  class CacheSim
+  {
+  public:
+    CacheSim(size_t numVerts, size_t size)
+      : mStamps(numVerts, 0),
+        mSize(size),
+        mClock(size + 1)
+    {}
+
+    // true on a miss
+    bool use(GLuint v)
+    {
+      if (mClock - mStamps[v] <= mSize) return false;
+      mStamps[v] = mClock++;
+      return true;
+    }
+
+    void flush() {mClock += mSize + 1;}
+
+  private:
+    std::vector<size_t> mStamps;
+    size_t mSize;
+    size_t mClock;
+  };
+
+  size_t numVertsUsed(const std::vector<GLuint> & indices)
+  {
+    if (indices.empty()) return 0;
+    return (size_t) *std::max_element(indices.begin(), indices.end()) + 1;
+  }
+}
+
+float dmp::acmr(const std::vector<GLuint> & indices, size_t cacheSize)
+{
+  auto numTris = indices.size() / 3;
+  if (numTris == 0) return 0.0f;
+
+  CacheSim cache(numVertsUsed(indices), cacheSize);
+  size_t misses = 0;
+  for (size_t i = 0; i < numTris * 3; ++i)
+    {
+      if (cache.use(indices[i])) ++misses;
+    }
+
+  return (float) misses / (float) numTris;
+}
+
+std::vector<size_t> dmp::optimizeVertexCache(std::vector<GLuint> & indices,
+                                             size_t numVerts,
+                                             size_t cacheSize)
+{
+  auto numTris = indices.size() / 3;
+  std::vector<size_t> clusters;
+  if (numTris == 0) return clusters;
+
+  // triangles using each vertex, as one flat list with offsets
+  std::vector<uint32_t> live(numVerts, 0);
+  for (size_t i = 0; i < numTris * 3; ++i) ++live[indices[i]];
+
+  std::vector<size_t> offsets(numVerts + 1, 0);
+  std::partial_sum(live.begin(), live.end(), offsets.begin() + 1);
+
+  std::vector<uint32_t> adjacency(offsets.back());
+  {
+    auto fill = offsets;
+    for (size_t i = 0; i < numTris * 3; ++i)
+      {
+        adjacency[fill[indices[i]]++] = (uint32_t) (i / 3);
+      }
+  }
+
+  std::vector<size_t> stamps(numVerts, 0);
+  size_t clock = cacheSize + 1;
+  std::vector<uint8_t> emitted(numTris, 0);
+  std::vector<GLuint> deadEnds;
+  std::vector<GLuint> candidates;
+  size_t cursor = 0;
+
+  std::vector<GLuint> res;
+  res.reserve(numTris * 3);
+
+  // Somewhere to go when no candidate has triangles left: a vertex used
+  // recently, if one still has some, else the next one in input order
+  auto skipDeadEnd = [&]()
+    {
+      while (!deadEnds.empty())
+        {
+          auto d = deadEnds.back();
+          deadEnds.pop_back();
+          if (live[d] > 0) return d;
+        }
+
+      for (; cursor < numVerts; ++cursor)
+        {
+          if (live[cursor] > 0) return (GLuint) cursor;
+        }
+
+      return noVertex;
+    };
+
+  auto fan = skipDeadEnd();
+  clusters.push_back(0);
+
+  while (fan != noVertex)
+    {
+      candidates.clear();
+
+      for (size_t a = offsets[fan]; a < offsets[fan + 1]; ++a)
+        {
+          auto t = adjacency[a];
+          if (emitted[t]) continue;
+
+          for (size_t j = 0; j < 3; ++j)
+            {
+              auto v = indices[3 * t + j];
+              res.push_back(v);
+              deadEnds.push_back(v);
+              candidates.push_back(v);
+              --live[v];
+
+              if (clock - stamps[v] > cacheSize) stamps[v] = clock++;
+            }
+
+          emitted[t] = 1;
+        }
+
+      // the candidate that will still be in the cache once its remaining
+      // triangles are emitted, and has been there longest. One that
+      // wouldn't still beats none
+      auto next = noVertex;
+      long best = -1;
+      for (auto v : candidates)
+        {
+          if (live[v] == 0) continue;
+
+          long priority = 0;
+          if (clock - stamps[v] + 2 * live[v] <= cacheSize)
+            {
+              priority = (long) (clock - stamps[v]);
+            }
+
+          if (priority > best)
+            {
+              best = priority;
+              next = v;
+            }
+        }
+
+      if (next == noVertex)
+        {
+          next = skipDeadEnd();
+          if (next != noVertex) clusters.push_back(res.size() / 3);
+        }
+
+      fan = next;
+    }
+
+  expect("Every triangle reordered", res.size() == numTris * 3);
+  indices.swap(res);
+  return clusters;
+}
+
+void dmp::optimizeOverdraw(std::vector<GLuint> & indices,
+                           const std::vector<ObjectVertex> & verts,
+                           const std::vector<size_t> & clusters,
+                           size_t cacheSize,
+                           float threshold)
+{
+  auto numTris = indices.size() / 3;
+  if (numTris == 0 || clusters.empty()) return;
+
+  // Split each cluster wherever its cold start has been paid off, that is
+  // where its own ACMR has come down to the target. Restarting the cache
+  // there keeps the whole mesh within the target wherever the clusters
+  // end up
+  auto target = threshold * acmr(indices, cacheSize);
+
+  std::vector<size_t> starts;
+  CacheSim cache(verts.size(), cacheSize);
+  for (size_t c = 0; c < clusters.size(); ++c)
+    {
+      auto end = c + 1 < clusters.size() ? clusters[c + 1] : numTris;
+      auto start = clusters[c];
+      size_t misses = 0;
+
+      cache.flush();
+      starts.push_back(start);
+
+      for (auto t = start; t < end; ++t)
+        {
+          for (size_t j = 0; j < 3; ++j)
+            {
+              if (cache.use(indices[3 * t + j])) ++misses;
+            }
+
+          if (t + 1 < end
+              && (float) misses <= target * (float) (t + 1 - start))
+            {
+              cache.flush();
+              misses = 0;
+              start = t + 1;
+              starts.push_back(start);
+            }
+        }
+    }
+
+  // area weighted centroid and normal of each cluster and of the mesh
+  struct Cluster
+  {
+    size_t begin;
+    size_t end;
+    glm::vec3 centroid;
+    glm::vec3 normal;
+    float occlusion;
+  };
+
+  std::vector<Cluster> parts;
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+
+  for (size_t i = 0; i < starts.size(); ++i)
+    {
+      Cluster part = {starts[i],
+                      i + 1 < starts.size() ? starts[i + 1] : numTris,
+                      glm::vec3(0.0f),
+                      glm::vec3(0.0f),
+                      0.0f};
+      float area = 0.0f;
+
+      for (auto t = part.begin; t < part.end; ++t)
+        {
+          const auto & a = verts[indices[3 * t]].position;
+          const auto & b = verts[indices[3 * t + 1]].position;
+          const auto & c = verts[indices[3 * t + 2]].position;
+
+          auto n = glm::cross(b - a, c - a);
+          auto triArea = glm::length(n);
+          part.centroid += (a + b + c) * (triArea / 3.0f);
+          part.normal += n;
+          area += triArea;
+        }
+
+      meshCentroid += part.centroid;
+      meshArea += area;
+      if (area > 0.0f) part.centroid /= area;
+
+      auto len = glm::length(part.normal);
+      if (len > 0.0f) part.normal /= len;
+
+      parts.push_back(part);
+    }
+
+  if (meshArea > 0.0f) meshCentroid /= meshArea;
+
+  for (auto & curr : parts)
+    {
+      curr.occlusion = glm::dot(curr.centroid - meshCentroid, curr.normal);
+    }
+
+  std::stable_sort(parts.begin(), parts.end(),
+                   [](const Cluster & lhs, const Cluster & rhs)
+                   {
+                     return lhs.occlusion > rhs.occlusion;
+                   });
+
+  std::vector<GLuint> res;
+  res.reserve(indices.size());
+  for (const auto & curr : parts)
+    {
+      res.insert(res.end(),
+                 indices.begin() + (ptrdiff_t) (3 * curr.begin),
+                 indices.begin() + (ptrdiff_t) (3 * curr.end));
+    }
+
+  indices.swap(res);
+}
+
+void dmp::optimizeVertexFetch(std::vector<ObjectVertex> & verts,
+                              std::vector<GLuint> & indices)
+{
+  std::vector<GLuint> remap(verts.size(), noVertex);
+  std::vector<ObjectVertex> res;
+  res.reserve(verts.size());
+
+  for (auto & curr : indices)
+    {
+      if (remap[curr] == noVertex)
+        {
+          remap[curr] = (GLuint) res.size();
+          res.push_back(verts[curr]);
+        }
+      curr = remap[curr];
+    }
+
+  verts.swap(res);
+}
+
+void dmp::optimizeMesh(Mesh & mesh)
+{
+  if (mesh.indices.size() < 3) return;
+
+  std::vector<LodLevel> whole = {{0, mesh.indices.size(), 0.0f}};
+  const auto & levels = mesh.lods.empty() ? whole : mesh.lods;
+
+  // levels are optimized on their own
+  auto optimizeLevels = [&]()
+    {
+      for (const auto & level : levels)
+        {
+          auto first = mesh.indices.begin() + (ptrdiff_t) level.firstIndex;
+          auto last = first + (ptrdiff_t) level.numIndices;
+          std::vector<GLuint> part(first, last);
+
+          auto clusters = optimizeVertexCache(part,
+                                              mesh.verts.size(),
+                                              vertexCacheSize);
+          if (optimizeMeshOverdraw)
+            {
+              optimizeOverdraw(part,
+                               mesh.verts,
+                               clusters,
+                               vertexCacheSize,
+                               overdrawAcmrThreshold);
+            }
+
+          std::copy(part.begin(), part.end(), first);
+        }
+
+      // the finest level comes first, so its vertices get the best order
+      optimizeVertexFetch(mesh.verts, mesh.indices);
+    };
+
+  // Only debug builds pay for measuring the finest level's ACMR, which
+  // renumbering the vertices leaves as it is
+  ifRelease(optimizeLevels());
+  ifDebug(auto finest = [&]()
+            {
+              auto first = mesh.indices.begin()
+                + (ptrdiff_t) levels[0].firstIndex;
+              return std::vector<GLuint>(first, first
+                                         + (ptrdiff_t) levels[0].numIndices);
+            };
+          auto before = acmr(finest(), vertexCacheSize);
+          optimizeLevels();
+          std::cerr << "Optimized mesh " << mesh.name << ": ACMR "
+                    << before << " -> " << acmr(finest(), vertexCacheSize)
+                    << ", " << levels.size() << " levels of detail"
+                    << std::endl);
+}
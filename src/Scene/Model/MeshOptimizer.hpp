@@ -0,0 +1,45 @@
+#ifndef DMP_SCENE_MODEL_MESHOPTIMIZER_HPP
+#define DMP_SCENE_MODEL_MESHOPTIMIZER_HPP
+
+#include <vector>
+#include <GL/glew.h>
+#include "Model.hpp"
+
+namespace dmp
+{
+  // Average cache miss ratio: vertices transformed per triangle drawn,
+  // simulating a FIFO post-transform cache of cacheSize entries. 0.5 is
+  // the best a large regular grid can do, 3 the worst anything can
+  float acmr(const std::vector<GLuint> & indices, size_t cacheSize);
+
+  // Reorders triangles for the post-transform vertex cache with Tipsify
+  // (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+  // Locality and Reduced Overdraw", 2007), which runs in linear time.
+  // Returns the index of the first triangle of each cluster: the runs
+  // between the points where Tipsify had no neighbouring vertex left to go
+  // to, which can be drawn in any order for about the same ACMR
+  std::vector<size_t> optimizeVertexCache(std::vector<GLuint> & indices,
+                                          size_t numVerts,
+                                          size_t cacheSize);
+
+  // Draws the clusters that face out from the mesh's centre, and so are
+  // most likely to hide the rest, first. Clusters are those returned by
+  // optimizeVertexCache, split further wherever the ACMR within them is
+  // already within threshold times the whole mesh's
+  void optimizeOverdraw(std::vector<GLuint> & indices,
+                        const std::vector<ObjectVertex> & verts,
+                        const std::vector<size_t> & clusters,
+                        size_t cacheSize,
+                        float threshold);
+
+  // Renumbers vertices in the order the indices first use them, so that
+  // vertex fetches walk the buffer forwards. Unused vertices are dropped
+  void optimizeVertexFetch(std::vector<ObjectVertex> & verts,
+                           std::vector<GLuint> & indices);
+
+  // All of the above with the settings from config.hpp, reporting the
+  // ACMR before and after in debug builds
+  void optimizeMesh(Mesh & mesh);
+}
+
+#endif
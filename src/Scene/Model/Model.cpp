@@ -0,0 +1,723 @@
+#include "Model.hpp"
+
+#include <map>
+#include <unordered_map>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <iostream>
+#include "../../MappedFile.hpp"
+#include "../../util.hpp"
+#include "../../Timer.hpp"
+#include "../../config.hpp"
+#include "MeshOptimizer.hpp"
+#include "Simplify.hpp"
+
+namespace
+{
+  const int32_t noIndex = std::numeric_limits<int32_t>::min();
+
+  // aim for this many bytes per chunk, within a few chunks per thread
+  const size_t chunkBytes = 1 << 20;
+  const size_t chunksPerThread = 4;
+
+  // One corner of a triangle as indices into the file's v, vt and vn
+  // lists, or noIndex. Negative indices in the file count back from the
+  // line they're on; until every chunk knows where it starts in those
+  // lists, they are kept relative to the chunk's first entry and flagged
+  struct Corner
+  {
+    int32_t idx[3];
+    uint8_t relative; // bit i set if idx[i] is relative to the chunk
+  };
+
+  const uint32_t noVertex = 0xFFFFFFFF;
+
+  // A vertex as a mesh and its v, vt and vn indices, 0 based, with
+  // absent ones left as noVertex
+  struct Key
+  {
+    uint32_t mesh;
+    uint32_t idx[3];
+
+    bool operator==(const Key & other) const
+    {
+      return mesh == other.mesh
+        && idx[0] == other.idx[0]
+        && idx[1] == other.idx[1]
+        && idx[2] == other.idx[2];
+    }
+  };
+
+  uint64_t hashKey(const Key & k)
+  {
+    uint64_t h = ((uint64_t) k.idx[0] << 32) | k.idx[1];
+    h ^= (((uint64_t) k.idx[2] << 32) | k.mesh) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return h;
+  }
+
+  // Open addressing hash table from Key to a 64 bit value, with linear
+  // probing. Keys are only ever added. Flat arrays rather than
+  // std::unordered_map's node per entry, since this is the hot loop of
+  // the import
+  class KeyTable
+  {
+  public:
+    KeyTable(size_t expected)
+    {
+      size_t capacity = 16;
+      while (capacity < 2 * expected) capacity *= 2;
+      mKeys.assign(capacity, empty());
+      mValues.resize(capacity);
+    }
+
+    // the value stored for key, storing value first if key is new, and
+    // whether it was new
+    std::pair<uint64_t, bool> insert(const Key & key,
+                                     uint64_t hash,
+                                     uint64_t value)
+    {
+      if (2 * (mSize + 1) > mKeys.size()) grow();
+
+      auto mask = mKeys.size() - 1;
+      for (auto slot = (size_t) hash & mask; ; slot = (slot + 1) & mask)
+        {
+          if (mKeys[slot] == key) return {mValues[slot], false};
+          if (mKeys[slot].mesh != noVertex) continue;
+
+          mKeys[slot] = key;
+          mValues[slot] = value;
+          ++mSize;
+          return {value, true};
+        }
+    }
+
+  private:
+    static Key empty() {return {noVertex, {noVertex, noVertex, noVertex}};}
+
+    void grow()
+    {
+      KeyTable bigger(mKeys.size());
+      for (size_t i = 0; i < mKeys.size(); ++i)
+        {
+          if (mKeys[i].mesh == noVertex) continue;
+          bigger.insert(mKeys[i], hashKey(mKeys[i]), mValues[i]);
+        }
+      *this = std::move(bigger);
+    }
+
+    std::vector<Key> mKeys;
+    std::vector<uint64_t> mValues;
+    size_t mSize = 0;
+  };
+
+  struct Chunk
+  {
+    const char * begin;
+    const char * end;
+
+    // parsed
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::vector<Corner> corners; // three per triangle
+    std::vector<std::pair<size_t, std::string>> groups; // first corner, name
+
+    // where this chunk's entries start in the file's v, vt and vn lists
+    size_t base[3];
+
+    // runs of corners by mesh, as first corner and mesh
+    std::vector<std::pair<size_t, uint32_t>> meshRuns;
+
+    // the chunk's distinct vertices, and each corner as one of them
+    std::vector<Key> unique;
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> local;
+    std::vector<size_t> meshCorners; // corners per mesh
+
+    // for each unique vertex, whether this chunk is the first to have it,
+    // and if not, the chunk and unique vertex that was, packed by ownerOf
+    std::vector<uint8_t> first;
+    std::vector<uint64_t> owner;
+    std::vector<size_t> meshFirsts; // first vertices per mesh
+    std::vector<size_t> meshBase; // where those go in each mesh's verts
+    dmp::AABB bounds; // of the first vertices
+
+    // unique vertex to index within its mesh
+    std::vector<uint32_t> remap;
+  };
+
+  bool isSpace(char c) {return c == ' ' || c == '\t';}
+  bool isDigit(char c) {return c >= '0' && c <= '9';}
+
+  void skipSpace(const char *& p, const char * end)
+  {
+    while (p < end && isSpace(*p)) ++p;
+  }
+
+  const char * lineEnd(const char * p, const char * end)
+  {
+    while (p < end && *p != '\n') ++p;
+    return p;
+  }
+
+  // strtof is locale dependent and slow; OBJ floats are plain decimals
+  float parseFloat(const char *& p, const char * end)
+  {
+    static const double powers[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    skipSpace(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t digits = 0;
+    int exponent = 0;
+    bool any = false;
+    const uint64_t maxDigits = 100000000000000000ULL;
+
+    for (; p < end && isDigit(*p); ++p, any = true)
+      {
+        if (digits < maxDigits) digits = digits * 10 + (uint64_t) (*p - '0');
+        else ++exponent;
+      }
+
+    if (p < end && *p == '.')
+      {
+        for (++p; p < end && isDigit(*p); ++p, any = true)
+          {
+            if (digits >= maxDigits) continue;
+            digits = digits * 10 + (uint64_t) (*p - '0');
+            --exponent;
+          }
+      }
+
+    expect("OBJ number has digits", any);
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+      {
+        ++p;
+        bool negativeExp = false;
+        if (p < end && (*p == '-' || *p == '+')) negativeExp = *p++ == '-';
+
+        int exp = 0;
+        for (; p < end && isDigit(*p); ++p)
+          {
+            if (exp < 1000) exp = exp * 10 + (*p - '0');
+          }
+        exponent += negativeExp ? -exp : exp;
+      }
+
+    double value = (double) digits;
+    auto absExp = std::abs(exponent);
+    double scale = absExp <= 22 ? powers[absExp] : std::pow(10.0, absExp);
+    value = exponent < 0 ? value / scale : value * scale;
+
+    return (float) (negative ? -value : value);
+  }
+
+  long parseIndex(const char *& p, const char * end)
+  {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    expect("OBJ index has digits", p < end && isDigit(*p));
+
+    long value = 0;
+    for (; p < end && isDigit(*p); ++p)
+      {
+        value = value * 10 + (*p - '0');
+        expect("OBJ index in range",
+               value <= std::numeric_limits<int32_t>::max());
+      }
+
+    return negative ? -value : value;
+  }
+
+  // Parses one v/vt/vn corner. counts are how many of each list the chunk
+  // has seen so far, for resolving negative indices
+  Corner parseCorner(const char *& p, const char * end, const size_t counts[3])
+  {
+    Corner res = {{noIndex, noIndex, noIndex}, 0};
+
+    for (int i = 0; i < 3; ++i)
+      {
+        if (i > 0)
+          {
+            if (p >= end || *p != '/') break;
+            ++p;
+            // v//vn
+            if (p < end && *p == '/') continue;
+          }
+
+        long raw = parseIndex(p, end);
+        expect("OBJ index not 0", raw != 0);
+
+        if (raw > 0)
+          {
+            res.idx[i] = (int32_t) (raw - 1);
+          }
+        else
+          {
+            res.idx[i] = (int32_t) ((long) counts[i] + raw);
+            res.relative |= (uint8_t) (1 << i);
+          }
+      }
+
+    expect("OBJ face corner has a position", res.idx[0] != noIndex);
+    return res;
+  }
+
+  std::string parseName(const char * p, const char * end)
+  {
+    skipSpace(p, end);
+    while (end > p && (isSpace(end[-1]) || end[-1] == '\r')) --end;
+    return std::string(p, end);
+  }
+
+  void parseChunk(Chunk & chunk)
+  {
+    const char * p = chunk.begin;
+    std::vector<Corner> polygon;
+
+    while (p < chunk.end)
+      {
+        const char * end = lineEnd(p, chunk.end);
+        skipSpace(p, end);
+
+        if (end - p >= 2 && isSpace(p[1]))
+          {
+            switch (p[0])
+              {
+              case 'v':
+                {
+                  p += 2;
+                  float x = parseFloat(p, end);
+                  float y = parseFloat(p, end);
+                  float z = parseFloat(p, end);
+                  chunk.positions.push_back({x, y, z});
+                  break;
+                }
+              case 'f':
+                {
+                  const size_t counts[3] = {
+                    chunk.positions.size(),
+                    chunk.texCoords.size(),
+                    chunk.normals.size()
+                  };
+
+                  polygon.clear();
+                  p += 2;
+                  while (true)
+                    {
+                      skipSpace(p, end);
+                      if (p == end || *p == '\r' || *p == '#') break;
+                      polygon.push_back(parseCorner(p, end, counts));
+                    }
+
+                  expect("OBJ face has at least three corners",
+                         polygon.size() >= 3);
+
+                  for (size_t i = 1; i + 1 < polygon.size(); ++i)
+                    {
+                      chunk.corners.push_back(polygon[0]);
+                      chunk.corners.push_back(polygon[i]);
+                      chunk.corners.push_back(polygon[i + 1]);
+                    }
+                  break;
+                }
+              case 'o':
+              case 'g':
+                chunk.groups.push_back({chunk.corners.size(),
+                                        parseName(p + 2, end)});
+                break;
+              default:
+                break;
+              }
+          }
+        else if (end - p >= 3 && p[0] == 'v' && isSpace(p[2]))
+          {
+            if (p[1] == 't')
+              {
+                p += 3;
+                float u = parseFloat(p, end);
+                float v = parseFloat(p, end);
+                chunk.texCoords.push_back({u, v});
+              }
+            else if (p[1] == 'n')
+              {
+                p += 3;
+                float x = parseFloat(p, end);
+                float y = parseFloat(p, end);
+                float z = parseFloat(p, end);
+                chunk.normals.push_back({x, y, z});
+              }
+          }
+
+        p = end + 1;
+      }
+  }
+
+  // mesh of each corner of chunk, walking its runs in order. Only valid
+  // once local has been sized, since corners is dropped after dedup
+  template <typename Fn>
+  void forEachCorner(const Chunk & chunk, Fn fn)
+  {
+    for (size_t r = 0; r < chunk.meshRuns.size(); ++r)
+      {
+        size_t last = r + 1 < chunk.meshRuns.size()
+          ? chunk.meshRuns[r + 1].first
+          : chunk.local.size();
+
+        for (size_t i = chunk.meshRuns[r].first; i < last; ++i)
+          {
+            fn(i, chunk.meshRuns[r].second);
+          }
+      }
+  }
+
+  void smoothNormals(dmp::Mesh & mesh, const std::vector<uint8_t> & missing)
+  {
+    std::vector<glm::vec3> sums(mesh.verts.size());
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+      {
+        const auto & a = mesh.verts[mesh.indices[i]].position;
+        const auto & b = mesh.verts[mesh.indices[i + 1]].position;
+        const auto & c = mesh.verts[mesh.indices[i + 2]].position;
+
+        // unnormalized, so larger faces count for more
+        auto n = glm::cross(b - a, c - a);
+        for (size_t j = 0; j < 3; ++j) sums[mesh.indices[i + j]] += n;
+      }
+
+    for (size_t i = 0; i < mesh.verts.size(); ++i)
+      {
+        if (!missing[i]) continue;
+        float len = glm::length(sums[i]);
+        mesh.verts[i].normal = len > 0.0f
+          ? sums[i] / len
+          : glm::vec3(0.0f, 1.0f, 0.0f);
+      }
+  }
+}
+
+dmp::Model::Model(const std::string & path, ThreadPool & pool)
+{
+  // only debug builds time the import and report it
+  ifRelease(initModel(path, pool));
+  ifDebug(auto start = Clock::now();
+          auto size = initModel(path, pool);
+          float ms = Milliseconds(Clock::now() - start).count();
+
+          size_t verts = 0;
+          size_t tris = 0;
+          for (const auto & curr : mMeshes)
+            {
+              verts += curr.verts.size();
+              // of the finest level only
+              tris += (curr.lods.empty()
+                       ? curr.indices.size()
+                       : curr.lods[0].numIndices) / 3;
+            }
+
+          std::cerr << "Imported " << path << ": " << mMeshes.size()
+                    << " meshes, " << verts << " vertices, " << tris
+                    << " triangles in " << ms << " ms ("
+                    << (float) size / (1024.0f * 1024.0f) / (ms / 1000.0f)
+                    << " MiB/s)" << std::endl);
+}
+
+size_t dmp::Model::initModel(const std::string & path, ThreadPool & pool)
+{
+  MappedFile file(path);
+  expect("Model file mapped", file.valid());
+
+  // Split at line breaks
+
+  auto text = reinterpret_cast<const char *>(file.data());
+  auto size = file.size();
+  auto numChunks = std::max((size_t) 1,
+                            std::min(pool.size() * chunksPerThread,
+                                     size / chunkBytes));
+
+  std::vector<Chunk> chunks(numChunks);
+  const char * prev = text;
+  for (size_t i = 0; i < numChunks; ++i)
+    {
+      const char * end = text + size;
+      if (i + 1 < numChunks)
+        {
+          end = std::max(prev, text + size * (i + 1) / numChunks);
+          end = lineEnd(end, text + size);
+          if (end < text + size) ++end;
+        }
+      chunks[i].begin = prev;
+      chunks[i].end = end;
+      prev = end;
+    }
+
+  pool.parallelFor(numChunks, [&](size_t i) {parseChunk(chunks[i]);});
+
+  // Assign meshes to runs of corners and chunks to their place in the
+  // file's v, vt and vn lists. Corners before the first o or g of a chunk
+  // continue the previous chunk's mesh
+
+  std::map<std::string, uint32_t> meshIds;
+  auto fileName = path.substr(path.find_last_of('/') + 1);
+  mMeshes.push_back({fileName, {}, {}, {}});
+  meshIds[fileName] = 0;
+
+  uint32_t currMesh = 0;
+  size_t totals[3] = {0, 0, 0};
+  for (auto & chunk : chunks)
+    {
+      chunk.meshRuns.push_back({0, currMesh});
+      for (const auto & group : chunk.groups)
+        {
+          auto found = meshIds.find(group.second);
+          if (found == meshIds.end())
+            {
+              found = meshIds.emplace(group.second,
+                                      (uint32_t) mMeshes.size()).first;
+              mMeshes.push_back({group.second, {}, {}, {}});
+            }
+          currMesh = found->second;
+          chunk.meshRuns.push_back({group.first, currMesh});
+        }
+
+      chunk.base[0] = totals[0];
+      chunk.base[1] = totals[1];
+      chunk.base[2] = totals[2];
+      totals[0] += chunk.positions.size();
+      totals[1] += chunk.texCoords.size();
+      totals[2] += chunk.normals.size();
+    }
+
+  expect("OBJ lists fit 32 bit indices",
+         totals[0] < noVertex && totals[1] < noVertex && totals[2] < noVertex);
+
+  std::vector<glm::vec3> positions(totals[0]);
+  std::vector<glm::vec2> texCoords(totals[1]);
+  std::vector<glm::vec3> normals(totals[2]);
+  auto numMeshes = mMeshes.size();
+
+  // Gather the lists, resolve indices and deduplicate within each chunk
+
+  pool.parallelFor(numChunks, [&](size_t c)
+    {
+      auto & chunk = chunks[c];
+      std::copy(chunk.positions.begin(), chunk.positions.end(),
+                positions.begin() + (ptrdiff_t) chunk.base[0]);
+      std::copy(chunk.texCoords.begin(), chunk.texCoords.end(),
+                texCoords.begin() + (ptrdiff_t) chunk.base[1]);
+      std::copy(chunk.normals.begin(), chunk.normals.end(),
+                normals.begin() + (ptrdiff_t) chunk.base[2]);
+
+      KeyTable seen(chunk.corners.size() / 4);
+      chunk.local.resize(chunk.corners.size());
+      chunk.meshCorners.assign(numMeshes, 0);
+
+      forEachCorner(chunk, [&](size_t i, uint32_t mesh)
+        {
+          const auto & corner = chunk.corners[i];
+          Key key = {mesh, {noVertex, noVertex, noVertex}};
+
+          for (int j = 0; j < 3; ++j)
+            {
+              if (corner.idx[j] == noIndex) continue;
+
+              long idx = corner.idx[j];
+              if (corner.relative & (1 << j)) idx += (long) chunk.base[j];
+              expect("OBJ index refers to an earlier entry",
+                     idx >= 0 && (size_t) idx < totals[j]);
+              key.idx[j] = (uint32_t) idx;
+            }
+
+          auto hash = hashKey(key);
+          auto found = seen.insert(key, hash, chunk.unique.size());
+          if (found.second)
+            {
+              chunk.unique.push_back(key);
+              chunk.hashes.push_back(hash);
+            }
+          chunk.local[i] = (uint32_t) found.first;
+          ++chunk.meshCorners[mesh];
+        });
+
+      // no longer needed, and large
+      std::vector<Corner>().swap(chunk.corners);
+    });
+
+  // Merge the chunks' distinct vertices. Each shard of the hash space
+  // finds which chunk has each of its vertices first, going through the
+  // chunks in order. Those first appearances are then numbered in file
+  // order, so that vertices keep the locality they had in the file
+
+  auto ownerOf = [](size_t c, size_t u) {return ((uint64_t) c << 32) | u;};
+  auto numShards = numChunks;
+
+  for (auto & chunk : chunks)
+    {
+      chunk.first.resize(chunk.unique.size());
+      chunk.owner.resize(chunk.unique.size());
+    }
+
+  pool.parallelFor(numShards, [&](size_t shard)
+    {
+      KeyTable owners(0);
+      for (size_t c = 0; c < numChunks; ++c)
+        {
+          auto & chunk = chunks[c];
+          for (size_t u = 0; u < chunk.unique.size(); ++u)
+            {
+              // high bits, since the tables index by the low ones
+              if ((chunk.hashes[u] >> 40) % numShards != shard) continue;
+
+              auto found = owners.insert(chunk.unique[u],
+                                         chunk.hashes[u],
+                                         ownerOf(c, u));
+              chunk.first[u] = found.second;
+              chunk.owner[u] = found.first;
+            }
+        }
+    });
+
+  pool.parallelFor(numChunks, [&](size_t c)
+    {
+      auto & chunk = chunks[c];
+      chunk.meshFirsts.assign(numMeshes, 0);
+      for (size_t u = 0; u < chunk.unique.size(); ++u)
+        {
+          if (chunk.first[u]) ++chunk.meshFirsts[chunk.unique[u].mesh];
+        }
+    });
+
+  std::vector<std::vector<uint8_t>> missingNormal(numMeshes);
+  for (size_t m = 0; m < numMeshes; ++m)
+    {
+      size_t total = 0;
+      for (auto & chunk : chunks)
+        {
+          chunk.meshBase.resize(numMeshes);
+          chunk.meshBase[m] = total;
+          total += chunk.meshFirsts[m];
+        }
+      expect("mesh vertices fit 32 bit indices", total < noVertex);
+      mMeshes[m].verts.resize(total);
+      missingNormal[m].resize(total);
+    }
+
+  pool.parallelFor(numChunks, [&](size_t c)
+    {
+      auto & chunk = chunks[c];
+      auto next = chunk.meshBase;
+      chunk.remap.resize(chunk.unique.size());
+
+      for (size_t u = 0; u < chunk.unique.size(); ++u)
+        {
+          if (!chunk.first[u]) continue;
+
+          const auto & key = chunk.unique[u];
+          auto idx = next[key.mesh]++;
+          auto & vert = mMeshes[key.mesh].verts[idx];
+
+          vert.position = positions[key.idx[0]];
+          chunk.bounds.grow(vert.position);
+          vert.texCoords = key.idx[1] != noVertex
+            ? texCoords[key.idx[1]]
+            : glm::vec2(0.0f);
+          vert.normal = key.idx[2] != noVertex
+            ? normals[key.idx[2]]
+            : glm::vec3(0.0f);
+          missingNormal[key.mesh][idx] = key.idx[2] == noVertex;
+
+          chunk.remap[u] = (uint32_t) idx;
+        }
+    });
+
+  for (const auto & chunk : chunks) mBounds.grow(chunk.bounds);
+
+  // every first appearance is numbered now, so the rest can look theirs up
+  pool.parallelFor(numChunks, [&](size_t c)
+    {
+      auto & chunk = chunks[c];
+      for (size_t u = 0; u < chunk.unique.size(); ++u)
+        {
+          if (chunk.first[u]) continue;
+          const auto & owner = chunks[chunk.owner[u] >> 32];
+          chunk.remap[u] = owner.remap[chunk.owner[u] & 0xFFFFFFFF];
+        }
+    });
+
+  // Write out each mesh's indices, every chunk into its own range
+
+  std::vector<size_t> cursors(numChunks * numMeshes);
+  for (size_t m = 0; m < numMeshes; ++m)
+    {
+      size_t total = 0;
+      for (size_t c = 0; c < numChunks; ++c)
+        {
+          cursors[c * numMeshes + m] = total;
+          total += chunks[c].meshCorners[m];
+        }
+      mMeshes[m].indices.resize(total);
+    }
+
+  pool.parallelFor(numChunks, [&](size_t c)
+    {
+      auto & chunk = chunks[c];
+      auto cursor = cursors.begin() + (ptrdiff_t) (c * numMeshes);
+
+      forEachCorner(chunk, [&](size_t i, uint32_t mesh)
+        {
+          mMeshes[mesh].indices[cursor[mesh]++] = chunk.remap[chunk.local[i]];
+        });
+    });
+
+  pool.parallelFor(numMeshes, [&](size_t m)
+    {
+      const auto & missing = missingNormal[m];
+      if (std::find(missing.begin(), missing.end(), 1) != missing.end())
+        {
+          smoothNormals(mMeshes[m], missing);
+        }
+
+      if (generateLods) buildLods(mMeshes[m]);
+      if (optimizeMeshes) optimizeMesh(mMeshes[m]);
+    });
+
+  mMeshes.erase(std::remove_if(mMeshes.begin(),
+                               mMeshes.end(),
+                               [](const Mesh & mesh)
+                               {
+                                 return mesh.indices.empty();
+                               }),
+                mMeshes.end());
+
+  return size;
+}
+
+std::vector<dmp::Object> dmp::Model::objects(size_t matIdx,
+                                             size_t texIdx) const
+{
+  std::vector<Object> res;
+  res.reserve(mMeshes.size());
+
+  for (const auto & curr : mMeshes)
+    {
+      res.emplace_back(curr.verts,
+                       curr.indices,
+                       curr.lods,
+                       GL_TRIANGLES,
+                       matIdx,
+                       texIdx);
+    }
+
+  return res;
+}
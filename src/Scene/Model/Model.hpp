@@ -0,0 +1,64 @@
+#ifndef DMP_SCENE_MODEL_MODEL_HPP
+#define DMP_SCENE_MODEL_MODEL_HPP
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "../Object.hpp"
+#include "../../ThreadPool.hpp"
+
+namespace dmp
+{
+  // Indexed triangles with no two vertices alike, ready to be uploaded as
+  // an Object
+  struct Mesh
+  {
+    std::string name;
+    std::vector<ObjectVertex> verts;
+    std::vector<GLuint> indices;
+
+    // ranges of indices, finest first. Empty means every index is one level
+    std::vector<LodLevel> lods;
+  };
+
+  // A Wavefront OBJ file. v, vt, vn and f lines are read, with polygons
+  // fanned into triangles, and each o or g line starts a new Mesh (or
+  // continues an earlier one of the same name). Everything else, materials
+  // included, is ignored. Vertices the file gives no normal get smooth,
+  // area weighted ones
+  //
+  // The file is memory mapped and split at line breaks into chunks that
+  // are parsed on pool in parallel. Each chunk deduplicates its own
+  // triangle corners, then the chunks' unique vertices are merged by
+  // shards of the hash space, also in parallel
+  class Model
+  {
+  public:
+    Model() = delete;
+    Model(const Model &) = delete;
+    Model & operator=(const Model &) = delete;
+    Model(Model &&) = default;
+    Model & operator=(Model &&) = default;
+
+    // throws if path can't be read or isn't a valid OBJ file. Must not be
+    // called from one of pool's tasks
+    Model(const std::string & path, ThreadPool & pool);
+
+    const std::vector<Mesh> & meshes() const {return mMeshes;}
+
+    // bounds of every mesh together
+    const AABB & bounds() const {return mBounds;}
+
+    // one Object per mesh. Must be called on the GL thread
+    std::vector<Object> objects(size_t matIdx, size_t texIdx) const;
+
+  private:
+    // returns the size of the file read, in bytes
+    size_t initModel(const std::string & path, ThreadPool & pool);
+
+    std::vector<Mesh> mMeshes;
+    AABB mBounds;
+  };
+}
+
+#endif
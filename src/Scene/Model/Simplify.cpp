@@ -0,0 +1,294 @@
+#include "Simplify.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include "../../util.hpp"
+#include "../../config.hpp"
+
+namespace
+{
+  // Sum of squared distances to a set of planes, as the symmetric 4x4
+  // matrix of the planes' outer products
+  struct Quadric
+  {
+    double a[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    static Quadric plane(const glm::vec3 & n, double d)
+    {
+      Quadric q;
+      double x = n.x;
+      double y = n.y;
+      double z = n.z;
+      q.a[0] = x * x;
+      q.a[1] = x * y;
+      q.a[2] = x * z;
+      q.a[3] = x * d;
+      q.a[4] = y * y;
+      q.a[5] = y * z;
+      q.a[6] = y * d;
+      q.a[7] = z * z;
+      q.a[8] = z * d;
+      q.a[9] = d * d;
+      return q;
+    }
+
+    Quadric & operator+=(const Quadric & other)
+    {
+      for (int i = 0; i < 10; ++i) a[i] += other.a[i];
+      return *this;
+    }
+
+    double operator()(const glm::vec3 & p) const
+    {
+      double x = p.x;
+      double y = p.y;
+      double z = p.z;
+      double res = a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z
+        + 2 * a[3] * x + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+        + a[7] * z * z + 2 * a[8] * z + a[9];
+      return std::max(res, 0.0);
+    }
+  };
+
+  struct Collapse
+  {
+    GLuint from;
+    GLuint to;
+    double cost;
+  };
+
+  struct PositionHash
+  {
+    size_t operator()(const glm::vec3 & p) const
+    {
+      return (size_t) dmp::hashBytes(&p, sizeof(p));
+    }
+  };
+
+  glm::vec3 triangleNormal(const glm::vec3 & a,
+                           const glm::vec3 & b,
+                           const glm::vec3 & c)
+  {
+    return glm::cross(b - a, c - a);
+  }
+}
+
+std::vector<GLuint> dmp::simplify(const std::vector<ObjectVertex> & verts,
+                                  const std::vector<GLuint> & indices,
+                                  size_t targetIndices,
+                                  float maxError,
+                                  float & error)
+{
+  error = 0.0f;
+  auto numVerts = verts.size();
+  std::vector<GLuint> res(indices);
+
+  // vertices that share a position, so that a seam moves as one
+  std::vector<GLuint> wedge(numVerts);
+  std::vector<uint8_t> locked(numVerts, 0);
+  {
+    std::unordered_map<glm::vec3, GLuint, PositionHash> first;
+    first.reserve(numVerts);
+    for (GLuint v = 0; v < numVerts; ++v)
+      {
+        auto found = first.emplace(verts[v].position, v);
+        wedge[v] = found.first->second;
+        if (!found.second)
+          {
+            locked[v] = 1;
+            locked[found.first->second] = 1;
+          }
+      }
+  }
+
+  // borders are edges only one triangle has; lock their ends. Undirected
+  // edges are counted by their lower end first
+  {
+    std::unordered_map<uint64_t, uint32_t> edges;
+    edges.reserve(res.size());
+    for (size_t i = 0; i < res.size(); i += 3)
+      {
+        for (size_t j = 0; j < 3; ++j)
+          {
+            uint64_t a = wedge[res[i + j]];
+            uint64_t b = wedge[res[i + (j + 1) % 3]];
+            ++edges[std::min(a, b) << 32 | std::max(a, b)];
+          }
+      }
+
+    for (const auto & curr : edges)
+      {
+        if (curr.second != 1) continue;
+        locked[curr.first >> 32] = 1;
+        locked[curr.first & 0xFFFFFFFF] = 1;
+      }
+  }
+
+  std::vector<Quadric> quadrics(numVerts);
+  for (size_t i = 0; i + 2 < res.size(); i += 3)
+    {
+      const auto & a = verts[res[i]].position;
+      const auto & b = verts[res[i + 1]].position;
+      const auto & c = verts[res[i + 2]].position;
+
+      auto n = triangleNormal(a, b, c);
+      auto len = glm::length(n);
+      if (len == 0.0f) continue;
+      n /= len;
+
+      auto q = Quadric::plane(n, -(double) glm::dot(n, a));
+      for (size_t j = 0; j < 3; ++j) quadrics[wedge[res[i + j]]] += q;
+    }
+
+  double maxCost = (double) maxError * maxError;
+  std::vector<GLuint> remap(numVerts);
+  std::vector<uint8_t> touched(numVerts);
+  std::vector<size_t> adjOffsets(numVerts + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<Collapse> collapses;
+
+  // Passes of collapses, each collapse a vertex and the one it lands on
+  // being left alone by the rest of the pass, so that costs and flip
+  // checks are all against the mesh as it was at the start of the pass
+  while (res.size() > targetIndices)
+    {
+      // triangles around each vertex
+      std::fill(adjOffsets.begin(), adjOffsets.end(), 0);
+      for (auto v : res) ++adjOffsets[v + 1];
+      for (size_t v = 0; v < numVerts; ++v) adjOffsets[v + 1] += adjOffsets[v];
+      adjacency.resize(res.size());
+      {
+        auto fill = adjOffsets;
+        for (size_t i = 0; i < res.size(); ++i)
+          {
+            adjacency[fill[res[i]]++] = (uint32_t) (i / 3);
+          }
+      }
+
+      collapses.clear();
+      for (size_t i = 0; i < res.size(); i += 3)
+        {
+          for (size_t j = 0; j < 3; ++j)
+            {
+              auto from = res[i + j];
+              auto to = res[i + (j + 1) % 3];
+              if (locked[from] || wedge[to] == wedge[from]) continue;
+
+              auto cost = quadrics[from](verts[to].position);
+              if (cost <= maxCost) collapses.push_back({from, to, cost});
+            }
+        }
+
+      std::sort(collapses.begin(),
+                collapses.end(),
+                [](const Collapse & lhs, const Collapse & rhs)
+                {
+                  return lhs.cost < rhs.cost;
+                });
+
+      for (size_t v = 0; v < numVerts; ++v) remap[v] = (GLuint) v;
+      std::fill(touched.begin(), touched.end(), 0);
+
+      // each collapse takes about two triangles with it
+      auto wanted = (res.size() - targetIndices) / 6 + 1;
+      size_t done = 0;
+
+      for (const auto & curr : collapses)
+        {
+          if (done >= wanted) break;
+          if (touched[curr.from] || touched[curr.to]) continue;
+
+          // refuse to turn any remaining triangle around from over
+          const auto & to = verts[curr.to].position;
+          bool flips = false;
+          for (auto a = adjOffsets[curr.from];
+               a < adjOffsets[curr.from + 1] && !flips;
+               ++a)
+            {
+              auto t = 3 * (size_t) adjacency[a];
+              glm::vec3 p[3];
+              bool dropped = false;
+              for (size_t j = 0; j < 3; ++j)
+                {
+                  auto v = res[t + j];
+                  if (v == curr.to) dropped = true;
+                  p[j] = verts[v].position;
+                }
+              if (dropped) continue;
+
+              auto before = triangleNormal(p[0], p[1], p[2]);
+              for (size_t j = 0; j < 3; ++j)
+                {
+                  if (res[t + j] == curr.from) p[j] = to;
+                }
+              auto after = triangleNormal(p[0], p[1], p[2]);
+              flips = glm::dot(before, after) <= 0.0f;
+            }
+          if (flips) continue;
+
+          // the neighbours' costs change too, so leave them to the next pass
+          for (auto a = adjOffsets[curr.from];
+               a < adjOffsets[curr.from + 1];
+               ++a)
+            {
+              auto t = 3 * (size_t) adjacency[a];
+              for (size_t j = 0; j < 3; ++j) touched[res[t + j]] = 1;
+            }
+
+          remap[curr.from] = curr.to;
+          quadrics[curr.to] += quadrics[curr.from];
+          error = std::max(error, (float) std::sqrt(curr.cost));
+          ++done;
+        }
+
+      if (done == 0) break;
+
+      size_t out = 0;
+      for (size_t i = 0; i < res.size(); i += 3)
+        {
+          auto a = remap[res[i]];
+          auto b = remap[res[i + 1]];
+          auto c = remap[res[i + 2]];
+          if (a == b || b == c || c == a) continue;
+          res[out++] = a;
+          res[out++] = b;
+          res[out++] = c;
+        }
+      res.resize(out);
+    }
+
+  return res;
+}
+
+void dmp::buildLods(Mesh & mesh)
+{
+  mesh.lods.clear();
+  mesh.lods.push_back({0, mesh.indices.size(), 0.0f});
+  if (mesh.indices.empty()) return;
+
+  AABB box;
+  for (const auto & curr : mesh.verts) box.grow(curr.position);
+  auto maxError = lodMaxError * glm::length(box.max - box.min);
+
+  std::vector<GLuint> prev(mesh.indices);
+  float prevError = 0.0f;
+  while (mesh.lods.size() < maxLodLevels)
+    {
+      auto target = prev.size() / 6 * 3;
+      if (target / 3 < minLodTriangles) break;
+
+      float error;
+      auto next = simplify(mesh.verts, prev, target, maxError, error);
+
+      // stuck on locked vertices, or at the error limit
+      if (next.size() > prev.size() * 3 / 4) break;
+
+      // errors add up from level to level
+      prevError += error;
+      mesh.lods.push_back({mesh.indices.size(), next.size(), prevError});
+      mesh.indices.insert(mesh.indices.end(), next.begin(), next.end());
+      prev.swap(next);
+    }
+}
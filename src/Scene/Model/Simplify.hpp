@@ -0,0 +1,33 @@
+#ifndef DMP_SCENE_MODEL_SIMPLIFY_HPP
+#define DMP_SCENE_MODEL_SIMPLIFY_HPP
+
+#include <vector>
+#include <GL/glew.h>
+#include "Model.hpp"
+
+namespace dmp
+{
+  // Quadric error edge collapse (Garland and Heckbert, "Surface
+  // Simplification Using Quadric Error Metrics", 1997), with each vertex
+  // collapsing onto a neighbour rather than a new position, so the result
+  // indexes the same vertices as indices does. Collapses go cheapest first
+  // until at most targetIndices remain or the next would move the surface
+  // further than maxError. Vertices on borders and on seams between
+  // vertices that share a position but not their other attributes stay
+  // put. error is set to how far the result strays from the input
+  std::vector<GLuint> simplify(const std::vector<ObjectVertex> & verts,
+                               const std::vector<GLuint> & indices,
+                               size_t targetIndices,
+                               float maxError,
+                               float & error);
+
+  // Fills mesh.lods with a chain of levels of detail, the first being
+  // every triangle, each following one simplified to about half the
+  // triangles of the one before. Levels are appended to mesh.indices, so
+  // the chain shares one vertex buffer and one index buffer. Stops at
+  // maxLodLevels levels, at minLodTriangles, or when simplifying no longer
+  // gets far
+  void buildLods(Mesh & mesh);
+}
+
+#endif
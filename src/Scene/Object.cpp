@@ -1,7 +1,9 @@
 #include "Object.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <glm/gtc/matrix_transform.hpp>
+#include "../config.hpp"
 
 #include <glm/gtx/string_cast.hpp>
 
@@ -49,9 +51,96 @@ dmp::Object::Object(std::vector<ObjectVertex> verts,
   initObject(&verts, &idxs);
 }
 
+dmp::Object::Object(std::vector<ObjectVertex> verts,
+                    std::vector<GLuint> idxs,
+                    std::vector<LodLevel> lods,
+                    GLenum format,
+                    size_t matIdx,
+                    size_t texIdx)
+{
+  mHasIndices = true;
+  mPrimFormat = format;
+  mMaterialIdx = matIdx;
+  mTextureIdx = texIdx;
+  mNumVerts = verts.size();
+  initObject(&verts, &idxs, std::move(lods));
+}
+
+dmp::Object::Object(std::shared_ptr<const RetainedGeometry> geom,
+                    GLenum format,
+                    size_t matIdx,
+                    size_t texIdx)
+{
+  mHasIndices = geom->indices != nullptr;
+  mPrimFormat = format;
+  mMaterialIdx = matIdx;
+  mTextureIdx = texIdx;
+  mNumVerts = geom->numVerts;
+  initObject(std::move(geom));
+}
+
+namespace
+{
+  struct OwnedGeometry
+  {
+    std::vector<unsigned char> verts;
+    std::vector<unsigned char> indices;
+  };
+}
+
 void dmp::Object::initObject(std::vector<ObjectVertex> * verts,
-                             std::vector<GLuint> * idxs)
+                             std::vector<GLuint> * idxs,
+                             std::vector<LodLevel> lods)
 {
+  // vertices that get rewritten through updateVertices stay unpacked
+  auto format = mDrawMode == GL_STATIC_DRAW
+    ? meshVertexFormat
+    : VertexFormat::Full;
+
+  auto geom = std::make_shared<RetainedGeometry>();
+  for (const auto & curr : *verts)
+    {
+      geom->bounds.grow(curr.position);
+    }
+
+  auto owned = std::make_shared<OwnedGeometry>();
+  owned->verts = packVertices(verts->data(),
+                              verts->size(),
+                              format,
+                              geom->bounds);
+  geom->layout = &vertexLayout(format);
+  geom->verts = owned->verts.data();
+  geom->numVerts = verts->size();
+
+  if (idxs)
+    {
+      geom->indexType = indexType(verts->size());
+      owned->indices = packIndices(idxs->data(),
+                                   idxs->size(),
+                                   geom->indexType);
+      geom->indices = owned->indices.data();
+      geom->numIndices = idxs->size();
+    }
+
+  // the unpacked vertices double as the CPU copy that updates work on
+  if (mDrawMode == GL_DYNAMIC_DRAW)
+    {
+      auto shadow = reinterpret_cast<ObjectVertex *>(owned->verts.data());
+      mShadow = std::shared_ptr<ObjectVertex>(owned, shadow);
+    }
+
+  geom->storage = std::move(owned);
+  geom->lods = std::move(lods);
+  initObject(std::move(geom));
+}
+
+void dmp::Object::initObject(std::shared_ptr<const RetainedGeometry> geom)
+{
+  const auto & layout = *geom->layout;
+  mFormat = layout.format;
+  mIndexType = geom->indexType;
+  mDecode = decodeMatrix(mFormat, geom->bounds);
+
   glGenVertexArrays(1,&mVAO);
   glGenBuffers(1, &mVBO);
   if (mHasIndices) glGenBuffers(1, &mEBO);
@@ -59,13 +148,22 @@ void dmp::Object::initObject(std::vector<ObjectVertex> * verts,
   expectNoErrors("Gen Buffers and Arrays");
   glBindVertexArray(mVAO);
 
-  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
-  glBufferData(GL_ARRAY_BUFFER,
-               verts->size() * sizeof(ObjectVertex),
-               verts->data(),
-               mDrawMode);
+  auto vertexBytes = geom->numVerts * (size_t) layout.stride;
+  if (mDrawMode == GL_STATIC_DRAW)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+      glBufferData(GL_ARRAY_BUFFER, vertexBytes, geom->verts, mDrawMode);
+    }
+  else
+    {
+      mStream = std::make_shared<StreamBuffer>(mVBO,
+                                               GL_ARRAY_BUFFER,
+                                               vertexBytes,
+                                               streamRegions,
+                                               geom->verts);
+    }
 
-  drawCount = (GLsizei) verts->size();
+  drawCount = (GLsizei) geom->numVerts;
 
   expectNoErrors("Upload Vertex data");
 
@@ -73,38 +171,25 @@ void dmp::Object::initObject(std::vector<ObjectVertex> * verts,
     {
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
       glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                   idxs->size() * sizeof(GLuint),
-                   idxs->data(),
+                   geom->numIndices * indexBytes(mIndexType),
+                   geom->indices,
                    mDrawMode);
 
-      drawCount = (GLsizei) idxs->size();
+      drawCount = (GLsizei) geom->numIndices;
 
       expectNoErrors("Upload Index data");
     }
 
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0,        // index
-                        3,        // number of components
-                        GL_FLOAT, // what is the type of this thing?
-                        GL_FALSE, // normalize [intMin, intMax] to [-1,1]?
-                        sizeof(ObjectVertex), // how much space between things?
-                        (GLvoid *) 0);        // offset of this thing
-
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1,
-                        3,
-                        GL_FLOAT,
-                        GL_FALSE,
-                        sizeof(ObjectVertex),
-                        (GLvoid *) offsetof(ObjectVertex, normal));
-
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2,
-                        2,
-                        GL_FLOAT,
-                        GL_FALSE,
-                        sizeof(ObjectVertex),
-                        (GLvoid *) offsetof(ObjectVertex, texCoords));
+  for (const auto & curr : layout.attributes)
+    {
+      glEnableVertexAttribArray(curr.location);
+      glVertexAttribPointer(curr.location,
+                            curr.components,
+                            curr.type,
+                            curr.normalized,
+                            layout.stride,
+                            (GLvoid *) (size_t) curr.offset);
+    }
 
   expectNoErrors("Set vertex attributes");
 
@@ -112,6 +197,19 @@ void dmp::Object::initObject(std::vector<ObjectVertex> * verts,
   glBindVertexArray(0);
 
   expectNoErrors("Complete object init");
+
+  mNumVerts = geom->numVerts;
+  mBounds = geom->bounds;
+  mLods = geom->lods;
+  mLod = 0;
+
+  // streamed vertices are only ever on the GPU, so what was given here
+  // would soon be stale
+  if (mPrimFormat == GL_TRIANGLES && mDrawMode != GL_STREAM_DRAW)
+    {
+      mGeometry = std::move(geom);
+    }
+
   mValid = true;
 }
 
@@ -130,9 +228,10 @@ void dmp::Object::sortByMaterial(std::vector<Object *> & objs)
 
 dmp::ObjectConstants dmp::Object::getObjectConstants() const
 {
+  // normals aren't quantized, so they skip the decode
   ObjectConstants retVal =
     {
-      mM,
+      mM * mDecode,
       glm::mat4(glm::transpose(glm::inverse(glm::mat3(mM))))
     };
 
@@ -143,141 +242,197 @@ void dmp::Object::draw() const
 {
   expect("Object valid", mValid);
   if (!mVisible) return;
+
+  // streamed vertices are drawn from the region last written
+  auto baseVertex = mStream ? (GLint) (mStream->region() * mNumVerts) : 0;
+
   if (mHasIndices)
     {
-      glDrawElements(mPrimFormat,
-                     drawCount,
-                     GL_UNSIGNED_INT,
-                     0); // TODO: whats up with this parameter? (its a pointer)
+      size_t first = 0;
+      auto count = drawCount;
+      if (!mLods.empty())
+        {
+          first = mLods[mLod].firstIndex;
+          count = (GLsizei) mLods[mLod].numIndices;
+        }
+
+      glDrawElementsBaseVertex(mPrimFormat,
+                               count,
+                               mIndexType,
+                               (GLvoid *) (first * indexBytes(mIndexType)),
+                               baseVertex);
     }
   else
     {
       glDrawArrays(mPrimFormat,
-                   0,
+                   baseVertex,
                    drawCount);
     }
   expectNoErrors("Draw object");
 }
 
-// -----------------------------------------------------------------------------
-// Primitive shape constructor
-// -----------------------------------------------------------------------------
+void dmp::Object::selectLod(const glm::mat4 & V,
+                            const glm::mat4 & P,
+                            float viewportHeight)
+{
+  if (mLods.size() < 2) return;
 
-static const dmp::ObjectVertex cubeVerts[] =
-  {
-    {
-      {-0.5f, -0.5f,  0.5f},
-      {-0.5f, -0.5f,  0.5f},
-      {}, // TODO: tex coords
-    },
-    {
-      {0.5f, -0.5f,  0.5f},
-      {0.5f, -0.5f,  0.5f},
-      {}, // TODO: tex coords
-    },
+  auto box = worldBounds();
+  auto center = glm::vec3(V * glm::vec4(box.centroid(), 1.0f));
+  auto radius = 0.5f * glm::length(box.max - box.min);
+  auto dist = std::max(glm::length(center) - radius, nearZ);
+
+  // errors are in object space; M's largest scale takes them to the world
+  auto scale = std::max(glm::length(glm::vec3(mM[0])),
+                        std::max(glm::length(glm::vec3(mM[1])),
+                                 glm::length(glm::vec3(mM[2]))));
+  auto pixelsPerUnit = 0.5f * viewportHeight * P[1][1] * scale / dist;
+
+  auto level = std::min(mLod, mLods.size() - 1);
+  while (level > 0 && mLods[level].error * pixelsPerUnit > lodPixelError)
     {
-      {0.5f,  0.5f,  0.5f},
-      {0.5f,  0.5f,  0.5f},
-      {}, // TODO: tex coords
-    },
+      --level;
+    }
+  while (level + 1 < mLods.size()
+         && mLods[level + 1].error * pixelsPerUnit
+         <= lodPixelError * (1.0f - lodHysteresis))
     {
-      {-0.5f,  0.5f,  0.5f},
-      {-0.5f,  0.5f,  0.5f},
-      {}, // TODO: tex coords
-    },
+      ++level;
+    }
+
+  mLod = level;
+}
+
+size_t dmp::Object::numTriangles() const
+{
+  if (mPrimFormat != GL_TRIANGLES) return 0;
+  if (!mLods.empty()) return mLods[mLod].numIndices / 3;
+  return (size_t) drawCount / 3;
+}
+
+// -----------------------------------------------------------------------------
+// Picking
+// -----------------------------------------------------------------------------
+
+// Moller-Trumbore, double sided
+static bool intersectTriangle(const dmp::Ray & ray,
+                              const glm::vec3 & a,
+                              const glm::vec3 & b,
+                              const glm::vec3 & c,
+                              float & t)
+{
+  const float epsilon = 1e-7f;
+
+  glm::vec3 ab = b - a;
+  glm::vec3 ac = c - a;
+  glm::vec3 p = glm::cross(ray.dir, ac);
+  float det = glm::dot(ab, p);
+
+  if (fabsf(det) < epsilon) return false;
+
+  float invDet = 1.0f / det;
+  glm::vec3 s = ray.origin - a;
+  float u = glm::dot(s, p) * invDet;
+  if (u < 0.0f || u > 1.0f) return false;
+
+  glm::vec3 q = glm::cross(s, ab);
+  float v = glm::dot(ray.dir, q) * invDet;
+  if (v < 0.0f || u + v > 1.0f) return false;
+
+  t = glm::dot(ac, q) * invDet;
+  return t >= 0.0f;
+}
+
+bool dmp::Object::intersect(const Ray & ray, float & t) const
+{
+  if (!mGeometry)
     {
-      {-0.5f, -0.5f, -0.5f},
-      {-0.5f, -0.5f, -0.5f},
-      {}, // TODO: tex coords
-    },
+      float tNear;
+      if (!worldBounds().intersect(ray, 1.0f / ray.dir, t, tNear)) return false;
+      t = tNear;
+      return true;
+    }
+
+  // Take the ray into object space rather than the triangles into world
+  // space. The direction is left unnormalized so that distances along the
+  // local ray are the same as distances along the world ray
+  glm::mat4 invM = glm::inverse(mM);
+  Ray local =
     {
-      {0.5f, -0.5f, -0.5f},
-      {0.5f, -0.5f, -0.5f},
-      {}, // TODO: tex coords
-    },
+      glm::vec3(invM * glm::vec4(ray.origin, 1.0f)),
+      glm::vec3(invM * glm::vec4(ray.dir, 0.0f))
+    };
+
+  // against the finest level, whatever is drawn
+  const auto & geom = *mGeometry;
+  bool indexed = geom.indices != nullptr;
+  size_t first = 0;
+  size_t count = indexed ? geom.numIndices : geom.numVerts;
+  if (indexed && !geom.lods.empty())
     {
-      {0.5f,  0.5f, -0.5f},
-      {0.5f,  0.5f, -0.5f},
-      {}, // TODO: tex coords
-    },
+      first = geom.lods[0].firstIndex;
+      count = first + geom.lods[0].numIndices;
+    }
+
+  bool hit = false;
+  for (size_t i = first; i + 2 < count; i += 3)
     {
-      {-0.5f,  0.5f, -0.5f},
-      {-0.5f,  0.5f, -0.5f},
-      {}, // TODO: tex coords
+      auto a = geom.position(indexed ? geom.index(i) : i);
+      auto b = geom.position(indexed ? geom.index(i + 1) : i + 1);
+      auto c = geom.position(indexed ? geom.index(i + 2) : i + 2);
+
+      float curr;
+      if (intersectTriangle(local, a, b, c, curr) && curr < t)
+        {
+          t = curr;
+          hit = true;
+        }
     }
-  };
 
-static const GLuint cubeIdxs[] =
-  {
-    0, 1, 2, //2, 1, 0,
-    2, 3, 0, //0, 3, 2,
-    1, 5, 6, //6, 5, 1,
-    6, 2, 1, //1, 2, 6,
-    7, 6, 5, //5, 6, 7,
-    5, 4, 7, //7, 4, 5,
-    4, 0, 3, //3, 0, 4,
-    3, 7, 4, //4, 7, 3,
-    4, 5, 1, //1, 5, 4,
-    1, 0, 4, //4, 0, 1,
-    3, 2, 6, //6, 2, 3,
-    6, 7, 3  //3, 7, 6
-  };
+  return hit;
+}
+
+// -----------------------------------------------------------------------------
+// Primitive shape constructor
+// -----------------------------------------------------------------------------
 
 dmp::Object::Object(Shape shape, glm::vec4 min, glm::vec4 max,
-                    size_t matIdx, size_t texIdx)
+                    size_t matIdx, size_t texIdx,
+                    const ShapeParams & params)
 {
   mHasIndices = true;
   mPrimFormat = GL_TRIANGLES;
   mMaterialIdx = matIdx;
   mTextureIdx = texIdx;
 
-  switch (shape)
-    {
-    case Cube:
-      glm::vec3 scaleFac = glm::vec3(max - min);
-      glm::vec3 offset = glm::vec3(glm::mix(min, max, 0.5f));
-      glm::mat4 trans = glm::translate(glm::mat4(), offset);
-      glm::mat4 scale = glm::scale(glm::mat4(), scaleFac);
-      glm::mat4 M = trans * scale;
-      glm::mat4 normalM = glm::mat4(glm::transpose(glm::inverse(glm::mat3(M))));
-
-      std::vector<ObjectVertex> v;
-
-      for (size_t i = 0; i < 8; ++i)
-        {
-          v.push_back({
-              glm::vec3(M * glm::vec4(cubeVerts[i].position, 1.0f)),
-              glm::vec3(normalM * glm::vec4(cubeVerts[i].normal, 0.0f)),
-                cubeVerts[i].texCoords
-            });
-        }
-
-      std::vector<GLuint> idxs;
-
-      for (size_t i = 0; i < 36; ++i)
-        {
-          idxs.push_back(cubeIdxs[i]);
-        }
-
-      initObject(&v, &idxs);
-      break;
-    }
+  auto mesh = buildShape(shape, glm::vec3(min), glm::vec3(max), params);
+  mNumVerts = mesh.verts.size();
+  initObject(&mesh.verts, &mesh.indices);
 }
 
-void dmp::Object::updateVertices(std::function<void(ObjectVertex * data,
+void dmp::Object::updateVertices(size_t first,
+                                 size_t count,
+                                 std::function<void(ObjectVertex * data,
                                                     size_t numElems)> updateFn)
 {
-  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
-  auto buf = glMapBufferRange(GL_ARRAY_BUFFER,
-                              0,
-                              mNumVerts * sizeof(ObjectVertex),
-                              GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
-  expectNoErrors("Map the VBO");
+  expect("Updated vertices are unpacked", mFormat == VertexFormat::Full);
+  expect("Updated vertices are streamed", mStream);
+  expect("Updated vertices exist",
+         first <= mNumVerts && count <= mNumVerts - first);
+  if (count == 0) return;
+
+  // with a CPU copy, update that and stream the result. The mapping is
+  // write only, so it is never read back either way
+  if (mShadow) updateFn(mShadow.get() + first, count);
+
+  auto bytes = count * sizeof(ObjectVertex);
+  auto buf = mStream->map(first * sizeof(ObjectVertex), bytes);
   expect("buffer not null", buf);
 
-  updateFn((ObjectVertex *) buf, mNumVerts);
+  if (mShadow) std::memcpy(buf, mShadow.get() + first, bytes);
+  else updateFn((ObjectVertex *) buf, count);
   expectNoErrors("call updateFn on buf");
 
-  glUnmapBuffer(GL_ARRAY_BUFFER);
-  expectNoErrors("Unmap the buffer");
+  mStream->unmap();
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
@@ -2,11 +2,15 @@
 #define DMP_SCENE_OBJECT_HPP
 
 #include <vector>
+#include <memory>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include "Types.hpp"
+#include "VertexFormat.hpp"
+#include "Shapes.hpp"
 #include "../util.hpp"
 #include "../Renderer/UniformBuffer.hpp"
+#include "../Renderer/StreamBuffer.hpp"
 
 #include <iostream>
 
@@ -14,31 +18,73 @@ namespace dmp
 {
   class Model;
 
-  enum Shape
-    {
-      Cube
-    };
-
-  struct ObjectVertex
-  {
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 texCoords;
-  };
-
   struct ObjectConstants
   {
     glm::mat4 M;
     glm::mat4 normalM;
 
-    static size_t std140Size()
+    static constexpr std::array<std140::Field, 2> layout()
     {
-      return dmp::std140PadStruct((std140MatSize<float, 4, 4>() * 2));
+      return {{
+          DMP_STD140_FIELD(ObjectConstants, Mat4, M),
+          DMP_STD140_FIELD(ObjectConstants, Mat4, normalM)
+        }};
+    }
+
+    static constexpr size_t std140Size()
+    {
+      return std140::blockSize(layout());
     }
 
     operator GLvoid *() {return (GLvoid *) this;}
   };
 
+  static_assert(std140::matches(ObjectConstants::layout()),
+                "ObjectConstants members are not at their std140 offsets");
+
+  // A range of an Object's indices that draws it at some level of detail,
+  // and how far, in object space, that level strays from the finest
+  struct LodLevel
+  {
+    size_t firstIndex;
+    size_t numIndices;
+    float error;
+  };
+
+  // CPU side copy of an Object's triangles, kept around for picking. Copies
+  // of an Object share their GPU buffers, so they share this too. The
+  // vertices and indices live in whatever storage points to, such as the
+  // packed buffers an Object was built from or a mapped cooked mesh, and
+  // no indices means the vertices are drawn in order
+  struct RetainedGeometry
+  {
+    std::shared_ptr<const void> storage;
+    const VertexLayout * layout = &vertexLayout(VertexFormat::Full);
+    const void * verts = nullptr;
+    size_t numVerts = 0;
+    const void * indices = nullptr;
+    size_t numIndices = 0;
+    GLenum indexType = GL_UNSIGNED_INT;
+    AABB bounds; // object space, and what quantized positions are within
+
+    // finest first. Empty means every index is one level
+    std::vector<LodLevel> lods;
+
+    glm::vec3 position(size_t i) const
+    {
+      return unpackPosition(verts, i, *layout, bounds);
+    }
+
+    GLuint index(size_t i) const
+    {
+      if (indexType == GL_UNSIGNED_SHORT)
+        {
+          return static_cast<const uint16_t *>(indices)[i];
+        }
+      return static_cast<const GLuint *>(indices)[i];
+    }
+  };
+
   class Object
   {
   public:
@@ -59,6 +105,12 @@ namespace dmp
       mValid = false;
     }
 
+    // drawMode GL_DYNAMIC_DRAW or GL_STREAM_DRAW makes an Object whose
+    // vertices can be rewritten with updateVertices. Dynamic Objects keep
+    // a CPU copy of their vertices, so updates can read them and picking
+    // sees them. Streamed Objects keep nothing, so updates must write
+    // every vertex they cover, and picking only tests bounds. Either way,
+    // bounds stay those of the vertices given here
     Object(std::vector<ObjectVertex> verts,
            std::vector<GLuint> idxs,
            GLenum format,
@@ -76,8 +128,25 @@ namespace dmp
            size_t matIdx,
            size_t texIdx);
 
+    // lods are ranges of idxs, finest first
+    Object(std::vector<ObjectVertex> verts,
+           std::vector<GLuint> idxs,
+           std::vector<LodLevel> lods,
+           GLenum format,
+           size_t matIdx,
+           size_t texIdx);
+
+    // a procedural shape fitted to the box [min, max], see buildShape.
+    // ShapeCache shares the mesh between Objects of the same shape
     Object(Shape shape, glm::vec4 min, glm::vec4 max,
-           size_t matIdx, size_t texIdx);
+           size_t matIdx, size_t texIdx,
+           const ShapeParams & params = ShapeParams());
+
+    // uploads straight from geom's storage, with no pass over the vertices
+    Object(std::shared_ptr<const RetainedGeometry> geom,
+           GLenum format,
+           size_t matIdx,
+           size_t texIdx);
 
     bool isDirty() const {return mDirty && mVisible;}
     void setClean() {mDirty = false;}
@@ -101,8 +170,36 @@ namespace dmp
 
     glm::mat4 getM() const {return mM;}
 
+    const AABB & localBounds() const {return mBounds;}
+    AABB worldBounds() const {return mBounds.transform(mM);}
+
+    // Intersects a world space ray with this object's triangles. t is the
+    // closest hit found so far; on return true it has been lowered to the
+    // distance of the hit on this object. Objects that retained no triangles
+    // are tested against their bounds instead
+    bool intersect(const Ray & ray, float & t) const;
+
+    // Picks the level of detail to draw from how many pixels each level's
+    // error covers, seen through V and P in a viewport viewportHeight
+    // pixels tall. Levels are coarsened past lodPixelError only with a
+    // margin of lodHysteresis, so objects near a threshold don't flicker
+    void selectLod(const glm::mat4 & V,
+                   const glm::mat4 & P,
+                   float viewportHeight);
+    void resetLod() {mLod = 0;}
+    size_t lod() const {return mLod;}
+    size_t numLods() const {return std::max(mLods.size(), (size_t) 1);}
+
+    // at the current level of detail
+    size_t numTriangles() const;
+
     size_t materialIndex() const {return mMaterialIdx;}
     size_t textureIndex() const {return mTextureIdx;}
+    void setMaterial(size_t matIdx, size_t texIdx)
+    {
+      mMaterialIdx = matIdx;
+      mTextureIdx = texIdx;
+    }
 
     static void sortByMaterial(std::vector<Object *> & objs);
 
@@ -118,16 +215,36 @@ namespace dmp
       mVisible = false;
     }
 
-    // memory maps the VBO, calls updateFn and then unmaps the VBO
-    // - data is a pointer to the data buffer
-    // - numElems is the number of elements in the mapped buffer
-    // CONTRACT: drawType must be dynamic draw
-    void updateVertices(std::function<void(ObjectVertex * data,
+    bool isVisible() const {return mVisible;}
+
+    // calls updateFn on vertices [first, first + count), then streams
+    // them to the GPU without waiting on draws that still read the old
+    // ones. See StreamBuffer
+    // - data is a pointer to vertex first
+    // - numElems is count
+    // CONTRACT: drawMode must be dynamic or stream draw, which keep
+    // vertices as ObjectVertex rather than packing them. With stream draw
+    // data is write only, and updateFn must write all of it
+    void updateVertices(size_t first,
+                        size_t count,
+                        std::function<void(ObjectVertex * data,
                                            size_t numElems)> updateFn);
 
+    // as above, over every vertex
+    void updateVertices(std::function<void(ObjectVertex * data,
+                                           size_t numElems)> updateFn)
+    {
+      updateVertices(0, mNumVerts, std::move(updateFn));
+    }
+
+    // updates that had to wait for the GPU, over every copy of this Object
+    size_t streamStalls() const {return mStream ? mStream->stalls() : 0;}
+
   private:
     void initObject(std::vector<ObjectVertex> * verts,
-                    std::vector<GLuint> * idxs);
+                    std::vector<GLuint> * idxs,
+                    std::vector<LodLevel> lods = {});
+    void initObject(std::shared_ptr<const RetainedGeometry> geom);
 
     GLuint mVAO = 0;
     GLuint mVBO = 0;
@@ -146,6 +263,21 @@ namespace dmp
     bool mVisible = true;
 
     GLenum mDrawMode = GL_STATIC_DRAW;
+    GLenum mIndexType = GL_UNSIGNED_INT;
+    VertexFormat mFormat = VertexFormat::Full;
+    glm::mat4 mDecode; // from stored positions to object space
+
+    std::vector<LodLevel> mLods;
+    size_t mLod = 0;
+
+    // streamRegions copies of the vertices for dynamic and stream draw
+    // Objects, and for dynamic draw the CPU copy. Copies of an Object
+    // share these, as they do the VBO
+    std::shared_ptr<StreamBuffer> mStream;
+    std::shared_ptr<ObjectVertex> mShadow;
+
+    AABB mBounds;
+    std::shared_ptr<const RetainedGeometry> mGeometry;
   };
 }
 
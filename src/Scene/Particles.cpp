@@ -0,0 +1,397 @@
+#include "Particles.hpp"
+
+#include <algorithm>
+#include "../util.hpp"
+#include "../config.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // xorshift, four independent lanes of it
+  struct Random
+  {
+#ifdef __SSE2__
+    __m128i state;
+
+    explicit Random(uint32_t seed)
+    {
+      state = _mm_set_epi32((int) (seed ^ 0x9E3779B9u) | 1,
+                            (int) (seed ^ 0x7F4A7C15u) | 1,
+                            (int) (seed ^ 0x85EBCA6Bu) | 1,
+                            (int) (seed ^ 0xC2B2AE35u) | 1);
+      for (int i = 0; i < 4; ++i) next();
+    }
+
+    // four floats in [0, 1)
+    __m128 next()
+    {
+      state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+      state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+      state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+
+      // the top 23 bits as the mantissa of a float in [1, 2)
+      auto bits = _mm_or_si128(_mm_srli_epi32(state, 9),
+                               _mm_set1_epi32(0x3F800000));
+      return _mm_sub_ps(_mm_castsi128_ps(bits), _mm_set1_ps(1.0f));
+    }
+#else
+    uint32_t state[4];
+
+    explicit Random(uint32_t seed)
+    {
+      state[0] = (seed ^ 0xC2B2AE35u) | 1;
+      state[1] = (seed ^ 0x85EBCA6Bu) | 1;
+      state[2] = (seed ^ 0x7F4A7C15u) | 1;
+      state[3] = (seed ^ 0x9E3779B9u) | 1;
+      float ignored[4];
+      for (int i = 0; i < 4; ++i) next(ignored);
+    }
+
+    void next(float * out)
+    {
+      for (int i = 0; i < 4; ++i)
+        {
+          auto & s = state[i];
+          s ^= s << 13;
+          s ^= s >> 17;
+          s ^= s << 5;
+          out[i] = (float) (s >> 8) / 16777216.0f;
+        }
+    }
+#endif
+  };
+}
+
+dmp::ParticleEmitter::ParticleEmitter(const EmitterParams & params)
+  : mParams(params),
+    mBlockSize(std::min(particleBlockSize, params.capacity))
+{
+  initParticleEmitter();
+}
+
+void dmp::ParticleEmitter::initParticleEmitter()
+{
+  expect("Particle emitter has room", mParams.capacity > 0);
+
+  auto numBlocks = (mParams.capacity + mBlockSize - 1) / mBlockSize;
+  for (auto & curr : mData) curr.resize(numBlocks * mBlockSize);
+  mBlockCounts.assign(numBlocks, 0);
+  mBlockEmits.assign(numBlocks, 0);
+  mBlockOffsets.assign(numBlocks, 0);
+
+  glGenVertexArrays(1, &mVAO);
+  glGenBuffers(1, &mVBO);
+  glBindVertexArray(mVAO);
+
+  mStream = std::make_unique<StreamBuffer>(mVBO,
+                                           GL_ARRAY_BUFFER,
+                                           mParams.capacity
+                                           * sizeof(ParticleInstance),
+                                           streamRegions,
+                                           nullptr);
+
+  // one per instance; the quad's corners come from gl_VertexID
+  glEnableVertexAttribArray(0);
+  glVertexAttribDivisor(0, 1);
+
+  glBindVertexArray(0);
+  expectNoErrors("Init particle emitter");
+  mValid = true;
+}
+
+void dmp::ParticleEmitter::freeParticleEmitter()
+{
+  if (!mValid) return;
+
+  mStream.reset();
+  glDeleteVertexArrays(1, &mVAO);
+  glDeleteBuffers(1, &mVBO);
+
+  mValid = false;
+}
+
+void dmp::ParticleEmitter::update(float deltaT, ThreadPool * pool)
+{
+  ++mFrame;
+
+  // deal out this update's births to blocks with room, first come first
+  // served, carrying fractions of a particle over to the next update
+  auto births = mParams.rate * deltaT + mEmitCarry;
+  auto toEmit = (size_t) births;
+  mEmitCarry = births - (float) toEmit;
+  if (toEmit > mParams.capacity - mCount)
+    {
+      toEmit = mParams.capacity - mCount;
+      mEmitCarry = 0.0f;
+    }
+
+  auto numBlocks = mBlockCounts.size();
+  for (size_t b = 0; b < numBlocks; ++b)
+    {
+      auto room = std::min(mBlockSize, mParams.capacity - b * mBlockSize)
+        - mBlockCounts[b];
+      mBlockEmits[b] = std::min(room, toEmit);
+      toEmit -= mBlockEmits[b];
+    }
+
+  auto step = [&](size_t b)
+    {
+      if (mBlockEmits[b] > 0)
+        {
+          auto seed = (uint32_t) hashBytes(&b, sizeof(b), mFrame);
+          emit(b, mBlockEmits[b], seed);
+        }
+      simulate(b, deltaT);
+    };
+  if (pool) pool->parallelFor(numBlocks, step);
+  else for (size_t b = 0; b < numBlocks; ++b) step(b);
+
+  mCount = 0;
+  for (size_t b = 0; b < numBlocks; ++b)
+    {
+      mBlockOffsets[b] = mCount;
+      mCount += mBlockCounts[b];
+    }
+  if (mCount == 0) return;
+
+  auto out = static_cast<ParticleInstance *>(
+    mStream->map(0, mCount * sizeof(ParticleInstance)));
+  auto copy = [&](size_t b) {write(b, out + mBlockOffsets[b]);};
+  if (pool) pool->parallelFor(numBlocks, copy);
+  else for (size_t b = 0; b < numBlocks; ++b) copy(b);
+  mStream->unmap();
+}
+
+void dmp::ParticleEmitter::emit(size_t block, size_t count, uint32_t seed)
+{
+  auto first = mBlockCounts[block];
+  float * dst[NumComponents];
+  for (int c = 0; c < NumComponents; ++c)
+    {
+      dst[c] = component((Component) c, block) + first;
+    }
+
+  auto origin = glm::vec3(mM[3]);
+  auto axis = glm::normalize(glm::vec3(mM[1]));
+  auto base = axis * mParams.speed;
+  auto spread = mParams.spread * mParams.speed;
+  auto radius = mParams.radius;
+  auto life = mParams.life;
+  auto jitter = mParams.lifeJitter * mParams.life;
+
+  Random random(seed);
+
+#ifdef __SSE2__
+  // centered on center, up to scale either way
+  auto around = [&](float center, float scale)
+    {
+      auto r = random.next();
+      return _mm_add_ps(_mm_set1_ps(center - scale),
+                        _mm_mul_ps(r, _mm_set1_ps(2.0f * scale)));
+    };
+
+  size_t i = 0;
+  for (; i < count; i += 4)
+    {
+      __m128 lanes[NumComponents] =
+        {
+          around(origin.x, radius),
+          around(origin.y, radius),
+          around(origin.z, radius),
+          around(base.x, spread),
+          around(base.y, spread),
+          around(base.z, spread),
+          _mm_setzero_ps(),
+          _mm_div_ps(_mm_set1_ps(1.0f),
+                     _mm_sub_ps(_mm_set1_ps(life),
+                                _mm_mul_ps(random.next(),
+                                           _mm_set1_ps(jitter))))
+        };
+
+      if (i + 4 <= count)
+        {
+          for (int c = 0; c < NumComponents; ++c)
+            {
+              _mm_storeu_ps(dst[c] + i, lanes[c]);
+            }
+          continue;
+        }
+
+      float tail[4];
+      for (int c = 0; c < NumComponents; ++c)
+        {
+          _mm_storeu_ps(tail, lanes[c]);
+          std::copy(tail, tail + (count - i), dst[c] + i);
+        }
+    }
+#else
+  const float centers[NumComponents] =
+    {origin.x, origin.y, origin.z, base.x, base.y, base.z, 0.0f, 0.0f};
+  const float scales[NumComponents] =
+    {radius, radius, radius, spread, spread, spread, 0.0f, 0.0f};
+
+  float r[4];
+  for (size_t i = 0; i < count; i += 4)
+    {
+      auto n = std::min(count - i, (size_t) 4);
+      for (int c = 0; c < Age; ++c)
+        {
+          random.next(r);
+          for (size_t j = 0; j < n; ++j)
+            {
+              dst[c][i + j] = centers[c] + scales[c] * (2.0f * r[j] - 1.0f);
+            }
+        }
+
+      random.next(r);
+      for (size_t j = 0; j < n; ++j)
+        {
+          dst[Age][i + j] = 0.0f;
+          dst[AgeRate][i + j] = 1.0f / (life - jitter * r[j]);
+        }
+    }
+#endif
+
+  mBlockCounts[block] += count;
+}
+
+void dmp::ParticleEmitter::simulate(size_t block, float deltaT)
+{
+  auto count = mBlockCounts[block];
+  float * data[NumComponents];
+  for (int c = 0; c < NumComponents; ++c)
+    {
+      data[c] = component((Component) c, block);
+    }
+
+  auto gravity = mParams.gravity * deltaT;
+
+  // The living are moved down over the dead as they go, in place. Writes
+  // never pass reads, so every write lands on a particle already read
+  size_t out = 0;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128 dt = _mm_set1_ps(deltaT);
+  const __m128 gx = _mm_set1_ps(gravity.x);
+  const __m128 gy = _mm_set1_ps(gravity.y);
+  const __m128 gz = _mm_set1_ps(gravity.z);
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  for (; i + 4 <= count; i += 4)
+    {
+      __m128 lanes[NumComponents];
+      for (int c = 0; c < NumComponents; ++c)
+        {
+          lanes[c] = _mm_loadu_ps(data[c] + i);
+        }
+
+      lanes[VelX] = _mm_add_ps(lanes[VelX], gx);
+      lanes[VelY] = _mm_add_ps(lanes[VelY], gy);
+      lanes[VelZ] = _mm_add_ps(lanes[VelZ], gz);
+      lanes[PosX] = _mm_add_ps(lanes[PosX], _mm_mul_ps(lanes[VelX], dt));
+      lanes[PosY] = _mm_add_ps(lanes[PosY], _mm_mul_ps(lanes[VelY], dt));
+      lanes[PosZ] = _mm_add_ps(lanes[PosZ], _mm_mul_ps(lanes[VelZ], dt));
+      lanes[Age] = _mm_add_ps(lanes[Age], _mm_mul_ps(lanes[AgeRate], dt));
+
+      auto alive = _mm_movemask_ps(_mm_cmplt_ps(lanes[Age], one));
+      if (alive == 0xF)
+        {
+          for (int c = 0; c < NumComponents; ++c)
+            {
+              _mm_storeu_ps(data[c] + out, lanes[c]);
+            }
+          out += 4;
+          continue;
+        }
+      if (alive == 0) continue;
+
+      float unpacked[NumComponents][4];
+      for (int c = 0; c < NumComponents; ++c)
+        {
+          _mm_storeu_ps(unpacked[c], lanes[c]);
+        }
+      for (int j = 0; j < 4; ++j)
+        {
+          if (!(alive & (1 << j))) continue;
+          for (int c = 0; c < NumComponents; ++c)
+            {
+              data[c][out] = unpacked[c][j];
+            }
+          ++out;
+        }
+    }
+#endif
+
+  for (; i < count; ++i)
+    {
+      data[VelX][i] += gravity.x;
+      data[VelY][i] += gravity.y;
+      data[VelZ][i] += gravity.z;
+      data[PosX][i] += data[VelX][i] * deltaT;
+      data[PosY][i] += data[VelY][i] * deltaT;
+      data[PosZ][i] += data[VelZ][i] * deltaT;
+      data[Age][i] += data[AgeRate][i] * deltaT;
+      if (data[Age][i] >= 1.0f) continue;
+
+      for (int c = 0; c < NumComponents; ++c) data[c][out] = data[c][i];
+      ++out;
+    }
+
+  mBlockCounts[block] = out;
+}
+
+void dmp::ParticleEmitter::write(size_t block, ParticleInstance * out) const
+{
+  auto count = mBlockCounts[block];
+  const float * x = component(PosX, block);
+  const float * y = component(PosY, block);
+  const float * z = component(PosZ, block);
+  const float * age = component(Age, block);
+
+  size_t i = 0;
+#ifdef __SSE2__
+  auto dst = reinterpret_cast<float *>(out);
+  for (; i + 4 <= count; i += 4)
+    {
+      __m128 r0 = _mm_loadu_ps(x + i);
+      __m128 r1 = _mm_loadu_ps(y + i);
+      __m128 r2 = _mm_loadu_ps(z + i);
+      __m128 r3 = _mm_loadu_ps(age + i);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(dst + 4 * i, r0);
+      _mm_storeu_ps(dst + 4 * i + 4, r1);
+      _mm_storeu_ps(dst + 4 * i + 8, r2);
+      _mm_storeu_ps(dst + 4 * i + 12, r3);
+    }
+#endif
+
+  for (; i < count; ++i)
+    {
+      out[i].posAge = glm::vec4(x[i], y[i], z[i], age[i]);
+    }
+}
+
+void dmp::ParticleEmitter::draw() const
+{
+  expect("Particle emitter valid", mValid);
+  if (mCount == 0) return;
+
+  glBindVertexArray(mVAO);
+  glBindBuffer(GL_ARRAY_BUFFER, mVBO);
+
+  // there's no base instance to start at the region drawn, so the
+  // attribute is pointed at it instead
+  auto offset = mStream->region() * mStream->regionBytes();
+  glVertexAttribPointer(0,
+                        4,
+                        GL_FLOAT,
+                        GL_FALSE,
+                        sizeof(ParticleInstance),
+                        (const GLvoid *) offset);
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei) mCount);
+  expectNoErrors("Draw particles");
+}
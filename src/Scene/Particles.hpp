@@ -0,0 +1,125 @@
+#ifndef DMP_SCENE_PARTICLES_HPP
+#define DMP_SCENE_PARTICLES_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "../ThreadPool.hpp"
+#include "../Renderer/StreamBuffer.hpp"
+
+namespace dmp
+{
+  struct EmitterParams
+  {
+    // most particles alive at once, and how many are born each second
+    size_t capacity = 65536;
+    float rate = 16384.0f;
+
+    // seconds each particle lives, shortened by up to lifeJitter of that
+    float life = 2.0f;
+    float lifeJitter = 0.5f;
+
+    // Particles leave the emitter along its y axis at speed, plus up to
+    // spread times speed along each axis at random. They're born up to
+    // radius from its origin along each axis
+    float speed = 4.0f;
+    float spread = 0.3f;
+    float radius = 0.05f;
+
+    // world space, so that turning the emitter doesn't turn it
+    glm::vec3 gravity = glm::vec3(0.0f, -9.8f, 0.0f);
+
+    // faded between over each particle's life
+    float startSize = 0.03f;
+    float endSize = 0.01f;
+    glm::vec4 startColor = glm::vec4(1.0f, 0.8f, 0.3f, 1.0f);
+    glm::vec4 endColor = glm::vec4(0.8f, 0.1f, 0.0f, 0.0f);
+  };
+
+  // What each particle draws as, one instance of a camera facing quad: its
+  // world space position, and its age over its life
+  struct ParticleInstance
+  {
+    glm::vec4 posAge;
+  };
+
+  // Emits, moves and kills particles, and draws them all with one
+  // instanced draw. Particles are stored as a structure of arrays, in
+  // blocks of particleBlockSize that each keep their living particles at
+  // the front. Each update a block emits its share of new particles,
+  // moves them and drops the dead ones, four at a time, as one task on the
+  // pool. The living are then streamed to the GPU, each block's after the
+  // ones before. Particles move in world space, so they trail behind an
+  // emitter that moves
+  class ParticleEmitter
+  {
+  public:
+    ParticleEmitter() = delete;
+    ParticleEmitter(const ParticleEmitter &) = delete;
+    ParticleEmitter & operator=(const ParticleEmitter &) = delete;
+
+    ParticleEmitter(const EmitterParams & params);
+    ~ParticleEmitter() {}
+
+    void freeParticleEmitter();
+
+    // where particles are born, set by the scene graph
+    void setM(glm::mat4 M) {mM = M;}
+    glm::mat4 getM() const {return mM;}
+
+    // Moves on by deltaT, with a pool spreading the blocks over it. Must
+    // be called on the GL thread, not from one of pool's tasks
+    void update(float deltaT, ThreadPool * pool = nullptr);
+
+    // the particle shader must be in use already
+    void draw() const;
+
+    const EmitterParams & params() const {return mParams;}
+
+    // living particles
+    size_t size() const {return mCount;}
+
+    // updates that had to wait for the GPU to finish drawing
+    size_t streamStalls() const {return mStream ? mStream->stalls() : 0;}
+
+  private:
+    // one array per component, so that four particles load at once
+    enum Component {PosX, PosY, PosZ, VelX, VelY, VelZ, Age, AgeRate,
+                    NumComponents};
+
+    void initParticleEmitter();
+    void emit(size_t block, size_t count, uint32_t seed);
+    void simulate(size_t block, float deltaT);
+    void write(size_t block, ParticleInstance * out) const;
+
+    float * component(Component c, size_t block)
+    {
+      return mData[c].data() + block * mBlockSize;
+    }
+    const float * component(Component c, size_t block) const
+    {
+      return mData[c].data() + block * mBlockSize;
+    }
+
+    EmitterParams mParams;
+    glm::mat4 mM;
+
+    size_t mBlockSize;
+    std::vector<float> mData[NumComponents];
+    std::vector<size_t> mBlockCounts;
+    std::vector<size_t> mBlockEmits;
+    std::vector<size_t> mBlockOffsets;
+    size_t mCount = 0;
+    float mEmitCarry = 0.0f;
+    uint32_t mFrame = 0;
+
+    bool mValid = false;
+    GLuint mVAO = 0;
+    GLuint mVBO = 0;
+    std::unique_ptr<StreamBuffer> mStream;
+  };
+}
+
+#endif
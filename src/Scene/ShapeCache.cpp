@@ -0,0 +1,39 @@
+#include "ShapeCache.hpp"
+
+#include <iostream>
+#include "../util.hpp"
+
+dmp::ShapeCache::ShapeCache(ThreadPool & pool)
+  : mPool(pool)
+{
+}
+
+dmp::Object dmp::ShapeCache::get(Shape shape, glm::vec4 min, glm::vec4 max,
+                                 size_t matIdx, size_t texIdx,
+                                 const ShapeParams & params)
+{
+  auto key = shapeKey(shape, glm::vec3(min), glm::vec3(max), params);
+
+  auto found = mShapes.find(key);
+  if (found == mShapes.end())
+    {
+      auto mesh = buildShape(shape,
+                             glm::vec3(min),
+                             glm::vec3(max),
+                             params,
+                             &mPool);
+      Object built(std::move(mesh.verts),
+                   std::move(mesh.indices),
+                   GL_TRIANGLES,
+                   matIdx,
+                   texIdx);
+      found = mShapes.emplace(key, built).first;
+
+      ifDebug(std::cerr << "Shape cache: " << mShapes.size()
+              << " unique shape(s)" << std::endl);
+    }
+
+  Object res = found->second;
+  res.setMaterial(matIdx, texIdx);
+  return res;
+}
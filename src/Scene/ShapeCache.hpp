@@ -0,0 +1,39 @@
+#ifndef DMP_SCENE_SHAPECACHE_HPP
+#define DMP_SCENE_SHAPECACHE_HPP
+
+#include <unordered_map>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "Object.hpp"
+#include "Shapes.hpp"
+#include "../ThreadPool.hpp"
+
+namespace dmp
+{
+  // Hands out Objects of procedural shapes, building each distinct shape,
+  // box and set of params once on pool and uploading it once. Objects
+  // from it are copies sharing that mesh, so many boxes cost one. Must be
+  // used on the GL thread, not from one of pool's tasks
+  class ShapeCache
+  {
+  public:
+    ShapeCache() = delete;
+    ShapeCache(const ShapeCache &) = delete;
+    ShapeCache & operator=(const ShapeCache &) = delete;
+
+    ShapeCache(ThreadPool & pool);
+
+    Object get(Shape shape, glm::vec4 min, glm::vec4 max,
+               size_t matIdx, size_t texIdx,
+               const ShapeParams & params = ShapeParams());
+
+    // number of distinct meshes built
+    size_t size() const {return mShapes.size();}
+
+  private:
+    ThreadPool & mPool;
+    std::unordered_map<uint64_t, Object> mShapes;
+  };
+}
+
+#endif
@@ -0,0 +1,563 @@
+#include "Shapes.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <glm/gtc/constants.hpp>
+#include "Types.hpp"
+#include "../util.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(dmp::ObjectVertex) == 8 * sizeof(float),
+              "ObjectVertex is position, normal and texCoords, packed");
+
+namespace
+{
+  // about how many vertices each task of a parallel build gets
+  const size_t verticesPerTask = 16384;
+
+  // fn(first, last) over chunks of [0, count) of perChunk each, on pool
+  // when there is one and more than one chunk
+  void forChunks(size_t count,
+                 size_t perChunk,
+                 dmp::ThreadPool * pool,
+                 const std::function<void(size_t, size_t)> & fn)
+  {
+    perChunk = std::max(perChunk, (size_t) 1);
+    auto chunks = (count + perChunk - 1) / perChunk;
+    if (!pool || chunks < 2)
+      {
+        if (count > 0) fn(0, count);
+        return;
+      }
+
+    pool->parallelFor(chunks, [&](size_t c)
+                      {
+                        auto first = c * perChunk;
+                        fn(first, std::min(count, first + perChunk));
+                      });
+  }
+
+  // one row of a surface of revolution, a circle about the y axis
+  struct ProfilePoint
+  {
+    float radius; // 0 makes the row a pole
+    float y;
+    float normalRadius; // the normal's component away from the axis
+    float normalY;
+    float v;
+  };
+
+  // Writes p swept around the y axis through n angles, given by their
+  // cosines and sines, with texture u coordinates us
+  void revolveRow(const ProfilePoint & p,
+                  const float * cosines,
+                  const float * sines,
+                  const float * us,
+                  size_t n,
+                  dmp::ObjectVertex * out)
+  {
+    size_t i = 0;
+#ifdef __SSE2__
+    // four vertices at a time, one vector per component, transposed into
+    // the two halves of each vertex
+    const __m128 radius = _mm_set1_ps(p.radius);
+    const __m128 normalRadius = _mm_set1_ps(p.normalRadius);
+    for (; i + 4 <= n; i += 4)
+      {
+        __m128 c = _mm_loadu_ps(cosines + i);
+        __m128 s = _mm_loadu_ps(sines + i);
+
+        __m128 px = _mm_mul_ps(c, radius);
+        __m128 py = _mm_set1_ps(p.y);
+        __m128 pz = _mm_mul_ps(s, radius);
+        __m128 nx = _mm_mul_ps(c, normalRadius);
+        __m128 ny = _mm_set1_ps(p.normalY);
+        __m128 nz = _mm_mul_ps(s, normalRadius);
+        __m128 u = _mm_loadu_ps(us + i);
+        __m128 v = _mm_set1_ps(p.v);
+
+        _MM_TRANSPOSE4_PS(px, py, pz, nx);
+        _MM_TRANSPOSE4_PS(ny, nz, u, v);
+
+        auto dst = reinterpret_cast<float *>(out + i);
+        _mm_storeu_ps(dst, px);
+        _mm_storeu_ps(dst + 4, ny);
+        _mm_storeu_ps(dst + 8, py);
+        _mm_storeu_ps(dst + 12, nz);
+        _mm_storeu_ps(dst + 16, pz);
+        _mm_storeu_ps(dst + 20, u);
+        _mm_storeu_ps(dst + 24, nx);
+        _mm_storeu_ps(dst + 28, v);
+      }
+#endif
+    for (; i < n; ++i)
+      {
+        out[i] = {
+          {cosines[i] * p.radius, p.y, sines[i] * p.radius},
+          {cosines[i] * p.normalRadius, p.normalY, sines[i] * p.normalRadius},
+          {us[i], p.v}
+        };
+      }
+  }
+
+  // Sweeps profile, which must run down the outside of the surface, around
+  // the y axis into rows of segments + 1 vertices, the last of each
+  // repeating the first at u = 1. Rows are joined by quads, which become
+  // triangles at poles
+  dmp::ShapeMesh revolve(const std::vector<ProfilePoint> & profile,
+                         size_t segments,
+                         dmp::ThreadPool * pool)
+  {
+    expect("Revolved shape has segments", segments >= 3);
+
+    auto rowLength = segments + 1;
+    std::vector<float> cosines(rowLength);
+    std::vector<float> sines(rowLength);
+    std::vector<float> us(rowLength);
+    for (size_t s = 0; s < rowLength; ++s)
+      {
+        // the seam meets exactly
+        auto angle = 2.0f * glm::pi<float>() * (float) (s % segments)
+          / (float) segments;
+        cosines[s] = std::cos(angle);
+        sines[s] = std::sin(angle);
+        us[s] = (float) s / (float) segments;
+      }
+
+    dmp::ShapeMesh res;
+    res.verts.resize(profile.size() * rowLength);
+    auto rowsPerTask = verticesPerTask / rowLength;
+
+    forChunks(profile.size(), rowsPerTask, pool, [&](size_t first, size_t last)
+              {
+                for (size_t r = first; r < last; ++r)
+                  {
+                    revolveRow(profile[r],
+                               cosines.data(),
+                               sines.data(),
+                               us.data(),
+                               rowLength,
+                               res.verts.data() + r * rowLength);
+                  }
+              });
+
+    // where each band of quads between two rows starts in the indices
+    auto pole = [&](size_t r) {return profile[r].radius == 0.0f;};
+    auto numBands = profile.empty() ? 0 : profile.size() - 1;
+    std::vector<size_t> bandFirst(numBands);
+    size_t numIndices = 0;
+    for (size_t b = 0; b < numBands; ++b)
+      {
+        bandFirst[b] = numIndices;
+        size_t triangles = (pole(b) ? 0 : 1) + (pole(b + 1) ? 0 : 1);
+        numIndices += 3 * triangles * segments;
+      }
+
+    res.indices.resize(numIndices);
+    forChunks(numBands, rowsPerTask, pool, [&](size_t first, size_t last)
+              {
+                for (size_t b = first; b < last; ++b)
+                  {
+                    auto out = res.indices.data() + bandFirst[b];
+                    for (size_t s = 0; s < segments; ++s)
+                      {
+                        auto a = (GLuint) (b * rowLength + s);
+                        auto below = a + (GLuint) rowLength;
+                        if (!pole(b))
+                          {
+                            *out++ = a;
+                            *out++ = a + 1;
+                            *out++ = below;
+                          }
+                        if (!pole(b + 1))
+                          {
+                            *out++ = a + 1;
+                            *out++ = below + 1;
+                            *out++ = below;
+                          }
+                      }
+                  }
+              });
+
+    return res;
+  }
+
+  // a disc of radius 1 at height y facing up or down, textured as seen
+  // from the side it faces
+  void appendCap(dmp::ShapeMesh & mesh, size_t segments, float y, bool up)
+  {
+    auto center = (GLuint) mesh.verts.size();
+    auto facing = up ? 1.0f : -1.0f;
+    mesh.verts.push_back({{0.0f, y, 0.0f},
+                          {0.0f, facing, 0.0f},
+                          {0.5f, 0.5f}});
+
+    for (size_t s = 0; s < segments; ++s)
+      {
+        auto angle = 2.0f * glm::pi<float>() * (float) s / (float) segments;
+        auto x = std::cos(angle);
+        auto z = std::sin(angle);
+        mesh.verts.push_back({{x, y, z},
+                              {0.0f, facing, 0.0f},
+                              {0.5f + 0.5f * x, 0.5f - 0.5f * facing * z}});
+      }
+
+    for (size_t s = 0; s < segments; ++s)
+      {
+        auto curr = center + 1 + (GLuint) s;
+        auto next = center + 1 + (GLuint) ((s + 1) % segments);
+        mesh.indices.insert(mesh.indices.end(),
+                            {center, up ? next : curr, up ? curr : next});
+      }
+  }
+
+  // A grid of width by depth vertices over x and z in [-0.5, 0.5], rows
+  // along x, with heights from height(x, z)
+  dmp::ShapeMesh grid(size_t width,
+                      size_t depth,
+                      const std::function<float(size_t, size_t)> & height,
+                      dmp::ThreadPool * pool)
+  {
+    expect("Grid has quads", width >= 2 && depth >= 2);
+
+    auto dx = 1.0f / (float) (width - 1);
+    auto dz = 1.0f / (float) (depth - 1);
+
+    dmp::ShapeMesh res;
+    res.verts.resize(width * depth);
+    res.indices.resize(6 * (width - 1) * (depth - 1));
+    auto rowsPerTask = verticesPerTask / width;
+
+    forChunks(depth, rowsPerTask, pool, [&](size_t first, size_t last)
+              {
+                for (size_t z = first; z < last; ++z)
+                  {
+                    for (size_t x = 0; x < width; ++x)
+                      {
+                        // central differences, one sided at the edges
+                        auto x0 = x > 0 ? x - 1 : x;
+                        auto x1 = x + 1 < width ? x + 1 : x;
+                        auto z0 = z > 0 ? z - 1 : z;
+                        auto z1 = z + 1 < depth ? z + 1 : z;
+                        auto slopeX = (height(x1, z) - height(x0, z))
+                          / ((float) (x1 - x0) * dx);
+                        auto slopeZ = (height(x, z1) - height(x, z0))
+                          / ((float) (z1 - z0) * dz);
+
+                        auto u = (float) x * dx;
+                        auto v = (float) z * dz;
+                        res.verts[z * width + x] = {
+                          {u - 0.5f, height(x, z), v - 0.5f},
+                          glm::normalize(glm::vec3(-slopeX, 1.0f, -slopeZ)),
+                          {u, 1.0f - v}
+                        };
+                      }
+
+                    if (z + 1 == depth) continue;
+
+                    auto out = res.indices.data() + 6 * (width - 1) * z;
+                    for (size_t x = 0; x + 1 < width; ++x)
+                      {
+                        auto a = (GLuint) (z * width + x);
+                        auto below = a + (GLuint) width;
+                        *out++ = a;
+                        *out++ = below;
+                        *out++ = a + 1;
+                        *out++ = a + 1;
+                        *out++ = below;
+                        *out++ = below + 1;
+                      }
+                  }
+              });
+
+    return res;
+  }
+
+  dmp::ShapeMesh cube()
+  {
+    // each face's normal, then the directions its u and v run in
+    const glm::vec3 faces[6][3] =
+      {
+        {{ 1.0f,  0.0f,  0.0f}, { 0.0f,  0.0f, -1.0f}, {0.0f, 1.0f,  0.0f}},
+        {{-1.0f,  0.0f,  0.0f}, { 0.0f,  0.0f,  1.0f}, {0.0f, 1.0f,  0.0f}},
+        {{ 0.0f,  1.0f,  0.0f}, { 1.0f,  0.0f,  0.0f}, {0.0f, 0.0f, -1.0f}},
+        {{ 0.0f, -1.0f,  0.0f}, { 1.0f,  0.0f,  0.0f}, {0.0f, 0.0f,  1.0f}},
+        {{ 0.0f,  0.0f,  1.0f}, { 1.0f,  0.0f,  0.0f}, {0.0f, 1.0f,  0.0f}},
+        {{ 0.0f,  0.0f, -1.0f}, {-1.0f,  0.0f,  0.0f}, {0.0f, 1.0f,  0.0f}}
+      };
+    const glm::vec2 corners[4] =
+      {
+        {0.0f, 0.0f}, {1.0f, 0.0f}, {1.0f, 1.0f}, {0.0f, 1.0f}
+      };
+
+    dmp::ShapeMesh res;
+    for (const auto & face : faces)
+      {
+        auto first = (GLuint) res.verts.size();
+        for (const auto & uv : corners)
+          {
+            auto p = 0.5f * face[0]
+              + (uv.x - 0.5f) * face[1]
+              + (uv.y - 0.5f) * face[2];
+            res.verts.push_back({p, face[0], uv});
+          }
+        res.indices.insert(res.indices.end(),
+                           {first, first + 1, first + 2,
+                            first, first + 2, first + 3});
+      }
+    return res;
+  }
+
+  // Poles first and last. v runs from 0 at the bottom to 1 at the top
+  std::vector<ProfilePoint> sphereProfile(size_t rings)
+  {
+    std::vector<ProfilePoint> res;
+    for (size_t r = 0; r <= rings; ++r)
+      {
+        auto phi = glm::pi<float>() * (float) r / (float) rings;
+        auto radius = r == 0 || r == rings ? 0.0f : std::sin(phi);
+        auto y = std::cos(phi);
+        res.push_back({radius, y, radius, y, 1.0f - (float) r / (float) rings});
+      }
+    return res;
+  }
+
+  // hemispheres of radius 1 on either end of a cylinder halfLength up and
+  // down from the origin, with v following the surface
+  std::vector<ProfilePoint> capsuleProfile(size_t rings, float halfLength)
+  {
+    auto perCap = std::max(rings / 2, (size_t) 1);
+    auto length = glm::pi<float>() + 2.0f * halfLength;
+
+    std::vector<ProfilePoint> res;
+    for (size_t k = 0; k <= perCap; ++k)
+      {
+        auto phi = 0.5f * glm::pi<float>() * (float) k / (float) perCap;
+        auto radius = k == 0 ? 0.0f : std::sin(phi);
+        auto y = std::cos(phi);
+        res.push_back({radius, halfLength + y, radius, y, 1.0f - phi / length});
+      }
+
+    // with no cylinder between them the caps share their edge
+    for (size_t k = halfLength > 0.0f ? 0 : 1; k <= perCap; ++k)
+      {
+        auto phi = 0.5f * glm::pi<float>() * (float) (perCap + k)
+          / (float) perCap;
+        auto radius = k == perCap ? 0.0f : std::sin(phi);
+        auto y = std::cos(phi);
+        auto along = phi + 2.0f * halfLength;
+        res.push_back({radius, y - halfLength, radius, y,
+                       1.0f - along / length});
+      }
+    return res;
+  }
+
+  // radius 1 from y = -1 to 1
+  std::vector<ProfilePoint> cylinderProfile(size_t rings)
+  {
+    std::vector<ProfilePoint> res;
+    for (size_t r = 0; r <= rings; ++r)
+      {
+        auto v = 1.0f - (float) r / (float) rings;
+        res.push_back({1.0f, 2.0f * v - 1.0f, 1.0f, 0.0f, v});
+      }
+    return res;
+  }
+
+  // ring of radius 1 through the middle of a tube of radius tube, starting
+  // from the top of the tube and going out and down around it
+  std::vector<ProfilePoint> torusProfile(size_t rings, float tube)
+  {
+    std::vector<ProfilePoint> res;
+    for (size_t r = 0; r <= rings; ++r)
+      {
+        auto theta = 0.5f * glm::pi<float>()
+          - 2.0f * glm::pi<float>() * (float) (r % rings) / (float) rings;
+        auto c = std::cos(theta);
+        auto s = std::sin(theta);
+        res.push_back({1.0f + tube * c, tube * s, c, s,
+                       (float) r / (float) rings});
+      }
+    return res;
+  }
+
+  // Scales and moves mesh from bounds onto [min, max] one axis at a time.
+  // Axes along which bounds are flat are just centered. Normals go through
+  // the cofactors of the scale, which unlike its inverse exist when the
+  // box is flat
+  void fit(dmp::ShapeMesh & mesh,
+           const dmp::AABB & bounds,
+           const glm::vec3 & min,
+           const glm::vec3 & max,
+           dmp::ThreadPool * pool)
+  {
+    auto from = bounds.max - bounds.min;
+    auto to = max - min;
+    glm::vec3 scale;
+    for (int i = 0; i < 3; ++i)
+      {
+        scale[i] = from[i] > 0.0f ? to[i] / from[i] : 1.0f;
+      }
+
+    auto fromCenter = 0.5f * (bounds.min + bounds.max);
+    auto toCenter = 0.5f * (min + max);
+    glm::vec3 normalScale(scale.y * scale.z,
+                          scale.x * scale.z,
+                          scale.x * scale.y);
+
+    // a uniform scale leaves normals be
+    bool uniform = normalScale.x == normalScale.y
+      && normalScale.y == normalScale.z
+      && normalScale.x > 0.0f;
+
+    forChunks(mesh.verts.size(), verticesPerTask, pool,
+              [&](size_t first, size_t last)
+              {
+                for (size_t i = first; i < last; ++i)
+                  {
+                    auto & curr = mesh.verts[i];
+                    curr.position = toCenter
+                      + (curr.position - fromCenter) * scale;
+                    if (uniform) continue;
+
+                    auto n = curr.normal * normalScale;
+                    auto len = glm::length(n);
+                    if (len > 0.0f) curr.normal = n / len;
+                  }
+              });
+  }
+
+  dmp::AABB box(const glm::vec3 & min, const glm::vec3 & max)
+  {
+    dmp::AABB res;
+    res.min = min;
+    res.max = max;
+    return res;
+  }
+}
+
+dmp::ShapeMesh dmp::buildShape(Shape shape,
+                               const glm::vec3 & min,
+                               const glm::vec3 & max,
+                               const ShapeParams & params,
+                               ThreadPool * pool)
+{
+  auto segments = params.segments;
+  auto rings = params.rings;
+
+  ShapeMesh res;
+  AABB bounds;
+  switch (shape)
+    {
+    case Cube:
+      res = cube();
+      bounds = box(glm::vec3(-0.5f), glm::vec3(0.5f));
+      break;
+
+    case Sphere:
+      expect("Sphere has rings", rings >= 2);
+      res = revolve(sphereProfile(rings), segments, pool);
+      bounds = box(glm::vec3(-1.0f), glm::vec3(1.0f));
+      break;
+
+    case Capsule:
+      {
+        // as long as it takes for caps of the box's width to be round
+        auto extent = max - min;
+        auto width = std::max(extent.x, extent.z);
+        auto halfLength = width > 0.0f
+          ? std::max(extent.y / width - 1.0f, 0.0f)
+          : 0.0f;
+
+        res = revolve(capsuleProfile(rings, halfLength), segments, pool);
+        bounds = box({-1.0f, -1.0f - halfLength, -1.0f},
+                     {1.0f, 1.0f + halfLength, 1.0f});
+        break;
+      }
+
+    case Cylinder:
+      expect("Cylinder has rings", rings >= 1);
+      res = revolve(cylinderProfile(rings), segments, pool);
+      appendCap(res, segments, 1.0f, true);
+      appendCap(res, segments, -1.0f, false);
+      bounds = box(glm::vec3(-1.0f), glm::vec3(1.0f));
+      break;
+
+    case Torus:
+      {
+        expect("Torus has rings", rings >= 3);
+        expect("Torus has a tube", params.ratio > 0.0f);
+
+        auto outer = 1.0f + params.ratio;
+        res = revolve(torusProfile(rings, params.ratio), segments, pool);
+        bounds = box({-outer, -params.ratio, -outer},
+                     {outer, params.ratio, outer});
+        break;
+      }
+
+    case Plane:
+      res = grid(segments + 1,
+                 rings + 1,
+                 [](size_t, size_t) {return 0.0f;},
+                 pool);
+      bounds = box({-0.5f, 0.0f, -0.5f}, {0.5f, 0.0f, 0.5f});
+      break;
+
+    case Heightfield:
+      {
+        const auto & heights = params.heights;
+        auto width = params.heightsWidth;
+        expect("Heightfield rows are whole",
+               width > 0 && heights.size() % width == 0);
+
+        auto range = std::minmax_element(heights.begin(), heights.end());
+        res = grid(width,
+                   heights.size() / width,
+                   [&](size_t x, size_t z) {return heights[z * width + x];},
+                   pool);
+        bounds = box({-0.5f, *range.first, -0.5f},
+                     {0.5f, *range.second, 0.5f});
+        break;
+      }
+    }
+
+  fit(res, bounds, min, max, pool);
+  return res;
+}
+
+uint64_t dmp::shapeKey(Shape shape,
+                       const glm::vec3 & min,
+                       const glm::vec3 & max,
+                       const ShapeParams & params)
+{
+  auto hashOf = [](const auto & value, uint64_t seed)
+    {
+      return hashBytes(&value, sizeof(value), seed);
+    };
+
+  auto res = hashBytes(&shape, sizeof(shape));
+  res = hashOf(min, res);
+  res = hashOf(max, res);
+
+  // what each shape ignores is left out, so it can't tell equal meshes
+  // apart
+  if (shape != Cube && shape != Heightfield)
+    {
+      res = hashOf(params.segments, res);
+      res = hashOf(params.rings, res);
+    }
+  if (shape == Torus) res = hashOf(params.ratio, res);
+  if (shape == Heightfield)
+    {
+      res = hashOf(params.heightsWidth, res);
+      res = hashBytes(params.heights.data(),
+                      params.heights.size() * sizeof(float),
+                      res);
+    }
+
+  return res;
+}
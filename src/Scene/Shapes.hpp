@@ -0,0 +1,64 @@
+#ifndef DMP_SCENE_SHAPES_HPP
+#define DMP_SCENE_SHAPES_HPP
+
+#include <vector>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "VertexFormat.hpp"
+#include "../ThreadPool.hpp"
+
+namespace dmp
+{
+  // Procedural meshes, each fitted to a box. Round shapes are round about
+  // the y axis; Plane and Heightfield lie in the xz plane. Texture
+  // coordinates go once around round shapes and once across flat ones
+  enum Shape
+    {
+      Cube,
+      Sphere,
+      Capsule,  // caps stay round as the box gets taller
+      Cylinder, // capped
+      Torus,
+      Plane,
+      Heightfield
+    };
+
+  struct ShapeParams
+  {
+    // quads around the y axis, and from top to bottom, or for Plane
+    // across x and z
+    size_t segments = 32;
+    size_t rings = 16;
+
+    // Torus: radius of the tube over that of the ring through its middle
+    float ratio = 0.25f;
+
+    // Heightfield: heightsWidth samples along x per row, rows along z.
+    // The lowest and highest fit the box's bottom and top
+    std::vector<float> heights;
+    size_t heightsWidth = 0;
+  };
+
+  struct ShapeMesh
+  {
+    std::vector<ObjectVertex> verts;
+    std::vector<GLuint> indices; // triangles, counterclockwise from outside
+  };
+
+  // shape with params fitted to the box [min, max]. With a pool, large
+  // meshes are built on it; must not be called from one of its tasks
+  ShapeMesh buildShape(Shape shape,
+                       const glm::vec3 & min,
+                       const glm::vec3 & max,
+                       const ShapeParams & params,
+                       ThreadPool * pool = nullptr);
+
+  // equal for calls to buildShape that give the same mesh
+  uint64_t shapeKey(Shape shape,
+                    const glm::vec3 & min,
+                    const glm::vec3 & max,
+                    const ShapeParams & params);
+}
+
+#endif
@@ -1,8 +1,6 @@
 #include "Skybox.hpp"
 #include "../util.hpp"
 #include "../config.hpp"
-#include "../Renderer/Texture.hpp"
-#include "../ext/stb_image.h"
 
 #include <iostream>
 
@@ -34,45 +32,11 @@ static const GLuint idxs[] =
     3, 7, 6
   };
 
-void dmp::Skybox::initSkybox(std::vector<const char *> tex)
+void dmp::Skybox::initSkybox(TextureHandle cubemap)
 {
-  glGenTextures(1, &mTexId);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, mTexId);
-
-  expectNoErrors("gen and bind cubemap");
-
-  int width, height, channels;
-  unsigned char * data;
-
-  for (size_t i = 0; i < tex.size(); ++i)
-    {
-      data = stbi_load(tex[i],
-                       &width,
-                       &height,
-                       &channels,
-                       3); // don't want a transparent skybox
-      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + ((GLenum)i),
-                   0,
-                   GL_RGB,
-                   width,
-                   height,
-                   0,
-                   GL_RGB,
-                   GL_UNSIGNED_BYTE,
-                   data);
-      stbi_image_free(data);
-
-      auto msg = std::string("Load cubemap image #") + std::to_string(i);
-      expectNoErrors(msg);
-    }
-
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-  expectNoErrors("finish loading cubemap");
+  expect("Skybox texture is a cube map",
+         cubemap && cubemap->target() == GL_TEXTURE_CUBE_MAP);
+  mTexture = cubemap;
 
   glGenVertexArrays(1, &mVAO);
   glGenBuffers(1, &mVBO);
@@ -102,32 +66,21 @@ void dmp::Skybox::initSkybox(std::vector<const char *> tex)
 
   expectNoErrors("assign vertex attributes");
 
-  auto vertName = skyboxShader + std::string(".vert");
-  auto fragName = skyboxShader + std::string(".frag");
-
-  mShaderProg.initShader(vertName.c_str(),
-                         nullptr, nullptr, nullptr,
-                         fragName.c_str());
-
-  expectNoErrors("load skybox shader");
-
   mValid = true;
 }
 
-void dmp::Skybox::bind(GLenum texUnit)
+void dmp::Skybox::bind(GLenum texUnit, GLuint shaderProg)
 {
   expect("Skybox valid", mValid);
-  glUseProgram(mShaderProg);
-  expectNoErrors("Bind shader program");
   glActiveTexture(texUnit);
   expectNoErrors("activate texture unit");
-  glBindTexture(GL_TEXTURE_CUBE_MAP, mTexId);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, *mTexture);
   expectNoErrors("bind texture");
 
-  GLuint pcIdx = glGetUniformBlockIndex(mShaderProg, "PassConstants");
-  glUniformBlockBinding(mShaderProg, pcIdx, 1);
+  GLuint pcIdx = glGetUniformBlockIndex(shaderProg, "PassConstants");
+  glUniformBlockBinding(shaderProg, pcIdx, 1);
 
-  glUniform1i(glGetUniformLocation(mShaderProg, "skybox"),
+  glUniform1i(glGetUniformLocation(shaderProg, "skybox"),
               texUnitAsInt(texUnit));
 
   expectNoErrors("set uniform");
@@ -151,5 +104,5 @@ void dmp::Skybox::freeSkybox()
   glDeleteVertexArrays(1, &mVAO);
   glDeleteBuffers(1, &mVBO);
   glDeleteBuffers(1, &mEBO);
-  glDeleteTextures(1, &mTexId);
+  mTexture.reset();
 }
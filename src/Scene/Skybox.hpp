@@ -1,10 +1,8 @@
 #ifndef DMP_SKYBOX_HPP
 #define DMP_SKYBOX_HPP
 
-#include <vector>
-#include <string>
 #include <GL/glew.h>
-#include "../Renderer/Shader.hpp"
+#include "../Renderer/Texture.hpp"
 
 namespace dmp
 {
@@ -19,25 +17,26 @@ namespace dmp
 
     ~Skybox() {}
 
-    Skybox(std::vector<const char *> tex)
+    // cubemap is a GL_TEXTURE_CUBE_MAP, usually from AssetCache::cubemap
+    Skybox(TextureHandle cubemap)
     {
-      initSkybox(tex);
+      initSkybox(cubemap);
     }
 
     void freeSkybox();
 
-    void bind(GLenum texUnit);
+    // shaderProg must be in use already
+    void bind(GLenum texUnit, GLuint shaderProg);
 
     void draw();
 
   private:
-    void initSkybox(std::vector<const char *> tex);
-    GLuint mTexId = 0;
+    void initSkybox(TextureHandle cubemap);
+    TextureHandle mTexture;
     bool mValid = false;
     GLuint mVAO;
     GLuint mVBO;
     GLuint mEBO;
-    Shader mShaderProg;
   };
 }
 
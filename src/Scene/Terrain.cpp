@@ -0,0 +1,643 @@
+#include "Terrain.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../util.hpp"
+#include "../config.hpp"
+
+namespace
+{
+  const uint32_t noNode = 0xFFFFFFFF;
+
+  // grid vertices along each side of a chunk, and its vertex count with
+  // a skirt vertex under each edge vertex of each side
+  const size_t chunkSide = dmp::terrainChunkQuads + 1;
+  const size_t chunkVerts = chunkSide * chunkSide + 4 * chunkSide;
+
+  struct Field
+  {
+    const unsigned char * data;
+    size_t width;
+    float spacing;
+    float heightScale;
+
+    float height(size_t x, size_t z) const
+    {
+      uint16_t h;
+      std::memcpy(&h, data + 2 * (z * width + x), sizeof(h));
+      return heightScale * (float) h / 65535.0f;
+    }
+  };
+
+  // Grid first, counterclockwise from above as rows along x, then skirts
+  // facing out from the sides at z = 0, z = 1, x = 0 and x = 1, each as
+  // quads hanging from that side's edges
+  std::vector<GLuint> chunkIndices()
+  {
+    const GLuint side = (GLuint) chunkSide;
+    const GLuint quads = side - 1;
+    std::vector<GLuint> res;
+    res.reserve(6 * quads * quads + 24 * quads);
+
+    for (GLuint z = 0; z < quads; ++z)
+      {
+        for (GLuint x = 0; x < quads; ++x)
+          {
+            auto i = z * side + x;
+            auto below = i + side;
+            res.insert(res.end(), {i, below, i + 1, i + 1, below, below + 1});
+          }
+      }
+
+    for (GLuint s = 0; s < 4; ++s)
+      {
+        auto skirt = side * side + s * side;
+        for (GLuint k = 0; k < quads; ++k)
+          {
+            GLuint a;
+            GLuint b;
+            switch (s)
+              {
+              case 0: a = k; b = k + 1; break;
+              case 1: a = quads * side + k; b = a + 1; break;
+              case 2: a = k * side; b = a + side; break;
+              default: a = k * side + quads; b = a + side; break;
+              }
+            auto lowA = skirt + k;
+            auto lowB = lowA + 1;
+
+            // the z = 0 and x = 1 sides run clockwise seen from outside
+            if (s == 0 || s == 3)
+              {
+                res.insert(res.end(), {a, b, lowA, b, lowB, lowA});
+              }
+            else
+              {
+                res.insert(res.end(), {a, lowA, b, b, lowA, lowB});
+              }
+          }
+      }
+
+    return res;
+  }
+
+  // The vertices of the node with its corner at sample (ox, oz), sampling
+  // every stride'th height, over a unit square that the node's transform
+  // stretches over its part of the field. Normals are of the field seen at
+  // that stride, squashed to match, so the transform takes them back
+  std::vector<dmp::ObjectVertex> buildChunk(const Field & field,
+                                            size_t ox,
+                                            size_t oz,
+                                            size_t stride,
+                                            float skirt)
+  {
+    const size_t quads = dmp::terrainChunkQuads;
+    auto size = (float) (quads * stride) * field.spacing;
+    auto last = field.width - 1;
+
+    std::vector<dmp::ObjectVertex> res(chunkVerts);
+    for (size_t z = 0; z < chunkSide; ++z)
+      {
+        auto sz = oz + z * stride;
+        auto up = sz >= stride ? sz - stride : sz;
+        auto down = std::min(sz + stride, last);
+        for (size_t x = 0; x < chunkSide; ++x)
+          {
+            auto sx = ox + x * stride;
+            auto left = sx >= stride ? sx - stride : sx;
+            auto right = std::min(sx + stride, last);
+
+            auto dx = (field.height(right, sz) - field.height(left, sz))
+              / ((float) (right - left) * field.spacing);
+            auto dz = (field.height(sx, down) - field.height(sx, up))
+              / ((float) (down - up) * field.spacing);
+
+            res[z * chunkSide + x] = {
+              glm::vec3((float) x / (float) quads,
+                        field.height(sx, sz),
+                        (float) z / (float) quads),
+              glm::normalize(glm::vec3(-dx * size, 1.0f, -dz * size)),
+              glm::vec2((float) sx, (float) sz) / (float) last
+            };
+          }
+      }
+
+    auto skirts = res.begin() + chunkSide * chunkSide;
+    for (size_t k = 0; k < chunkSide; ++k)
+      {
+        const size_t edges[4] =
+          {
+            k,
+            (chunkSide - 1) * chunkSide + k,
+            k * chunkSide,
+            k * chunkSide + chunkSide - 1
+          };
+        for (size_t s = 0; s < 4; ++s)
+          {
+            auto & low = skirts[s * chunkSide + k];
+            low = res[edges[s]];
+            low.position.y -= skirt;
+          }
+      }
+
+    return res;
+  }
+}
+
+dmp::Terrain::Terrain(const std::string & path,
+                      float spacing,
+                      float heightScale,
+                      size_t matIdx,
+                      size_t texIdx,
+                      ThreadPool & pool)
+  : mPool(pool),
+    mShared(std::make_shared<Shared>())
+{
+  mShared->file = MappedFile(path);
+  mShared->spacing = spacing;
+  mShared->heightScale = heightScale;
+  initTerrain(matIdx, texIdx);
+}
+
+void dmp::Terrain::initTerrain(size_t matIdx, size_t texIdx)
+{
+  auto & file = mShared->file;
+  expect("Terrain heights mapped", file.valid());
+
+  auto width = (size_t) std::sqrt((double) (file.size() / 2));
+  expect("Terrain heights are square", 2 * width * width == file.size());
+  expect("Terrain is whole chunks across",
+         width > 1 && (width - 1) % terrainChunkQuads == 0);
+  mShared->width = width;
+
+  auto across = (width - 1) / terrainChunkQuads;
+  while (((size_t) 1 << mDepth) < across) ++mDepth;
+  expect("Terrain is a power of two chunks across",
+         ((size_t) 1 << mDepth) == across);
+
+  mLevelOffsets.push_back(0);
+  for (size_t level = 0; level <= mDepth; ++level)
+    {
+      mLevelOffsets.push_back(mLevelOffsets.back()
+                              + ((size_t) 1 << (2 * level)));
+    }
+  initNodes();
+
+  auto root = nodeIndex(0, 0, 0);
+  auto extent = (float) (width - 1) * mShared->spacing;
+  mBounds.min = glm::vec3(0.0f,
+                          mNodes[root].minHeight - skirtDepth(root),
+                          0.0f);
+  mBounds.max = glm::vec3(extent, mNodes[root].maxHeight, extent);
+
+  mSlotOf.assign(mNodes.size(), -1);
+  mIsDrawn.assign(mNodes.size(), 0);
+  mChunkIndices = chunkIndices();
+
+  Field field = {file.data(), width, mShared->spacing, mShared->heightScale};
+  auto rootVerts = buildChunk(field,
+                              0,
+                              0,
+                              (size_t) 1 << mDepth,
+                              skirtDepth(root));
+
+  // Every chunk's bounds span the whole field's heights, which is all any
+  // node's vertices, skirts included, can reach
+  auto boundsVerts = rootVerts;
+  boundsVerts.front().position.y = mBounds.min.y;
+  boundsVerts.back().position.y = mBounds.max.y;
+
+  mChunkObjects.reserve(terrainChunkPool);
+  for (size_t i = 0; i < terrainChunkPool; ++i)
+    {
+      mChunkObjects.emplace_back(boundsVerts,
+                                 mChunkIndices,
+                                 GL_TRIANGLES,
+                                 matIdx,
+                                 texIdx,
+                                 GL_STREAM_DRAW);
+      mChunkObjects.back().hide();
+      mObjects.push_back(&mChunkObjects.back());
+    }
+  mChunks.resize(terrainChunkPool);
+  for (auto & curr : mChunks) curr.node = noNode;
+
+  // the root is always ready, to draw in place of anything that isn't
+  mChunkObjects[0].updateVertices([&](ObjectVertex * data, size_t)
+                                  {
+                                    std::copy(rootVerts.begin(),
+                                              rootVerts.end(),
+                                              data);
+                                  });
+  mChunks[0].node = root;
+  mChunks[0].ready = true;
+  mSlotOf[root] = 0;
+
+  ifDebug(std::cerr << "Terrain: " << width << " samples across, "
+          << mDepth + 1 << " levels, " << mNodes.size() << " nodes"
+          << std::endl);
+}
+
+void dmp::Terrain::initNodes()
+{
+  const size_t quads = terrainChunkQuads;
+  Field field = {mShared->file.data(),
+                 mShared->width,
+                 mShared->spacing,
+                 mShared->heightScale};
+  mNodes.resize(mLevelOffsets.back());
+
+  // leaves sample every height, so only their range is needed
+  auto leaves = (size_t) 1 << mDepth;
+  mPool.parallelFor(leaves, [&](size_t z)
+    {
+      for (size_t x = 0; x < leaves; ++x)
+        {
+          auto & node = mNodes[nodeIndex(mDepth, x, z)];
+          node.minHeight = std::numeric_limits<float>::max();
+          node.maxHeight = -std::numeric_limits<float>::max();
+          node.error = 0.0f;
+          for (size_t j = 0; j <= quads; ++j)
+            {
+              for (size_t i = 0; i <= quads; ++i)
+                {
+                  auto h = field.height(x * quads + i, z * quads + j);
+                  node.minHeight = std::min(node.minHeight, h);
+                  node.maxHeight = std::max(node.maxHeight, h);
+                }
+            }
+        }
+    });
+
+  // Each level up, a node's error is the most any height it drops and its
+  // children keep strays from its grid, or the most its children stray.
+  // A height it drops lies on a grid edge or diagonal, and the grid there
+  // is the mean of that edge's ends
+  for (size_t level = mDepth; level-- > 0;)
+    {
+      auto nodes = (size_t) 1 << level;
+      auto half = (size_t) 1 << (mDepth - level - 1);
+      mPool.parallelFor(nodes, [&](size_t z)
+        {
+          for (size_t x = 0; x < nodes; ++x)
+            {
+              auto & node = mNodes[nodeIndex(level, x, z)];
+              node.minHeight = std::numeric_limits<float>::max();
+              node.maxHeight = -std::numeric_limits<float>::max();
+              node.error = 0.0f;
+              for (size_t c = 0; c < 4; ++c)
+                {
+                  const auto & child =
+                    mNodes[nodeIndex(level + 1, 2 * x + c % 2, 2 * z + c / 2)];
+                  node.minHeight = std::min(node.minHeight, child.minHeight);
+                  node.maxHeight = std::max(node.maxHeight, child.maxHeight);
+                  node.error = std::max(node.error, child.error);
+                }
+
+              auto ox = x * quads * 2 * half;
+              auto oz = z * quads * 2 * half;
+              auto at = [&](size_t i, size_t j)
+                {
+                  return field.height(ox + i * half, oz + j * half);
+                };
+              for (size_t j = 0; j <= 2 * quads; ++j)
+                {
+                  // rows of the grid's vertices only drop every other one
+                  auto step = j % 2 ? 1 : 2;
+                  for (size_t i = j % 2 ? 0 : 1; i <= 2 * quads; i += step)
+                    {
+                      float mean;
+                      if (j % 2 == 0)
+                        {
+                          mean = 0.5f * (at(i - 1, j) + at(i + 1, j));
+                        }
+                      else if (i % 2 == 0)
+                        {
+                          mean = 0.5f * (at(i, j - 1) + at(i, j + 1));
+                        }
+                      else
+                        {
+                          mean = 0.5f * (at(i + 1, j - 1) + at(i - 1, j + 1));
+                        }
+
+                      node.error = std::max(node.error,
+                                            std::abs(at(i, j) - mean));
+                    }
+                }
+            }
+        });
+    }
+}
+
+void dmp::Terrain::setView(const glm::mat4 & V,
+                           const glm::mat4 & P,
+                           float viewportHeight)
+{
+  mV = V;
+  mP = P;
+  mViewportHeight = viewportHeight;
+  mHasView = true;
+}
+
+uint32_t dmp::Terrain::parent(uint32_t node) const
+{
+  size_t level;
+  size_t x;
+  size_t z;
+  nodeCoords(node, level, x, z);
+  if (level == 0) return node;
+  return nodeIndex(level - 1, x / 2, z / 2);
+}
+
+void dmp::Terrain::nodeCoords(uint32_t node,
+                              size_t & level,
+                              size_t & x,
+                              size_t & z) const
+{
+  level = 0;
+  while (mLevelOffsets[level + 1] <= node) ++level;
+  auto i = node - mLevelOffsets[level];
+  x = i & (((size_t) 1 << level) - 1);
+  z = i >> level;
+}
+
+float dmp::Terrain::skirtDepth(uint32_t node) const
+{
+  // deep enough for neighbours up to two levels coarser
+  auto coarser = parent(parent(node));
+  return std::max(mNodes[coarser].error, mShared->spacing);
+}
+
+dmp::AABB dmp::Terrain::nodeBounds(uint32_t node) const
+{
+  size_t level;
+  size_t x;
+  size_t z;
+  nodeCoords(node, level, x, z);
+  auto size = (float) (terrainChunkQuads << (mDepth - level))
+    * mShared->spacing;
+
+  AABB res;
+  res.min = glm::vec3((float) x * size,
+                      mNodes[node].minHeight - skirtDepth(node),
+                      (float) z * size);
+  res.max = glm::vec3((float) (x + 1) * size,
+                      mNodes[node].maxHeight,
+                      (float) (z + 1) * size);
+  return res;
+}
+
+glm::mat4 dmp::Terrain::nodeTransform(uint32_t node) const
+{
+  size_t level;
+  size_t x;
+  size_t z;
+  nodeCoords(node, level, x, z);
+  auto size = (float) (terrainChunkQuads << (mDepth - level))
+    * mShared->spacing;
+
+  auto res = glm::translate(glm::mat4(),
+                            glm::vec3((float) x * size,
+                                      0.0f,
+                                      (float) z * size));
+  return glm::scale(res, glm::vec3(size, 1.0f, size));
+}
+
+void dmp::Terrain::updateImpl(float, glm::mat4 M, bool dirty)
+{
+  ++mFrame;
+  receiveBuilt();
+
+  auto root = nodeIndex(0, 0, 0);
+  if (mHasView) select(M);
+  else mWanted.assign(1, root);
+
+  // each wanted node draws if it is ready, or else its nearest ready
+  // ancestor does
+  mDrawn.clear();
+  for (auto node : mWanted)
+    {
+      auto curr = node;
+      while (mSlotOf[curr] < 0 || !mChunks[mSlotOf[curr]].ready)
+        {
+          expect("Terrain root is ready", curr != root);
+          curr = parent(curr);
+        }
+
+      if (mIsDrawn[curr]) continue;
+      mChunks[mSlotOf[curr]].lastUsed = mFrame;
+      mDrawn.push_back(curr);
+      mIsDrawn[curr] = 1;
+    }
+
+  // and an ancestor drawing in place of some nodes covers all of them
+  auto covered = std::stable_partition(mDrawn.begin(),
+                                       mDrawn.end(),
+                                       [&](uint32_t node)
+                                       {
+                                         while (node != root)
+                                           {
+                                             node = parent(node);
+                                             if (mIsDrawn[node]) return false;
+                                           }
+                                         return true;
+                                       });
+  for (auto it = covered; it != mDrawn.end(); ++it) mIsDrawn[*it] = 0;
+  mDrawn.erase(covered, mDrawn.end());
+
+  // build wanted nodes into chunks that are free, or else least recently
+  // used, leaving alone the root and any chunk used or building now
+  for (auto node : mWanted)
+    {
+      if (mBuilding >= terrainBuildsInFlight) break;
+      if (mSlotOf[node] >= 0) continue;
+
+      size_t slot = mChunks.size();
+      for (size_t i = 0; i < mChunks.size(); ++i)
+        {
+          const auto & curr = mChunks[i];
+          if (curr.building || curr.lastUsed == mFrame || curr.node == root)
+            {
+              continue;
+            }
+          if (curr.node == noNode)
+            {
+              slot = i;
+              break;
+            }
+          if (slot == mChunks.size() || curr.lastUsed < mChunks[slot].lastUsed)
+            {
+              slot = i;
+            }
+        }
+      if (slot == mChunks.size()) break;
+
+      build(slot, node);
+    }
+
+  for (size_t i = 0; i < mChunks.size(); ++i)
+    {
+      auto & chunk = mChunks[i];
+      auto & obj = mChunkObjects[i];
+      if (!chunk.ready || !mIsDrawn[chunk.node])
+        {
+          obj.hide();
+          continue;
+        }
+
+      if (dirty || !chunk.placed)
+        {
+          obj.setM(M * nodeTransform(chunk.node));
+          chunk.placed = true;
+        }
+      obj.show();
+    }
+
+  for (auto node : mDrawn) mIsDrawn[node] = 0;
+}
+
+void dmp::Terrain::select(const glm::mat4 & M)
+{
+  mWanted.clear();
+  mHeap.clear();
+
+  Frustum frustum(mP * mV * M);
+
+  // errors and distances are both in the terrain's space, so any uniform
+  // scale in M cancels out of their ratio
+  auto eye = glm::vec3(glm::inverse(mV * M)
+                       * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+  auto pixelsPerUnit = 0.5f * mViewportHeight * mP[1][1];
+
+  auto consider = [&](uint32_t node)
+    {
+      size_t level;
+      size_t x;
+      size_t z;
+      nodeCoords(node, level, x, z);
+      if (level == mDepth)
+        {
+          mWanted.push_back(node);
+          return;
+        }
+
+      auto box = nodeBounds(node);
+      auto closest = glm::clamp(eye, box.min, box.max);
+      auto dist = std::max(glm::length(closest - eye), mShared->spacing);
+      mHeap.push_back({mNodes[node].error * pixelsPerUnit / dist, node});
+      std::push_heap(mHeap.begin(), mHeap.end());
+    };
+
+  auto root = nodeIndex(0, 0, 0);
+  if (frustum.outside(nodeBounds(root))) return;
+  consider(root);
+  size_t count = 1;
+
+  // Only nodes whose own chunk is ready are split, so that it can draw in
+  // place of children still being built, and those chunks are kept
+  uint32_t children[4];
+  while (!mHeap.empty())
+    {
+      auto top = mHeap.front();
+      if (top.pixels <= terrainPixelError) break;
+
+      std::pop_heap(mHeap.begin(), mHeap.end());
+      mHeap.pop_back();
+      auto slot = mSlotOf[top.node];
+      if (slot < 0 || !mChunks[slot].ready)
+        {
+          mWanted.push_back(top.node);
+          continue;
+        }
+
+      size_t level;
+      size_t x;
+      size_t z;
+      nodeCoords(top.node, level, x, z);
+      size_t numChildren = 0;
+      for (size_t c = 0; c < 4; ++c)
+        {
+          auto child = nodeIndex(level + 1, 2 * x + c % 2, 2 * z + c / 2);
+          if (!frustum.outside(nodeBounds(child)))
+            {
+              children[numChildren++] = child;
+            }
+        }
+      if (count - 1 + numChildren > terrainMaxChunks)
+        {
+          mWanted.push_back(top.node);
+          break;
+        }
+
+      mChunks[slot].lastUsed = mFrame;
+      count = count - 1 + numChildren;
+      for (size_t c = 0; c < numChildren; ++c) consider(children[c]);
+    }
+
+  for (const auto & curr : mHeap) mWanted.push_back(curr.node);
+}
+
+void dmp::Terrain::build(size_t slot, uint32_t node)
+{
+  auto & chunk = mChunks[slot];
+  if (chunk.node != noNode) mSlotOf[chunk.node] = -1;
+  chunk.node = node;
+  chunk.ready = false;
+  chunk.building = true;
+  chunk.placed = false;
+  mSlotOf[node] = (int32_t) slot;
+  mChunkObjects[slot].hide();
+  ++mBuilding;
+
+  size_t level;
+  size_t x;
+  size_t z;
+  nodeCoords(node, level, x, z);
+  auto stride = (size_t) 1 << (mDepth - level);
+  auto ox = x * terrainChunkQuads * stride;
+  auto oz = z * terrainChunkQuads * stride;
+  auto skirt = skirtDepth(node);
+
+  auto shared = mShared;
+  mPool.submit([shared, slot, ox, oz, stride, skirt]()
+               {
+                 Field field = {shared->file.data(),
+                                shared->width,
+                                shared->spacing,
+                                shared->heightScale};
+                 auto verts = buildChunk(field, ox, oz, stride, skirt);
+
+                 std::lock_guard<std::mutex> lock(shared->mutex);
+                 shared->built.emplace_back(slot, std::move(verts));
+               });
+}
+
+void dmp::Terrain::receiveBuilt()
+{
+  std::deque<std::pair<size_t, std::vector<ObjectVertex>>> built;
+  {
+    std::lock_guard<std::mutex> lock(mShared->mutex);
+    built.swap(mShared->built);
+  }
+
+  for (auto & curr : built)
+    {
+      auto & chunk = mChunks[curr.first];
+      chunk.building = false;
+      chunk.ready = true;
+      --mBuilding;
+
+      const auto & verts = curr.second;
+      mChunkObjects[curr.first].updateVertices(
+        [&](ObjectVertex * data, size_t numElems)
+        {
+          expect("Terrain chunk fills its Object",
+                 numElems == verts.size());
+          std::copy(verts.begin(), verts.end(), data);
+        });
+    }
+}
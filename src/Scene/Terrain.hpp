@@ -0,0 +1,168 @@
+#ifndef DMP_SCENE_TERRAIN_HPP
+#define DMP_SCENE_TERRAIN_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "Graph.hpp"
+#include "Object.hpp"
+#include "../MappedFile.hpp"
+#include "../ThreadPool.hpp"
+
+namespace dmp
+{
+  // A heightfield too large to draw as one Object, read through a memory
+  // mapping of a file of 16 bit unsigned heights in the machine's byte
+  // order, in rows along x from low z to high. The field is square, with
+  // 2^n * terrainChunkQuads + 1 samples along each side.
+  //
+  // The field is a quadtree whose nodes each draw as a grid of
+  // terrainChunkQuads by terrainChunkQuads quads, the root sampling every
+  // 2^n'th height and each level below twice as finely. Each time the
+  // graph is updated the tree is walked from the root, skipping nodes
+  // outside the view and splitting the node whose error covers the most
+  // pixels until none covers more than terrainPixelError or
+  // terrainMaxChunks are drawn. Neighbouring nodes of different levels
+  // don't meet exactly, so each grid has a skirt hanging down from its
+  // edges to hide the cracks between them.
+  //
+  // Nodes draw through a fixed pool of terrainChunkPool Objects, whose
+  // vertices are built on worker threads as nodes come into view. Until a
+  // node's vertices are ready, its nearest ancestor that has them draws in
+  // its place. So memory and triangles drawn stay bounded however large
+  // the field is
+  class Terrain : public Node
+  {
+  public:
+    Terrain() = delete;
+    Terrain(const Terrain &) = delete;
+    Terrain & operator=(const Terrain &) = delete;
+
+    // Maps the heights at path and lays them on the xz plane, from the
+    // origin along +x and +z, spacing apart and from 0 to heightScale
+    // high. Must be called on the GL thread, not from one of pool's tasks
+    Terrain(const std::string & path,
+            float spacing,
+            float heightScale,
+            size_t matIdx,
+            size_t texIdx,
+            ThreadPool & pool);
+    ~Terrain() = default;
+
+    // The view later updates cull against and pick levels of detail for,
+    // usually that of the last frame drawn. Until this is first called
+    // only the root is drawn
+    void setView(const glm::mat4 & V,
+                 const glm::mat4 & P,
+                 float viewportHeight);
+
+    // The chunk pool, to be drawn like any other Objects. Their transforms
+    // and visibility are set here as the graph is updated
+    const std::vector<Object *> & objects() const {return mObjects;}
+
+    // bounds of the whole field, in the space of the terrain's parent
+    const AABB & bounds() const {return mBounds;}
+
+    // chunks drawn at the last update, and chunks being built
+    size_t chunksDrawn() const {return mDrawn.size();}
+    size_t chunksBuilding() const {return mBuilding;}
+
+  private:
+    struct NodeInfo
+    {
+      float minHeight;
+      float maxHeight;
+      float error; // how far the node's grid strays from the full field
+    };
+
+    struct Chunk
+    {
+      uint32_t node;
+      bool ready = false;
+      bool building = false;
+      bool placed = false;
+      size_t lastUsed = 0;
+    };
+
+    struct Candidate
+    {
+      float pixels;
+      uint32_t node;
+
+      bool operator<(const Candidate & other) const
+      {
+        return pixels < other.pixels;
+      }
+    };
+
+    // What build tasks read and write, kept alive by them in case the
+    // terrain goes away first
+    struct Shared
+    {
+      MappedFile file;
+      size_t width;
+      float spacing;
+      float heightScale;
+
+      std::mutex mutex;
+      std::deque<std::pair<size_t, std::vector<ObjectVertex>>> built;
+    };
+
+    void initTerrain(size_t matIdx, size_t texIdx);
+    void initNodes();
+    void updateImpl(float deltaT, glm::mat4 M, bool dirty) override;
+
+    void select(const glm::mat4 & M);
+    void build(size_t slot, uint32_t node);
+    void receiveBuilt();
+
+    uint32_t nodeIndex(size_t level, size_t x, size_t z) const
+    {
+      return (uint32_t) (mLevelOffsets[level] + (z << level) + x);
+    }
+
+    uint32_t parent(uint32_t node) const;
+    void nodeCoords(uint32_t node,
+                    size_t & level,
+                    size_t & x,
+                    size_t & z) const;
+    AABB nodeBounds(uint32_t node) const;
+    float skirtDepth(uint32_t node) const;
+
+    // from a chunk's unit square grid to the node's part of the field
+    glm::mat4 nodeTransform(uint32_t node) const;
+
+    ThreadPool & mPool;
+    std::shared_ptr<Shared> mShared;
+
+    size_t mDepth = 0; // levels below the root
+    std::vector<size_t> mLevelOffsets;
+    std::vector<NodeInfo> mNodes;
+    std::vector<GLuint> mChunkIndices;
+    AABB mBounds;
+
+    std::vector<Object> mChunkObjects;
+    std::vector<Object *> mObjects;
+    std::vector<Chunk> mChunks;
+    std::vector<int32_t> mSlotOf; // per node, its chunk or -1
+    size_t mBuilding = 0;
+    size_t mFrame = 0;
+
+    bool mHasView = false;
+    glm::mat4 mV;
+    glm::mat4 mP;
+    float mViewportHeight = 0.0f;
+
+    // scratch, kept to save reallocating each update
+    std::vector<Candidate> mHeap;
+    std::vector<uint32_t> mWanted;
+    std::vector<uint32_t> mDrawn;
+    std::vector<uint8_t> mIsDrawn;
+  };
+}
+
+#endif
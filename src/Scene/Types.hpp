@@ -1,6 +1,7 @@
 #ifndef DMP_TYPES_HPP
 #define DMP_TYPES_HPP
 
+#include <limits>
 #include <glm/glm.hpp>
 #include "../Renderer/UniformBuffer.hpp"
 
@@ -13,21 +14,167 @@ namespace dmp
     glm::vec4 specular;
     float shininess;
 
-    static size_t std140Size()
+    // shaders know this block as MaterialConstants
+    static constexpr std::array<std140::Field, 4> layout()
     {
-      return dmp::std140PadStruct((std140VecSize<float, 4>() * 3)
-                                  + std140ScalarSize<float>());
+      return {{
+          DMP_STD140_FIELD(Material, Vec4, ambient),
+          DMP_STD140_FIELD(Material, Vec4, diffuse),
+          DMP_STD140_FIELD(Material, Vec4, specular),
+          DMP_STD140_FIELD(Material, Float, shininess)
+        }};
+    }
+
+    static constexpr size_t std140Size()
+    {
+      return std140::blockSize(layout());
     }
 
     operator GLvoid *() {return (GLvoid *) this;}
   };
 
+  static_assert(std140::matches(Material::layout()),
+                "Material members are not at their std140 offsets");
+
   struct Light
   {
     glm::vec4 color;
     glm::vec4 dir;
     glm::mat4 M;
   };
+
+  // Lights everything within radius of pos, fading out to nothing at the
+  // edge. pos is transformed by M, which the scene graph sets
+  struct PointLight
+  {
+    glm::vec4 color;
+    glm::vec4 pos;
+    float radius;
+    glm::mat4 M;
+  };
+
+  struct Ray
+  {
+    glm::vec3 origin;
+    glm::vec3 dir;
+  };
+
+  // An empty AABB has min > max, so growing it by anything yields that thing
+  struct AABB
+  {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    bool empty() const
+    {
+      return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void grow(const glm::vec3 & p)
+    {
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+    }
+
+    void grow(const AABB & other)
+    {
+      min = glm::min(min, other.min);
+      max = glm::max(max, other.max);
+    }
+
+    glm::vec3 centroid() const {return (min + max) * 0.5f;}
+
+    float surfaceArea() const
+    {
+      if (empty()) return 0.0f;
+      glm::vec3 e = max - min;
+      return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // Bounds of this box after transformation by M (Arvo's method)
+    AABB transform(const glm::mat4 & M) const
+    {
+      if (empty()) return *this;
+
+      AABB res;
+      res.min = glm::vec3(M[3]);
+      res.max = res.min;
+
+      for (int col = 0; col < 3; ++col)
+        {
+          for (int row = 0; row < 3; ++row)
+            {
+              float a = M[col][row] * min[col];
+              float b = M[col][row] * max[col];
+              res.min[row] += glm::min(a, b);
+              res.max[row] += glm::max(a, b);
+            }
+        }
+
+      return res;
+    }
+
+    // Slab test. invDir is 1 / ray.dir, precomputed by the caller since it
+    // is shared by every box tested against the same ray. On a hit, tNear is
+    // the entry distance along the ray (clamped to 0)
+    bool intersect(const Ray & ray,
+                   const glm::vec3 & invDir,
+                   float tMax,
+                   float & tNear) const
+    {
+      glm::vec3 t0 = (min - ray.origin) * invDir;
+      glm::vec3 t1 = (max - ray.origin) * invDir;
+      glm::vec3 tSmall = glm::min(t0, t1);
+      glm::vec3 tBig = glm::max(t0, t1);
+
+      float tEnter = glm::max(glm::max(tSmall.x, tSmall.y),
+                              glm::max(tSmall.z, 0.0f));
+      float tExit = glm::min(glm::min(tBig.x, tBig.y),
+                             glm::min(tBig.z, tMax));
+
+      tNear = tEnter;
+      return tEnter <= tExit;
+    }
+  };
+
+  // The planes bounding what C takes into clip space, facing in, taken
+  // from its rows (Gribb and Hartmann)
+  struct Frustum
+  {
+    glm::vec4 planes[6];
+
+    explicit Frustum(const glm::mat4 & C)
+    {
+      glm::vec4 rows[4];
+      for (int i = 0; i < 4; ++i)
+        {
+          rows[i] = glm::vec4(C[0][i], C[1][i], C[2][i], C[3][i]);
+        }
+
+      for (int i = 0; i < 3; ++i)
+        {
+          planes[2 * i] = rows[3] + rows[i];
+          planes[2 * i + 1] = rows[3] - rows[i];
+        }
+    }
+
+    // conservative: some boxes near corners are kept though outside
+    bool outside(const AABB & box) const
+    {
+      for (int i = 0; i < 6; ++i)
+        {
+          // the corner furthest along the plane's normal
+          glm::vec3 far(planes[i].x >= 0.0f ? box.max.x : box.min.x,
+                        planes[i].y >= 0.0f ? box.max.y : box.min.y,
+                        planes[i].z >= 0.0f ? box.max.z : box.min.z);
+          if (glm::dot(glm::vec3(planes[i]), far) + planes[i].w < 0.0f)
+            {
+              return true;
+            }
+        }
+      return false;
+    }
+  };
 }
 
 #endif
@@ -0,0 +1,248 @@
+#include "VertexFormat.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../util.hpp"
+
+namespace
+{
+  struct PackedVertex
+  {
+    glm::vec3 position;
+    uint32_t normal;
+    uint16_t texCoords[2];
+  };
+
+  struct QuantizedVertex
+  {
+    uint16_t position[4]; // the last is padding
+    uint32_t normal;
+    uint16_t texCoords[2];
+  };
+
+  static_assert(sizeof(dmp::ObjectVertex) == 32, "ObjectVertex is packed");
+  static_assert(sizeof(PackedVertex) == 20, "PackedVertex is packed");
+  static_assert(sizeof(QuantizedVertex) == 16, "QuantizedVertex is packed");
+
+  // round to nearest even, with overflow going to infinity
+  uint16_t toHalf(float f)
+  {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t biased = (x >> 23) & 0xFF;
+    uint32_t mantissa = x & 0x7FFFFF;
+    int32_t exponent = (int32_t) biased - 127 + 15;
+
+    // infinity and NaN stay so, as does anything too large
+    if (biased == 0xFF)
+      {
+        return (uint16_t) (sign | 0x7C00 | (mantissa ? 0x200 : 0));
+      }
+    if (exponent >= 31) return (uint16_t) (sign | 0x7C00);
+
+    uint32_t shift = 13;
+    uint32_t res = ((uint32_t) std::max(exponent, 0) << 10);
+    if (exponent <= 0)
+      {
+        // too small for a normal half; a denormal, or zero
+        if (exponent < -10) return (uint16_t) sign;
+        mantissa |= 0x800000;
+        shift = (uint32_t) (14 - exponent);
+      }
+    res |= mantissa >> shift;
+
+    // a carry out of the mantissa correctly bumps the exponent
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (res & 1))) ++res;
+
+    return (uint16_t) (sign | res);
+  }
+
+  // signed normalized 10:10:10:2, w = 0
+  uint32_t packNormal(const glm::vec3 & n)
+  {
+    auto snorm = [](float v)
+      {
+        auto i = (int32_t) std::lround(glm::clamp(v, -1.0f, 1.0f) * 511.0f);
+        return (uint32_t) i & 0x3FF;
+      };
+    return snorm(n.x) | (snorm(n.y) << 10) | (snorm(n.z) << 20);
+  }
+
+  uint16_t unorm16(float v)
+  {
+    return (uint16_t) std::lround(glm::clamp(v, 0.0f, 1.0f) * 65535.0f);
+  }
+
+  dmp::VertexLayout makeLayout(dmp::VertexFormat format)
+  {
+    switch (format)
+      {
+      case dmp::VertexFormat::Packed:
+        return {format, sizeof(PackedVertex), {
+            {0, 3, GL_FLOAT, GL_FALSE,
+             (GLuint) offsetof(PackedVertex, position)},
+            {1, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+             (GLuint) offsetof(PackedVertex, normal)},
+            {2, 2, GL_HALF_FLOAT, GL_FALSE,
+             (GLuint) offsetof(PackedVertex, texCoords)}
+          }};
+      case dmp::VertexFormat::Quantized:
+        return {format, sizeof(QuantizedVertex), {
+            {0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+             (GLuint) offsetof(QuantizedVertex, position)},
+            {1, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+             (GLuint) offsetof(QuantizedVertex, normal)},
+            {2, 2, GL_HALF_FLOAT, GL_FALSE,
+             (GLuint) offsetof(QuantizedVertex, texCoords)}
+          }};
+      default:
+        return {dmp::VertexFormat::Full, sizeof(dmp::ObjectVertex), {
+            {0, 3, GL_FLOAT, GL_FALSE,
+             (GLuint) offsetof(dmp::ObjectVertex, position)},
+            {1, 3, GL_FLOAT, GL_FALSE,
+             (GLuint) offsetof(dmp::ObjectVertex, normal)},
+            {2, 2, GL_FLOAT, GL_FALSE,
+             (GLuint) offsetof(dmp::ObjectVertex, texCoords)}
+          }};
+      }
+  }
+
+  // per axis scale from positions to fractions of bounds. Flat axes
+  // quantize to 0
+  glm::vec3 quantizeScale(const dmp::AABB & bounds)
+  {
+    auto extent = bounds.max - bounds.min;
+    return glm::vec3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+                     extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+                     extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+  }
+}
+
+const dmp::VertexLayout & dmp::vertexLayout(VertexFormat format)
+{
+  static const VertexLayout layouts[] =
+    {
+      makeLayout(VertexFormat::Full),
+      makeLayout(VertexFormat::Packed),
+      makeLayout(VertexFormat::Quantized)
+    };
+
+  expect("Known vertex format", (uint32_t) format < 3);
+  return layouts[(uint32_t) format];
+}
+
+std::vector<unsigned char> dmp::packVertices(const ObjectVertex * verts,
+                                             size_t numVerts,
+                                             VertexFormat format,
+                                             const AABB & bounds)
+{
+  const auto & layout = vertexLayout(format);
+  std::vector<unsigned char> res(numVerts * (size_t) layout.stride);
+
+  switch (format)
+    {
+    case VertexFormat::Full:
+      std::memcpy(res.data(), verts, res.size());
+      break;
+    case VertexFormat::Packed:
+      {
+        auto out = reinterpret_cast<PackedVertex *>(res.data());
+        for (size_t i = 0; i < numVerts; ++i)
+          {
+            out[i].position = verts[i].position;
+            out[i].normal = packNormal(verts[i].normal);
+            out[i].texCoords[0] = toHalf(verts[i].texCoords.x);
+            out[i].texCoords[1] = toHalf(verts[i].texCoords.y);
+          }
+        break;
+      }
+    case VertexFormat::Quantized:
+      {
+        auto scale = quantizeScale(bounds);
+        auto out = reinterpret_cast<QuantizedVertex *>(res.data());
+        for (size_t i = 0; i < numVerts; ++i)
+          {
+            auto q = (verts[i].position - bounds.min) * scale;
+            out[i].position[0] = unorm16(q.x);
+            out[i].position[1] = unorm16(q.y);
+            out[i].position[2] = unorm16(q.z);
+            out[i].position[3] = 0;
+            out[i].normal = packNormal(verts[i].normal);
+            out[i].texCoords[0] = toHalf(verts[i].texCoords.x);
+            out[i].texCoords[1] = toHalf(verts[i].texCoords.y);
+          }
+        break;
+      }
+    }
+
+  return res;
+}
+
+glm::vec3 dmp::unpackPosition(const void * verts,
+                              size_t i,
+                              const VertexLayout & layout,
+                              const AABB & bounds)
+{
+  auto vert = static_cast<const unsigned char *>(verts)
+    + i * (size_t) layout.stride;
+
+  if (layout.format != VertexFormat::Quantized)
+    {
+      glm::vec3 res;
+      std::memcpy(&res, vert, sizeof(res));
+      return res;
+    }
+
+  uint16_t q[3];
+  std::memcpy(q, vert, sizeof(q));
+  return bounds.min + (bounds.max - bounds.min)
+    * (glm::vec3(q[0], q[1], q[2]) / 65535.0f);
+}
+
+glm::mat4 dmp::decodeMatrix(VertexFormat format, const AABB & bounds)
+{
+  if (format != VertexFormat::Quantized || bounds.empty()) return glm::mat4();
+
+  auto M = glm::translate(glm::mat4(), bounds.min);
+  return glm::scale(M, bounds.max - bounds.min);
+}
+
+GLenum dmp::indexType(size_t numVerts)
+{
+  return numVerts <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+size_t dmp::indexBytes(GLenum type)
+{
+  return type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+std::vector<unsigned char> dmp::packIndices(const GLuint * indices,
+                                            size_t numIndices,
+                                            GLenum type)
+{
+  std::vector<unsigned char> res(numIndices * indexBytes(type));
+
+  if (type == GL_UNSIGNED_SHORT)
+    {
+      auto out = reinterpret_cast<uint16_t *>(res.data());
+      for (size_t i = 0; i < numIndices; ++i)
+        {
+          expect("Index fits 16 bits", indices[i] <= 0xFFFF);
+          out[i] = (uint16_t) indices[i];
+        }
+    }
+  else
+    {
+      std::memcpy(res.data(), indices, res.size());
+    }
+
+  return res;
+}
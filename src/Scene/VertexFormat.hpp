@@ -0,0 +1,77 @@
+#ifndef DMP_SCENE_VERTEXFORMAT_HPP
+#define DMP_SCENE_VERTEXFORMAT_HPP
+
+#include <vector>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Types.hpp"
+
+namespace dmp
+{
+  struct ObjectVertex
+  {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+  };
+
+  // How vertices are stored on the GPU. Every format feeds the same shader
+  // inputs, so meshes can mix them freely
+  // - Full: ObjectVertex as is, 32 bytes
+  // - Packed: float positions, 10:10:10:2 normals and half float texture
+  //   coordinates, 20 bytes
+  // - Quantized: as Packed, but with 16 bit positions relative to the
+  //   mesh's bounds, 16 bytes
+  enum class VertexFormat : uint32_t
+    {
+      Full = 0,
+      Packed = 1,
+      Quantized = 2
+    };
+
+  // one glVertexAttribPointer
+  struct VertexAttribute
+  {
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    GLuint offset; // within a vertex
+  };
+
+  struct VertexLayout
+  {
+    VertexFormat format;
+    GLsizei stride;
+    std::vector<VertexAttribute> attributes;
+  };
+
+  const VertexLayout & vertexLayout(VertexFormat format);
+
+  // verts converted to format. Quantized positions are fractions of
+  // bounds, which must hold every vertex
+  std::vector<unsigned char> packVertices(const ObjectVertex * verts,
+                                          size_t numVerts,
+                                          VertexFormat format,
+                                          const AABB & bounds);
+
+  // object space position of vertex i of verts, packed as layout says
+  glm::vec3 unpackPosition(const void * verts,
+                           size_t i,
+                           const VertexLayout & layout,
+                           const AABB & bounds);
+
+  // takes positions as stored in format to object space
+  glm::mat4 decodeMatrix(VertexFormat format, const AABB & bounds);
+
+  // the narrowest index type that can address numVerts vertices
+  GLenum indexType(size_t numVerts);
+  size_t indexBytes(GLenum type);
+
+  std::vector<unsigned char> packIndices(const GLuint * indices,
+                                         size_t numIndices,
+                                         GLenum type);
+}
+
+#endif
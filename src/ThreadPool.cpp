@@ -0,0 +1,103 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <exception>
+
+dmp::ThreadPool::ThreadPool(size_t numThreads)
+{
+  for (size_t i = 0; i < std::max(numThreads, (size_t) 1); ++i)
+    {
+      mThreads.emplace_back([this]() {workerLoop();});
+    }
+}
+
+dmp::ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = true;
+    mTasks.clear();
+  }
+  mWake.notify_all();
+
+  for (auto & curr : mThreads)
+    {
+      curr.join();
+    }
+}
+
+size_t dmp::ThreadPool::defaultThreadCount()
+{
+  size_t cores = std::thread::hardware_concurrency();
+  return cores > 1 ? cores - 1 : 1;
+}
+
+void dmp::ThreadPool::submit(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTasks.push_back(std::move(task));
+  }
+  mWake.notify_one();
+}
+
+void dmp::ThreadPool::parallelFor(size_t count,
+                                  const std::function<void(size_t)> & fn)
+{
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t remaining = count;
+  std::exception_ptr error;
+
+  auto task = [&](size_t i)
+    {
+      return [&, i]()
+             {
+               std::exception_ptr caught;
+               try
+                 {
+                   fn(i);
+                 }
+               catch (...)
+                 {
+                   caught = std::current_exception();
+                 }
+
+               // notified under the lock, so the waiter can't return and
+               // destroy done before this is through with it
+               std::lock_guard<std::mutex> lock(mutex);
+               if (caught && !error) error = caught;
+               if (--remaining == 0) done.notify_one();
+             };
+    };
+
+  // pushed to the front last first, so they still start in order
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (size_t i = count; i > 0; --i) mTasks.push_front(task(i - 1));
+  }
+  mWake.notify_all();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&]() {return remaining == 0;});
+  if (error) std::rethrow_exception(error);
+}
+
+void dmp::ThreadPool::workerLoop()
+{
+  while (true)
+    {
+      std::function<void()> task;
+
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWake.wait(lock, [this]() {return mStopping || !mTasks.empty();});
+        if (mStopping) return;
+
+        task = std::move(mTasks.front());
+        mTasks.pop_front();
+      }
+
+      task();
+    }
+}
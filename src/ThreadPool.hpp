@@ -0,0 +1,53 @@
+#ifndef DMP_THREADPOOL_HPP
+#define DMP_THREADPOOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace dmp
+{
+  // Fixed set of worker threads pulling tasks off a shared queue. Tasks
+  // still queued when the pool is destroyed are dropped; running ones are
+  // waited for
+  class ThreadPool
+  {
+  public:
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    ThreadPool() : ThreadPool(defaultThreadCount()) {}
+    ThreadPool(size_t numThreads);
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+
+    // Runs fn(0) to fn(count - 1) on the pool and waits for all of them.
+    // They go ahead of every task already queued, so that a caller waiting
+    // on them, usually once a frame, isn't held up by background work
+    // such as asset loads; only by the tasks already running. The first
+    // exception thrown by any of them is rethrown here. Must not be called
+    // from one of this pool's own tasks, which would wait on itself
+    void parallelFor(size_t count, const std::function<void(size_t)> & fn);
+
+    size_t size() const {return mThreads.size();}
+
+    // one thread per core, leaving one for the thread that owns the GL
+    // context
+    static size_t defaultThreadCount();
+
+  private:
+    void workerLoop();
+
+    std::vector<std::thread> mThreads;
+    std::deque<std::function<void()>> mTasks;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    bool mStopping = false;
+  };
+}
+
+#endif
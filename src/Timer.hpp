@@ -7,6 +7,9 @@ using Clock = std::chrono::high_resolution_clock;
 using TimePoint = std::chrono::high_resolution_clock::time_point;
 using Duration = std::chrono::high_resolution_clock::duration;
 
+// for reporting durations: Milliseconds(end - start).count()
+using Milliseconds = std::chrono::duration<float, std::milli>;
+
 
 namespace dmp
 {
@@ -36,6 +36,21 @@ namespace dmp
       return h;
     }
 
+    // Window size in screen coordinates, the space cursor positions are in
+    int getWidth() const
+    {
+      int w, h;
+      glfwGetWindowSize(mWindow, &w, &h);
+      return w;
+    }
+
+    int getHeight() const
+    {
+      int w, h;
+      glfwGetWindowSize(mWindow, &w, &h);
+      return h;
+    }
+
     // Input
     std::function<void(GLFWwindow *, int, int, int)> mouseButtonFn;
     std::function<void(GLFWwindow *, double, double)> cursorPosFn;
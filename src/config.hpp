@@ -4,6 +4,7 @@
 #include <vector>
 #include <map>
 #include <glm/glm.hpp>
+#include "Scene/VertexFormat.hpp"
 
 
 namespace dmp
@@ -15,10 +16,50 @@ namespace dmp
 
   static const size_t maxLights = 8;
 
+  // With dynamic resolution, the scene is drawn at between minRenderScale
+  // and maxRenderScale of the window's size, chosen each frame to keep the
+  // GPU time of the passes drawn at that scale near targetGpuFrameMs
+  static const float targetGpuFrameMs = 14.0f;
+  static const float minRenderScale = 0.5f;
+  static const float maxRenderScale = 1.0f;
+
+  // Point lights are binned into a clusterGridX by clusterGridY by
+  // clusterGridZ grid over the view frustum each frame, with depth slices
+  // spaced exponentially between nearZ and farZ. A fragment only shades the
+  // lights in its cluster, at most maxLightsPerCluster of them
+  static const size_t maxPointLights = 4096;
+  static const size_t clusterGridX = 16;
+  static const size_t clusterGridY = 9;
+  static const size_t clusterGridZ = 24;
+  static const size_t maxLightsPerCluster = 128;
+
+  // time per frame spent uploading textures that finished loading
+  static const float assetUploadBudgetMs = 2.0f;
+
+  // keep each Texture's decoded pixels in memory after upload
+  static const bool retainTextureImages = false;
+
+  // decode each texture once into a mip mapped file under textureCacheDir,
+  // then map that file on later runs instead of decoding again
+  static const bool useTextureCache = true;
+  static const char * const textureCacheDir = "res/cache/textures";
+
+  // GPU memory for textures, mip levels included. Past this, textures that
+  // haven't been drawn with for textureEvictAfterFrames drop to their mip
+  // levels no larger than evictedTextureSize until drawn with again
+  static const size_t textureBudgetBytes = 256 * 1024 * 1024;
+  static const size_t textureEvictAfterFrames = 300;
+  static const size_t evictedTextureSize = 64;
+
+  // save linked programs as driver binaries, and load those on later runs
+  static const bool useShaderCache = true;
+  static const char * const shaderCacheDir = "res/cache/shaders";
+
   static const char * const basicShader = "res/shaders/basic";
+  static const char * const depthShader = "res/shaders/depth";
   static const char * const skyboxShader = "res/shaders/skybox";
   static const char * const overlayShader = "res/shaders/overlay";
-  static const char * const overlayPickingShader = "res/shaders/overlayPicking";
+  static const char * const particleShader = "res/shaders/particle";
 
   static const char * const skyBox[6] = {
     "res/textures/skyRight.tga",
@@ -31,6 +72,83 @@ namespace dmp
 
   static const char * const modelDir = "res/models";
 
+  // each model is placed this many times, in a line receding from the
+  // camera, so far copies can draw coarser levels of detail
+  static const size_t modelCopies = 16;
+
+  // import each model once into a file under meshCacheDir that is laid out
+  // as the GPU takes it, then map that file on later runs instead
+  static const bool useMeshCache = true;
+  static const char * const meshCacheDir = "res/cache/meshes";
+
+  // how static meshes are stored on the GPU, and in the mesh cache
+  static const VertexFormat meshVertexFormat = VertexFormat::Quantized;
+
+  // reorder imported meshes' triangles for the post-transform vertex cache
+  // and their vertices for fetch locality. Clusters of triangles are also
+  // put in an order that cuts overdraw, at an ACMR of at most
+  // overdrawAcmrThreshold times the vertex cache order's
+  static const bool optimizeMeshes = true;
+  static const bool optimizeMeshOverdraw = true;
+  static const size_t vertexCacheSize = 16;
+  static const float overdrawAcmrThreshold = 1.05f;
+
+  // Simplify imported meshes into levels of detail, each with about half
+  // the triangles of the one before, down to minLodTriangles. No level
+  // strays from the one before by more than lodMaxError of the mesh's
+  // diagonal
+  static const bool generateLods = true;
+  static const size_t maxLodLevels = 6;
+  static const size_t minLodTriangles = 64;
+  static const float lodMaxError = 0.05f;
+
+  // the coarsest level whose error covers at most lodPixelError pixels is
+  // drawn, once it is lodHysteresis under that
+  static const float lodPixelError = 1.0f;
+  static const float lodHysteresis = 0.25f;
+
+  // copies of the vertices of each dynamic Object in flight, so updates
+  // write one the GPU is done with instead of waiting on it. One more than
+  // the frames the GPU can lag behind
+  static const size_t streamRegions = 3;
+
+  // vertices along each side of the streamed wave sheet
+  static const size_t waveGridSize = 128;
+
+  // Terrain is drawn in chunks of terrainChunkQuads by terrainChunkQuads
+  // quads, at most terrainMaxChunks of them, coarsening where that many
+  // would not hold the error of each under terrainPixelError pixels.
+  // Chunk meshes live in a pool of terrainChunkPool Objects, each about
+  // 120KB of streamRegions copies of its vertices, and at most
+  // terrainBuildsInFlight are built on worker threads at once
+  static const size_t terrainChunkQuads = 32;
+  static const size_t terrainMaxChunks = 128;
+  static const size_t terrainChunkPool = 192;
+  static const size_t terrainBuildsInFlight = 8;
+  static const float terrainPixelError = 2.0f;
+
+  // the heights the terrain is read from, generated into terrainCacheDir
+  // on first run: terrainSamples by terrainSamples of them, terrainSpacing
+  // apart and up to terrainHeightScale high
+  static const char * const terrainCacheDir = "res/cache/terrain";
+  static const size_t terrainSamples = 2049;
+  static const float terrainSpacing = 0.5f;
+  static const float terrainHeightScale = 40.0f;
+
+  // particles are simulated in blocks of particleBlockSize, each a task on
+  // the worker pool
+  static const size_t particleBlockSize = 16384;
+
+  // particles alive at once in the fountain in the demo scene
+  static const size_t fountainParticles = 1 << 20;
+
+  // crowd members are culled and posed crowdBatchSize to a task on the
+  // worker pool
+  static const size_t crowdBatchSize = 64;
+
+  // animated figures in the crowd in the demo scene
+  static const size_t crowdSize = 2048;
+
 }
 
 #endif
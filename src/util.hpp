@@ -14,6 +14,7 @@
 #include <boost/assert.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <chrono>
+#include <cstdint>
 
 // Exectue a statement IFF built in release mode (NDEBUG is definend)
 // define ifRelease
@@ -320,6 +321,22 @@ namespace dmp
     // Union should be complete at this point
   }
 
+  // 64 bit FNV-1a. Not cryptographic, just cheap and stable across runs.
+  // Hash several pieces together by passing the previous result as seed
+  inline uint64_t hashBytes(const void * data,
+                            size_t len,
+                            uint64_t seed = 0xcbf29ce484222325ULL)
+  {
+    auto bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < len; ++i)
+      {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+      }
+    return hash;
+  }
+
   inline auto unixTimestamp()
   {
     using namespace std::chrono;